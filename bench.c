@@ -0,0 +1,415 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Benchmarks for the vector kernels. Each one runs first with the vector
+ * paths disabled by HACKTV_CPU_SCALAR and then with the paths the CPU
+ * supports, and the two rates are printed side by side. The feature
+ * flags are cached when first read, so each pass runs in its own
+ * process.
+ * 
+ * Build with "make bench". It isn't part of the default build. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "video.h"
+#include "composite.h"
+#include "fir.h"
+#include "cpu.h"
+
+/* Minimum run time of each benchmark in seconds */
+#define BENCH_TIME 0.25
+
+/* Input samples per FIR call, about one line */
+#define BENCH_BLOCK 1280
+
+typedef struct {
+	const char *name;
+	double (*run)(const void *arg);
+	const void *arg;
+} bench_t;
+
+/* Composite video modes */
+typedef struct {
+	int lines;
+	double active;
+	unsigned int sample_rate;
+} bench_composite_t;
+
+/* FIR filters */
+typedef struct {
+	int type;
+	int ntaps;
+	int interpolation;
+	int decimation;
+} bench_fir_t;
+
+#define FIR_REAL     0
+#define FIR_COMPLEX  1
+#define FIR_SCOMPLEX 2
+#define FIR_INT32    3
+#define FIR_RESAMPLE 4
+#define FIR_STRIDED  5
+
+static const bench_composite_t _pal_13 = { 576, 52e-6, 13500000 };
+static const bench_composite_t _pal_20 = { 576, 52e-6, 20250000 };
+static const bench_composite_t _ntsc_13 = { 480, 52.65e-6, 13500000 };
+static const bench_composite_t _ntsc_20 = { 480, 52.65e-6, 20250000 };
+
+static const bench_fir_t _real_15 = { FIR_REAL, 15, 1, 1 };
+static const bench_fir_t _real_51 = { FIR_REAL, 51, 1, 1 };
+static const bench_fir_t _real_101 = { FIR_REAL, 101, 1, 1 };
+static const bench_fir_t _strided_51 = { FIR_STRIDED, 51, 1, 1 };
+static const bench_fir_t _complex_51 = { FIR_COMPLEX, 51, 1, 1 };
+static const bench_fir_t _scomplex_51 = { FIR_SCOMPLEX, 51, 1, 1 };
+static const bench_fir_t _int32_51 = { FIR_INT32, 51, 1, 1 };
+static const bench_fir_t _video_3_2 = { FIR_RESAMPLE, 0, 20250000, 13500000 };
+static const bench_fir_t _audio_32k = { FIR_RESAMPLE, 0, 20250000, 32000 };
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static double _run_composite(const void *arg, int yuv)
+{
+	const bench_composite_t *m = arg;
+	composite_rgb_t rgb_kernel;
+	composite_yuv_t yuv_kernel;
+	int32_t (*lut)[0x100][4];
+	int32_t offset[4] = { 0, 0, 0, 0 };
+	int16_t *output, *lut_i, *lut_q;
+	uint32_t *rgb;
+	uint8_t *py;
+	double t0, t;
+	uint64_t samples;
+	int width, x, y, k;
+	
+	width = m->sample_rate * m->active;
+	
+	lut = malloc(sizeof(int32_t) * 3 * 0x100 * 4);
+	output = malloc(sizeof(int16_t) * width * 2);
+	lut_i = malloc(sizeof(int16_t) * width);
+	lut_q = malloc(sizeof(int16_t) * width);
+	rgb = malloc(sizeof(uint32_t) * width);
+	py = malloc(width * 2);
+	
+	if(!lut || !output || !lut_i || !lut_q || !rgb || !py)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	
+	/* Levels are random but within the range of the real tables */
+	srand(1);
+	
+	for(k = 0; k < 3; k++)
+	{
+		for(x = 0; x < 0x100; x++)
+		{
+			for(y = 0; y < 4; y++)
+			{
+				lut[k][x][y] = ((rand() % 20000) - 10000) * (1 << VID_YIQ_BITS) / 3;
+			}
+		}
+	}
+	
+	for(x = 0; x < width; x++)
+	{
+		lut_i[x] = (rand() % 65536) - 32768;
+		lut_q[x] = (rand() % 65536) - 32768;
+		rgb[x] = rand() & 0xFFFFFF;
+	}
+	
+	for(x = 0; x < width * 2; x++)
+	{
+		py[x] = rand();
+	}
+	
+	rgb_kernel = composite_rgb_kernel(cpu_features());
+	yuv_kernel = composite_yuv_kernel(cpu_features());
+	
+	samples = 0;
+	t0 = _now();
+	
+	do
+	{
+		/* One frame of active video */
+		for(y = 0; y < m->lines; y++)
+		{
+			if(yuv)
+			{
+				yuv_kernel(output, py, py + width, py + width + width / 2, 0, width, lut, offset, lut_i, lut_q);
+			}
+			else
+			{
+				rgb_kernel(output, rgb, width, lut, offset, lut_i, lut_q);
+			}
+		}
+		
+		samples += (uint64_t) width * m->lines;
+		t = _now() - t0;
+	}
+	while(t < BENCH_TIME);
+	
+	free(lut);
+	free(output);
+	free(lut_i);
+	free(lut_q);
+	free(rgb);
+	free(py);
+	
+	return(samples / t / 1e6);
+}
+
+static double _run_composite_rgb(const void *arg)
+{
+	return(_run_composite(arg, 0));
+}
+
+static double _run_composite_yuv(const void *arg)
+{
+	return(_run_composite(arg, 1));
+}
+
+static double _run_fir(const void *arg)
+{
+	const bench_fir_t *f = arg;
+	fir_int16_t fir16;
+	fir_int32_t fir32;
+	double *taps;
+	int16_t *in16, *out16;
+	int32_t *in32, *out32;
+	double t0, t;
+	uint64_t samples;
+	int n, x, r;
+	
+	/* Output room for the largest interpolation */
+	n = BENCH_BLOCK * (f->interpolation / f->decimation + 1);
+	
+	taps = calloc(f->ntaps + 1, sizeof(double) * 2);
+	in16 = malloc(sizeof(int16_t) * BENCH_BLOCK * 2);
+	out16 = malloc(sizeof(int16_t) * n * 2);
+	in32 = malloc(sizeof(int32_t) * BENCH_BLOCK * 2);
+	out32 = malloc(sizeof(int32_t) * BENCH_BLOCK * 2);
+	
+	if(!taps || !in16 || !out16 || !in32 || !out32)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	
+	srand(1);
+	
+	for(x = 0; x < BENCH_BLOCK * 2; x++)
+	{
+		in16[x] = (rand() % 65536) - 32768;
+	}
+	
+	for(x = 0; x < BENCH_BLOCK * 2; x++)
+	{
+		in32[x] = in16[x];
+	}
+	
+	switch(f->type)
+	{
+	case FIR_COMPLEX:
+	case FIR_SCOMPLEX:
+		fir_complex_band_pass(taps, f->ntaps, 20250000, -1250000, 5500000, 750000, 1);
+		break;
+	
+	case FIR_RESAMPLE:
+		break;
+	
+	default:
+		fir_low_pass(taps, f->ntaps, 20250000, 5500000, 750000, 1);
+		break;
+	}
+	
+	switch(f->type)
+	{
+	case FIR_COMPLEX: r = fir_int16_complex_init(&fir16, taps, f->ntaps, 1, 1, 0); break;
+	case FIR_SCOMPLEX: r = fir_int16_scomplex_init(&fir16, taps, f->ntaps, 1, 1, 0); break;
+	case FIR_INT32: r = fir_int32_init(&fir32, taps, f->ntaps, 1, 1, 0); break;
+	case FIR_RESAMPLE: r = fir_int16_resampler_init(&fir16, f->interpolation, f->decimation); break;
+	default: r = fir_int16_init(&fir16, taps, f->ntaps, 1, 1, 0); break;
+	}
+	
+	if(r != 0)
+	{
+		fprintf(stderr, "Failed to initialise the filter\n");
+		exit(-1);
+	}
+	
+	/* The audio resampler takes a few input samples per line */
+	n = f->type == FIR_RESAMPLE && f->decimation < 100000 ? BENCH_BLOCK / 16 : BENCH_BLOCK;
+	
+	samples = 0;
+	t0 = _now();
+	
+	do
+	{
+		switch(f->type)
+		{
+		case FIR_STRIDED: samples += fir_int16_process_strided(&fir16, out16, 2, in16, 2, n); break;
+		case FIR_INT32: samples += fir_int32_process(&fir32, out32, in32, n); break;
+		default: samples += fir_int16_process(&fir16, out16, in16, n); break;
+		}
+		
+		t = _now() - t0;
+	}
+	while(t < BENCH_TIME);
+	
+	if(f->type == FIR_INT32)
+	{
+		fir_int32_free(&fir32);
+	}
+	else
+	{
+		fir_int16_free(&fir16);
+	}
+	
+	free(taps);
+	free(in16);
+	free(out16);
+	free(in32);
+	free(out32);
+	
+	/* Rates are of output samples */
+	return(samples / t / 1e6);
+}
+
+static const bench_t _benchmarks[] = {
+	{ "composite rgb 625/PAL 13.5 MHz",  _run_composite_rgb, &_pal_13 },
+	{ "composite rgb 625/PAL 20.25 MHz", _run_composite_rgb, &_pal_20 },
+	{ "composite rgb 525/NTSC 13.5 MHz",  _run_composite_rgb, &_ntsc_13 },
+	{ "composite rgb 525/NTSC 20.25 MHz", _run_composite_rgb, &_ntsc_20 },
+	{ "composite yuv 625/PAL 13.5 MHz",  _run_composite_yuv, &_pal_13 },
+	{ "composite yuv 625/PAL 20.25 MHz", _run_composite_yuv, &_pal_20 },
+	{ "composite yuv 525/NTSC 13.5 MHz",  _run_composite_yuv, &_ntsc_13 },
+	{ "composite yuv 525/NTSC 20.25 MHz", _run_composite_yuv, &_ntsc_20 },
+	{ "fir_int16_process 15 taps",          _run_fir, &_real_15 },
+	{ "fir_int16_process 51 taps",          _run_fir, &_real_51 },
+	{ "fir_int16_process 101 taps",         _run_fir, &_real_101 },
+	{ "fir_int16_process_strided 51 taps",  _run_fir, &_strided_51 },
+	{ "fir_int16_complex_process 51 taps",  _run_fir, &_complex_51 },
+	{ "fir_int16_scomplex_process 51 taps", _run_fir, &_scomplex_51 },
+	{ "fir_int32_process 51 taps",          _run_fir, &_int32_51 },
+	{ "resampler 13.5 > 20.25 MHz",         _run_fir, &_video_3_2 },
+	{ "resampler 32 kHz > 20.25 MHz",       _run_fir, &_audio_32k },
+	{ NULL }
+};
+
+#define BENCH_COUNT (sizeof(_benchmarks) / sizeof(bench_t) - 1)
+
+static int _run_pass(double *results, int scalar)
+{
+	pid_t pid;
+	int i, status;
+	
+	pid = fork();
+	if(pid < 0)
+	{
+		perror("fork");
+		return(-1);
+	}
+	
+	if(pid == 0)
+	{
+		if(scalar)
+		{
+			setenv("HACKTV_CPU_SCALAR", "1", 1);
+		}
+		else
+		{
+			unsetenv("HACKTV_CPU_SCALAR");
+		}
+		
+		for(i = 0; i < BENCH_COUNT; i++)
+		{
+			results[i] = _benchmarks[i].run(_benchmarks[i].arg);
+		}
+		
+		_exit(0);
+	}
+	
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "Benchmark pass failed\n");
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int main(int argc, char *argv[])
+{
+	double *results;
+	int features;
+	int i;
+	
+	/* Shared with the child processes that run each pass */
+	results = mmap(NULL, sizeof(double) * BENCH_COUNT * 2, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(results == MAP_FAILED)
+	{
+		perror("mmap");
+		return(-1);
+	}
+	
+	if(_run_pass(&results[0], 1) != 0 ||
+	   _run_pass(&results[BENCH_COUNT], 0) != 0)
+	{
+		return(-1);
+	}
+	
+	features = cpu_features();
+	
+	printf("Vector paths:%s%s%s%s%s%s\n\n",
+		features & CPU_SSE2 ? " SSE2" : "",
+		features & CPU_SSSE3 ? " SSSE3" : "",
+		features & CPU_SSE41 ? " SSE4.1" : "",
+		features & CPU_AVX2 ? " AVX2" : "",
+		features & CPU_NEON ? " NEON" : "",
+		features == 0 ? " none" : ""
+	);
+	
+	printf("%-36s %12s %12s %8s\n", "Kernel", "Scalar MS/s", "Vector MS/s", "Speedup");
+	
+	for(i = 0; i < BENCH_COUNT; i++)
+	{
+		printf("%-36s %12.1f %12.1f %7.2fx\n",
+			_benchmarks[i].name,
+			results[i],
+			results[BENCH_COUNT + i],
+			results[BENCH_COUNT + i] / results[i]
+		);
+	}
+	
+	munmap(results, sizeof(double) * BENCH_COUNT * 2);
+	
+	return(0);
+}
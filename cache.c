@@ -0,0 +1,485 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hacktv.h"
+#include "cache.h"
+
+#define CACHE_MAGIC   "HACKTVIQ"
+#define CACHE_VERSION 2
+
+/* Samples start on a page boundary */
+#define CACHE_DATA_OFFSET 4096
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_rate;
+	uint64_t key;
+	uint64_t samples;
+	uint32_t frames;
+	uint32_t reserved;
+} _cache_header_t;
+
+/* 64-bit FNV-1a */
+static uint64_t _fnv1a(uint64_t h, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+	
+	while(length--)
+	{
+		h ^= *(p++);
+		h *= 0x100000001B3ULL;
+	}
+	
+	return(h);
+}
+
+static uint64_t _fnv1a_str(uint64_t h, const char *s)
+{
+	/* Include the terminator so "ab","c" differs from "a","bc" */
+	return(s ? _fnv1a(h, s, strlen(s) + 1) : _fnv1a(h, "", 1));
+}
+
+static uint64_t _fnv1a_i64(uint64_t h, int64_t v)
+{
+	return(_fnv1a(h, &v, sizeof(v)));
+}
+
+static uint64_t _fnv1a_f64(uint64_t h, double v)
+{
+	/* -0.0 and 0.0 give the same output */
+	if(v == 0) v = 0;
+	return(_fnv1a(h, &v, sizeof(v)));
+}
+
+uint64_t cache_key(const vid_t *vid, char *const *sources, int nsources, unsigned int frames)
+{
+	const vid_config_t *conf = &vid->conf;
+	uint64_t h = 0xCBF29CE484222325ULL;
+	int32_t v[4];
+	int i;
+	
+	/* Hash each setting by value, so the key doesn't depend on
+	 * structure padding or where the strings are. The thread,
+	 * frame pool, cache directory and verbose settings don't
+	 * change the output and are left out. New settings need
+	 * adding here */
+	h = _fnv1a_i64(h, conf->output_type);
+	h = _fnv1a_i64(h, conf->modulation);
+	h = _fnv1a_f64(h, conf->video_bw);
+	h = _fnv1a_f64(h, conf->vsb_upper_bw);
+	h = _fnv1a_f64(h, conf->vsb_lower_bw);
+	h = _fnv1a_f64(h, conf->fm_level);
+	h = _fnv1a_f64(h, conf->fm_deviation);
+	h = _fnv1a_f64(h, conf->level);
+	h = _fnv1a_i64(h, conf->offset);
+	h = _fnv1a_str(h, conf->passthru);
+	h = _fnv1a_f64(h, conf->video_level);
+	h = _fnv1a_f64(h, conf->fm_mono_level);
+	h = _fnv1a_f64(h, conf->fm_left_level);
+	h = _fnv1a_f64(h, conf->fm_right_level);
+	h = _fnv1a_f64(h, conf->am_audio_level);
+	h = _fnv1a_f64(h, conf->nicam_level);
+	h = _fnv1a_f64(h, conf->dance_level);
+	h = _fnv1a_i64(h, conf->type);
+	h = _fnv1a_i64(h, conf->frame_rate_num);
+	h = _fnv1a_i64(h, conf->frame_rate_den);
+	h = _fnv1a_i64(h, conf->lines);
+	h = _fnv1a_i64(h, conf->hline);
+	h = _fnv1a_i64(h, conf->active_lines);
+	h = _fnv1a_i64(h, conf->interlace);
+	h = _fnv1a_f64(h, conf->hsync_width);
+	h = _fnv1a_f64(h, conf->vsync_short_width);
+	h = _fnv1a_f64(h, conf->vsync_long_width);
+	h = _fnv1a_f64(h, conf->white_level);
+	h = _fnv1a_f64(h, conf->black_level);
+	h = _fnv1a_f64(h, conf->blanking_level);
+	h = _fnv1a_f64(h, conf->sync_level);
+	h = _fnv1a_f64(h, conf->active_width);
+	h = _fnv1a_f64(h, conf->active_left);
+	h = _fnv1a_f64(h, conf->gamma);
+	h = _fnv1a_str(h, conf->teletext);
+	h = _fnv1a_str(h, conf->logo);
+	h = _fnv1a_i64(h, conf->timestamp);
+	h = _fnv1a_i64(h, conf->position);
+	h = _fnv1a_str(h, conf->mode);
+	h = _fnv1a_str(h, conf->wss);
+	h = _fnv1a_i64(h, conf->letterbox);
+	h = _fnv1a_i64(h, conf->pillarbox);
+	h = _fnv1a_f64(h, conf->volume);
+	h = _fnv1a_i64(h, conf->downmix);
+	h = _fnv1a_str(h, conf->videocrypt);
+	h = _fnv1a_str(h, conf->videocrypt2);
+	h = _fnv1a_str(h, conf->videocrypts);
+	h = _fnv1a_i64(h, conf->enableemm);
+	h = _fnv1a_i64(h, conf->disableemm);
+	h = _fnv1a_i64(h, conf->showecm);
+	h = _fnv1a_i64(h, conf->showserial);
+	h = _fnv1a_i64(h, conf->findkey);
+	h = _fnv1a_str(h, conf->d11);
+	h = _fnv1a_str(h, conf->systercnr);
+	h = _fnv1a_str(h, conf->syster);
+	h = _fnv1a_i64(h, conf->systeraudio);
+	h = _fnv1a_i64(h, conf->acp);
+	h = _fnv1a_i64(h, conf->subtitles);
+	h = _fnv1a_i64(h, conf->txsubtitles);
+	h = _fnv1a_i64(h, conf->vits);
+	h = _fnv1a_str(h, conf->eurocrypt);
+	h = _fnv1a_i64(h, conf->ec_mat_rating);
+	h = _fnv1a_str(h, conf->ec_ppv);
+	h = _fnv1a_f64(h, conf->rw_co);
+	h = _fnv1a_f64(h, conf->gw_co);
+	h = _fnv1a_f64(h, conf->bw_co);
+	h = _fnv1a_i64(h, conf->colour_mode);
+	h = _fnv1a_f64(h, conf->colour_carrier);
+	h = _fnv1a_i64(h, conf->colour_lookup_lines);
+	h = _fnv1a_f64(h, conf->burst_width);
+	h = _fnv1a_f64(h, conf->burst_left);
+	h = _fnv1a_f64(h, conf->burst_level);
+	h = _fnv1a_f64(h, conf->burst_rise);
+	h = _fnv1a_f64(h, conf->fsc_flag_width);
+	h = _fnv1a_f64(h, conf->fsc_flag_left);
+	h = _fnv1a_f64(h, conf->fsc_flag_level);
+	h = _fnv1a_f64(h, conf->iu_co);
+	h = _fnv1a_f64(h, conf->iv_co);
+	h = _fnv1a_f64(h, conf->qu_co);
+	h = _fnv1a_f64(h, conf->qv_co);
+	h = _fnv1a_f64(h, conf->fm_mono_carrier);
+	h = _fnv1a_f64(h, conf->fm_mono_deviation);
+	h = _fnv1a_i64(h, conf->fm_mono_preemph);
+	h = _fnv1a_f64(h, conf->fm_left_carrier);
+	h = _fnv1a_f64(h, conf->fm_left_deviation);
+	h = _fnv1a_i64(h, conf->fm_left_preemph);
+	h = _fnv1a_f64(h, conf->fm_right_carrier);
+	h = _fnv1a_f64(h, conf->fm_right_deviation);
+	h = _fnv1a_i64(h, conf->fm_right_preemph);
+	h = _fnv1a_i64(h, conf->a2stereo);
+	h = _fnv1a_f64(h, conf->nicam_carrier);
+	h = _fnv1a_f64(h, conf->nicam_beta);
+	h = _fnv1a_f64(h, conf->dance_carrier);
+	h = _fnv1a_f64(h, conf->dance_beta);
+	h = _fnv1a_f64(h, conf->am_mono_carrier);
+	h = _fnv1a_f64(h, conf->am_mono_bandwidth);
+	h = _fnv1a_i64(h, conf->mac_mode);
+	h = _fnv1a_i64(h, conf->chid);
+	h = _fnv1a_i64(h, conf->scramble_video);
+	h = _fnv1a_i64(h, conf->scramble_audio);
+	h = _fnv1a_i64(h, conf->vfilter);
+	h = _fnv1a_str(h, conf->scaler);
+	h = _fnv1a_i64(h, conf->yuv);
+	
+	v[0] = vid->sample_rate;
+	v[1] = vid->pixel_rate;
+	v[2] = frames;
+	v[3] = CACHE_VERSION;
+	h = _fnv1a(h, v, sizeof(v));
+	
+	for(i = 0; i < nsources; i++)
+	{
+		h = _fnv1a_str(h, sources[i]);
+	}
+	
+	return(h);
+}
+
+char *cache_file_path(const char *dir, const char *name, const char *suffix)
+{
+	char *real, *path;
+	uint64_t h;
+	size_t l;
+	
+	/* Name the file after the full path, so the same input
+	 * reached by a different route shares it */
+	real = realpath(name, NULL);
+	h = _fnv1a_str(0xCBF29CE484222325ULL, real ? real : name);
+	free(real);
+	
+	l = strlen(dir) + strlen(suffix) + 18;
+	path = malloc(l);
+	if(path)
+	{
+		snprintf(path, l, "%s/%016llx%s", dir, (unsigned long long) h, suffix);
+	}
+	
+	return(path);
+}
+
+static int _cache_map(cache_t *c)
+{
+	_cache_header_t hdr;
+	struct stat st;
+	int fd;
+	
+	fd = open(c->path, O_RDONLY);
+	if(fd < 0)
+	{
+		return(CACHE_MISS);
+	}
+	
+	if(fstat(fd, &st) != 0 ||
+	   pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	   memcmp(hdr.magic, CACHE_MAGIC, 8) != 0 ||
+	   hdr.version != CACHE_VERSION ||
+	   hdr.key != c->key ||
+	   hdr.sample_rate != c->sample_rate ||
+	   hdr.frames != c->frames ||
+	   hdr.samples == 0 ||
+	   (uint64_t) st.st_size != CACHE_DATA_OFFSET + hdr.samples * sizeof(int16_t) * 2)
+	{
+		/* Missing, incomplete or not ours. Render it again */
+		close(fd);
+		return(CACHE_MISS);
+	}
+	
+	c->map_size = st.st_size;
+	c->map = mmap(NULL, c->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if(c->map == MAP_FAILED)
+	{
+		perror("mmap");
+		c->map = NULL;
+		return(HACKTV_ERROR);
+	}
+	
+	/* It is read front to back, over and over */
+	madvise(c->map, c->map_size, MADV_SEQUENTIAL);
+	madvise(c->map, c->map_size, MADV_WILLNEED);
+	
+	c->data = (int16_t *) ((uint8_t *) c->map + CACHE_DATA_OFFSET);
+	c->samples = hdr.samples;
+	
+	return(CACHE_HIT);
+}
+
+int cache_open(cache_t *c, const char *dir, uint64_t key, const vid_t *vid, unsigned int frames)
+{
+	size_t l;
+	int r;
+	
+	memset(c, 0, sizeof(cache_t));
+	
+	c->key = key;
+	c->sample_rate = vid->sample_rate;
+	c->frames = frames;
+	
+	l = strlen(dir) + 32;
+	c->path = malloc(l);
+	c->tmp_path = malloc(l);
+	if(!c->path || !c->tmp_path)
+	{
+		cache_close(c);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	snprintf(c->path, l, "%s/%016llx.iq", dir, (unsigned long long) key);
+	snprintf(c->tmp_path, l, "%s/%016llx.tmp", dir, (unsigned long long) key);
+	
+	r = _cache_map(c);
+	if(r != CACHE_MISS)
+	{
+		if(r != CACHE_HIT) cache_close(c);
+		return(r);
+	}
+	
+	/* Not cached yet, record the first frames. The file is
+	 * read back while checking the frame after them */
+	c->f = fopen(c->tmp_path, "w+b");
+	if(!c->f)
+	{
+		perror(c->tmp_path);
+		cache_close(c);
+		return(HACKTV_ERROR);
+	}
+	
+	if(fseek(c->f, CACHE_DATA_OFFSET, SEEK_SET) != 0)
+	{
+		perror(c->tmp_path);
+		cache_close(c);
+		return(HACKTV_ERROR);
+	}
+	
+	c->recording = 1;
+	c->lines_left = (uint64_t) frames * vid->conf.lines;
+	c->frame_lines = vid->conf.lines;
+	
+	return(CACHE_MISS);
+}
+
+static int _cache_check(cache_t *c, const int16_t *data, size_t samples)
+{
+	size_t l = samples * sizeof(int16_t) * 2;
+	
+	if(l > c->check_size)
+	{
+		int16_t *p = realloc(c->check, l);
+		
+		if(!p)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		c->check = p;
+		c->check_size = l;
+	}
+	
+	/* Compare the line against the same line of the first frame */
+	if(c->check_offset + samples > c->samples ||
+	   pread(fileno(c->f), c->check, l, CACHE_DATA_OFFSET + c->check_offset * sizeof(int16_t) * 2) != (ssize_t) l ||
+	   memcmp(c->check, data, l) != 0)
+	{
+		return(CACHE_REJECTED);
+	}
+	
+	c->check_offset += samples;
+	
+	return(CACHE_MISS);
+}
+
+int cache_write(cache_t *c, const int16_t *data, size_t samples)
+{
+	_cache_header_t hdr;
+	int r;
+	
+	if(!c->recording)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	if(c->checking)
+	{
+		r = _cache_check(c, data, samples);
+		
+		if(r != CACHE_MISS)
+		{
+			cache_abort(c);
+			return(r);
+		}
+		
+		if(--c->lines_left > 0)
+		{
+			return(CACHE_MISS);
+		}
+		
+		/* The frame matched, write the header and make it live */
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, CACHE_MAGIC, 8);
+		hdr.version = CACHE_VERSION;
+		hdr.sample_rate = c->sample_rate;
+		hdr.key = c->key;
+		hdr.samples = c->samples;
+		hdr.frames = c->frames;
+		
+		if(fseek(c->f, 0, SEEK_SET) != 0 ||
+		   fwrite(&hdr, sizeof(hdr), 1, c->f) != 1 ||
+		   fclose(c->f) != 0)
+		{
+			perror(c->tmp_path);
+			c->f = NULL;
+			cache_abort(c);
+			return(HACKTV_ERROR);
+		}
+		
+		c->f = NULL;
+		
+		if(rename(c->tmp_path, c->path) != 0)
+		{
+			perror(c->path);
+			cache_abort(c);
+			return(HACKTV_ERROR);
+		}
+		
+		c->recording = 0;
+		c->checking = 0;
+		
+		/* The first frame has just been sent again */
+		c->resume = c->check_offset;
+		
+		return(_cache_map(c) == CACHE_HIT ? CACHE_HIT : HACKTV_ERROR);
+	}
+	
+	if(fwrite(data, sizeof(int16_t) * 2, samples, c->f) != samples)
+	{
+		perror(c->tmp_path);
+		cache_abort(c);
+		return(HACKTV_ERROR);
+	}
+	
+	c->samples += samples;
+	
+	if(--c->lines_left > 0)
+	{
+		return(CACHE_MISS);
+	}
+	
+	/* The last line is in. Check the next frame before using it */
+	if(fflush(c->f) != 0)
+	{
+		perror(c->tmp_path);
+		cache_abort(c);
+		return(HACKTV_ERROR);
+	}
+	
+	c->checking = 1;
+	c->check_offset = 0;
+	c->lines_left = c->frame_lines;
+	
+	return(CACHE_MISS);
+}
+
+void cache_abort(cache_t *c)
+{
+	if(c->f)
+	{
+		fclose(c->f);
+		c->f = NULL;
+	}
+	
+	if(c->recording)
+	{
+		unlink(c->tmp_path);
+		c->recording = 0;
+		c->checking = 0;
+	}
+	
+	free(c->check);
+	c->check = NULL;
+	c->check_size = 0;
+}
+
+void cache_close(cache_t *c)
+{
+	cache_abort(c);
+	
+	if(c->map)
+	{
+		munmap(c->map, c->map_size);
+	}
+	
+	free(c->path);
+	free(c->tmp_path);
+	memset(c, 0, sizeof(cache_t));
+}
+
@@ -0,0 +1,94 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "video.h"
+
+/* Pre-rendered IQ cache. The first frames of a run are saved to a file
+ * named after a hash of the video configuration and sources, and later
+ * passes stream the file instead of rendering them again.
+ * 
+ * That only works if the signal repeats after those frames, which
+ * depends on the source as well as the mode. So one more frame is
+ * rendered after them and compared against the first. The cache is
+ * only used if they match. */
+
+#define CACHE_MISS     0
+#define CACHE_HIT      1
+#define CACHE_REJECTED 2
+
+typedef struct {
+	
+	/* Final and temporary file names */
+	char *path;
+	char *tmp_path;
+	
+	uint64_t key;
+	int sample_rate;
+	unsigned int frames;
+	
+	/* Recording state */
+	int recording;
+	FILE *f;
+	uint64_t lines_left;
+	
+	/* Checking the frame after the cached ones against the first */
+	int checking;
+	int frame_lines;
+	size_t check_offset;
+	int16_t *check;
+	size_t check_size;
+	
+	/* Samples to skip on the first pass after a check, where
+	 * the first frame has already been sent */
+	size_t resume;
+	
+	/* Mapped cache and the total number of samples */
+	void *map;
+	size_t map_size;
+	int16_t *data;
+	size_t samples;
+	
+} cache_t;
+
+/* Hash the settings that determine the output signal */
+extern uint64_t cache_key(const vid_t *vid, char *const *sources, int nsources, unsigned int frames);
+
+/* Path of a file in the cache directory belonging to the input file
+ * name, or NULL if out of memory. The caller frees it */
+extern char *cache_file_path(const char *dir, const char *name, const char *suffix);
+
+/* Open the cache for key in dir. Returns CACHE_HIT if it already exists
+ * and has been mapped, CACHE_MISS if it is ready to record, or an error */
+extern int cache_open(cache_t *c, const char *dir, uint64_t key, const vid_t *vid, unsigned int frames);
+
+/* Record one line of samples. Returns CACHE_HIT once the last line
+ * has been written and checked and the cache is ready to play, or
+ * CACHE_REJECTED if the signal doesn't repeat */
+extern int cache_write(cache_t *c, const int16_t *data, size_t samples);
+
+/* Stop recording and discard a partial cache */
+extern void cache_abort(cache_t *c);
+
+extern void cache_close(cache_t *c);
+
+#endif
+
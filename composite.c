@@ -0,0 +1,405 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Vector kernels for the active video part of the raster. Each kernel
+ * produces exactly the same output as composite_rgb_scalar(). */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "video.h"
+#include "composite.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void composite_rgb_scalar(int16_t *output, const uint32_t *rgb, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const int32_t *r, *g, *b;
+	int x;
+	int32_t y, i, q;
+	
+	for(x = 0; x < n; x++)
+	{
+		r = lut[0][(rgb[x] >> 16) & 0xFF];
+		g = lut[1][(rgb[x] >> 8) & 0xFF];
+		b = lut[2][(rgb[x] >> 0) & 0xFF];
+		
+		y = _yiq_limit(offset[0] + r[0] + g[0] + b[0]);
+		
+		if(lut_i != NULL)
+		{
+			i = _yiq_limit(offset[1] + r[1] + g[1] + b[1]);
+			q = _yiq_limit(offset[2] + r[2] + g[2] + b[2]);
+			
+			y += (i * lut_i[x]) >> 15;
+			y += (q * lut_q[x]) >> 15;
+		}
+		
+		output[x * 2] = y;
+	}
+}
+
+void composite_yuv_scalar(int16_t *output, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int x, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const int32_t *a, *b, *c;
+	int k;
+	int32_t y, i, q;
+	
+	for(k = 0; k < n; k++, x++)
+	{
+		a = lut[0][py[x]];
+		b = lut[1][pu[x >> 1]];
+		c = lut[2][pv[x >> 1]];
+		
+		y = _yiq_limit(offset[0] + a[0] + b[0] + c[0]);
+		
+		if(lut_i != NULL)
+		{
+			i = _yiq_limit(offset[1] + a[1] + b[1] + c[1]);
+			q = _yiq_limit(offset[2] + a[2] + b[2] + c[2]);
+			
+			y += (i * lut_i[k]) >> 15;
+			y += (q * lut_q[k]) >> 15;
+		}
+		
+		output[k * 2] = y;
+	}
+}
+
+#if defined(CPU_X86)
+
+/* Four pixel sums of [y, i, q, 0] into composite levels, written to
+ * the even samples of output */
+__attribute__((target("sse2")))
+static inline void _composite_sse2(int16_t *output, const __m128i p[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const __m128i lmin = _mm_set1_epi16(-INT16_MAX);
+	const __m128i even = _mm_set1_epi32(0x0000FFFF);
+	__m128i a, b, y, q, v, lo, hi;
+	
+	/* Limit to +/- INT16_MAX: [y0 i0 q0 0 y1 i1 q1 0] */
+	a = _mm_max_epi16(_mm_packs_epi32(p[0], p[1]), lmin);
+	b = _mm_max_epi16(_mm_packs_epi32(p[2], p[3]), lmin);
+	
+	/* Transpose to [y0 y1 y2 y3 i0 i1 i2 i3] and [q0 q1 q2 q3 ...] */
+	v = _mm_unpacklo_epi16(a, b);
+	a = _mm_unpackhi_epi16(a, b);
+	y = _mm_unpacklo_epi16(v, a);
+	q = _mm_unpackhi_epi16(v, a);
+	
+	/* Sign extend Y to 32-bits */
+	v = _mm_srai_epi32(_mm_unpacklo_epi16(y, y), 16);
+	
+	if(lut_i != NULL)
+	{
+		/* Full 32-bit products of the I and Q levels with the subcarrier */
+		a = _mm_unpackhi_epi64(y, y);
+		b = _mm_loadl_epi64((const __m128i *) lut_i);
+		lo = _mm_mullo_epi16(a, b);
+		hi = _mm_mulhi_epi16(a, b);
+		v = _mm_add_epi32(v, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15));
+		
+		b = _mm_loadl_epi64((const __m128i *) lut_q);
+		lo = _mm_mullo_epi16(q, b);
+		hi = _mm_mulhi_epi16(q, b);
+		v = _mm_add_epi32(v, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15));
+	}
+	
+	/* Write the low 16-bits of each level to the even samples */
+	a = _mm_loadu_si128((const __m128i *) output);
+	a = _mm_or_si128(_mm_andnot_si128(even, a), _mm_and_si128(even, v));
+	_mm_storeu_si128((__m128i *) output, a);
+}
+
+__attribute__((target("sse2")))
+static void _composite_rgb_sse2(int16_t *output, const uint32_t *rgb, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const __m128i off = _mm_loadu_si128((const __m128i *) offset);
+	__m128i p[4];
+	uint32_t c;
+	int x, k;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		/* Sum the Y, I and Q contributions of each pixel. There is no
+		 * gather in SSE2, so each pixel is one vector of [y, i, q, 0] */
+		for(k = 0; k < 4; k++)
+		{
+			c = rgb[x + k];
+			p[k] = _mm_add_epi32(off, _mm_loadu_si128((const __m128i *) lut[0][(c >> 16) & 0xFF]));
+			p[k] = _mm_add_epi32(p[k], _mm_loadu_si128((const __m128i *) lut[1][(c >> 8) & 0xFF]));
+			p[k] = _mm_add_epi32(p[k], _mm_loadu_si128((const __m128i *) lut[2][(c >> 0) & 0xFF]));
+			p[k] = _mm_srai_epi32(p[k], VID_YIQ_BITS);
+		}
+		
+		_composite_sse2(
+			&output[x * 2], p,
+			lut_i != NULL ? &lut_i[x] : NULL,
+			lut_q != NULL ? &lut_q[x] : NULL
+		);
+	}
+	
+	composite_rgb_scalar(
+		output + x * 2, rgb + x, n - x, lut, offset,
+		lut_i != NULL ? lut_i + x : NULL,
+		lut_q != NULL ? lut_q + x : NULL
+	);
+}
+
+__attribute__((target("sse2")))
+static void _composite_yuv_sse2(int16_t *output, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int x, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const __m128i off = _mm_loadu_si128((const __m128i *) offset);
+	__m128i p[4];
+	int k, j, c;
+	
+	for(k = 0; k + 4 <= n; k += 4)
+	{
+		/* Each pixel is one vector of [y, i, q, 0], as for RGB */
+		for(j = 0; j < 4; j++)
+		{
+			c = (x + k + j) >> 1;
+			p[j] = _mm_add_epi32(off, _mm_loadu_si128((const __m128i *) lut[0][py[x + k + j]]));
+			p[j] = _mm_add_epi32(p[j], _mm_loadu_si128((const __m128i *) lut[1][pu[c]]));
+			p[j] = _mm_add_epi32(p[j], _mm_loadu_si128((const __m128i *) lut[2][pv[c]]));
+			p[j] = _mm_srai_epi32(p[j], VID_YIQ_BITS);
+		}
+		
+		_composite_sse2(
+			&output[k * 2], p,
+			lut_i != NULL ? &lut_i[k] : NULL,
+			lut_q != NULL ? &lut_q[k] : NULL
+		);
+	}
+	
+	composite_yuv_scalar(
+		output + k * 2, py, pu, pv, x + k, n - k, lut, offset,
+		lut_i != NULL ? lut_i + k : NULL,
+		lut_q != NULL ? lut_q + k : NULL
+	);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _level_avx2(const int32_t *lut, __m256i r, __m256i g, __m256i b, int32_t offset)
+{
+	__m256i v;
+	
+	v = _mm256_set1_epi32(offset);
+	v = _mm256_add_epi32(v, _mm256_i32gather_epi32((const int *) lut, r, 4));
+	v = _mm256_add_epi32(v, _mm256_i32gather_epi32((const int *) lut, g, 4));
+	v = _mm256_add_epi32(v, _mm256_i32gather_epi32((const int *) lut, b, 4));
+	v = _mm256_srai_epi32(v, VID_YIQ_BITS);
+	v = _mm256_min_epi32(v, _mm256_set1_epi32(INT16_MAX));
+	v = _mm256_max_epi32(v, _mm256_set1_epi32(-INT16_MAX));
+	
+	return(v);
+}
+
+/* Eight pixels from their table indices into composite levels, written
+ * to the even samples of output */
+__attribute__((target("avx2")))
+static inline void _composite_avx2(int16_t *output, const int32_t *base, __m256i r, __m256i g, __m256i b, const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	__m256i c, v, l;
+	
+	v = _level_avx2(base + 0, r, g, b, offset[0]);
+	
+	if(lut_i != NULL)
+	{
+		l = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) lut_i));
+		l = _mm256_mullo_epi32(_level_avx2(base + 1, r, g, b, offset[1]), l);
+		v = _mm256_add_epi32(v, _mm256_srai_epi32(l, 15));
+		
+		l = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) lut_q));
+		l = _mm256_mullo_epi32(_level_avx2(base + 2, r, g, b, offset[2]), l);
+		v = _mm256_add_epi32(v, _mm256_srai_epi32(l, 15));
+	}
+	
+	/* Write the low 16-bits of each level to the even samples */
+	c = _mm256_loadu_si256((const __m256i *) output);
+	c = _mm256_blend_epi16(c, v, 0x55);
+	_mm256_storeu_si256((__m256i *) output, c);
+}
+
+__attribute__((target("avx2")))
+static void _composite_rgb_avx2(int16_t *output, const uint32_t *rgb, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const int32_t *base = &lut[0][0][0];
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i c, r, g, b;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		/* Table indices of the R, G and B contributions, in int32 units */
+		c = _mm256_loadu_si256((const __m256i *) &rgb[x]);
+		r = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 16), mask), 2);
+		g = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 8), mask), 2);
+		b = _mm256_slli_epi32(_mm256_and_si256(c, mask), 2);
+		g = _mm256_add_epi32(g, _mm256_set1_epi32(0x100 * 4));
+		b = _mm256_add_epi32(b, _mm256_set1_epi32(0x200 * 4));
+		
+		_composite_avx2(
+			&output[x * 2], base, r, g, b, offset,
+			lut_i != NULL ? &lut_i[x] : NULL,
+			lut_q != NULL ? &lut_q[x] : NULL
+		);
+	}
+	
+	/* Avoid the AVX to SSE transition penalty in the tail and after */
+	_mm256_zeroupper();
+	
+	composite_rgb_scalar(
+		output + x * 2, rgb + x, n - x, lut, offset,
+		lut_i != NULL ? lut_i + x : NULL,
+		lut_q != NULL ? lut_q + x : NULL
+	);
+}
+
+__attribute__((target("avx2")))
+static void _composite_yuv_avx2(int16_t *output, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int x, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const int32_t *base = &lut[0][0][0];
+	__m128i u, v;
+	__m256i r, g, b;
+	uint32_t c;
+	int k = 0;
+	
+	/* Start on a whole chroma sample */
+	if(n > 0 && (x & 1))
+	{
+		composite_yuv_scalar(output, py, pu, pv, x, 1, lut, offset, lut_i, lut_q);
+		k = 1;
+	}
+	
+	for(; k + 8 <= n; k += 8)
+	{
+		/* Eight luma samples and four of each chroma, doubled up */
+		memcpy(&c, &pu[(x + k) >> 1], 4);
+		u = _mm_cvtsi32_si128(c);
+		memcpy(&c, &pv[(x + k) >> 1], 4);
+		v = _mm_cvtsi32_si128(c);
+		
+		r = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &py[x + k]));
+		g = _mm256_cvtepu8_epi32(_mm_unpacklo_epi8(u, u));
+		b = _mm256_cvtepu8_epi32(_mm_unpacklo_epi8(v, v));
+		
+		/* Table indices, in int32 units */
+		r = _mm256_slli_epi32(r, 2);
+		g = _mm256_add_epi32(_mm256_slli_epi32(g, 2), _mm256_set1_epi32(0x100 * 4));
+		b = _mm256_add_epi32(_mm256_slli_epi32(b, 2), _mm256_set1_epi32(0x200 * 4));
+		
+		_composite_avx2(
+			&output[k * 2], base, r, g, b, offset,
+			lut_i != NULL ? &lut_i[k] : NULL,
+			lut_q != NULL ? &lut_q[k] : NULL
+		);
+	}
+	
+	_mm256_zeroupper();
+	
+	composite_yuv_scalar(
+		output + k * 2, py, pu, pv, x + k, n - k, lut, offset,
+		lut_i != NULL ? lut_i + k : NULL,
+		lut_q != NULL ? lut_q + k : NULL
+	);
+}
+
+#elif defined(CPU_ARM_NEON)
+
+static void _composite_rgb_neon(int16_t *output, const uint32_t *rgb, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q)
+{
+	const int32x4_t off = vld1q_s32(offset);
+	const int16x8_t lmin = vdupq_n_s16(-INT16_MAX);
+	int32x4_t p[4], v;
+	int16x8_t a, b;
+	int16x8x2_t t, u;
+	int16x4x2_t o;
+	uint32_t c;
+	int x, k;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		/* Sum the Y, I and Q contributions of each pixel */
+		for(k = 0; k < 4; k++)
+		{
+			c = rgb[x + k];
+			p[k] = vaddq_s32(off, vld1q_s32(lut[0][(c >> 16) & 0xFF]));
+			p[k] = vaddq_s32(p[k], vld1q_s32(lut[1][(c >> 8) & 0xFF]));
+			p[k] = vaddq_s32(p[k], vld1q_s32(lut[2][(c >> 0) & 0xFF]));
+			p[k] = vshrq_n_s32(p[k], VID_YIQ_BITS);
+		}
+		
+		/* Limit to +/- INT16_MAX: [y0 i0 q0 0 y1 i1 q1 0] */
+		a = vmaxq_s16(vcombine_s16(vqmovn_s32(p[0]), vqmovn_s32(p[1])), lmin);
+		b = vmaxq_s16(vcombine_s16(vqmovn_s32(p[2]), vqmovn_s32(p[3])), lmin);
+		
+		/* [y0 q0 y1 q1 y2 q2 y3 q3] and [i0 0 i1 0 i2 0 i3 0] */
+		t = vuzpq_s16(a, b);
+		u = vuzpq_s16(t.val[0], t.val[0]);
+		
+		v = vmovl_s16(vget_low_s16(u.val[0]));
+		
+		if(lut_i != NULL)
+		{
+			a = vuzpq_s16(t.val[1], t.val[1]).val[0];
+			v = vaddq_s32(v, vshrq_n_s32(vmull_s16(vget_low_s16(a), vld1_s16(&lut_i[x])), 15));
+			v = vaddq_s32(v, vshrq_n_s32(vmull_s16(vget_low_s16(u.val[1]), vld1_s16(&lut_q[x])), 15));
+		}
+		
+		/* Write the low 16-bits of each level to the even samples */
+		o = vld2_s16(&output[x * 2]);
+		o.val[0] = vmovn_s32(v);
+		vst2_s16(&output[x * 2], o);
+	}
+	
+	composite_rgb_scalar(
+		output + x * 2, rgb + x, n - x, lut, offset,
+		lut_i != NULL ? lut_i + x : NULL,
+		lut_q != NULL ? lut_q + x : NULL
+	);
+}
+
+#endif
+
+composite_rgb_t composite_rgb_kernel(int features)
+{
+#if defined(CPU_X86)
+	if(features & CPU_AVX2) return(_composite_rgb_avx2);
+	if(features & CPU_SSE2) return(_composite_rgb_sse2);
+#elif defined(CPU_ARM_NEON)
+	if(features & CPU_NEON) return(_composite_rgb_neon);
+#endif
+	
+	return(composite_rgb_scalar);
+}
+
+composite_yuv_t composite_yuv_kernel(int features)
+{
+#if defined(CPU_X86)
+	if(features & CPU_AVX2) return(_composite_yuv_avx2);
+	if(features & CPU_SSE2) return(_composite_yuv_sse2);
+#endif
+	
+	return(composite_yuv_scalar);
+}
+
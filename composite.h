@@ -0,0 +1,67 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _COMPOSITE_H
+#define _COMPOSITE_H
+
+#include <stdint.h>
+
+/* Converts a run of n 0xRRGGBB pixels into composite video levels.
+ * 
+ * lut and offset are the separable RGB > Y/I/Q tables from vid_t, with
+ * VID_YIQ_BITS fractional bits. When lut_i and lut_q are not NULL the
+ * I and Q levels are modulated onto the colour subcarrier and added to Y.
+ * 
+ * Levels are written to every second sample of output, matching the
+ * interleaved I/Q layout of the line buffers. The Q samples are not
+ * modified. */
+typedef void (*composite_rgb_t)(
+	int16_t *output,
+	const uint32_t *rgb,
+	int n,
+	const int32_t lut[3][0x100][4],
+	const int32_t offset[4],
+	const int16_t *lut_i,
+	const int16_t *lut_q
+);
+
+extern void composite_rgb_scalar(int16_t *output, const uint32_t *rgb, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q);
+
+/* The same for planar YUV 4:2:2. Pixels x to x + n - 1 of the rows py,
+ * pu and pv are converted, with the Y'CbCr tables in place of RGB. The
+ * output and subcarrier pointers start at pixel x. */
+typedef void (*composite_yuv_t)(
+	int16_t *output,
+	const uint8_t *py,
+	const uint8_t *pu,
+	const uint8_t *pv,
+	int x,
+	int n,
+	const int32_t lut[3][0x100][4],
+	const int32_t offset[4],
+	const int16_t *lut_i,
+	const int16_t *lut_q
+);
+
+extern void composite_yuv_scalar(int16_t *output, const uint8_t *py, const uint8_t *pu, const uint8_t *pv, int x, int n, const int32_t lut[3][0x100][4], const int32_t offset[4], const int16_t *lut_i, const int16_t *lut_q);
+
+/* Return the fastest kernels supported by the CPU features in cpu.h */
+extern composite_rgb_t composite_rgb_kernel(int features);
+extern composite_yuv_t composite_yuv_kernel(int features);
+
+#endif
+
@@ -0,0 +1,896 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Sample format conversion. The vector kernels produce exactly the same
+ * output as the scalar ones. Dither is read from a fixed table of
+ * triangular noise rather than generated per sample, so every kernel
+ * sees the same sequence.
+ * 
+ * With istep 2 each vector load takes in one value past the last one it
+ * keeps, so the vector loops stop one step early rather than read past
+ * the end of the input. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hacktv.h"
+#include "convert.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Float output scale */
+#define FLOAT_SCALE (1.0 / 32767.0)
+
+/* Scalar kernels */
+
+/* Dither generators. Fill out with CONVERT_DITHER_BLOCK values, each the
+ * sum of two uniform values of one output step. The +128 offset makes
+ * the truncating shift that follows round to nearest.
+ * 
+ * Each step of the 16 interleaved xorshift32 generators gives 32 values,
+ * the low and high halves of each one's output. They are laid out in
+ * two groups of eight generators, the low halves then the high halves,
+ * so the vector versions give the same sequence */
+typedef void (*_dither_kernel_t)(uint32_t *rng, int16_t *out);
+
+static void _dither_scalar(uint32_t *rng, int16_t *out)
+{
+	uint32_t r;
+	int i, j;
+	
+	for(i = 0; i < CONVERT_DITHER_BLOCK; i += 32, out += 32)
+	{
+		for(j = 0; j < 16; j++)
+		{
+			r = rng[j];
+			r ^= r << 13;
+			r ^= r >> 17;
+			r ^= r << 5;
+			rng[j] = r;
+			
+			out[(j & 8) * 2 + (j & 7) + 0] = (int) (r & 0xFF) + (int) ((r >> 8) & 0xFF) - 255 + 128;
+			out[(j & 8) * 2 + (j & 7) + 8] = (int) ((r >> 16) & 0xFF) + (int) (r >> 24) - 255 + 128;
+		}
+	}
+}
+
+static inline int _add_dither(int v, const int16_t *dither, size_t x)
+{
+	if(dither)
+	{
+		v += dither[x];
+		if(v > INT16_MAX) v = INT16_MAX;
+		else if(v < INT16_MIN) v = INT16_MIN;
+	}
+	
+	return(v);
+}
+
+static void _uint8_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint8_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		d[x] = (_add_dither(*src, dither, x) - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int8_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		d[x] = _add_dither(*src, dither, x) >> 8;
+	}
+}
+
+static void _uint16_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint16_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		d[x] = *src - INT16_MIN;
+	}
+}
+
+static void _int16_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int16_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		d[x] = *src;
+	}
+}
+
+static void _int32_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int32_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		/* (v << 16) + v, wrapping at INT16_MIN */
+		d[x] = (int32_t) ((uint32_t) *src * 65537U);
+	}
+}
+
+static void _float_scalar(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	float *d = dst;
+	size_t x;
+	
+	for(x = 0; x < n; x++, src += istep)
+	{
+		d[x] = (float) *src * FLOAT_SCALE;
+	}
+}
+
+#if defined(CPU_X86)
+
+/* SSE2 kernels, 8 values per step */
+
+__attribute__((target("sse2")))
+static inline __m128i _xorshift_sse2(__m128i r)
+{
+	r = _mm_xor_si128(r, _mm_slli_epi32(r, 13));
+	r = _mm_xor_si128(r, _mm_srli_epi32(r, 17));
+	r = _mm_xor_si128(r, _mm_slli_epi32(r, 5));
+	
+	return(r);
+}
+
+/* Sum the bytes of each 16-bit half, less 127 */
+__attribute__((target("sse2")))
+static inline __m128i _tpdf_sse2(__m128i r)
+{
+	__m128i m = _mm_set1_epi16(0xFF);
+	
+	return(_mm_sub_epi16(
+		_mm_add_epi16(_mm_and_si128(r, m), _mm_srli_epi16(r, 8)),
+		_mm_set1_epi16(255 - 128)
+	));
+}
+
+__attribute__((target("sse2")))
+static void _dither_sse2(uint32_t *rng, int16_t *out)
+{
+	__m128i r[4], t[4];
+	int i, j;
+	
+	for(j = 0; j < 4; j++)
+	{
+		r[j] = _mm_loadu_si128((const __m128i *) &rng[j * 4]);
+	}
+	
+	for(i = 0; i < CONVERT_DITHER_BLOCK; i += 32, out += 32)
+	{
+		for(j = 0; j < 4; j++)
+		{
+			r[j] = _xorshift_sse2(r[j]);
+			t[j] = _tpdf_sse2(r[j]);
+		}
+		
+		/* Gather the low halves then the high halves of each group */
+		for(j = 0; j < 2; j++)
+		{
+			__m128i a = t[j * 2 + 0];
+			__m128i b = t[j * 2 + 1];
+			
+			/* Sign extend the 16-bit halves for the saturating pack */
+			_mm_storeu_si128((__m128i *) &out[j * 16 + 0], _mm_packs_epi32(
+				_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+				_mm_srai_epi32(_mm_slli_epi32(b, 16), 16)
+			));
+			_mm_storeu_si128((__m128i *) &out[j * 16 + 8], _mm_packs_epi32(
+				_mm_srai_epi32(a, 16),
+				_mm_srai_epi32(b, 16)
+			));
+		}
+	}
+	
+	for(j = 0; j < 4; j++)
+	{
+		_mm_storeu_si128((__m128i *) &rng[j * 4], r[j]);
+	}
+}
+
+__attribute__((target("sse2")))
+static inline __m128i _load_sse2(const int16_t *src, int istep)
+{
+	__m128i a, b;
+	
+	if(istep == 1)
+	{
+		return(_mm_loadu_si128((const __m128i *) src));
+	}
+	
+	/* Keep the even values */
+	a = _mm_loadu_si128((const __m128i *) &src[0]);
+	b = _mm_loadu_si128((const __m128i *) &src[8]);
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	
+	return(_mm_packs_epi32(a, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i _narrow_sse2(__m128i v, const int16_t *dither)
+{
+	if(dither)
+	{
+		v = _mm_adds_epi16(v, _mm_loadu_si128((const __m128i *) dither));
+	}
+	
+	v = _mm_srai_epi16(v, 8);
+	
+	return(_mm_packs_epi16(v, v));
+}
+
+__attribute__((target("sse2")))
+static void _uint8_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint8_t *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _narrow_sse2(_load_sse2(src, istep), dither ? &dither[x] : NULL);
+		v = _mm_xor_si128(v, _mm_set1_epi8(0x80));
+		_mm_storel_epi64((__m128i *) &d[x], v);
+	}
+	
+	_uint8_scalar(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _int8_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int8_t *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _narrow_sse2(_load_sse2(src, istep), dither ? &dither[x] : NULL);
+		_mm_storel_epi64((__m128i *) &d[x], v);
+	}
+	
+	_int8_scalar(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _uint16_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint16_t *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _mm_xor_si128(_load_sse2(src, istep), _mm_set1_epi16(INT16_MIN));
+		_mm_storeu_si128((__m128i *) &d[x], v);
+	}
+	
+	_uint16_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _int16_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int16_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		_mm_storeu_si128((__m128i *) &d[x], _load_sse2(src, istep));
+	}
+	
+	_int16_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _int32_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int32_t *d = dst;
+	__m128i v, s, lo, hi;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _load_sse2(src, istep);
+		
+		/* Sign extend to 32-bits */
+		s = _mm_srai_epi16(v, 15);
+		lo = _mm_unpacklo_epi16(v, s);
+		hi = _mm_unpackhi_epi16(v, s);
+		
+		lo = _mm_add_epi32(_mm_slli_epi32(lo, 16), lo);
+		hi = _mm_add_epi32(_mm_slli_epi32(hi, 16), hi);
+		
+		_mm_storeu_si128((__m128i *) &d[x + 0], lo);
+		_mm_storeu_si128((__m128i *) &d[x + 4], hi);
+	}
+	
+	_int32_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("sse2")))
+static inline __m128 _float4_sse2(__m128i v)
+{
+	const __m128d scale = _mm_set1_pd(FLOAT_SCALE);
+	__m128d a, b;
+	
+	/* Scale in double precision to match the scalar kernel */
+	a = _mm_mul_pd(_mm_cvtepi32_pd(v), scale);
+	b = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), scale);
+	
+	return(_mm_movelh_ps(_mm_cvtpd_ps(a), _mm_cvtpd_ps(b)));
+}
+
+__attribute__((target("sse2")))
+static void _float_sse2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	float *d = dst;
+	__m128i v, s;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _load_sse2(src, istep);
+		s = _mm_srai_epi16(v, 15);
+		
+		_mm_storeu_ps(&d[x + 0], _float4_sse2(_mm_unpacklo_epi16(v, s)));
+		_mm_storeu_ps(&d[x + 4], _float4_sse2(_mm_unpackhi_epi16(v, s)));
+	}
+	
+	_float_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+/* AVX2 kernels, 16 values per step */
+
+__attribute__((target("avx2")))
+static void _dither_avx2(uint32_t *rng, int16_t *out)
+{
+	__m256i r[2], t;
+	__m256i m = _mm256_set1_epi16(0xFF);
+	int i, j;
+	
+	r[0] = _mm256_loadu_si256((const __m256i *) &rng[0]);
+	r[1] = _mm256_loadu_si256((const __m256i *) &rng[8]);
+	
+	for(i = 0; i < CONVERT_DITHER_BLOCK; i += 32, out += 32)
+	{
+		for(j = 0; j < 2; j++)
+		{
+			r[j] = _mm256_xor_si256(r[j], _mm256_slli_epi32(r[j], 13));
+			r[j] = _mm256_xor_si256(r[j], _mm256_srli_epi32(r[j], 17));
+			r[j] = _mm256_xor_si256(r[j], _mm256_slli_epi32(r[j], 5));
+			
+			/* Sum the bytes of each 16-bit half, less 127 */
+			t = _mm256_sub_epi16(
+				_mm256_add_epi16(_mm256_and_si256(r[j], m), _mm256_srli_epi16(r[j], 8)),
+				_mm256_set1_epi16(255 - 128)
+			);
+			
+			/* Low halves then high halves, in generator order */
+			t = _mm256_packs_epi32(
+				_mm256_srai_epi32(_mm256_slli_epi32(t, 16), 16),
+				_mm256_srai_epi32(t, 16)
+			);
+			t = _mm256_permute4x64_epi64(t, _MM_SHUFFLE(3, 1, 2, 0));
+			
+			_mm256_storeu_si256((__m256i *) &out[j * 16], t);
+		}
+	}
+	
+	_mm256_storeu_si256((__m256i *) &rng[0], r[0]);
+	_mm256_storeu_si256((__m256i *) &rng[8], r[1]);
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _load_avx2(const int16_t *src, int istep)
+{
+	__m256i a, b;
+	
+	if(istep == 1)
+	{
+		return(_mm256_loadu_si256((const __m256i *) src));
+	}
+	
+	/* Keep the even values. The pack works within each
+	 * 128-bit lane, so put them back in order after */
+	a = _mm256_loadu_si256((const __m256i *) &src[0]);
+	b = _mm256_loadu_si256((const __m256i *) &src[16]);
+	a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+	b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+	
+	return(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i _narrow_avx2(__m256i v, const int16_t *dither)
+{
+	if(dither)
+	{
+		v = _mm256_adds_epi16(v, _mm256_loadu_si256((const __m256i *) dither));
+	}
+	
+	v = _mm256_srai_epi16(v, 8);
+	v = _mm256_packs_epi16(v, v);
+	
+	/* Gather the low 64-bits of each lane */
+	return(_mm256_castsi256_si128(_mm256_permute4x64_epi64(v, 0x08)));
+}
+
+__attribute__((target("avx2")))
+static void _uint8_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint8_t *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		v = _narrow_avx2(_load_avx2(src, istep), dither ? &dither[x] : NULL);
+		v = _mm_xor_si128(v, _mm_set1_epi8(0x80));
+		_mm_storeu_si128((__m128i *) &d[x], v);
+	}
+	
+	_mm256_zeroupper();
+	
+	_uint8_sse2(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _int8_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int8_t *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		v = _narrow_avx2(_load_avx2(src, istep), dither ? &dither[x] : NULL);
+		_mm_storeu_si128((__m128i *) &d[x], v);
+	}
+	
+	_mm256_zeroupper();
+	
+	_int8_sse2(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _uint16_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint16_t *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		v = _mm256_xor_si256(_load_avx2(src, istep), _mm256_set1_epi16(INT16_MIN));
+		_mm256_storeu_si256((__m256i *) &d[x], v);
+	}
+	
+	_mm256_zeroupper();
+	
+	_uint16_sse2(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _int16_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int16_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		_mm256_storeu_si256((__m256i *) &d[x], _load_avx2(src, istep));
+	}
+	
+	_mm256_zeroupper();
+	
+	_int16_sse2(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _int32_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int32_t *d = dst;
+	__m256i v, lo, hi;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		v = _load_avx2(src, istep);
+		
+		lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+		hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		
+		lo = _mm256_add_epi32(_mm256_slli_epi32(lo, 16), lo);
+		hi = _mm256_add_epi32(_mm256_slli_epi32(hi, 16), hi);
+		
+		_mm256_storeu_si256((__m256i *) &d[x + 0], lo);
+		_mm256_storeu_si256((__m256i *) &d[x + 8], hi);
+	}
+	
+	_mm256_zeroupper();
+	
+	_int32_sse2(&d[x], src, istep, NULL, n - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 _float8_avx2(__m256i v)
+{
+	const __m256d scale = _mm256_set1_pd(FLOAT_SCALE);
+	__m256d a, b;
+	
+	/* Scale in double precision to match the scalar kernel */
+	a = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), scale);
+	b = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), scale);
+	
+	return(_mm256_set_m128(_mm256_cvtpd_ps(b), _mm256_cvtpd_ps(a)));
+}
+
+__attribute__((target("avx2")))
+static void _float_avx2(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	float *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 16 + istep - 1 <= n; x += 16, src += 16 * istep)
+	{
+		v = _load_avx2(src, istep);
+		
+		_mm256_storeu_ps(&d[x + 0], _float8_avx2(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v))));
+		_mm256_storeu_ps(&d[x + 8], _float8_avx2(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1))));
+	}
+	
+	_mm256_zeroupper();
+	
+	_float_sse2(&d[x], src, istep, NULL, n - x);
+}
+
+#elif defined(CPU_ARM_NEON)
+
+/* NEON kernels, 8 values per step */
+
+static inline uint32x4_t _xorshift_neon(uint32x4_t r)
+{
+	r = veorq_u32(r, vshlq_n_u32(r, 13));
+	r = veorq_u32(r, vshrq_n_u32(r, 17));
+	r = veorq_u32(r, vshlq_n_u32(r, 5));
+	
+	return(r);
+}
+
+/* Sum the bytes of each 16-bit half, less 127 */
+static inline int16x8_t _tpdf_neon(uint32x4_t r)
+{
+	uint16x8_t v = vreinterpretq_u16_u32(r);
+	
+	v = vaddq_u16(vandq_u16(v, vdupq_n_u16(0xFF)), vshrq_n_u16(v, 8));
+	
+	return(vsubq_s16(vreinterpretq_s16_u16(v), vdupq_n_s16(255 - 128)));
+}
+
+static void _dither_neon(uint32_t *rng, int16_t *out)
+{
+	uint32x4_t r[4];
+	int16x8_t a, b;
+	int16x8x2_t h;
+	int i, j;
+	
+	for(j = 0; j < 4; j++)
+	{
+		r[j] = vld1q_u32(&rng[j * 4]);
+	}
+	
+	for(i = 0; i < CONVERT_DITHER_BLOCK; i += 32, out += 32)
+	{
+		for(j = 0; j < 4; j++)
+		{
+			r[j] = _xorshift_neon(r[j]);
+		}
+		
+		/* Gather the low halves then the high halves of each group */
+		for(j = 0; j < 2; j++)
+		{
+			a = _tpdf_neon(r[j * 2 + 0]);
+			b = _tpdf_neon(r[j * 2 + 1]);
+			
+			h = vuzpq_s16(a, b);
+			
+			vst1q_s16(&out[j * 16 + 0], h.val[0]);
+			vst1q_s16(&out[j * 16 + 8], h.val[1]);
+		}
+	}
+	
+	for(j = 0; j < 4; j++)
+	{
+		vst1q_u32(&rng[j * 4], r[j]);
+	}
+}
+
+static inline int16x8_t _load_neon(const int16_t *src, int istep)
+{
+	if(istep == 1)
+	{
+		return(vld1q_s16(src));
+	}
+	
+	return(vld2q_s16(src).val[0]);
+}
+
+static inline int8x8_t _narrow_neon(int16x8_t v, const int16_t *dither)
+{
+	if(dither)
+	{
+		v = vqaddq_s16(v, vld1q_s16(dither));
+	}
+	
+	return(vshrn_n_s16(v, 8));
+}
+
+static void _uint8_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint8_t *d = dst;
+	uint8x8_t v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = vreinterpret_u8_s8(_narrow_neon(_load_neon(src, istep), dither ? &dither[x] : NULL));
+		vst1_u8(&d[x], veor_u8(v, vdup_n_u8(0x80)));
+	}
+	
+	_uint8_scalar(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+static void _int8_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int8_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		vst1_s8(&d[x], _narrow_neon(_load_neon(src, istep), dither ? &dither[x] : NULL));
+	}
+	
+	_int8_scalar(&d[x], src, istep, dither ? &dither[x] : NULL, n - x);
+}
+
+static void _uint16_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	uint16_t *d = dst;
+	uint16x8_t v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = vreinterpretq_u16_s16(_load_neon(src, istep));
+		vst1q_u16(&d[x], veorq_u16(v, vdupq_n_u16(0x8000)));
+	}
+	
+	_uint16_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+static void _int16_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int16_t *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		vst1q_s16(&d[x], _load_neon(src, istep));
+	}
+	
+	_int16_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+static void _int32_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	int32_t *d = dst;
+	int16x8_t v;
+	int32x4_t lo, hi;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _load_neon(src, istep);
+		
+		lo = vmovl_s16(vget_low_s16(v));
+		hi = vmovl_s16(vget_high_s16(v));
+		
+		vst1q_s32(&d[x + 0], vaddq_s32(vshlq_n_s32(lo, 16), lo));
+		vst1q_s32(&d[x + 4], vaddq_s32(vshlq_n_s32(hi, 16), hi));
+	}
+	
+	_int32_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+#if defined(__aarch64__)
+
+static inline float32x4_t _float4_neon(int32x4_t v)
+{
+	float64x2_t a, b;
+	
+	/* Scale in double precision to match the scalar kernel */
+	a = vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(v))), FLOAT_SCALE);
+	b = vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(v))), FLOAT_SCALE);
+	
+	return(vcombine_f32(vcvt_f32_f64(a), vcvt_f32_f64(b)));
+}
+
+static void _float_neon(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n)
+{
+	float *d = dst;
+	int16x8_t v;
+	size_t x;
+	
+	for(x = 0; x + 8 + istep - 1 <= n; x += 8, src += 8 * istep)
+	{
+		v = _load_neon(src, istep);
+		
+		vst1q_f32(&d[x + 0], _float4_neon(vmovl_s16(vget_low_s16(v))));
+		vst1q_f32(&d[x + 4], _float4_neon(vmovl_s16(vget_high_s16(v))));
+	}
+	
+	_float_scalar(&d[x], src, istep, NULL, n - x);
+}
+
+#else
+
+/* 32-bit ARM has no double precision vectors */
+#define _float_neon _float_scalar
+
+#endif
+
+#endif
+
+/* Kernels for each type, indexed by HACKTV_UINT8 ... HACKTV_FLOAT */
+static convert_kernel_t _kernels[6] = {
+	_uint8_scalar, _int8_scalar, _uint16_scalar,
+	_int16_scalar, _int32_scalar, _float_scalar,
+};
+
+static _dither_kernel_t _dither = _dither_scalar;
+
+static const size_t _sizes[6] = {
+	sizeof(uint8_t), sizeof(int8_t), sizeof(uint16_t),
+	sizeof(int16_t), sizeof(int32_t), sizeof(float),
+};
+
+/* Select the kernels for this CPU. Called by convert_init(), before
+ * any converter can be running on another thread */
+static void _init_kernels(void)
+{
+	int f = cpu_features();
+	
+#if defined(CPU_X86)
+	if(f & CPU_SSE2)
+	{
+		_kernels[HACKTV_UINT8] = _uint8_sse2;
+		_kernels[HACKTV_INT8] = _int8_sse2;
+		_kernels[HACKTV_UINT16] = _uint16_sse2;
+		_kernels[HACKTV_INT16] = _int16_sse2;
+		_kernels[HACKTV_INT32] = _int32_sse2;
+		_kernels[HACKTV_FLOAT] = _float_sse2;
+		_dither = _dither_sse2;
+	}
+	
+	if(f & CPU_AVX2)
+	{
+		_kernels[HACKTV_UINT8] = _uint8_avx2;
+		_kernels[HACKTV_INT8] = _int8_avx2;
+		_kernels[HACKTV_UINT16] = _uint16_avx2;
+		_kernels[HACKTV_INT16] = _int16_avx2;
+		_kernels[HACKTV_INT32] = _int32_avx2;
+		_kernels[HACKTV_FLOAT] = _float_avx2;
+		_dither = _dither_avx2;
+	}
+#elif defined(CPU_ARM_NEON)
+	if(f & CPU_NEON)
+	{
+		_kernels[HACKTV_UINT8] = _uint8_neon;
+		_kernels[HACKTV_INT8] = _int8_neon;
+		_kernels[HACKTV_UINT16] = _uint16_neon;
+		_kernels[HACKTV_INT16] = _int16_neon;
+		_kernels[HACKTV_INT32] = _int32_neon;
+		_kernels[HACKTV_FLOAT] = _float_neon;
+		_dither = _dither_neon;
+	}
+#endif
+}
+
+int convert_init(convert_t *s, int type, int istep, int dither)
+{
+	int i;
+	
+	if(type < HACKTV_UINT8 || type > HACKTV_FLOAT)
+	{
+		return(-1);
+	}
+	
+	_init_kernels();
+	
+	/* Dither only applies when reducing to 8-bits */
+	if(type != HACKTV_UINT8 && type != HACKTV_INT8)
+	{
+		dither = 0;
+	}
+	
+	s->type = type;
+	s->size = _sizes[type];
+	s->istep = istep;
+	s->dither = dither;
+	s->kernel = _kernels[type];
+	
+	/* Any non-zero seeds will do */
+	for(i = 0; i < CONVERT_DITHER_LANES; i++)
+	{
+		s->rng[i] = 0x12345678 + i * 0x9E3779B9;
+	}
+	
+	s->noise_offset = CONVERT_DITHER_BLOCK;
+	
+	return(0);
+}
+
+void convert(convert_t *s, void *dst, const int16_t *src, size_t n)
+{
+	uint8_t *d = dst;
+	size_t l;
+	
+	if(!s->dither)
+	{
+		s->kernel(dst, src, s->istep, NULL, n);
+		return;
+	}
+	
+	/* Work through the dither a block at a time */
+	for(; n; n -= l, d += l * s->size, src += l * s->istep)
+	{
+		if(s->noise_offset == CONVERT_DITHER_BLOCK)
+		{
+			_dither(s->rng, s->noise);
+			s->noise_offset = 0;
+		}
+		
+		l = CONVERT_DITHER_BLOCK - s->noise_offset;
+		if(l > n) l = n;
+		
+		s->kernel(d, src, s->istep, &s->noise[s->noise_offset], l);
+		s->noise_offset += l;
+	}
+}
+
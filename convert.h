@@ -0,0 +1,64 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CONVERT_H
+#define _CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Values of dither generated at a time, and the number of
+ * independent generators interleaved to make them */
+#define CONVERT_DITHER_BLOCK 1024
+#define CONVERT_DITHER_LANES 16
+
+/* Sample format conversion for the output sinks */
+typedef void (*convert_kernel_t)(void *dst, const int16_t *src, int istep, const int16_t *dither, size_t n);
+
+typedef struct {
+	
+	/* Output type (HACKTV_UINT8 ... HACKTV_FLOAT) */
+	int type;
+	
+	/* Bytes per output value */
+	size_t size;
+	
+	/* Step between input values, 1 to take every value
+	 * or 2 to take the I samples only from a complex input */
+	int istep;
+	
+	/* Add TPDF dither when reducing to 8-bits */
+	int dither;
+	
+	/* xorshift32 states, carried from block to block so the
+	 * dither doesn't repeat, and the block being used up */
+	uint32_t rng[CONVERT_DITHER_LANES];
+	int16_t noise[CONVERT_DITHER_BLOCK];
+	int noise_offset;
+	
+	convert_kernel_t kernel;
+	
+} convert_t;
+
+/* Set up a converter to type. Returns -1 if type is not recognised */
+extern int convert_init(convert_t *s, int type, int istep, int dither);
+
+/* Convert n values from src into dst */
+extern void convert(convert_t *s, void *dst, const int16_t *src, size_t n);
+
+#endif
+
@@ -0,0 +1,57 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include "cpu.h"
+
+static int _features = -1;
+
+static int _detect(void)
+{
+	int f = 0;
+	
+	if(getenv("HACKTV_CPU_SCALAR") != NULL)
+	{
+		return(0);
+	}
+	
+#if defined(CPU_X86)
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("sse2")) f |= CPU_SSE2;
+	if(__builtin_cpu_supports("ssse3")) f |= CPU_SSSE3;
+	if(__builtin_cpu_supports("sse4.1")) f |= CPU_SSE41;
+	if(__builtin_cpu_supports("avx2")) f |= CPU_AVX2;
+#elif defined(CPU_ARM_NEON)
+	/* NEON is part of the baseline on targets built with it enabled */
+	f |= CPU_NEON;
+#endif
+	
+	return(f);
+}
+
+int cpu_features(void)
+{
+	/* Detection has no side effects, a race here is harmless */
+	if(_features < 0)
+	{
+		_features = _detect();
+	}
+	
+	return(_features);
+}
+
@@ -0,0 +1,40 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+/* CPU feature flags */
+#define CPU_SSE2   (1 << 0)
+#define CPU_SSSE3  (1 << 1)
+#define CPU_SSE41  (1 << 2)
+#define CPU_AVX2   (1 << 3)
+#define CPU_NEON   (1 << 4)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#elif defined(__ARM_NEON)
+#define CPU_ARM_NEON
+#endif
+
+/* Returns the features supported by the running CPU. The result is
+ * cached after the first call. Setting the HACKTV_CPU_SCALAR environment
+ * variable disables all vector paths. */
+extern int cpu_features(void);
+
+#endif
+
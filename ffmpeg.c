@@ -42,6 +42,8 @@
 #endif
 #include <pthread.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavdevice/avdevice.h>
@@ -54,10 +56,22 @@
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include "hacktv.h"
+#include "cache.h"
 
-/* Maximum length of the packet queue */
-/* Taken from ffplay.c */
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+/* Length of each packet queue, in AV_TIME_BASE units */
+#define VIDEO_QUEUE_DURATION (2 * AV_TIME_BASE)
+#define AUDIO_QUEUE_DURATION (2 * AV_TIME_BASE)
+
+/* Longest a queue can grow while the other decoder is starved,
+ * to read past poorly interleaved parts of a file */
+#define STARVED_QUEUE_DURATION (30 * AV_TIME_BASE)
+
+/* A queue always takes this many packets, whatever their length */
+#define MIN_QUEUE_LENGTH 2
+
+/* Hard limit on the size of each packet queue, for streams
+ * without usable packet durations */
+#define MAX_QUEUE_SIZE (256 * 1024 * 1024)
 
 /* Temp hack */
 char current_text[256];
@@ -65,14 +79,16 @@ char current_text[256];
 typedef struct __packet_queue_item_t {
 	
 	AVPacket pkt;
+	int64_t duration;	/* In AV_TIME_BASE units */
 	struct __packet_queue_item_t *next;
 	
 } _packet_queue_item_t;
 
-typedef struct {
+typedef struct __packet_queue_t {
 	
 	int length;	/* Number of packets */
 	int size;       /* Number of bytes used */
+	int64_t duration;	/* Length of the packets, in AV_TIME_BASE units */
 	int eof;        /* End of stream / file flag */
 	int abort;      /* Abort flag */
 	
@@ -80,26 +96,121 @@ typedef struct {
 	_packet_queue_item_t *first;
 	_packet_queue_item_t *last;
 	
+	/* Items no longer in use, taken before allocating new ones */
+	_packet_queue_item_t *spare;
+	
+	/* The stream's time base and the queue length limit */
+	AVRational time_base;
+	int64_t max_duration;
+	
+	/* For packets without a duration */
+	int64_t last_dts;
+	int64_t last_duration;
+	
+	/* The other queue fed by the input thread. The writer doesn't
+	 * wait on this queue while the other one's reader is starved */
+	struct __packet_queue_t *peer;
+	atomic_int starved;
+	
+	/* Statistics */
+	int peak_length;
+	int peak_size;
+	int64_t peak_duration;
+	uint64_t write_stalls;	/* Writer waited for room */
+	uint64_t read_stalls;	/* Reader waited for a packet */
+	
 	/* Thread locking and signaling */
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	
 } _packet_queue_t;
 
+/* Default number of frames in each frame pool */
+#define FRAME_POOL_DEPTH 4
+
+/* Keyframe index cache, kept in the --cache directory */
+#define KEY_INDEX_MAGIC   "HACKTVKI"
+#define KEY_INDEX_VERSION 1
+#define KEY_INDEX_SUFFIX  ".hacktv-idx"
+
+/* Index entry access moved behind functions in libavformat 58.78 */
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+#define _INDEX_ENTRIES(st) avformat_index_get_entries_count(st)
+#else
+#define _INDEX_ENTRIES(st) ((st)->nb_index_entries)
+#endif
+
+typedef struct {
+	int64_t ts;	/* In the video stream's time base */
+	int64_t pos;	/* Byte position in the file, or -1 */
+} _key_index_entry_t;
+
+typedef struct {
+	int length;
+	int size;
+	_key_index_entry_t *entries;
+} _key_index_t;
+
 typedef struct {
+	char magic[8];
+	uint32_t version;
+	int32_t stream;
+	int32_t tb_num;
+	int32_t tb_den;
+	uint64_t file_size;
+	int64_t mtime;
+	uint64_t length;
+} _key_index_header_t;
+
+/* A pool of frames passed from one thread to the next. The producer
+ * takes a free frame, fills it and queues it. The consumer reads frames
+ * from the queue in order and keeps the last one until its next read,
+ * so it can use the frame in place. A frame may be queued more than once
+ * to repeat it, each frame counts its references and is only free again
+ * once they are all gone. */
+typedef struct {
+	
+	int depth;		/* Number of frames */
+	int closed;		/* Producer has finished, read out the queue */
+	int abort;		/* Abort flag */
 	
-	int ready;	/* Frame ready flag */
-	int repeat;	/* Repeat the previous frame */
-	int abort;	/* Abort flag */
+	/* The AVFrame buffers and their reference counts */
+	AVFrame **frame;
+	int *refs;
 	
-	/* The AVFrame buffers */
-	AVFrame *frame[2];
+	/* Queue of frame indexes, oldest first */
+	int *queue;
+	int head;
+	int length;
+	
+	int writing;		/* Frame held by the producer, or -1 */
+	int last;		/* Frame last queued, or -1 */
+	int held;		/* Frame held by the consumer, or -1 */
 	
 	/* Thread locking and signaling */
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	
-} _frame_dbuffer_t;
+} _frame_pool_t;
+
+/* Scaling algorithms for --scaler */
+static const struct {
+	const char *id;
+	int flags;
+} _scalers[] = {
+	{ "fast-bilinear", SWS_FAST_BILINEAR },
+	{ "bilinear",      SWS_BILINEAR },
+	{ "bicubic",       SWS_BICUBIC },
+	{ "experimental",  SWS_X },
+	{ "point",         SWS_POINT },
+	{ "area",          SWS_AREA },
+	{ "bicublin",      SWS_BICUBLIN },
+	{ "gauss",         SWS_GAUSS },
+	{ "sinc",          SWS_SINC },
+	{ "lanczos",       SWS_LANCZOS },
+	{ "spline",        SWS_SPLINE },
+	{ NULL,            0 },
+};
 
 typedef struct {
 	
@@ -109,7 +220,7 @@ typedef struct {
 	int sample_rate;
 	uint32_t *video;
 	vid_t *s;
-	int seekflag;
+	atomic_int seekflag;
 	uint8_t background;
 	int bstat;
 	
@@ -123,12 +234,21 @@ typedef struct {
 	_packet_queue_t video_queue;
 	AVStream *video_stream;
 	AVCodecContext *video_codec_ctx;
-	_frame_dbuffer_t in_video_buffer;
+	_frame_pool_t in_video_pool;
 	int video_eof;
 	
+	/* Seeking. Frames before seek_frame (in video_time_base units)
+	 * are dropped by the decoder, unscaled, until it is reached */
+	int seeking;
+	int64_t seek_frame;
+	int64_t seek_start;	/* av_gettime_relative() at open */
+	int seek_dropped;
+	
 	/* Video scaling */
 	struct SwsContext *sws_ctx;
-	_frame_dbuffer_t out_video_buffer;
+	int sws_flags;
+	enum AVPixelFormat pix_fmt;	/* RGB32, or YUV422P for --yuv */
+	_frame_pool_t out_video_pool;
 	
 	/* Audio decoder */
 	AVRational audio_time_base;
@@ -136,12 +256,12 @@ typedef struct {
 	_packet_queue_t audio_queue;
 	AVStream *audio_stream;
 	AVCodecContext *audio_codec_ctx;
-	_frame_dbuffer_t in_audio_buffer;
+	_frame_pool_t in_audio_pool;
 	int audio_eof;
 	
 	/* Audio resampler */
 	struct SwrContext *swr_ctx;
-	_frame_dbuffer_t out_audio_buffer;
+	_frame_pool_t out_audio_pool;
 	int out_frame_size;
 	int allowed_error;
 	
@@ -156,7 +276,7 @@ typedef struct {
 	pthread_t video_scaler_thread;
 	pthread_t audio_decode_thread;
 	pthread_t audio_scaler_thread;
-	volatile int thread_abort;
+	atomic_int thread_abort;
 	
 	/* Video filter buffers */
 	AVFilterContext *vbuffersink_ctx;
@@ -197,12 +317,13 @@ void _audio_offset(uint8_t const **dst, uint8_t const * const *src, int offset,
 	}
 }
 
-static int _packet_queue_init(_packet_queue_t *q)
+static int _packet_queue_init(_packet_queue_t *q, AVStream *stream, int64_t max_duration)
 {
-	q->length = 0;
-	q->size = 0;
-	q->eof = 0;
-	q->abort = 0;
+	memset(q, 0, sizeof(_packet_queue_t));
+	
+	q->time_base = stream ? stream->time_base : AV_TIME_BASE_Q;
+	q->max_duration = max_duration;
+	q->last_dts = AV_NOPTS_VALUE;
 	
 	pthread_mutex_init(&q->mutex, NULL);
 	pthread_cond_init(&q->cond, NULL);
@@ -223,9 +344,15 @@ static int _packet_queue_flush(_packet_queue_t *q)
 		q->first = p->next;
 		
 		av_packet_unref(&p->pkt);
-		free(p);
+		
+		p->next = q->spare;
+		q->spare = p;
 	}
 	
+	q->length = 0;
+	q->size = 0;
+	q->duration = 0;
+	
 	pthread_cond_signal(&q->cond);
 	pthread_mutex_unlock(&q->mutex);
 	
@@ -234,8 +361,16 @@ static int _packet_queue_flush(_packet_queue_t *q)
 
 static void _packet_queue_free(_packet_queue_t *q)
 {
+	_packet_queue_item_t *p;
+	
 	_packet_queue_flush(q);
 	
+	while((p = q->spare) != NULL)
+	{
+		q->spare = p->next;
+		free(p);
+	}
+	
 	pthread_cond_destroy(&q->cond);
 	pthread_mutex_destroy(&q->mutex);
 }
@@ -250,9 +385,75 @@ static void _packet_queue_abort(_packet_queue_t *q)
 	pthread_mutex_unlock(&q->mutex);
 }
 
+static void _packet_queue_wake(_packet_queue_t *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static void _packet_queue_stats(_packet_queue_t *q, const char *name)
+{
+	fprintf(stderr, "ffmpeg: %s queue peaked at %d packets, %.2f seconds, %.1f MiB. %llu input stalls, %llu decoder stalls\n",
+		name,
+		q->peak_length,
+		(double) q->peak_duration / AV_TIME_BASE,
+		q->peak_size / 1048576.0,
+		(unsigned long long) q->write_stalls,
+		(unsigned long long) q->read_stalls
+	);
+}
+
+/* The length of a packet in AV_TIME_BASE units. When the demuxer doesn't
+ * give one, use the step in decode time or else the last length seen */
+static int64_t _packet_duration(_packet_queue_t *q, const AVPacket *pkt)
+{
+	int64_t d = pkt->duration;
+	
+	if(d <= 0 && pkt->dts != AV_NOPTS_VALUE && q->last_dts != AV_NOPTS_VALUE)
+	{
+		d = pkt->dts - q->last_dts;
+	}
+	
+	if(pkt->dts != AV_NOPTS_VALUE)
+	{
+		q->last_dts = pkt->dts;
+	}
+	
+	if(d > 0)
+	{
+		q->last_duration = av_rescale_q(d, q->time_base, AV_TIME_BASE_Q);
+	}
+	
+	return(q->last_duration);
+}
+
+static int _packet_queue_full(_packet_queue_t *q, int size)
+{
+	if(q->length < MIN_QUEUE_LENGTH)
+	{
+		return(0);
+	}
+	
+	if(q->size + size + (int) sizeof(_packet_queue_item_t) > MAX_QUEUE_SIZE)
+	{
+		return(1);
+	}
+	
+	/* Keep reading further while the other decoder is waiting,
+	 * the streams may be far apart in the file */
+	if(q->peer != NULL && atomic_load(&q->peer->starved))
+	{
+		return(q->duration >= STARVED_QUEUE_DURATION);
+	}
+	
+	return(q->duration >= q->max_duration);
+}
+
 static int _packet_queue_write(_packet_queue_t *q, AVPacket *pkt)
 {
 	_packet_queue_item_t *p;
+	int64_t duration;
 	
 	pthread_mutex_lock(&q->mutex);
 	
@@ -263,10 +464,18 @@ static int _packet_queue_write(_packet_queue_t *q, AVPacket *pkt)
 	}
 	else
 	{
-		/* Limit the size of the queue */
-		while(q->abort == 0 && q->size + pkt->size + sizeof(_packet_queue_item_t) > MAX_QUEUE_SIZE)
+		duration = _packet_duration(q, pkt);
+		
+		/* Limit the length of the queue */
+		if(q->abort == 0 && _packet_queue_full(q, pkt->size))
 		{
-			pthread_cond_wait(&q->cond, &q->mutex);
+			q->write_stalls++;
+			
+			do
+			{
+				pthread_cond_wait(&q->cond, &q->mutex);
+			}
+			while(q->abort == 0 && _packet_queue_full(q, pkt->size));
 		}
 		
 		if(q->abort == 1)
@@ -280,9 +489,23 @@ static int _packet_queue_write(_packet_queue_t *q, AVPacket *pkt)
 			return(-2);
 		}
 		
-		/* Allocate memory for queue item and copy packet */
-		p = malloc(sizeof(_packet_queue_item_t));
+		/* Take a spare queue item, or allocate one */
+		p = q->spare;
+		
+		if(p != NULL)
+		{
+			q->spare = p->next;
+		}
+		else if((p = malloc(sizeof(_packet_queue_item_t))) == NULL)
+		{
+			av_packet_unref(pkt);
+			pthread_mutex_unlock(&q->mutex);
+			
+			return(-1);
+		}
+		
 		p->pkt = *pkt;
+		p->duration = duration;
 		p->next = NULL;
 		
 		/* Add the item to the end of the queue */
@@ -298,6 +521,11 @@ static int _packet_queue_write(_packet_queue_t *q, AVPacket *pkt)
 		q->last = p;
 		q->length++;
 		q->size += pkt->size + sizeof(_packet_queue_item_t);
+		q->duration += duration;
+		
+		if(q->length > q->peak_length) q->peak_length = q->length;
+		if(q->size > q->peak_size) q->peak_size = q->size;
+		if(q->duration > q->peak_duration) q->peak_duration = q->duration;
 	}
 	
 	pthread_cond_signal(&q->cond);
@@ -312,10 +540,25 @@ static int _packet_queue_read(_packet_queue_t *q, AVPacket *pkt)
 	
 	pthread_mutex_lock(&q->mutex);
 	
+	if(q->length == 0 && q->abort == 0 && q->eof == 0)
+	{
+		q->read_stalls++;
+		atomic_store(&q->starved, 1);
+		
+		if(q->peer != NULL)
+		{
+			/* The input thread may be waiting for room in the other queue */
+			pthread_mutex_unlock(&q->mutex);
+			_packet_queue_wake(q->peer);
+			pthread_mutex_lock(&q->mutex);
+		}
+	}
+	
 	while(q->length == 0)
 	{
 		if(q->abort == 1 || q->eof == 1)
 		{
+			atomic_store(&q->starved, 0);
 			pthread_mutex_unlock(&q->mutex);
 			return(q->abort == 1 ? -2 : -1);
 		}
@@ -323,14 +566,19 @@ static int _packet_queue_read(_packet_queue_t *q, AVPacket *pkt)
 		pthread_cond_wait(&q->cond, &q->mutex);
 	}
 	
+	atomic_store(&q->starved, 0);
+	
 	p = q->first;
 	
 	*pkt = p->pkt;
 	q->first = p->next;
 	q->length--;
 	q->size -= pkt->size + sizeof(_packet_queue_item_t);
+	q->duration -= p->duration;
 	
-	free(p);
+	/* Keep the item for the next write */
+	p->next = q->spare;
+	q->spare = p;
 	
 	pthread_cond_signal(&q->cond);
 	pthread_mutex_unlock(&q->mutex);
@@ -338,115 +586,213 @@ static int _packet_queue_read(_packet_queue_t *q, AVPacket *pkt)
 	return(0);
 }
 
-static int _frame_dbuffer_init(_frame_dbuffer_t *d)
+static int _frame_pool_init(_frame_pool_t *p, int depth)
 {
-	d->ready = 0;
-	d->repeat = 0;
-	d->abort = 0;
+	int i;
+	
+	memset(p, 0, sizeof(_frame_pool_t));
 	
-	d->frame[0] = av_frame_alloc();
-	d->frame[1] = av_frame_alloc();
+	/* One frame for each side at least */
+	p->depth = depth < 2 ? 2 : depth;
+	p->writing = -1;
+	p->last = -1;
+	p->held = -1;
 	
-	if(!d->frame[0] || !d->frame[1])
+	p->frame = calloc(p->depth, sizeof(AVFrame *));
+	p->refs = calloc(p->depth, sizeof(int));
+	p->queue = calloc(p->depth, sizeof(int));
+	
+	if(!p->frame || !p->refs || !p->queue)
 	{
-		av_frame_free(&d->frame[0]);
-		av_frame_free(&d->frame[1]);
+		free(p->frame);
+		free(p->refs);
+		free(p->queue);
 		return(-1);
 	}
 	
-	pthread_mutex_init(&d->mutex, NULL);
-	pthread_cond_init(&d->cond, NULL);
+	for(i = 0; i < p->depth; i++)
+	{
+		p->frame[i] = av_frame_alloc();
+		
+		if(!p->frame[i])
+		{
+			while(i--) av_frame_free(&p->frame[i]);
+			free(p->frame);
+			free(p->refs);
+			free(p->queue);
+			return(-1);
+		}
+	}
+	
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
 	
 	return(0);
 }
 
-static void _frame_dbuffer_free(_frame_dbuffer_t *d)
+static void _frame_pool_free(_frame_pool_t *p)
+{
+	int i;
+	
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+	
+	for(i = 0; i < p->depth; i++)
+	{
+		av_frame_free(&p->frame[i]);
+	}
+	
+	free(p->frame);
+	free(p->refs);
+	free(p->queue);
+}
+
+static void _frame_pool_abort(_frame_pool_t *p)
 {
-	pthread_cond_destroy(&d->cond);
-	pthread_mutex_destroy(&d->mutex);
+	pthread_mutex_lock(&p->mutex);
+	
+	p->abort = 1;
 	
-	av_frame_free(&d->frame[0]);
-	av_frame_free(&d->frame[1]);
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
 }
 
-static void _frame_dbuffer_abort(_frame_dbuffer_t *d)
+/* Called by the producer when it has no more frames. The consumer
+ * reads out what is queued before seeing the end */
+static void _frame_pool_close(_frame_pool_t *p)
 {
-	pthread_mutex_lock(&d->mutex);
+	pthread_mutex_lock(&p->mutex);
 	
-	d->abort = 1;
+	p->closed = 1;
 	
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
 }
 
-static AVFrame *_frame_dbuffer_back_buffer(_frame_dbuffer_t *d)
+/* Wait for a free frame for the producer to fill. Returns NULL on abort */
+static AVFrame *_frame_pool_get(_frame_pool_t *p)
 {
-	AVFrame *frame;
-	pthread_mutex_lock(&d->mutex);
+	AVFrame *frame = NULL;
+	int i;
+	
+	pthread_mutex_lock(&p->mutex);
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	while(p->abort == 0)
 	{
-		pthread_cond_wait(&d->cond, &d->mutex);
+		for(i = 0; i < p->depth && p->refs[i] > 0; i++);
+		
+		if(i < p->depth)
+		{
+			/* The producer's reference stops it being handed out again */
+			p->refs[i] = 1;
+			p->writing = i;
+			frame = p->frame[i];
+			break;
+		}
+		
+		pthread_cond_wait(&p->cond, &p->mutex);
 	}
 	
-	frame = d->frame[1];
-	
-	pthread_mutex_unlock(&d->mutex);
+	pthread_mutex_unlock(&p->mutex);
 	
 	return(frame);
 }
 
-static void _frame_dbuffer_ready(_frame_dbuffer_t *d, int repeat)
+/* Queue the frame from _frame_pool_get(), or with repeat set queue the
+ * last frame again. Returns -1 if there is nothing to repeat */
+static int _frame_pool_ready(_frame_pool_t *p, int repeat)
 {
-	pthread_mutex_lock(&d->mutex);
+	int i;
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	i = repeat ? p->last : p->writing;
+	
+	if(i < 0)
+	{
+		pthread_mutex_unlock(&p->mutex);
+		return(-1);
+	}
+	
+	/* Wait for room in the queue */
+	while(p->length == p->depth && p->abort == 0)
+	{
+		pthread_cond_wait(&p->cond, &p->mutex);
+	}
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	if(repeat)
 	{
-		pthread_cond_wait(&d->cond, &d->mutex);
+		p->refs[i]++;
+	}
+	else
+	{
+		/* The queue takes over the producer's reference */
+		p->writing = -1;
+		p->last = i;
+	}
+	
+	if(p->abort == 0)
+	{
+		p->queue[(p->head + p->length) % p->depth] = i;
+		p->length++;
+	}
+	else
+	{
+		p->refs[i]--;
 	}
 	
-	d->ready = 1;
-	d->repeat = repeat;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
 	
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	return(0);
 }
 
-static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
+/* Hand back the frame from _frame_pool_get() unused */
+static void _frame_pool_release(_frame_pool_t *p)
 {
-	AVFrame *frame;
-	
-	pthread_mutex_lock(&d->mutex);
+	pthread_mutex_lock(&p->mutex);
 	
-	/* Wait for a flag to be set */
-	while(d->ready == 0 && d->abort == 0)
+	if(p->writing >= 0)
 	{
-		pthread_cond_wait(&d->cond, &d->mutex);
+		p->refs[p->writing]--;
+		p->writing = -1;
+		pthread_cond_broadcast(&p->cond);
 	}
 	
-	/* Die if it was the abort flag */
-	if(d->abort != 0)
+	pthread_mutex_unlock(&p->mutex);
+}
+
+/* Hand back the frame from the last read and wait for the next one.
+ * Returns NULL on abort, or once closed and the queue is empty */
+static AVFrame *_frame_pool_read(_frame_pool_t *p)
+{
+	AVFrame *frame = NULL;
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	if(p->held >= 0)
 	{
-		pthread_mutex_unlock(&d->mutex);
-		return(NULL);
+		p->refs[p->held]--;
+		p->held = -1;
+		pthread_cond_broadcast(&p->cond);
 	}
 	
-	/* Swap the frames if we're not repeating */
-	if(d->repeat == 0)
+	while(p->length == 0 && p->closed == 0 && p->abort == 0)
 	{
-		frame       = d->frame[1];
-		d->frame[1] = d->frame[0];
-		d->frame[0] = frame;
+		pthread_cond_wait(&p->cond, &p->mutex);
 	}
 	
-	frame = d->frame[0];
-	d->ready = 0;
+	if(p->length > 0 && p->abort == 0)
+	{
+		p->held = p->queue[p->head];
+		p->head = (p->head + 1) % p->depth;
+		p->length--;
+		frame = p->frame[p->held];
+		
+		pthread_cond_broadcast(&p->cond);
+	}
 	
-	/* Signal we're finished and release the mutex */
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	pthread_mutex_unlock(&p->mutex);
 	
 	return(frame);
 }
@@ -581,11 +927,22 @@ static void *_input_thread(void *arg)
 	return(NULL);
 }
 
+/* Is a video timestamp before the seek target? */
+static int _seek_past(av_ffmpeg_t *av, int64_t pts)
+{
+	if(pts == AV_NOPTS_VALUE)
+	{
+		return(0);
+	}
+	
+	return(av_rescale_q(pts, av->video_stream->time_base, av->video_time_base) < av->seek_frame);
+}
+
 static void *_video_decode_thread(void *arg)
 {
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
 	AVPacket pkt, *ppkt = NULL;
-	AVFrame *frame;
+	AVFrame *frame, *iframe;
 	int r;
 	
 	//fprintf(stderr, "_video_decode_thread(): Starting\n");
@@ -607,6 +964,13 @@ static void *_video_decode_thread(void *arg)
 			ppkt = (r >= 0 ? &pkt : NULL);
 		}
 		
+		if(av->seeking && ppkt != NULL)
+		{
+			/* Frames before the target that nothing else
+			 * refers to needn't be decoded at all */
+			av->video_codec_ctx->skip_frame = _seek_past(av, ppkt->pts) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+		}
+		
 		r = avcodec_send_packet(av->video_codec_ctx, ppkt);
 		
 		if(ppkt != NULL && r != AVERROR(EAGAIN))
@@ -623,6 +987,25 @@ static void *_video_decode_thread(void *arg)
 		
 		r = avcodec_receive_frame(av->video_codec_ctx, frame);
 		
+		if(r == 0 && av->seeking)
+		{
+			if(_seek_past(av, frame->best_effort_timestamp))
+			{
+				/* Not there yet, drop it before filtering and scaling */
+				av->seek_dropped++;
+				av_frame_unref(frame);
+				continue;
+			}
+			
+			av->video_codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+			av->seeking = 0;
+			
+			fprintf(stderr, "Seek took %.2f seconds, %d frames decoded and dropped\n",
+				(av_gettime_relative() - av->seek_start) / 1e6,
+				av->seek_dropped
+			);
+		}
+		
 		if(r == 0)
 		{
 			/* Push the decoded frame into the filtergraph */
@@ -638,8 +1021,15 @@ static void *_video_decode_thread(void *arg)
 			}
 			
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&av->in_video_buffer), frame);
-			_frame_dbuffer_ready(&av->in_video_buffer, 0);
+			iframe = _frame_pool_get(&av->in_video_pool);
+			if(iframe == NULL)
+			{
+				/* Thread is aborting */
+				break;
+			}
+			
+			av_frame_ref(iframe, frame);
+			_frame_pool_ready(&av->in_video_pool, 0);
 			
 		}
 		else if(r != AVERROR(EAGAIN))
@@ -649,7 +1039,7 @@ static void *_video_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&av->in_video_buffer);
+	_frame_pool_close(&av->in_video_pool);
 	
 	av_frame_free(&frame);
 	
@@ -658,6 +1048,67 @@ static void *_video_decode_thread(void *arg)
 	return(NULL);
 }
 
+/* YUV output is full range BT.601, to match the tables in video.c */
+static void _sws_output_range(av_ffmpeg_t *av, struct SwsContext *ctx)
+{
+	int *inv_table, *table;
+	int src_range, dst_range;
+	int brightness, contrast, saturation;
+	
+	if(av->pix_fmt != AV_PIX_FMT_YUV422P ||
+	   sws_getColorspaceDetails(ctx, &inv_table, &src_range, &table, &dst_range, &brightness, &contrast, &saturation) < 0)
+	{
+		return;
+	}
+	
+	sws_setColorspaceDetails(ctx, inv_table, src_range, sws_getCoefficients(SWS_CS_ITU601), 1, brightness, contrast, saturation);
+}
+
+/* Allocate a reference counted buffer for a scaled frame, with the
+ * planes packed end to end as the raster reads them */
+static int _alloc_video_frame(AVFrame *frame, enum AVPixelFormat pix_fmt, int width, int height)
+{
+	int size;
+	
+	frame->format = pix_fmt;
+	frame->width = width;
+	frame->height = height;
+	
+	size = av_image_get_buffer_size(pix_fmt, width, height, 1);
+	if(size < 0)
+	{
+		return(size);
+	}
+	
+	frame->buf[0] = av_buffer_alloc(size);
+	if(!frame->buf[0])
+	{
+		return(AVERROR(ENOMEM));
+	}
+	
+	return(av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, pix_fmt, width, height, 1));
+}
+
+/* Scale a frame and overlay the logo */
+static void _scale_frame(av_ffmpeg_t *av, AVFrame *src, AVFrame *dst)
+{
+	sws_scale(
+		av->sws_ctx,
+		(uint8_t const * const *) src->data,
+		src->linesize,
+		0,
+		av->video_codec_ctx->height,
+		dst->data,
+		dst->linesize
+	);
+	
+	/* Print logo, if enabled */
+	if(av->s->conf.logo)
+	{
+		overlay_image((uint32_t *) dst->data[0], &av->s->vid_logo, av->s->active_width, av->s->conf.active_lines, av->s->vid_logo.position);
+	}
+}
+
 static void *_video_scaler_thread(void *arg)
 {
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
@@ -666,7 +1117,7 @@ static void *_video_scaler_thread(void *arg)
 	int64_t pts;
 	
 	/* Fetch video frames and pass them through the scaler */
-	while((frame = _frame_dbuffer_flip(&av->in_video_buffer)) != NULL)
+	while((frame = _frame_pool_read(&av->in_video_pool)) != NULL)
 	{
 		pts = frame->best_effort_timestamp;
 		
@@ -685,8 +1136,17 @@ static void *_video_scaler_thread(void *arg)
 			
 			while(pts > 0)
 			{
-				/* This frame is in the future. Repeat the previous one */
-				_frame_dbuffer_ready(&av->out_video_buffer, 1);
+				/* This frame is in the future. Repeat the previous
+				 * one, or start with black if there isn't one */
+				if(_frame_pool_ready(&av->out_video_pool, 1) != 0)
+				{
+					oframe = _frame_pool_get(&av->out_video_pool);
+					if(oframe == NULL) break;
+					
+					vid_fill_framebuffer(av->s, oframe->data[0], 0);
+					_frame_pool_ready(&av->out_video_pool, 0);
+				}
+				
 				av->video_start_time++;
 				pts--;
 			}
@@ -694,17 +1154,16 @@ static void *_video_scaler_thread(void *arg)
 		
 		if(av->seekflag < 2) av->seekflag++;
 		
-		oframe = _frame_dbuffer_back_buffer(&av->out_video_buffer);
+		/* Scale straight into a free frame in the pool */
+		oframe = _frame_pool_get(&av->out_video_pool);
+		if(oframe == NULL)
+		{
+			/* Thread is aborting */
+			av_frame_unref(frame);
+			break;
+		}
 		
-		sws_scale(
-			av->sws_ctx,
-			(uint8_t const * const *) frame->data,
-			frame->linesize,
-			0,
-			av->video_codec_ctx->height,
-			oframe->data,
-			oframe->linesize
-		);
+		_scale_frame(av, frame, oframe);
 		
 		ratio = frame->sample_aspect_ratio;
 		
@@ -723,12 +1182,8 @@ static void *_video_scaler_thread(void *arg)
 			INT_MAX
 		);
 		
-		/* Print logo, if enabled */
-		if(av->s->conf.logo)
-		{
-			overlay_image((uint32_t *) oframe->data[0], &av->s->vid_logo, av->s->active_width, av->s->conf.active_lines, av->s->vid_logo.position);
-		}
-		
+		/* The text overlays stay on this thread, they
+		 * can update teletext and print to the console */
 		if(av->s->conf.timestamp)
 		{
 			char timestr[20];
@@ -779,11 +1234,11 @@ static void *_video_scaler_thread(void *arg)
 		
 		av_frame_unref(frame);
 		
-		_frame_dbuffer_ready(&av->out_video_buffer, 0);
+		_frame_pool_ready(&av->out_video_pool, 0);
 		av->video_start_time++;
 	}
 	
-	_frame_dbuffer_abort(&av->out_video_buffer);
+	_frame_pool_close(&av->out_video_pool);
 	
 	// fprintf(stderr, "_video_scaler_thread(): Ending\n");
 	
@@ -800,7 +1255,9 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 		return(NULL);
 	}
 	
-	frame = _frame_dbuffer_flip(&av->out_video_buffer);
+	/* The raster renderer reads this frame in place. It stays ours
+	 * until the next call */
+	frame = _frame_pool_read(&av->out_video_pool);
 	if(!frame)
 	{
 		/* EOF or abort */
@@ -844,14 +1301,19 @@ static uint32_t *_av_ffmpeg_read_video(void *private, float *ratio)
 			av->background--;
 		}
 
-		memset(frame->data[0], av->background, vid_get_framebuffer_length(av->s));
-		print_generic_text(	av->font[2], (uint32_t *) frame->data[0],
-							"SEEKING VIDEO",
-							50, 47, 1, 0, 0, 0);
+		vid_fill_framebuffer(av->s, frame->data[0], av->background);
 		
-		print_generic_text(	av->font[2], (uint32_t *) frame->data[0],
-							"PLEASE WAIT",
-							50, 53, 1, 0, 0, 0);
+		/* The text can only be drawn on RGB frames */
+		if(!av->s->framebuffer_yuv)
+		{
+			print_generic_text(	av->font[2], (uint32_t *) frame->data[0],
+								"SEEKING VIDEO",
+								50, 47, 1, 0, 0, 0);
+			
+			print_generic_text(	av->font[2], (uint32_t *) frame->data[0],
+								"PLEASE WAIT",
+								50, 53, 1, 0, 0, 0);
+		}
 
 		/* Print logo, if enabled */
 		if(av->s->conf.logo)
@@ -869,7 +1331,7 @@ static void *_audio_decode_thread(void *arg)
 	 *       they should probably be combined */
 	av_ffmpeg_t *av = (av_ffmpeg_t *) arg;
 	AVPacket pkt, *ppkt = NULL;
-	AVFrame *frame;
+	AVFrame *frame, *iframe;
 	int r;
 	
 	//fprintf(stderr, "_audio_decode_thread(): Starting\n");
@@ -916,8 +1378,15 @@ static void *_audio_decode_thread(void *arg)
 			}
 			
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&av->in_audio_buffer), frame);
-			_frame_dbuffer_ready(&av->in_audio_buffer, 0);
+			iframe = _frame_pool_get(&av->in_audio_pool);
+			if(iframe == NULL)
+			{
+				/* Thread is aborting */
+				break;
+			}
+			
+			av_frame_ref(iframe, frame);
+			_frame_pool_ready(&av->in_audio_pool, 0);
 		}
 		else if(r != AVERROR(EAGAIN))
 		{
@@ -926,7 +1395,7 @@ static void *_audio_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&av->in_audio_buffer);
+	_frame_pool_close(&av->in_audio_pool);
 	
 	av_frame_free(&frame);
 	
@@ -946,7 +1415,7 @@ static void *_audio_scaler_thread(void *arg)
 	//fprintf(stderr, "_audio_scaler_thread(): Starting\n");
 	
 	/* Fetch audio frames and pass them through the resampler */
-	while((frame = _frame_dbuffer_flip(&av->in_audio_buffer)) != NULL)
+	while((frame = _frame_pool_read(&av->in_audio_pool)) != NULL)
 	{
 		pts = frame->best_effort_timestamp;
 		drop = 0;
@@ -991,7 +1460,9 @@ static void *_audio_scaler_thread(void *arg)
 		
 		do
 		{
-			oframe = _frame_dbuffer_back_buffer(&av->out_audio_buffer);
+			oframe = _frame_pool_get(&av->out_audio_pool);
+			if(oframe == NULL) break;
+			
 			r = swr_convert(
 				av->swr_ctx,
 				oframe->data,
@@ -999,11 +1470,16 @@ static void *_audio_scaler_thread(void *arg)
 				count ? data : NULL,
 				count
 			);
-			if(r == 0) break;
+			if(r <= 0)
+			{
+				/* Nothing to queue, hand the frame back */
+				_frame_pool_release(&av->out_audio_pool);
+				break;
+			}
 			
 			oframe->nb_samples = r;
 			
-			_frame_dbuffer_ready(&av->out_audio_buffer, 0);
+			_frame_pool_ready(&av->out_audio_pool, 0);
 			
 			av->audio_start_time += count;
 			count = 0;
@@ -1013,7 +1489,7 @@ static void *_audio_scaler_thread(void *arg)
 		av_frame_unref(frame);
 	}
 	
-	_frame_dbuffer_abort(&av->out_audio_buffer);
+	_frame_pool_close(&av->out_audio_pool);
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Ending\n");
 	
@@ -1030,7 +1506,7 @@ static int16_t *_av_ffmpeg_read_audio(void *private, size_t *samples)
 		return(NULL);
 	}
 	
-	frame = _frame_dbuffer_flip(&av->out_audio_buffer);
+	frame = _frame_pool_read(&av->out_audio_pool);
 	if(!frame)
 	{
 		/* EOF or abort */
@@ -1068,18 +1544,14 @@ static int _av_ffmpeg_close(void *private)
 	
 	if(av->video_stream != NULL)
 	{
-		_frame_dbuffer_abort(&av->in_video_buffer);
-		_frame_dbuffer_abort(&av->out_video_buffer);
+		_frame_pool_abort(&av->in_video_pool);
+		_frame_pool_abort(&av->out_video_pool);
 		
 		pthread_join(av->video_decode_thread, NULL);
 		pthread_join(av->video_scaler_thread, NULL);
 		
-		_packet_queue_free(&av->video_queue);
-		_frame_dbuffer_free(&av->in_video_buffer);
-		
-		av_freep(&av->out_video_buffer.frame[0]->data[0]);
-		av_freep(&av->out_video_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&av->out_video_buffer);
+		_frame_pool_free(&av->in_video_pool);
+		_frame_pool_free(&av->out_video_pool);
 		
 		avcodec_free_context(&av->video_codec_ctx);
 		sws_freeContext(av->sws_ctx);
@@ -1087,23 +1559,29 @@ static int _av_ffmpeg_close(void *private)
 	
 	if(av->audio_stream != NULL)
 	{
-		_frame_dbuffer_abort(&av->in_audio_buffer);
-		_frame_dbuffer_abort(&av->out_audio_buffer);
+		_frame_pool_abort(&av->in_audio_pool);
+		_frame_pool_abort(&av->out_audio_pool);
 		
 		pthread_join(av->audio_decode_thread, NULL);
 		pthread_join(av->audio_scaler_thread, NULL);
 		
-		_packet_queue_free(&av->audio_queue);
-		_frame_dbuffer_free(&av->in_audio_buffer);
-		
-		//av_freep(&av->out_audio_buffer.frame[0]->data[0]);
-		//av_freep(&av->out_audio_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&av->out_audio_buffer);
+		_frame_pool_free(&av->in_audio_pool);
+		_frame_pool_free(&av->out_audio_pool);
 		
 		avcodec_free_context(&av->audio_codec_ctx);
 		swr_free(&av->swr_ctx);
 	}
 	
+	if(av->s->conf.verbose)
+	{
+		if(av->video_stream != NULL) _packet_queue_stats(&av->video_queue, "Video");
+		if(av->audio_stream != NULL) _packet_queue_stats(&av->audio_queue, "Audio");
+	}
+	
+	/* Each decoder can wake the other's queue, free them once both have stopped */
+	_packet_queue_free(&av->video_queue);
+	_packet_queue_free(&av->audio_queue);
+	
 	avformat_close_input(&av->format_ctx);
 	
 	free(av);
@@ -1111,12 +1589,273 @@ static int _av_ffmpeg_close(void *private)
 	return(HACKTV_OK);
 }
 
+static int _key_index_add(_key_index_t *idx, int64_t ts, int64_t pos)
+{
+	_key_index_entry_t *e;
+	
+	if(idx->length == idx->size)
+	{
+		e = realloc(idx->entries, sizeof(_key_index_entry_t) * (idx->size ? idx->size * 2 : 256));
+		if(e == NULL)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		idx->entries = e;
+		idx->size = idx->size ? idx->size * 2 : 256;
+	}
+	
+	idx->entries[idx->length].ts = ts;
+	idx->entries[idx->length].pos = pos;
+	idx->length++;
+	
+	return(HACKTV_OK);
+}
+
+static void _key_index_free(_key_index_t *idx)
+{
+	free(idx->entries);
+	memset(idx, 0, sizeof(_key_index_t));
+}
+
+/* Load the index from the sidecar if it matches the input file */
+static int _key_index_load(_key_index_t *idx, const char *path, const struct stat *fs, AVStream *stream)
+{
+	_key_index_header_t hdr;
+	FILE *f;
+	
+	f = fopen(path, "rb");
+	if(f == NULL)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	if(fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	   memcmp(hdr.magic, KEY_INDEX_MAGIC, 8) != 0 ||
+	   hdr.version != KEY_INDEX_VERSION ||
+	   hdr.stream != stream->index ||
+	   hdr.tb_num != stream->time_base.num ||
+	   hdr.tb_den != stream->time_base.den ||
+	   hdr.file_size != (uint64_t) fs->st_size ||
+	   hdr.mtime != (int64_t) fs->st_mtime ||
+	   hdr.length == 0 || hdr.length > INT_MAX)
+	{
+		/* Stale or not ours, build it again */
+		fclose(f);
+		return(HACKTV_ERROR);
+	}
+	
+	idx->entries = malloc(sizeof(_key_index_entry_t) * hdr.length);
+	if(idx->entries == NULL)
+	{
+		fclose(f);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	idx->length = idx->size = hdr.length;
+	
+	if(fread(idx->entries, sizeof(_key_index_entry_t), idx->length, f) != (size_t) idx->length)
+	{
+		_key_index_free(idx);
+		fclose(f);
+		return(HACKTV_ERROR);
+	}
+	
+	fclose(f);
+	
+	return(HACKTV_OK);
+}
+
+/* Write the index out, quietly giving up if the directory isn't writable */
+static void _key_index_save(const _key_index_t *idx, const char *path, const struct stat *fs, AVStream *stream)
+{
+	_key_index_header_t hdr;
+	char *tmp;
+	FILE *f;
+	
+	tmp = malloc(strlen(path) + 5);
+	if(tmp == NULL)
+	{
+		return;
+	}
+	
+	sprintf(tmp, "%s.tmp", path);
+	
+	f = fopen(tmp, "wb");
+	if(f == NULL)
+	{
+		free(tmp);
+		return;
+	}
+	
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, KEY_INDEX_MAGIC, 8);
+	hdr.version = KEY_INDEX_VERSION;
+	hdr.stream = stream->index;
+	hdr.tb_num = stream->time_base.num;
+	hdr.tb_den = stream->time_base.den;
+	hdr.file_size = fs->st_size;
+	hdr.mtime = fs->st_mtime;
+	hdr.length = idx->length;
+	
+	if(fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	   fwrite(idx->entries, sizeof(_key_index_entry_t), idx->length, f) != (size_t) idx->length ||
+	   fclose(f) != 0 ||
+	   rename(tmp, path) != 0)
+	{
+		unlink(tmp);
+	}
+	
+	free(tmp);
+}
+
+/* Read through the input without decoding anything, noting
+ * the timestamp and position of each video keyframe */
+static int _key_index_build(_key_index_t *idx, const char *url, av_ffmpeg_t *av, int64_t size)
+{
+	AVFormatContext *ctx = NULL;
+	AVPacket pkt;
+	int64_t ts, t, next;
+	int r;
+	
+	/* A second context leaves the main one where it is. The
+	 * format is already known so there is nothing to probe */
+	r = avformat_open_input(&ctx, url, av->format_ctx->iformat, NULL);
+	if(r < 0)
+	{
+		return(HACKTV_ERROR);
+	}
+	
+	fprintf(stderr, "Indexing keyframes...");
+	
+	t = av_gettime_relative();
+	next = t + 1000000;
+	
+	while((r = av_read_frame(ctx, &pkt)) >= 0)
+	{
+		/* Show how far through the file it is once a second */
+		if(pkt.pos >= 0 && size > 0 && av_gettime_relative() >= next)
+		{
+			fprintf(stderr, "\rIndexing keyframes... %d%%", (int) (pkt.pos * 100 / size));
+			next += 1000000;
+		}
+		
+		if(pkt.stream_index == av->video_stream->index && (pkt.flags & AV_PKT_FLAG_KEY))
+		{
+			ts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+			
+			/* Keep the list in order, skipping anything out of place */
+			if(ts != AV_NOPTS_VALUE && (idx->length == 0 || ts > idx->entries[idx->length - 1].ts))
+			{
+				r = _key_index_add(idx, ts, pkt.pos);
+			}
+		}
+		
+		av_packet_unref(&pkt);
+		
+		if(r < 0)
+		{
+			break;
+		}
+	}
+	
+	avformat_close_input(&ctx);
+	
+	if(r != AVERROR_EOF || idx->length == 0)
+	{
+		fprintf(stderr, "\rIndexing keyframes... failed\n");
+		_key_index_free(idx);
+		return(HACKTV_ERROR);
+	}
+	
+	fprintf(stderr, "\rIndexing keyframes... found %d in %.2f seconds\n", idx->length, (av_gettime_relative() - t) / 1e6);
+	
+	return(HACKTV_OK);
+}
+
+/* The last keyframe at or before ts, or NULL if there isn't one */
+static const _key_index_entry_t *_key_index_find(const _key_index_t *idx, int64_t ts)
+{
+	int a = 0, b = idx->length;
+	int m;
+	
+	while(a < b)
+	{
+		m = (a + b) / 2;
+		
+		if(idx->entries[m].ts <= ts) a = m + 1;
+		else b = m;
+	}
+	
+	return(a > 0 ? &idx->entries[a - 1] : NULL);
+}
+
+/* Seek to the last video keyframe before the target timestamp. The
+ * decoder drops the frames between it and the target */
+static int _seek_video(av_ffmpeg_t *av, const char *url, int64_t target, const char *cache)
+{
+	AVStream *st = av->video_stream;
+	const _key_index_entry_t *e;
+	_key_index_t idx;
+	struct stat fs;
+	char *path;
+	int r = -1;
+	
+	memset(&idx, 0, sizeof(_key_index_t));
+	
+	/* Use the demuxer's own index where it has one. Otherwise, with
+	 * --cache, index a local file once and keep it in the cache. The
+	 * scan reads the whole file, so it isn't done without one */
+	if(_INDEX_ENTRIES(st) == 0 && cache != NULL &&
+	   (av->format_ctx->pb != NULL && (av->format_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL)) &&
+	   stat(url, &fs) == 0 && S_ISREG(fs.st_mode) &&
+	   (path = cache_file_path(cache, url, KEY_INDEX_SUFFIX)) != NULL)
+	{
+		if(_key_index_load(&idx, path, &fs, st) == HACKTV_OK)
+		{
+			fprintf(stderr, "Loaded %d keyframes from '%s'\n", idx.length, path);
+		}
+		else if(_key_index_build(&idx, url, av, fs.st_size) == HACKTV_OK)
+		{
+			_key_index_save(&idx, path, &fs, st);
+		}
+		
+		free(path);
+	}
+	
+	e = _key_index_find(&idx, target);
+	if(e != NULL)
+	{
+		/* A byte seek lands exactly on the keyframe's packet, where
+		 * the demuxer's timestamp search would only get close */
+		if(e->pos >= 0 && !(av->format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+		{
+			r = av_seek_frame(av->format_ctx, st->index, e->pos, AVSEEK_FLAG_BYTE);
+		}
+		
+		if(r < 0)
+		{
+			r = av_seek_frame(av->format_ctx, st->index, e->ts, AVSEEK_FLAG_BACKWARD);
+		}
+	}
+	
+	_key_index_free(&idx);
+	
+	if(r < 0)
+	{
+		r = av_seek_frame(av->format_ctx, st->index, target, AVSEEK_FLAG_BACKWARD);
+	}
+	
+	return(r < 0 ? HACKTV_ERROR : HACKTV_OK);
+}
+
 int av_ffmpeg_open(vid_t *s, char *input_url)
 {
 	av_ffmpeg_t *av;
 	AVCodec *codec;
 	AVRational time_base;
 	int64_t start_time = 0;
+	int depth;
 	int r;
 	int i;
 	
@@ -1346,15 +2085,36 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 		
 		/* Video filter ends here */
 		
+		/* Find the scaling algorithm, bicubic by default */
+		av->sws_flags = SWS_BICUBIC;
+		
+		if(s->conf.scaler != NULL)
+		{
+			for(i = 0; _scalers[i].id != NULL; i++)
+			{
+				if(strcmp(_scalers[i].id, s->conf.scaler) == 0) break;
+			}
+			
+			if(_scalers[i].id == NULL)
+			{
+				fprintf(stderr, "Unrecognised scaler '%s'.\n", s->conf.scaler);
+				return(HACKTV_ERROR);
+			}
+			
+			av->sws_flags = _scalers[i].flags;
+		}
+		
 		/* Initialise SWS context for software scaling */
+		av->pix_fmt = s->conf.yuv ? AV_PIX_FMT_YUV422P : AV_PIX_FMT_RGB32;
+		
 		av->sws_ctx = sws_getContext(
 			av->video_codec_ctx->width,
 			av->video_codec_ctx->height,
 			av->video_codec_ctx->pix_fmt,
 			s->active_width,
 			s->conf.active_lines,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
+			av->pix_fmt,
+			av->sws_flags,
 			NULL,
 			NULL,
 			NULL
@@ -1365,6 +2125,8 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 			return(HACKTV_OUT_OF_MEMORY);
 		}
 		
+		_sws_output_range(av, av->sws_ctx);
+		
 		av->video_eof = 0;
 	}
 	else
@@ -1609,7 +2371,14 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 		if (s->conf.position > 0) 
 		{
 			av->video_start_time = av_rescale_q(request_timestamp, time_base, av->video_time_base);
-			av_seek_frame(av->format_ctx, av->video_stream->index, request_timestamp, 0);
+			av->seek_frame = av->video_start_time;
+			av->seek_start = av_gettime_relative();
+			av->seeking = 1;
+			
+			if(_seek_video(av, input_url, request_timestamp, s->conf.cache) != HACKTV_OK)
+			{
+				fprintf(stderr, "Seeking to %d minutes failed\n", s->conf.position);
+			}
 		}
 		else
 		{
@@ -1655,33 +2424,39 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 	/* Register the callback functions */
 	av->s = s;
 	s->av_private = av;
+	s->framebuffer_yuv = av->video_stream != NULL && s->conf.yuv;
 	s->av_read_video = _av_ffmpeg_read_video;
 	s->av_read_audio = _av_ffmpeg_read_audio;
 	s->av_eof = _av_ffmpeg_eof;
 	s->av_close = _av_ffmpeg_close;
 	
+	/* Frames buffered between each thread */
+	depth = s->conf.frame_pool > 0 ? s->conf.frame_pool : FRAME_POOL_DEPTH;
+	
 	/* Start the threads */
 	av->thread_abort = 0;
-	_packet_queue_init(&av->video_queue);
-	_packet_queue_init(&av->audio_queue);
+	_packet_queue_init(&av->video_queue, av->video_stream, VIDEO_QUEUE_DURATION);
+	_packet_queue_init(&av->audio_queue, av->audio_stream, AUDIO_QUEUE_DURATION);
+	av->video_queue.peer = &av->audio_queue;
+	av->audio_queue.peer = &av->video_queue;
 	
 	if(av->video_stream != NULL)
 	{
-		_frame_dbuffer_init(&av->in_video_buffer);
-		_frame_dbuffer_init(&av->out_video_buffer);
+		if(_frame_pool_init(&av->in_video_pool, depth) != 0 ||
+		   _frame_pool_init(&av->out_video_pool, depth) != 0)
+		{
+			fprintf(stderr, "Error allocating the video frame pools\n");
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Allocate memory for the output frame buffers */
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < av->out_video_pool.depth; i++)
 		{
-			av->out_video_buffer.frame[i]->width = s->active_width;
-			av->out_video_buffer.frame[i]->height = s->conf.active_lines;
-			
-			r = av_image_alloc(
-				av->out_video_buffer.frame[i]->data,
-				av->out_video_buffer.frame[i]->linesize,
-				s->active_width, s->conf.active_lines,
-				AV_PIX_FMT_RGB32, 1
-			);
+			if(_alloc_video_frame(av->out_video_pool.frame[i], av->pix_fmt, s->active_width, s->conf.active_lines) < 0)
+			{
+				fprintf(stderr, "Error allocating the video frame buffers\n");
+				return(HACKTV_OUT_OF_MEMORY);
+			}
 		}
 		
 		r = pthread_create(&av->video_decode_thread, NULL, &_video_decode_thread, (void *) av);
@@ -1700,8 +2475,12 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 	
 	if(av->audio_stream != NULL)
 	{
-		_frame_dbuffer_init(&av->in_audio_buffer);
-		_frame_dbuffer_init(&av->out_audio_buffer);
+		if(_frame_pool_init(&av->in_audio_pool, depth) != 0 ||
+		   _frame_pool_init(&av->out_audio_pool, depth) != 0)
+		{
+			fprintf(stderr, "Error allocating the audio frame pools\n");
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Calculate the number of samples needed for output */
 		av->out_frame_size = av_rescale_rnd(
@@ -1719,14 +2498,14 @@ int av_ffmpeg_open(vid_t *s, char *input_url)
 		/* Calculate the allowed error in input samples, +/- 20ms */
 		av->allowed_error = av_rescale_q(AV_TIME_BASE * 0.020, AV_TIME_BASE_Q, av->audio_time_base);
 		
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < av->out_audio_pool.depth; i++)
 		{
-			av->out_audio_buffer.frame[i]->format = AV_SAMPLE_FMT_S16;
-			av->out_audio_buffer.frame[i]->channel_layout = AV_CH_LAYOUT_STEREO;
-			av->out_audio_buffer.frame[i]->sample_rate = HACKTV_AUDIO_SAMPLE_RATE;
-			av->out_audio_buffer.frame[i]->nb_samples = av->out_frame_size;
+			av->out_audio_pool.frame[i]->format = AV_SAMPLE_FMT_S16;
+			av->out_audio_pool.frame[i]->channel_layout = AV_CH_LAYOUT_STEREO;
+			av->out_audio_pool.frame[i]->sample_rate = HACKTV_AUDIO_SAMPLE_RATE;
+			av->out_audio_pool.frame[i]->nb_samples = av->out_frame_size;
 			
-			r = av_frame_get_buffer(av->out_audio_buffer.frame[i], 0);
+			r = av_frame_get_buffer(av->out_audio_pool.frame[i], 0);
 			if(r < 0)
 			{
 				fprintf(stderr, "Error allocating output audio buffer %d\n", i);
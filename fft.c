@@ -0,0 +1,131 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "fft.h"
+
+int fft_init(fft_t *s, int n)
+{
+	int i, j, b;
+	
+	memset(s, 0, sizeof(fft_t));
+	
+	/* The length must be a power of two */
+	if(n < 2 || (n & (n - 1)) != 0)
+	{
+		return(-1);
+	}
+	
+	for(s->bits = 0; (1 << s->bits) < n; s->bits++);
+	s->n = n;
+	
+	s->rev = malloc(sizeof(int) * n);
+	s->tw = malloc(sizeof(double) * n);
+	if(!s->rev || !s->tw)
+	{
+		fft_free(s);
+		return(-1);
+	}
+	
+	for(i = 0; i < n; i++)
+	{
+		for(j = 0, b = 0; b < s->bits; b++)
+		{
+			j |= ((i >> b) & 1) << (s->bits - 1 - b);
+		}
+		
+		s->rev[i] = j;
+	}
+	
+	for(i = 0; i < n / 2; i++)
+	{
+		s->tw[i * 2 + 0] = cos(2.0 * M_PI * i / n);
+		s->tw[i * 2 + 1] = -sin(2.0 * M_PI * i / n);
+	}
+	
+	return(0);
+}
+
+void fft_free(fft_t *s)
+{
+	free(s->rev);
+	free(s->tw);
+	memset(s, 0, sizeof(fft_t));
+}
+
+static void _fft(const fft_t *s, double *x, double sign)
+{
+	int i, j, k, m, h, step;
+	double wr, wi, tr, ti;
+	double *a, *b;
+	
+	/* Reorder the input */
+	for(i = 0; i < s->n; i++)
+	{
+		j = s->rev[i];
+		
+		if(j > i)
+		{
+			tr = x[i * 2 + 0];
+			ti = x[i * 2 + 1];
+			x[i * 2 + 0] = x[j * 2 + 0];
+			x[i * 2 + 1] = x[j * 2 + 1];
+			x[j * 2 + 0] = tr;
+			x[j * 2 + 1] = ti;
+		}
+	}
+	
+	/* Butterflies, doubling in size each pass */
+	for(m = 2; m <= s->n; m <<= 1)
+	{
+		h = m / 2;
+		step = s->n / m;
+		
+		for(k = 0; k < s->n; k += m)
+		{
+			for(j = 0; j < h; j++)
+			{
+				wr = s->tw[j * step * 2 + 0];
+				wi = s->tw[j * step * 2 + 1] * sign;
+				
+				a = &x[(k + j) * 2];
+				b = &x[(k + j + h) * 2];
+				
+				tr = b[0] * wr - b[1] * wi;
+				ti = b[0] * wi + b[1] * wr;
+				
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+void fft_forward(const fft_t *s, double *x)
+{
+	_fft(s, x, 1.0);
+}
+
+void fft_inverse(const fft_t *s, double *x)
+{
+	_fft(s, x, -1.0);
+}
+
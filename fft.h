@@ -0,0 +1,47 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _FFT_H
+#define _FFT_H
+
+/* A simple radix-2 complex FFT. Data is stored as interleaved real and
+ * imaginary doubles, transformed in place. */
+
+typedef struct {
+	
+	int n;
+	int bits;
+	
+	/* Bit reversed index of each position */
+	int *rev;
+	
+	/* Twiddle factors, n / 2 complex values */
+	double *tw;
+	
+} fft_t;
+
+extern int fft_init(fft_t *s, int n);
+extern void fft_free(fft_t *s);
+
+/* Forward transform */
+extern void fft_forward(const fft_t *s, double *x);
+
+/* Inverse transform. The result is not scaled by 1 / n */
+extern void fft_inverse(const fft_t *s, double *x);
+
+#endif
+
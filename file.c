@@ -15,281 +15,431 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+/* File sink. Samples are converted into large aligned buffers which are
+ * handed to a writer thread, so the conversion and the disk writes
+ * overlap. With O_DIRECT the writes bypass the page cache.
+ * 
+ * The samples can be written raw, as a SigMF recording (raw data plus a
+ * JSON metadata file), or as a WAV file. WAV files switch to RF64 once
+ * they grow past 4 GiB. */
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include "hacktv.h"
+#include "file.h"
+#include "convert.h"
+
+/* Size and number of the write buffers */
+#define FILE_BUFFER_SIZE (4 << 20)
+#define FILE_BUFFERS     4
+
+/* Buffer alignment, enough for O_DIRECT */
+#define FILE_ALIGN 4096
+
+/* Length of the WAV header */
+#define WAV_HEADER_MAX 80
+
+/* WAV format codes */
+#define WAVE_FORMAT_PCM        1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SIGMF_ENDIAN "_be"
+#else
+#define SIGMF_ENDIAN "_le"
+#endif
 
-/* File sink */
 typedef struct {
-	FILE *f;
-	void *data;
-	size_t data_size;
-	size_t samples;
-	int complex;
-	int type;
+	
+	int fd;
+	int direct;
+	
+	/* Sample converter */
+	convert_t conv;
+	
+	/* Input values per sample, 2 for complex */
+	int values;
+	
+	/* Container format and the length of its header */
+	int container;
+	size_t header;
+	int sample_rate;
+	
+	/* Write buffers. The producer fills buffer in, the writer
+	 * thread writes out the queued buffers from out onwards */
+	uint8_t *buffers[FILE_BUFFERS];
+	size_t length[FILE_BUFFERS];
+	size_t offset;
+	int in;
+	int out;
+	int queued;
+	
+	/* Writer thread */
+	pthread_t thread;
+	int thread_started;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	int error;
+	
+	/* Statistics */
+	uint64_t bytes;
+	double busy;
+	struct timespec start;
+	
+	/* Samples written, for the latency tracking */
+	latency_t *latency;
+	uint64_t samples;
+	
 } rf_file_t;
 
-static int _rf_file_write_uint8_real(void *private, int16_t *iq_data, size_t samples)
+static uint8_t *_put_le(uint8_t *p, uint64_t v, int bytes)
 {
-	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
-	
-	while(samples)
+	for(; bytes; bytes--, v >>= 8)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i] = (iq_data[0] - INT16_MIN) >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		*(p++) = v & 0xFF;
 	}
 	
-	return(HACKTV_OK);
+	return(p);
 }
 
-static int _rf_file_write_int8_real(void *private, int16_t *iq_data, size_t samples)
+/* Build a WAV header for data_size bytes of samples, or UINT64_MAX if
+ * the length is not known yet. A JUNK chunk reserves space for the ds64
+ * chunk, which replaces it if the file turns out to need RF64. The
+ * header is always 80 bytes, a whole number of samples of any type,
+ * so no sample is split at the end of a write buffer */
+static size_t _wav_header(rf_file_t *rf, uint8_t *h, uint64_t data_size)
 {
-	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
-	
-	while(samples)
-	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i] = iq_data[0] >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
-	}
-	
-	return(HACKTV_OK);
+	int fl = rf->conv.type == HACKTV_FLOAT;
+	int block = rf->conv.size * rf->values;
+	size_t header = 12 + 36 + 24 + 8;
+	uint64_t riff = data_size + header - 8;
+	int unknown = data_size == UINT64_MAX;
+	int rf64 = !unknown && riff > UINT32_MAX;
+	uint8_t *p = h;
+	
+	p = _put_le(p, rf64 ? 0x34364652 : 0x46464952, 4);	/* "RF64" / "RIFF" */
+	p = _put_le(p, rf64 || unknown ? UINT32_MAX : riff, 4);
+	p = _put_le(p, 0x45564157, 4);				/* "WAVE" */
+	
+	p = _put_le(p, rf64 ? 0x34367364 : 0x4B4E554A, 4);	/* "ds64" / "JUNK" */
+	p = _put_le(p, 28, 4);
+	p = _put_le(p, rf64 ? riff : 0, 8);
+	p = _put_le(p, rf64 ? data_size : 0, 8);
+	p = _put_le(p, rf64 ? data_size / block : 0, 8);
+	p = _put_le(p, 0, 4);
+	
+	p = _put_le(p, 0x20746D66, 4);				/* "fmt " */
+	p = _put_le(p, 16, 4);
+	p = _put_le(p, fl ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM, 2);
+	p = _put_le(p, rf->values, 2);
+	p = _put_le(p, rf->sample_rate, 4);
+	p = _put_le(p, (uint64_t) rf->sample_rate * block, 4);
+	p = _put_le(p, block, 2);
+	p = _put_le(p, rf->conv.size * 8, 2);
+	
+	p = _put_le(p, 0x61746164, 4);				/* "data" */
+	p = _put_le(p, rf64 || unknown ? UINT32_MAX : data_size, 4);
+	
+	return(p - h);
 }
 
-static int _rf_file_write_uint16_real(void *private, int16_t *iq_data, size_t samples)
+/* Write the SigMF metadata file describing the recording */
+static int _sigmf_meta(hacktv_t *s, rf_file_t *rf, const char *filename)
 {
-	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	static const char *types[] = { "u8", "i8", "u16" SIGMF_ENDIAN, "i16" SIGMF_ENDIAN, "i32" SIGMF_ENDIAN, "f32" SIGMF_ENDIAN };
+	char datetime[32];
+	time_t now;
+	FILE *f;
 	
-	while(samples)
+	f = fopen(filename, "w");
+	if(!f)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u16[i] = (iq_data[0] - INT16_MIN);
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		perror(filename);
+		return(HACKTV_ERROR);
 	}
 	
-	return(HACKTV_OK);
-}
-
-static int _rf_file_write_int16_real(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	int16_t *i16 = rf->data;
-	int i;
-	
-	while(samples)
+	now = time(NULL);
+	strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	
+	fprintf(f,
+		"{\n"
+		"    \"global\": {\n"
+		"        \"core:datatype\": \"%c%s\",\n"
+		"        \"core:sample_rate\": %d,\n"
+		"        \"core:version\": \"1.0.0\",\n"
+		"        \"core:recorder\": \"hacktv\",\n"
+		"        \"core:description\": \"hacktv %s mode\"\n"
+		"    },\n"
+		"    \"captures\": [\n"
+		"        {\n"
+		"            \"core:sample_start\": 0,\n",
+		rf->values == 2 ? 'c' : 'r', types[rf->conv.type],
+		rf->sample_rate,
+		s->mode
+	);
+	
+	if(s->frequency != 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i16[i] = iq_data[0];
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		fprintf(f, "            \"core:frequency\": %llu,\n", (unsigned long long) s->frequency);
 	}
 	
-	return(HACKTV_OK);
-}
-
-static int _rf_file_write_int32_real(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	fprintf(f,
+		"            \"core:datetime\": \"%s\"\n"
+		"        }\n"
+		"    ],\n"
+		"    \"annotations\": []\n"
+		"}\n",
+		datetime
+	);
 	
-	while(samples)
+	if(fclose(f) != 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i32[i] = (iq_data[0] << 16) + iq_data[0];
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		perror(filename);
+		return(HACKTV_ERROR);
 	}
 	
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_float_real(void *private, int16_t *iq_data, size_t samples)
+static double _elapsed(const struct timespec *a, const struct timespec *b)
 {
-	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	return((b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9);
+}
+
+static int _write_all(rf_file_t *rf, const uint8_t *data, size_t length)
+{
+	ssize_t r;
+	
+	/* O_DIRECT needs whole blocks, write a short final buffer without it */
+	if(rf->direct && length % FILE_ALIGN != 0)
+	{
+		fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+		rf->direct = 0;
+	}
 	
-	while(samples)
+	while(length)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		r = write(rf->fd, data, length);
+		
+		if(r < 0)
 		{
-			f32[i] = (float) iq_data[0] * (1.0 / 32767.0);
+			if(errno == EINTR) continue;
+			perror("write");
+			return(-1);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		data += r;
+		length -= r;
 		
-		samples -= i;
+		/* A short write leaves the file offset unaligned, so
+		 * O_DIRECT can't be used for the rest of the output */
+		if(rf->direct && length)
+		{
+			fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+			rf->direct = 0;
+		}
 	}
 	
-	return(HACKTV_OK);
+	return(0);
 }
 
-static int _rf_file_write_uint8_complex(void *private, int16_t *iq_data, size_t samples)
+static void *_writer_thread(void *arg)
 {
-	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	rf_file_t *rf = arg;
+	struct timespec t0, t1;
+	uint64_t n;
+	int i, r;
+	
+	pthread_mutex_lock(&rf->mutex);
 	
-	while(samples)
+	while(1)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		while(rf->queued == 0 && !rf->quit)
 		{
-			u8[i * 2 + 0] = (iq_data[0] - INT16_MIN) >> 8;
-			u8[i * 2 + 1] = (iq_data[1] - INT16_MIN) >> 8;
+			pthread_cond_wait(&rf->cond, &rf->mutex);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(rf->queued == 0)
+		{
+			break;
+		}
 		
-		samples -= i;
-	}
-	
-	return(HACKTV_OK);
-}
-
-static int _rf_file_write_int8_complex(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
-	
-	while(samples)
-	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		i = rf->out;
+		pthread_mutex_unlock(&rf->mutex);
+		
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		r = _write_all(rf, rf->buffers[i], rf->length[i]);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		
+		pthread_mutex_lock(&rf->mutex);
+		
+		rf->busy += _elapsed(&t0, &t1);
+		rf->bytes += rf->length[i];
+		
+		n = (rf->bytes - rf->header) / (rf->conv.size * rf->values);
+		latency_consume(rf->latency, n - rf->samples);
+		rf->samples = n;
+		
+		rf->out = (rf->out + 1) % FILE_BUFFERS;
+		rf->queued--;
+		
+		if(r != 0)
 		{
-			i8[i * 2 + 0] = iq_data[0] >> 8;
-			i8[i * 2 + 1] = iq_data[1] >> 8;
+			rf->error = 1;
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		pthread_cond_signal(&rf->cond);
 		
-		samples -= i;
+		if(rf->error)
+		{
+			break;
+		}
 	}
 	
-	return(HACKTV_OK);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	return(NULL);
 }
 
-static int _rf_file_write_uint16_complex(void *private, int16_t *iq_data, size_t samples)
+/* Queue the current buffer for writing and wait for the next one */
+static int _queue_buffer(rf_file_t *rf)
 {
-	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	int r;
+	
+	pthread_mutex_lock(&rf->mutex);
+	
+	rf->length[rf->in] = rf->offset;
+	rf->queued++;
+	pthread_cond_signal(&rf->cond);
 	
-	while(samples)
+	while(rf->queued == FILE_BUFFERS && !rf->error)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u16[i * 2 + 0] = (iq_data[0] - INT16_MIN);
-			u16[i * 2 + 1] = (iq_data[1] - INT16_MIN);
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		pthread_cond_wait(&rf->cond, &rf->mutex);
 	}
 	
-	return(HACKTV_OK);
-}
-
-static int _rf_file_write_int16_complex(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
+	rf->in = (rf->in + 1) % FILE_BUFFERS;
+	rf->offset = 0;
+	r = rf->error;
 	
-	fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f);
+	pthread_mutex_unlock(&rf->mutex);
 	
-	return(HACKTV_OK);
+	return(r ? HACKTV_ERROR : HACKTV_OK);
 }
 
-static int _rf_file_write_int32_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write(void *private, int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	size_t l, n;
+	
+	/* Number of output values */
+	n = samples * rf->values;
 	
-	while(samples)
+	while(n)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i32[i * 2 + 0] = (iq_data[0] << 16) + iq_data[0];
-			i32[i * 2 + 1] = (iq_data[1] << 16) + iq_data[1];
-		}
+		l = (FILE_BUFFER_SIZE - rf->offset) / rf->conv.size;
+		if(l > n) l = n;
+		
+		convert(&rf->conv, rf->buffers[rf->in] + rf->offset, iq_data, l);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		rf->offset += l * rf->conv.size;
+		iq_data += l * rf->conv.istep;
+		n -= l;
 		
-		samples -= i;
+		if(rf->offset == FILE_BUFFER_SIZE)
+		{
+			if(_queue_buffer(rf) != HACKTV_OK)
+			{
+				return(HACKTV_ERROR);
+			}
+		}
 	}
 	
 	return(HACKTV_OK);
 }
 
-static int _rf_file_write_float_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_close(void *private)
 {
 	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	struct timespec end;
+	double t;
+	int i, r = HACKTV_OK;
 	
-	while(samples)
+	if(rf->thread_started)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		/* Write out anything left in the current buffer */
+		if(rf->offset > 0)
 		{
-			f32[i * 2 + 0] = (float) iq_data[0] * (1.0 / 32767.0);
-			f32[i * 2 + 1] = (float) iq_data[1] * (1.0 / 32767.0);
+			r = _queue_buffer(rf);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		pthread_mutex_lock(&rf->mutex);
+		rf->quit = 1;
+		pthread_cond_signal(&rf->cond);
+		pthread_mutex_unlock(&rf->mutex);
+		
+		pthread_join(rf->thread, NULL);
+		
+		if(rf->error) r = HACKTV_ERROR;
+		
+		/* Fill in the final sizes, if the output can seek */
+		if(rf->container == RF_FILE_WAV && r == HACKTV_OK && rf->fd != STDOUT_FILENO)
+		{
+			uint8_t h[WAV_HEADER_MAX];
+			size_t l;
+			
+			if(rf->direct)
+			{
+				fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+			}
+			
+			l = _wav_header(rf, h, rf->bytes - rf->header);
+			if(pwrite(rf->fd, h, l, 0) != l)
+			{
+				perror("pwrite");
+				r = HACKTV_ERROR;
+			}
+		}
 		
-		samples -= i;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t = _elapsed(&rf->start, &end);
+		
+		fprintf(stderr, "file: Wrote %.1f MiB in %.1f seconds, %.1f MiB/s (%.1f MiB/s while writing)\n",
+			rf->bytes / 1048576.0, t,
+			t > 0 ? rf->bytes / 1048576.0 / t : 0,
+			rf->busy > 0 ? rf->bytes / 1048576.0 / rf->busy : 0
+		);
 	}
 	
-	return(HACKTV_OK);
-}
-
-static int _rf_file_close(void *private)
-{
-	rf_file_t *rf = private;
+	pthread_mutex_destroy(&rf->mutex);
+	pthread_cond_destroy(&rf->cond);
+	
+	if(rf->fd >= 0 && rf->fd != STDOUT_FILENO) close(rf->fd);
+	
+	for(i = 0; i < FILE_BUFFERS; i++)
+	{
+		free(rf->buffers[i]);
+	}
 	
-	if(rf->f && rf->f != stdout) fclose(rf->f);
-	if(rf->data) free(rf->data);
 	free(rf);
 	
-	return(HACKTV_OK);
+	return(r);
 }
 
-int rf_file_open(hacktv_t *s, char *filename, int type)
+int rf_file_open(hacktv_t *s, char *filename, int type, int container)
 {
 	rf_file_t *rf = calloc(1, sizeof(rf_file_t));
+	char *data_filename = NULL;
+	int complex;
+	int i, r;
 	
 	if(!rf)
 	{
@@ -297,8 +447,39 @@ int rf_file_open(hacktv_t *s, char *filename, int type)
 		return(HACKTV_ERROR);
 	}
 	
-	rf->complex = s->vid.conf.output_type == HACKTV_INT16_COMPLEX;
-	rf->type = type;
+	rf->fd = -1;
+	pthread_mutex_init(&rf->mutex, NULL);
+	pthread_cond_init(&rf->cond, NULL);
+	
+	complex = s->vid.conf.output_type == HACKTV_INT16_COMPLEX;
+	
+	/* Complex output takes every value, real output only the I samples */
+	if(convert_init(&rf->conv, type, complex ? 1 : 2, s->dither) != 0)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		_rf_file_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	rf->values = complex ? 2 : 1;
+	rf->container = container;
+	rf->sample_rate = s->vid.sample_rate;
+	rf->latency = s->latency;
+	
+	/* WAV has no signed 8-bit or unsigned 16-bit sample formats */
+	if(container == RF_FILE_WAV && (type == HACKTV_INT8 || type == HACKTV_UINT16))
+	{
+		fprintf(stderr, "WAV output supports uint8, int16, int32 and float types only.\n");
+		_rf_file_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	if(container == RF_FILE_SIGMF && filename != NULL && strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "SigMF output cannot be written to stdout.\n");
+		_rf_file_close(rf);
+		return(HACKTV_ERROR);
+	}
 	
 	if(filename == NULL)
 	{
@@ -308,67 +489,104 @@ int rf_file_open(hacktv_t *s, char *filename, int type)
 	}
 	else if(strcmp(filename, "-") == 0)
 	{
-		rf->f = stdout;
+		rf->fd = STDOUT_FILENO;
 	}
 	else
 	{
-		rf->f = fopen(filename, "wb");	
+		if(container == RF_FILE_SIGMF)
+		{
+			char *ext;
+			
+			/* Accept the recording name with or without an extension */
+			data_filename = malloc(strlen(filename) + 12);
+			if(!data_filename)
+			{
+				perror("malloc");
+				_rf_file_close(rf);
+				return(HACKTV_ERROR);
+			}
+			
+			strcpy(data_filename, filename);
+			
+			ext = strrchr(data_filename, '.');
+			if(ext && (strcmp(ext, ".sigmf-data") == 0 || strcmp(ext, ".sigmf-meta") == 0 || strcmp(ext, ".sigmf") == 0))
+			{
+				*ext = '\0';
+			}
+			
+			ext = data_filename + strlen(data_filename);
+			strcpy(ext, ".sigmf-meta");
+			
+			r = _sigmf_meta(s, rf, data_filename);
+			if(r != HACKTV_OK)
+			{
+				free(data_filename);
+				_rf_file_close(rf);
+				return(r);
+			}
+			
+			strcpy(ext, ".sigmf-data");
+			filename = data_filename;
+		}
+		
+		rf->direct = s->file_direct;
+		rf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | (rf->direct ? O_DIRECT : 0), 0666);
+		
+		if(rf->fd < 0 && rf->direct && errno == EINVAL)
+		{
+			/* Not every filesystem supports O_DIRECT */
+			fprintf(stderr, "%s: O_DIRECT is not supported here, using buffered writes\n", filename);
+			rf->direct = 0;
+			rf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		}
 		
-		if(!rf->f)
+		if(rf->fd < 0)
 		{
-			perror("fopen");
+			perror(filename);
+			free(data_filename);
 			_rf_file_close(rf);
 			return(HACKTV_ERROR);
 		}
+		
+		free(data_filename);
 	}
 	
-	/* Find the size of the output data type */
-	switch(type)
+	/* Allocate the write buffers */
+	for(i = 0; i < FILE_BUFFERS; i++)
 	{
-	case HACKTV_UINT8:  rf->data_size = sizeof(uint8_t);  break;
-	case HACKTV_INT8:   rf->data_size = sizeof(int8_t);   break;
-	case HACKTV_UINT16: rf->data_size = sizeof(uint16_t); break;
-	case HACKTV_INT16:  rf->data_size = sizeof(int16_t);  break;
-	case HACKTV_INT32:  rf->data_size = sizeof(int32_t);  break;
-	case HACKTV_FLOAT:  rf->data_size = sizeof(float);    break;
-	default:
-		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
-		_rf_file_close(rf);
-		return(HACKTV_ERROR);
+		rf->buffers[i] = aligned_alloc(FILE_ALIGN, FILE_BUFFER_SIZE);
+		if(!rf->buffers[i])
+		{
+			perror("aligned_alloc");
+			_rf_file_close(rf);
+			return(HACKTV_ERROR);
+		}
 	}
 	
-	/* Double the size for complex types */
-	if(rf->complex) rf->data_size *= 2;
+	if(container == RF_FILE_WAV)
+	{
+		/* Start the first buffer with a header of unknown length,
+		 * the sizes are filled in when the file is closed */
+		rf->header = _wav_header(rf, rf->buffers[0], UINT64_MAX);
+		rf->offset = rf->header;
+	}
 	
-	/* Allocate enough memory for one TV line */
-	rf->samples = s->vid.width;
+	clock_gettime(CLOCK_MONOTONIC, &rf->start);
 	
-	/* Allocate the memory, unless the output is int16 complex */
-	if(rf->type != HACKTV_INT16 || !rf->complex)
+	if(pthread_create(&rf->thread, NULL, _writer_thread, rf) != 0)
 	{
-		rf->data = malloc(rf->data_size * rf->samples);
-		if(!rf->data)
-		{
-			perror("malloc");
-			_rf_file_close(rf);
-			return(HACKTV_ERROR);
-		}
+		perror("pthread_create");
+		_rf_file_close(rf);
+		return(HACKTV_ERROR);
 	}
 	
+	rf->thread_started = 1;
+	
 	/* Register the callback functions */
 	s->rf_private = rf;
+	s->rf_write = _rf_file_write;
 	s->rf_close = _rf_file_close;
 	
-	switch(type)
-	{
-	case HACKTV_UINT8:  s->rf_write = rf->complex ? _rf_file_write_uint8_complex  : _rf_file_write_uint8_real;  break;
-	case HACKTV_INT8:   s->rf_write = rf->complex ? _rf_file_write_int8_complex   : _rf_file_write_int8_real;   break;
-	case HACKTV_UINT16: s->rf_write = rf->complex ? _rf_file_write_uint16_complex : _rf_file_write_uint16_real; break;
-	case HACKTV_INT16:  s->rf_write = rf->complex ? _rf_file_write_int16_complex  : _rf_file_write_int16_real;  break;
-	case HACKTV_INT32:  s->rf_write = rf->complex ? _rf_file_write_int32_complex  : _rf_file_write_int32_real;  break;
-	case HACKTV_FLOAT:  s->rf_write = rf->complex ? _rf_file_write_float_complex  : _rf_file_write_float_real;  break;
-	}
-	
 	return(HACKTV_OK);
 }
 
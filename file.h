@@ -18,7 +18,12 @@
 #ifndef _FILE_H
 #define _FILE_H
 
-extern int rf_file_open(hacktv_t *s, char *filename, int type);
+/* Container formats */
+#define RF_FILE_RAW   0
+#define RF_FILE_SIGMF 1
+#define RF_FILE_WAV   2
+
+extern int rf_file_open(hacktv_t *s, char *filename, int type, int container);
 
 #endif
 
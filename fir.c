@@ -21,6 +21,13 @@
 #include <math.h>
 #include "fir.h"
 #include "common.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 
@@ -198,6 +205,588 @@ void fir_complex_band_pass(double *taps, size_t ntaps, double sample_rate, doubl
 
 
 
+/* Dot product kernels */
+
+
+
+/* The vector versions accumulate in the same width
+ * as the scalar loops they replace and wrap identically on overflow, so
+ * the results are exactly the same whichever one is selected. */
+
+typedef int32_t (*_dot_int16_t)(const int16_t *a, const int16_t *b, int n);
+typedef int64_t (*_dot_int32_t)(const int32_t *a, const int32_t *b, int n);
+typedef void (*_dot2_int16_t)(int32_t *ra, int32_t *rb, const int16_t *w, const int16_t *a, const int16_t *b, int n);
+typedef void (*_mac8_int16_t)(int32_t *acc, const int16_t *taps, const int16_t *w, int pairs);
+
+/* Sum of a[i] * b[i] */
+static int32_t _dot_int16_scalar(const int16_t *a, const int16_t *b, int n)
+{
+	uint32_t r;
+	int i;
+	
+	for(r = i = 0; i < n; i++)
+	{
+		r += (int32_t) a[i] * b[i];
+	}
+	
+	return((int32_t) r);
+}
+
+static int64_t _dot_int32_scalar(const int32_t *a, const int32_t *b, int n)
+{
+	int64_t r;
+	int i;
+	
+	for(r = i = 0; i < n; i++)
+	{
+		r += (int64_t) a[i] * (int64_t) b[i];
+	}
+	
+	return(r);
+}
+
+/* Sums of w[i] * a[i] and w[i] * b[i], for the I and Q taps of a
+ * complex filter sharing the one window */
+static void _dot2_int16_scalar(int32_t *ra, int32_t *rb, const int16_t *w, const int16_t *a, const int16_t *b, int n)
+{
+	*ra = _dot_int16_scalar(w, a, n);
+	*rb = _dot_int16_scalar(w, b, n);
+}
+
+static void _mac8_int16_scalar(int32_t *acc, const int16_t *taps, const int16_t *w, int pairs)
+{
+	uint32_t r[8] = { 0 };
+	int j, l;
+	
+	for(j = 0; j < pairs; j++, taps += 16)
+	{
+		for(l = 0; l < 8; l++)
+		{
+			r[l] += (uint32_t) ((int32_t) taps[l * 2 + 0] * w[j * 2 + 0])
+			      + (uint32_t) ((int32_t) taps[l * 2 + 1] * w[j * 2 + 1]);
+		}
+	}
+	
+	for(l = 0; l < 8; l++)
+	{
+		acc[l] = (int32_t) r[l];
+	}
+}
+
+#if defined(CPU_X86)
+
+__attribute__((target("sse2")))
+static int32_t _hsum_epi32_sse2(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return(_mm_cvtsi128_si32(v));
+}
+
+__attribute__((target("sse2")))
+static void _dot2_int16_sse2(int32_t *ra, int32_t *rb, const int16_t *w, const int16_t *a, const int16_t *b, int n)
+{
+	__m128i acca = _mm_setzero_si128();
+	__m128i accb = _mm_setzero_si128();
+	__m128i x;
+	uint32_t sa, sb;
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		x = _mm_loadu_si128((const __m128i *) &w[i]);
+		acca = _mm_add_epi32(acca, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i *) &a[i])));
+		accb = _mm_add_epi32(accb, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i *) &b[i])));
+	}
+	
+	for(sa = _hsum_epi32_sse2(acca), sb = _hsum_epi32_sse2(accb); i < n; i++)
+	{
+		sa += (int32_t) w[i] * a[i];
+		sb += (int32_t) w[i] * b[i];
+	}
+	
+	*ra = (int32_t) sa;
+	*rb = (int32_t) sb;
+}
+
+__attribute__((target("sse4.1")))
+static int64_t _dot_int32_sse41(const int32_t *a, const int32_t *b, int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	__m128i va, vb;
+	int64_t r[2];
+	int i;
+	
+	for(i = 0; i + 4 <= n; i += 4)
+	{
+		va = _mm_loadu_si128((const __m128i *) &a[i]);
+		vb = _mm_loadu_si128((const __m128i *) &b[i]);
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(va, vb));
+		acc = _mm_add_epi64(acc, _mm_mul_epi32(_mm_srli_epi64(va, 32), _mm_srli_epi64(vb, 32)));
+	}
+	
+	_mm_storeu_si128((__m128i *) r, acc);
+	
+	return(r[0] + r[1] + _dot_int32_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static void _dot2_int16_avx2(int32_t *ra, int32_t *rb, const int16_t *w, const int16_t *a, const int16_t *b, int n)
+{
+	__m256i acca = _mm256_setzero_si256();
+	__m256i accb = _mm256_setzero_si256();
+	__m256i x;
+	__m128i v, y;
+	uint32_t sa, sb;
+	int i;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		x = _mm256_loadu_si256((const __m256i *) &w[i]);
+		acca = _mm256_add_epi32(acca, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i *) &a[i])));
+		accb = _mm256_add_epi32(accb, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i *) &b[i])));
+	}
+	
+	/* Reduce both together, the a sums in lanes 0-1 and b in 2-3 */
+	x = _mm256_hadd_epi32(acca, accb);
+	v = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+	
+	if(i + 8 <= n)
+	{
+		y = _mm_loadu_si128((const __m128i *) &w[i]);
+		v = _mm_add_epi32(v, _mm_hadd_epi32(
+			_mm_madd_epi16(y, _mm_loadu_si128((const __m128i *) &a[i])),
+			_mm_madd_epi16(y, _mm_loadu_si128((const __m128i *) &b[i]))
+		));
+		i += 8;
+	}
+	
+	v = _mm_hadd_epi32(v, v);
+	
+	for(sa = _mm_cvtsi128_si32(v), sb = _mm_extract_epi32(v, 1); i < n; i++)
+	{
+		sa += (int32_t) w[i] * a[i];
+		sb += (int32_t) w[i] * b[i];
+	}
+	
+	*ra = (int32_t) sa;
+	*rb = (int32_t) sb;
+}
+
+__attribute__((target("avx2")))
+static int64_t _dot_int32_avx2(const int32_t *a, const int32_t *b, int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m256i va, vb;
+	int64_t r[4];
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		va = _mm256_loadu_si256((const __m256i *) &a[i]);
+		vb = _mm256_loadu_si256((const __m256i *) &b[i]);
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(va, vb));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(va, 32), _mm256_srli_epi64(vb, 32)));
+	}
+	
+	_mm256_storeu_si256((__m256i *) r, acc);
+	_mm256_zeroupper();
+	
+	return(r[0] + r[1] + r[2] + r[3] + _dot_int32_sse41(a + i, b + i, n - i));
+}
+
+/* Eight sums of products for the wide interpolator. taps holds pairs
+ * of taps for each of the eight outputs, w the matching input pairs */
+__attribute__((target("sse2")))
+static void _mac8_int16_sse2(int32_t *acc, const int16_t *taps, const int16_t *w, int pairs)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+	__m128i vw;
+	int32_t p;
+	int j;
+	
+	for(j = 0; j < pairs; j++, taps += 16)
+	{
+		memcpy(&p, &w[j * 2], sizeof(int32_t));
+		vw = _mm_set1_epi32(p);
+		lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) &taps[0]), vw));
+		hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) &taps[8]), vw));
+	}
+	
+	_mm_storeu_si128((__m128i *) &acc[0], lo);
+	_mm_storeu_si128((__m128i *) &acc[4], hi);
+}
+
+__attribute__((target("avx2")))
+static void _mac8_int16_avx2(int32_t *acc, const int16_t *taps, const int16_t *w, int pairs)
+{
+	__m256i r = _mm256_setzero_si256();
+	int32_t p;
+	int j;
+	
+	for(j = 0; j < pairs; j++, taps += 16)
+	{
+		memcpy(&p, &w[j * 2], sizeof(int32_t));
+		r = _mm256_add_epi32(r, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *) taps),
+			_mm256_set1_epi32(p)
+		));
+	}
+	
+	_mm256_storeu_si256((__m256i *) acc, r);
+	_mm256_zeroupper();
+}
+
+#elif defined(CPU_ARM_NEON)
+
+static int32_t _dot_int16_neon(const int16_t *a, const int16_t *b, int n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int16x8_t va, vb;
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		va = vld1q_s16(&a[i]);
+		vb = vld1q_s16(&b[i]);
+		acc = vmlal_s16(acc, vget_low_s16(va), vget_low_s16(vb));
+		acc = vmlal_s16(acc, vget_high_s16(va), vget_high_s16(vb));
+	}
+	
+	return((int32_t) ((uint32_t) vaddvq_s32(acc) + (uint32_t) _dot_int16_scalar(a + i, b + i, n - i)));
+}
+
+static void _dot2_int16_neon(int32_t *ra, int32_t *rb, const int16_t *w, const int16_t *a, const int16_t *b, int n)
+{
+	int32x4_t acca = vdupq_n_s32(0);
+	int32x4_t accb = vdupq_n_s32(0);
+	int16x8_t vw, va, vb;
+	uint32_t sa, sb;
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		vw = vld1q_s16(&w[i]);
+		va = vld1q_s16(&a[i]);
+		vb = vld1q_s16(&b[i]);
+		acca = vmlal_s16(acca, vget_low_s16(vw), vget_low_s16(va));
+		acca = vmlal_s16(acca, vget_high_s16(vw), vget_high_s16(va));
+		accb = vmlal_s16(accb, vget_low_s16(vw), vget_low_s16(vb));
+		accb = vmlal_s16(accb, vget_high_s16(vw), vget_high_s16(vb));
+	}
+	
+	for(sa = vaddvq_s32(acca), sb = vaddvq_s32(accb); i < n; i++)
+	{
+		sa += (int32_t) w[i] * a[i];
+		sb += (int32_t) w[i] * b[i];
+	}
+	
+	*ra = (int32_t) sa;
+	*rb = (int32_t) sb;
+}
+
+static int64_t _dot_int32_neon(const int32_t *a, const int32_t *b, int n)
+{
+	int64x2_t acc = vdupq_n_s64(0);
+	int32x4_t va, vb;
+	int i;
+	
+	for(i = 0; i + 4 <= n; i += 4)
+	{
+		va = vld1q_s32(&a[i]);
+		vb = vld1q_s32(&b[i]);
+		acc = vmlal_s32(acc, vget_low_s32(va), vget_low_s32(vb));
+		acc = vmlal_s32(acc, vget_high_s32(va), vget_high_s32(vb));
+	}
+	
+	return(vaddvq_s64(acc) + _dot_int32_scalar(a + i, b + i, n - i));
+}
+
+static void _mac8_int16_neon(int32_t *acc, const int16_t *taps, const int16_t *w, int pairs)
+{
+	int32x4_t lo = vdupq_n_s32(0);
+	int32x4_t hi = vdupq_n_s32(0);
+	int16x4_t vw;
+	int16x8_t t;
+	int32_t p;
+	int j;
+	
+	for(j = 0; j < pairs; j++, taps += 16)
+	{
+		memcpy(&p, &w[j * 2], sizeof(int32_t));
+		vw = vreinterpret_s16_s32(vdup_n_s32(p));
+		
+		t = vld1q_s16(&taps[0]);
+		lo = vaddq_s32(lo, vpaddq_s32(vmull_s16(vget_low_s16(t), vw), vmull_s16(vget_high_s16(t), vw)));
+		t = vld1q_s16(&taps[8]);
+		hi = vaddq_s32(hi, vpaddq_s32(vmull_s16(vget_low_s16(t), vw), vmull_s16(vget_high_s16(t), vw)));
+	}
+	
+	vst1q_s32(&acc[0], lo);
+	vst1q_s32(&acc[4], hi);
+}
+
+#endif
+
+static _dot_int16_t _dot_int16 = _dot_int16_scalar;
+static _dot2_int16_t _dot2_int16 = _dot2_int16_scalar;
+static _dot_int32_t _dot_int32 = _dot_int32_scalar;
+static _mac8_int16_t _mac8_int16 = _mac8_int16_scalar;
+
+/* Select the kernels for this CPU. Called by the init functions, before
+ * any filter can be running on another thread */
+static void _init_kernels(void)
+{
+	int f = cpu_features();
+	
+#if defined(CPU_X86)
+	/* _dot_int16 stays scalar on x86. The compiler vectorises that
+	 * loop well at -O3, and it measured as fast or faster than the
+	 * kernels here. Computing I and Q together in one pass over the
+	 * window does still gain */
+	if(f & CPU_SSE2)
+	{
+		_dot2_int16 = _dot2_int16_sse2;
+		_mac8_int16 = _mac8_int16_sse2;
+	}
+	
+	if(f & CPU_SSE41)
+	{
+		_dot_int32 = _dot_int32_sse41;
+	}
+	
+	if(f & CPU_AVX2)
+	{
+		_dot2_int16 = _dot2_int16_avx2;
+		_dot_int32 = _dot_int32_avx2;
+		_mac8_int16 = _mac8_int16_avx2;
+	}
+#elif defined(CPU_ARM_NEON)
+	if(f & CPU_NEON)
+	{
+		_dot_int16 = _dot_int16_neon;
+		_dot2_int16 = _dot2_int16_neon;
+		_dot_int32 = _dot_int32_neon;
+		_mac8_int16 = _mac8_int16_neon;
+	}
+#endif
+}
+
+
+
+/* Fast convolution */
+
+
+
+/* Prepare the frequency response of a filter for overlap-save fast
+ * convolution. Any of the int16 filter types can use this, treating
+ * the taps and input as complex with a zero imaginary part where the
+ * type is real. Returns 0 without enabling it for short filters. */
+static int _init_fft(fir_int16_t *s)
+{
+	int i, k, n;
+	double re, im;
+	
+	memset(&s->fft, 0, sizeof(fft_t));
+	s->fresp = NULL;
+	s->fbuf = NULL;
+	
+	if(s->bwin == NULL || s->ataps < FIR_FFT_TAPS)
+	{
+		return(0);
+	}
+	
+	/* Transform length, at least four times the filter length */
+	for(n = 2; n < s->ataps * 4; n <<= 1);
+	
+	if(fft_init(&s->fft, n) != 0)
+	{
+		return(-1);
+	}
+	
+	s->fresp = calloc(n, sizeof(double) * 2);
+	s->fbuf = malloc(n * sizeof(double) * 2);
+	if(!s->fresp || !s->fbuf)
+	{
+		return(-1);
+	}
+	
+	/* The window is correlated with the taps, so reverse
+	 * them to make an ordinary convolution */
+	for(i = 0; i < s->ataps; i++)
+	{
+		k = s->ataps - 1 - i;
+		
+		if(s->type == 2)
+		{
+			re = s->itaps[i * 2 + 0];
+			im = s->qtaps[i * 2 + 0];
+		}
+		else
+		{
+			re = s->itaps[i];
+			im = s->type == 3 ? s->qtaps[i] : 0;
+		}
+		
+		/* Include the 1 / n scaling of the inverse transform */
+		s->fresp[k * 2 + 0] = re / n;
+		s->fresp[k * 2 + 1] = im / n;
+	}
+	
+	fft_forward(&s->fft, s->fresp);
+	
+	return(0);
+}
+
+/* Calculate n outputs from the window win. n must not exceed the
+ * transform length less the filter length. The products are exact
+ * integers, small enough to be recovered exactly by rounding, so the
+ * result matches the direct form except where that would overflow */
+static void _fft_block(fir_int16_t *s, int16_t *out, int ostep, const int16_t *win, size_t n)
+{
+	double *x = s->fbuf;
+	double re, im;
+	size_t i, l;
+	int64_t a;
+	
+	l = n + s->ataps - 1;
+	
+	if(s->type == 2)
+	{
+		for(i = 0; i < l * 2; i++)
+		{
+			x[i] = win[i];
+		}
+	}
+	else
+	{
+		for(i = 0; i < l; i++)
+		{
+			x[i * 2 + 0] = win[i];
+			x[i * 2 + 1] = 0;
+		}
+	}
+	
+	memset(&x[l * 2], 0, (s->fft.n - l) * sizeof(double) * 2);
+	
+	fft_forward(&s->fft, x);
+	
+	for(i = 0; i < s->fft.n; i++)
+	{
+		re = x[i * 2 + 0] * s->fresp[i * 2 + 0] - x[i * 2 + 1] * s->fresp[i * 2 + 1];
+		im = x[i * 2 + 0] * s->fresp[i * 2 + 1] + x[i * 2 + 1] * s->fresp[i * 2 + 0];
+		x[i * 2 + 0] = re;
+		x[i * 2 + 1] = im;
+	}
+	
+	fft_inverse(&s->fft, x);
+	
+	/* The first ataps - 1 results are wrapped around, skip them */
+	x += (s->ataps - 1) * 2;
+	
+	for(i = 0; i < n; i++, out += ostep, x += 2)
+	{
+		a = llround(x[0]) >> 15;
+		out[0] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+		
+		if(s->type != 1)
+		{
+			a = llround(x[1]) >> 15;
+			out[1] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+		}
+	}
+}
+
+
+
+/* Wide interpolation */
+
+
+
+/* Reorder the taps of a filter that interpolates by eight or more so
+ * that consecutive outputs use consecutive phases, grouped in blocks
+ * of eight outputs with the taps paired for the multiply-add kernels.
+ * Output k of the sequence uses phase (k * decimation) % interpolation,
+ * which repeats every interpolation outputs. */
+static int _init_wide(fir_int16_t *s)
+{
+	int blocks, pairs;
+	int b, j, l, p;
+	int16_t *t;
+	
+	s->staps = NULL;
+	s->k = 0;
+	
+	if(s->type != 1 || s->interpolation < s->decimation * 8)
+	{
+		return(0);
+	}
+	
+	blocks = (s->interpolation + 7) / 8;
+	pairs = (s->ataps + 1) / 2;
+	
+	s->staps = calloc(blocks * pairs * 16, sizeof(int16_t));
+	if(!s->staps)
+	{
+		return(-1);
+	}
+	
+	for(b = 0; b < blocks; b++)
+	{
+		for(l = 0; l < 8 && b * 8 + l < s->interpolation; l++)
+		{
+			p = (int) ((int64_t) (b * 8 + l) * s->decimation % s->interpolation);
+			
+			for(j = 0; j < s->ataps; j++)
+			{
+				t = &s->staps[(b * pairs + j / 2) * 16];
+				t[l * 2 + (j & 1)] = s->itaps[p * s->ataps + j];
+			}
+		}
+	}
+	
+	return(0);
+}
+
+/* Calculate the next n outputs from the current window. The window holds
+ * ataps samples from owin, and an odd final tap is paired with the sample
+ * after it, which is always inside the buffer and multiplied by zero */
+static void _wide_interp(fir_int16_t *s, int16_t *out, int n)
+{
+	const int16_t *w = &s->win[s->owin];
+	int pairs = (s->ataps + 1) / 2;
+	unsigned int k = s->k;
+	int32_t acc[8];
+	int32_t a;
+	int l, e;
+	
+	while(n > 0)
+	{
+		_mac8_int16(acc, &s->staps[(k / 8) * pairs * 16], w, pairs);
+		
+		/* Stop at the end of the block, the output
+		 * count or the end of the phase sequence */
+		l = k % 8;
+		e = l + n < 8 ? l + n : 8;
+		if(k - l + e > s->interpolation) e = s->interpolation - (k - l);
+		
+		n -= e - l;
+		k += e - l;
+		if(k == s->interpolation) k = 0;
+		
+		for(; l < e; l++, out += 2)
+		{
+			a = acc[l] >> 15;
+			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+		}
+	}
+	
+	s->k = k;
+}
+
+
+
 /* int16_t */
 
 
@@ -206,6 +795,8 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 {
 	int i, j;
 	
+	_init_kernels();
+	
 	s->type = 1;
 	
 	s->interpolation = interpolation;
@@ -229,17 +820,34 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t));
+	
+	/* Block processing works on plain filters only */
+	s->lhist = 0;
+	s->bwin = NULL;
+	
+	if(interpolation == 1 && decimation == 1)
+	{
+		s->lhist = s->ataps - 1 + delay;
+		s->bwin = calloc(s->lhist + FIR_BLOCK_SIZE, sizeof(int16_t));
+	}
+	
 	s->owin = 0;
 	s->d = 0;
 	
+	if(_init_fft(s) != 0 || _init_wide(s) != 0)
+	{
+		fir_int16_free(s);
+		return(-1);
+	}
+	
 	return(0);
 }
 
 size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int a;
-	int x, y;
-	const int16_t *win, *taps;
+	int x;
+	int n;
 	
 	if(s->type == 0) return(0);
 	else if(s->type == 2) return(fir_int16_complex_process(s, out, in, samples));
@@ -252,16 +860,28 @@ size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t
 		if(s->owin < s->ataps) s->win[s->owin + s->lwin] = *in;
 		if(++s->owin == s->lwin) s->owin = 0;
 		
-		for(; s->d < s->interpolation; s->d += s->decimation)
+		if(s->staps)
 		{
-			win = &s->win[s->owin];
-			taps = &s->itaps[s->d * s->ataps];
-			
-			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
+			/* Count the outputs for this input and calculate
+			 * them together */
+			for(n = 0; s->d < s->interpolation; s->d += s->decimation)
 			{
-				a += *(win++) * *(taps++);
+				n++;
 			}
+			s->d -= s->interpolation;
+			
+			_wide_interp(s, out, n);
+			out += n * 2;
+			x += n;
+			in += 2;
+			
+			continue;
+		}
+		
+		for(; s->d < s->interpolation; s->d += s->decimation)
+		{
+			/* Calculate the next output sample */
+			a = _dot_int16(&s->win[s->owin], &s->itaps[s->d * s->ataps], s->ataps);
 			
 			a >>= 15;
 			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
@@ -295,11 +915,100 @@ size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_t *in,
 	return(x);
 }
 
+/* Filter a block of samples through a filter without interpolation or
+ * decimation. The input is appended to the history so every output is a
+ * dot product over contiguous memory, and only the history is carried
+ * between blocks. Equivalent to fir_int16_process() with the given
+ * input and output steps. Returns the number of output samples. */
+size_t fir_int16_process_strided(fir_int16_t *s, int16_t *out, int ostep, const int16_t *in, int istep, size_t samples)
+{
+	int c = s->type == 2 ? 2 : 1;
+	int16_t *buf;
+	size_t i, l, n, x;
+	int32_t a, b;
+	
+	if(s->type == 0 || s->bwin == NULL) return(0);
+	
+	for(x = 0; x < samples; x += n)
+	{
+		n = samples - x;
+		if(n > FIR_BLOCK_SIZE) n = FIR_BLOCK_SIZE;
+		
+		/* Append the block to the history */
+		buf = &s->bwin[s->lhist * c];
+		
+		if(c == 2)
+		{
+			for(i = 0; i < n; i++, in += istep)
+			{
+				buf[i * 2 + 0] = in[0];
+				buf[i * 2 + 1] = in[1];
+			}
+		}
+		else
+		{
+			for(i = 0; i < n; i++, in += istep)
+			{
+				buf[i] = *in;
+			}
+		}
+		
+		/* Calculate the output samples. A transform pair costs
+		 * around 4 N log2(N) operations, so only use it when the
+		 * direct form would cost more */
+		i = 0;
+		
+		if(s->fft.n && n * s->ataps > 4 * s->fft.n * s->fft.bits)
+		{
+			for(; i < n; i += l, out += l * ostep)
+			{
+				l = s->fft.n - s->ataps + 1;
+				if(l > n - i) l = n - i;
+				
+				_fft_block(s, out, ostep, &s->bwin[i * c], l);
+			}
+		}
+		
+		for(; i < n; i++, out += ostep)
+		{
+			if(s->type == 2)
+			{
+				_dot2_int16(&a, &b, &s->bwin[i * 2], s->itaps, s->qtaps, s->ataps * 2);
+				a >>= 15;
+				b >>= 15;
+				out[0] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+				out[1] = b < INT16_MIN ? INT16_MIN : (b > INT16_MAX ? INT16_MAX : b);
+			}
+			else
+			{
+				a = _dot_int16(&s->bwin[i], s->itaps, s->ataps) >> 15;
+				out[0] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+				
+				if(s->type == 3)
+				{
+					a = _dot_int16(&s->bwin[i], s->qtaps, s->ataps) >> 15;
+					out[1] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+				}
+			}
+		}
+		
+		/* The end of this block becomes the history for the next */
+		memmove(s->bwin, &s->bwin[n * c], s->lhist * c * sizeof(int16_t));
+	}
+	
+	return(samples);
+}
+
 void fir_int16_free(fir_int16_t *s)
 {
 	free(s->win);
+	free(s->bwin);
 	free(s->itaps);
 	free(s->qtaps);
+	fft_free(&s->fft);
+	free(s->fresp);
+	free(s->fbuf);
+	free(s->staps);
 	memset(s, 0, sizeof(fir_int16_t));
 }
 
@@ -369,6 +1078,8 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 {
 	int i, j;
 	
+	_init_kernels();
+	
 	s->type = 2;
 	
 	s->interpolation = interpolation;
@@ -395,17 +1106,34 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t) * 2);
+	
+	/* Block processing works on plain filters only */
+	s->lhist = 0;
+	s->bwin = NULL;
+	
+	if(interpolation == 1 && decimation == 1)
+	{
+		s->lhist = s->ataps - 1 + delay;
+		s->bwin = calloc(s->lhist + FIR_BLOCK_SIZE, sizeof(int16_t) * 2);
+	}
+	
 	s->owin = 0;
 	s->d = 0;
 	
+	if(_init_fft(s) != 0 || _init_wide(s) != 0)
+	{
+		fir_int16_free(s);
+		return(-1);
+	}
+	
 	return(0);
 }
 
 size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int32_t ai, aq;
-	int x, y;
-	const int16_t *win, *itaps, *qtaps;
+	int x;
+	const int16_t *win;
 	
 	for(x = 0; samples; samples--)
 	{
@@ -422,15 +1150,9 @@ size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int16_t *in
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
 			win = &s->win[s->owin * 2];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++)
-			{
-				ai += *(win++) * *(itaps++);
-				aq += *(win++) * *(qtaps++);
-			}
+			_dot2_int16(&ai, &aq, win, &s->itaps[s->d * s->ataps * 2], &s->qtaps[s->d * s->ataps * 2], s->ataps * 2);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -451,6 +1173,8 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 {
 	int i, j;
 	
+	_init_kernels();
+	
 	s->type = 3;
 	
 	s->interpolation = interpolation;
@@ -475,17 +1199,34 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t));
+	
+	/* Block processing works on plain filters only */
+	s->lhist = 0;
+	s->bwin = NULL;
+	
+	if(interpolation == 1 && decimation == 1)
+	{
+		s->lhist = s->ataps - 1 + delay;
+		s->bwin = calloc(s->lhist + FIR_BLOCK_SIZE, sizeof(int16_t));
+	}
+	
 	s->owin = 0;
 	s->d = 0;
 	
+	if(_init_fft(s) != 0 || _init_wide(s) != 0)
+	{
+		fir_int16_free(s);
+		return(-1);
+	}
+	
 	return(0);
 }
 
 size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int32_t ai, aq;
-	int x, y;
-	const int16_t *win, *itaps, *qtaps;
+	int x;
+	const int16_t *win;
 	
 	for(x = 0; samples; samples--)
 	{
@@ -497,15 +1238,10 @@ size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *i
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
 			win = &s->win[s->owin];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++)
-			{
-				ai += *win     * *(itaps++);
-				aq += *(win++) * *(qtaps++);
-			}
+			ai = _dot_int16(win, &s->itaps[s->d * s->ataps], s->ataps);
+			aq = _dot_int16(win, &s->qtaps[s->d * s->ataps], s->ataps);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -532,6 +1268,8 @@ int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int i
 {
 	int i, j;
 	
+	_init_kernels();
+	
 	s->type = 1;
 	
 	s->interpolation = interpolation;
@@ -554,6 +1292,17 @@ int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int i
 	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int32_t));
+	
+	/* Block processing works on plain filters only */
+	s->lhist = 0;
+	s->bwin = NULL;
+	
+	if(interpolation == 1 && decimation == 1)
+	{
+		s->lhist = s->ataps - 1 + delay;
+		s->bwin = calloc(s->lhist + FIR_BLOCK_SIZE, sizeof(int32_t));
+	}
+	
 	s->owin = 0;
 	s->d = 0;
 	
@@ -563,8 +1312,7 @@ int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int i
 size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t samples)
 {
 	int64_t a;
-	int x, y;
-	const int32_t *win, *taps;
+	int x;
 	
 	if(s->type == 0) return(0);
 	//else if(s->type == 2) return(fir_int32_complex_process(s, out, in, samples));
@@ -579,14 +1327,8 @@ size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t
 		
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
-			win = &s->win[s->owin];
-			taps = &s->itaps[s->d * s->ataps];
-			
 			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
-			{
-				a += (int64_t) *(win++) * (int64_t) *(taps++);
-			}
+			a = _dot_int32(&s->win[s->owin], &s->itaps[s->d * s->ataps], s->ataps);
 			
 			a >>= 15;
 			*out = a < INT32_MIN ? INT32_MIN : (a > INT32_MAX ? INT32_MAX : a);
@@ -601,9 +1343,46 @@ size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t
 	return(x);
 }
 
+/* As fir_int16_process_strided(), for int32 filters */
+size_t fir_int32_process_strided(fir_int32_t *s, int32_t *out, int ostep, const int32_t *in, int istep, size_t samples)
+{
+	int32_t *buf;
+	size_t i, n, x;
+	int64_t a;
+	
+	if(s->type == 0 || s->bwin == NULL) return(0);
+	
+	for(x = 0; x < samples; x += n)
+	{
+		n = samples - x;
+		if(n > FIR_BLOCK_SIZE) n = FIR_BLOCK_SIZE;
+		
+		/* Append the block to the history */
+		buf = &s->bwin[s->lhist];
+		
+		for(i = 0; i < n; i++, in += istep)
+		{
+			buf[i] = *in;
+		}
+		
+		/* Calculate the output samples */
+		for(i = 0; i < n; i++, out += ostep)
+		{
+			a = _dot_int32(&s->bwin[i], s->itaps, s->ataps) >> 15;
+			*out = a < INT32_MIN ? INT32_MIN : (a > INT32_MAX ? INT32_MAX : a);
+		}
+		
+		/* The end of this block becomes the history for the next */
+		memmove(s->bwin, &s->bwin[n], s->lhist * sizeof(int32_t));
+	}
+	
+	return(samples);
+}
+
 void fir_int32_free(fir_int32_t *s)
 {
 	free(s->win);
+	free(s->bwin);
 	free(s->itaps);
 	free(s->qtaps);
 	memset(s, 0, sizeof(fir_int32_t));
@@ -657,6 +1436,8 @@ void limiter_free(limiter_t *s)
 {
 	fir_int32_free(&s->vfir);
 	fir_int32_free(&s->ffir);
+	free(s->vblock);
+	free(s->fblock);
 	free(s->shape);
 	free(s->att);
 	free(s->fix);
@@ -711,7 +1492,9 @@ int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, co
 	s->att = calloc(sizeof(int16_t), s->width);
 	s->fix = calloc(sizeof(int32_t), s->width);
 	s->var = calloc(sizeof(int32_t), s->width);
-	if(!s->att || !s->fix || !s->var)
+	s->vblock = malloc(sizeof(int32_t) * FIR_BLOCK_SIZE);
+	s->fblock = malloc(sizeof(int32_t) * FIR_BLOCK_SIZE);
+	if(!s->att || !s->fix || !s->var || !s->vblock || !s->fblock)
 	{
 		limiter_free(s);
 		return(-1);
@@ -725,55 +1508,65 @@ int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, co
 
 void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16_t *fin, int samples, int step)
 {
-	int i, j;
+	int i, j, n;
 	int32_t a, b;
 	
-	for(i = 0; i < samples; i++)
+	for(; samples > 0; samples -= n)
 	{
-		s->var[s->p] = *vin;
-		s->fix[s->p] = (fin ? *fin : 0);
-		s->att[s->p] = 0;
-		
-		/* Apply input filters */
-		if(s->vfir.type) fir_int32_process(&s->vfir, &s->var[s->p], &s->var[s->p], 1);
-		if(s->ffir.type) fir_int32_process(&s->ffir, &s->fix[s->p], &s->fix[s->p], 1);
+		n = samples < FIR_BLOCK_SIZE ? samples : FIR_BLOCK_SIZE;
 		
-		/* Hard limit the fixed input */
-		if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
-		else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
-		
-		/* The variable signal is the difference between vin and fin */
-		s->var[s->p] -= s->fix[s->p];
+		/* Apply the input filters to the whole block */
+		for(i = 0; i < n; i++)
+		{
+			s->vblock[i] = vin[i * step];
+			s->fblock[i] = fin ? fin[i * step] : 0;
+		}
 		
-		if(++s->p == s->width) s->p = 0;
-		if(++s->h == s->width) s->h = 0;
+		if(s->vfir.type) fir_int32_process_strided(&s->vfir, s->vblock, 1, s->vblock, 1, n);
+		if(s->ffir.type) fir_int32_process_strided(&s->ffir, s->fblock, 1, s->fblock, 1, n);
 		
-		/* Soft limit the variable input */
-		a = abs(s->var[s->h] + s->fix[s->h]);
-		if(a > s->level)
+		for(i = 0; i < n; i++)
 		{
-			a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+			s->var[s->p] = s->vblock[i];
+			s->fix[s->p] = s->fblock[i];
+			s->att[s->p] = 0;
 			
-			for(j = 0; j < s->width; j++)
+			/* Hard limit the fixed input */
+			if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
+			else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
+			
+			/* The variable signal is the difference between vin and fin */
+			s->var[s->p] -= s->fix[s->p];
+			
+			if(++s->p == s->width) s->p = 0;
+			if(++s->h == s->width) s->h = 0;
+			
+			/* Soft limit the variable input */
+			a = abs(s->var[s->h] + s->fix[s->h]);
+			if(a > s->level)
 			{
-				b = (a * s->shape[j]) >> 15;
-				if(b > s->att[s->p]) s->att[s->p] = b;
-				if(++s->p == s->width) s->p = 0;
+				a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+				
+				for(j = 0; j < s->width; j++)
+				{
+					b = (a * s->shape[j]) >> 15;
+					if(b > s->att[s->p]) s->att[s->p] = b;
+					if(++s->p == s->width) s->p = 0;
+				}
 			}
+			
+			a  = s->fix[s->p];
+			a += ((int64_t) s->var[s->p] * (INT16_MAX - s->att[s->p])) >> 15;
+			
+			/* Hard limit to catch rounding errors */
+			if(a < -s->level) a = -s->level;
+			else if(a > s->level) a = s->level;
+			
+			*out = a;
+			out += step;
 		}
 		
-		a  = s->fix[s->p];
-		a += ((int64_t) s->var[s->p] * (INT16_MAX - s->att[s->p])) >> 15;
-		
-		/* Hard limit to catch rounding errors */
-		if(a < -s->level) a = -s->level;
-		else if(a > s->level) a = s->level;
-		
-		*out = a;
-		
-		vin += step;
-		out += step;
-		if(fin) fin += step;
+		vin += n * step;
+		if(fin) fin += n * step;
 	}
 }
-
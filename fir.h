@@ -18,6 +18,15 @@
 #ifndef _FIR_H
 #define _FIR_H
 
+#include "fft.h"
+
+/* Maximum number of samples filtered in one pass by the block functions */
+#define FIR_BLOCK_SIZE 2048
+
+/* Filters with at least this many taps use fast convolution in the
+ * block functions */
+#define FIR_FFT_TAPS 128
+
 typedef struct {
 	
 	int type;
@@ -35,6 +44,22 @@ typedef struct {
 	int16_t *win;
 	int d;
 	
+	/* Block processing buffer, the last lhist input
+	 * samples followed by space for the next block */
+	unsigned int lhist;
+	int16_t *bwin;
+	
+	/* Fast convolution state, fft.n is 0 if unused */
+	fft_t fft;
+	double *fresp;
+	double *fbuf;
+	
+	/* Wide interpolation taps in output order, eight output
+	 * phases per block, or NULL if unused. k is the position
+	 * of the next output in the phase sequence */
+	int16_t *staps;
+	unsigned int k;
+	
 } fir_int16_t;
 
 typedef struct {
@@ -54,6 +79,11 @@ typedef struct {
 	int32_t *win;
 	int d;
 	
+	/* Block processing buffer, the last lhist input
+	 * samples followed by space for the next block */
+	unsigned int lhist;
+	int32_t *bwin;
+	
 } fir_int32_t;
 
 extern void fir_low_pass(double *taps, size_t ntaps, double sample_rate, double cutoff, double width, double gain);
@@ -63,6 +93,7 @@ extern void fir_complex_band_pass(double *taps, size_t ntaps, double sample_rate
 extern int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay);
 extern size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples);
 extern size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples);
+extern size_t fir_int16_process_strided(fir_int16_t *s, int16_t *out, int ostep, const int16_t *in, int istep, size_t samples);
 extern void fir_int16_free(fir_int16_t *s);
 
 extern int fir_int16_resampler_init(fir_int16_t *s, int interpolation, int decimation);
@@ -75,6 +106,7 @@ extern size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int
 
 extern int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay);
 extern size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t samples);
+extern size_t fir_int32_process_strided(fir_int32_t *s, int32_t *out, int ostep, const int32_t *in, int istep, size_t samples);
 extern void fir_int32_free(fir_int32_t *s);
 
 typedef struct {
@@ -98,6 +130,10 @@ typedef struct {
 	int width;
 	int16_t *shape;
 	
+	/* Filtered input blocks */
+	int32_t *vblock;
+	int32_t *fblock;
+	
 	/* Limiter state */
 	int16_t level;
 	int32_t *fix;
@@ -15,32 +15,52 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <osmo-fl2k.h>
-#include <pthread.h>
 #include "hacktv.h"
+#include "ring.h"
+#include "convert.h"
 
-#define BUFFERS 4
+/* Default TX buffer length in milliseconds */
+#define DEFAULT_TX_BUFFER 100
 
 typedef struct {
 	
 	fl2k_dev_t *d;
-	int abort;
+	volatile int abort;
 	
-	uint8_t buffer_r[BUFFERS][FL2K_BUF_LEN];
-	uint8_t buffer_g[BUFFERS][FL2K_BUF_LEN];
-	pthread_mutex_t mutex[BUFFERS];
+	/* Each ring slot holds one FL2K buffer of red samples
+	 * followed by one of green samples */
+	ring_t ring;
+	uint8_t *slot;
 	int len;
-	int in;
-	int out;
+	
+	/* The callback holds on to the slot it handed over until
+	 * the next call, and sends silence when there's nothing */
+	int held;
+	uint8_t *silence;
+	uint64_t underruns;
+	
+	/* Longest wait for the ring to drain on close, in ms */
+	unsigned int drain_timeout;
+	
+	/* int16 to uint8 converter, I samples to red and Q to green */
+	convert_t conv;
+	
+	latency_t *latency;
+	int verbose;
 	
 } fl2k_t;
 
 static void _callback(fl2k_data_info_t *data_info)
 {
 	fl2k_t *rf = data_info->ctx;
-	int i;
+	const uint8_t *slot;
+	uint64_t u;
 	
 	if(data_info->device_error)
 	{
@@ -48,52 +68,78 @@ static void _callback(fl2k_data_info_t *data_info)
 		return;
 	}
 	
-	/* Try to get a lock on the next output buffer */
-	i = (rf->out + 1) % BUFFERS;
-	
-	if(pthread_mutex_trylock(&rf->mutex[i]) != 0)
+	/* The previous slot has been sent, hand it back */
+	if(rf->held)
 	{
-		/* No luck, the writer must have it */
-		fprintf(stderr, "U");
-		return;
+		ring_read_release(&rf->ring);
+		rf->held = 0;
 	}
 	
-	/* Got a lock on the next buffer, clear and release the previous */
-	pthread_mutex_unlock(&rf->mutex[rf->out]);
+	slot = ring_read_slot(&rf->ring);
 	
-	rf->out = i;
+	if(slot == NULL)
+	{
+		/* Only report real starvation, not the initial fill or refill */
+		u = atomic_load_explicit(&rf->ring.underruns, memory_order_relaxed);
+		if(u != rf->underruns)
+		{
+			fprintf(stderr, "U");
+			rf->underruns = u;
+		}
+		
+		slot = rf->silence;
+	}
+	else
+	{
+		rf->held = 1;
+		latency_consume(rf->latency, FL2K_BUF_LEN);
+	}
 	
 	data_info->sampletype_signed = 0;
-	data_info->r_buf = (char *) rf->buffer_r[rf->out];
-	data_info->g_buf = (char *) rf->buffer_g[rf->out];
+	data_info->r_buf = (char *) slot;
+	data_info->g_buf = (char *) slot + FL2K_BUF_LEN;
 	data_info->b_buf = NULL;
 }
 
 static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	fl2k_t *rf = private;
-	int i;
-	
-	if(rf->abort)
-	{
-		return(HACKTV_ERROR);
-	}
+	size_t l;
 	
 	while(samples > 0)
 	{
-		for(; rf->len < FL2K_BUF_LEN && samples > 0; rf->len++, samples--)
+		if(rf->abort)
+		{
+			return(HACKTV_ERROR);
+		}
+		
+		if(rf->slot == NULL)
 		{
-			rf->buffer_r[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
-			rf->buffer_g[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
+			/* Wait for a free slot */
+			rf->slot = ring_write_slot(&rf->ring);
+			
+			if(rf->slot == NULL)
+			{
+				usleep(1000);
+				continue;
+			}
 		}
 		
+		l = FL2K_BUF_LEN - rf->len;
+		if(l > samples) l = samples;
+		
+		convert(&rf->conv, rf->slot + rf->len, &iq_data[0], l);
+		convert(&rf->conv, rf->slot + FL2K_BUF_LEN + rf->len, &iq_data[1], l);
+		
+		rf->len += l;
+		iq_data += l * 2;
+		samples -= l;
+		
 		if(rf->len == FL2K_BUF_LEN)
 		{
-			/* This buffer is full. Move on to the next. */
-			i = (rf->in + 1) % BUFFERS;
-			pthread_mutex_lock(&rf->mutex[i]);
-			pthread_mutex_unlock(&rf->mutex[rf->in]);
-			rf->in = i;
+			/* This slot is full. Move on to the next */
+			ring_write_commit(&rf->ring);
+			rf->slot = NULL;
 			rf->len = 0;
 		}
 	}
@@ -101,21 +147,70 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 	return(HACKTV_OK);
 }
 
+static void _drain(fl2k_t *rf)
+{
+	unsigned int t;
+	
+	if(rf->ring.data == NULL)
+	{
+		return;
+	}
+	
+	/* Pad out the last partly written slot with silence */
+	if(rf->slot != NULL)
+	{
+		memset(rf->slot + rf->len, 128, FL2K_BUF_LEN - rf->len);
+		memset(rf->slot + FL2K_BUF_LEN + rf->len, 128, FL2K_BUF_LEN - rf->len);
+		ring_write_commit(&rf->ring);
+		rf->slot = NULL;
+		rf->len = 0;
+	}
+	
+	/* Once closed the callback reads out whatever is left, even a
+	 * run too short to have reached the watermark. The ring is only
+	 * empty when the callback has handed back the last slot, after
+	 * it was sent */
+	ring_write_close(&rf->ring);
+	
+	for(t = 0; !ring_eof(&rf->ring) && !rf->abort && t < rf->drain_timeout; t++)
+	{
+		usleep(1000);
+	}
+	
+	if(!ring_eof(&rf->ring) && !rf->abort)
+	{
+		fprintf(stderr, "fl2k: Timed out sending the last samples\n");
+	}
+}
+
 static int _rf_close(void *private)
 {
 	fl2k_t *rf = private;
-	int r;
+	
+	_drain(rf);
 	
 	rf->abort = 1;
 	
-	fl2k_stop_tx(rf->d);
-	fl2k_close(rf->d);
+	if(rf->d)
+	{
+		fl2k_stop_tx(rf->d);
+		fl2k_close(rf->d);
+	}
 	
-	for(r = 0; r < BUFFERS; r++)
+	if(rf->verbose && rf->ring.data)
 	{
-		pthread_mutex_destroy(&rf->mutex[r]);
+		ring_stats_t st;
+		
+		ring_stats(&rf->ring, &st);
+		fprintf(stderr, "fl2k: %llu underruns, %llu overruns, lowest fill %u/%u slots, average %.1f\n",
+			(unsigned long long) st.underruns,
+			(unsigned long long) st.overruns,
+			st.min_fill, rf->ring.depth, st.avg_fill
+		);
 	}
 	
+	ring_free(&rf->ring);
+	free(rf->silence);
 	free(rf);
 	
 	return(HACKTV_OK);
@@ -124,6 +219,7 @@ static int _rf_close(void *private)
 int rf_fl2k_open(hacktv_t *s, const char *device)
 {
 	fl2k_t *rf;
+	int64_t depth;
 	int r;
 	
 	rf = calloc(1, sizeof(fl2k_t));
@@ -133,6 +229,29 @@ int rf_fl2k_open(hacktv_t *s, const char *device)
 	}
 	
 	rf->abort = 0;
+	rf->verbose = s->verbose;
+	rf->latency = s->latency;
+	
+	/* Every other value goes to each channel */
+	convert_init(&rf->conv, HACKTV_UINT8, 2, s->dither);
+	
+	/* Size the ring to hold the requested length of samples. The
+	 * callback waits for it to be half full before starting or resuming */
+	depth = (int64_t) (s->tx_buffer > 0 ? s->tx_buffer : DEFAULT_TX_BUFFER) * s->vid.sample_rate / 1000 / FL2K_BUF_LEN;
+	if(depth < 4) depth = 4;
+	
+	rf->silence = malloc(FL2K_BUF_LEN * 2);
+	if(!rf->silence || ring_init(&rf->ring, depth, FL2K_BUF_LEN * 2, depth / 2) != 0)
+	{
+		_rf_close(rf);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Mid-level on both channels */
+	memset(rf->silence, 128, FL2K_BUF_LEN * 2);
+	
+	/* Allow twice the time it takes to play out a full ring, plus a second */
+	rf->drain_timeout = depth * FL2K_BUF_LEN * 2000 / s->vid.sample_rate + 1000;
 	
 	r = device ? atoi(device) : 0;
 	
@@ -144,19 +263,7 @@ int rf_fl2k_open(hacktv_t *s, const char *device)
 		return(HACKTV_ERROR);
 	}
 	
-	for(r = 0; r < BUFFERS; r++)
-	{
-		pthread_mutex_init(&rf->mutex[r], NULL);
-	}
-	
-	/* Lock the initial buffer for the provider */
-	rf->in = 0;
-	pthread_mutex_lock(&rf->mutex[rf->in]);
-	
-	/* Lock the last empty buffer for the consumer */
-	rf->out = BUFFERS - 1;
-	pthread_mutex_lock(&rf->mutex[rf->out]);
-	
+	rf->slot = NULL;
 	rf->len = 0;
 	
 	r = fl2k_start_tx(rf->d, _callback, rf, 0);
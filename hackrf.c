@@ -19,214 +19,146 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libhackrf/hackrf.h>
-#include <pthread.h>
 #include <unistd.h>
 #include "hacktv.h"
 
-#define BUFFERS 32
+#include "ring.h"
+#include "convert.h"
 
-typedef struct {
-	
-	/* Buffers are locked while reading/writing */
-	pthread_mutex_t mutex;
-	
-	/* Pointer to the start of the buffer */
-	int8_t *data;
-	
-	/* Offset to start of data */
-	size_t start;
-	
-	/* Length of data ready */
-	size_t length;
-	
-} buffer_t;
+/* libhackrf hands the callback buffers of this size */
+#define SLOT_SIZE 262144
 
-typedef struct {
-	
-	buffer_t *buffers;
-	
-	int length;
-	int count;
-	int in;
-	int out;
-	
-} buffers_t;
+/* Default TX buffer length in milliseconds */
+#define DEFAULT_TX_BUFFER 1000
 
 typedef struct {
 	
 	/* HackRF device */
 	hackrf_device *d;
 	
-	/* Buffers */
-	buffers_t buffers;
+	/* Samples waiting to be sent */
+	ring_t ring;
 	
-} hackrf_t;
-
-static int _buffer_init(buffers_t *buffers, size_t count, size_t length)
-{
-	int i;
+	/* int16 to int8 converter */
+	convert_t conv;
 	
-	buffers->count = count;
-	buffers->length = length;
-	buffers->buffers = calloc(count, sizeof(buffer_t));
+	/* Underruns already reported by the callback */
+	uint64_t underruns;
 	
-	for(i = 0; i < count; i++)
-	{
-		pthread_mutex_init(&buffers->buffers[i].mutex, NULL);
-		buffers->buffers[i].data = malloc(length);
-		buffers->buffers[i].start = 0;
-		buffers->buffers[i].length = 0;
-	}
+	/* Longest wait for the ring to drain on close, in ms */
+	unsigned int drain_timeout;
 	
-	/* Lock the initial buffer for the provider */
-	buffers->in = 0;
-	pthread_mutex_lock(&buffers->buffers[buffers->in].mutex);
+	latency_t *latency;
+	int verbose;
 	
-	/* Lock the last empty buffer for the consumer */
-	buffers->out = count - 1;
-	pthread_mutex_lock(&buffers->buffers[buffers->out].mutex);
-
-	return(0);
-}
+} hackrf_t;
 
-static int _buffer_free(buffers_t *buffers)
+static int _tx_callback(hackrf_transfer *transfer)
 {
-	int i;
-	
-	for(i = 0; i < buffers->count; i++)
-	{
-		free(buffers->buffers[i].data);
-		pthread_mutex_destroy(&buffers->buffers[i].mutex);
-	}
+	hackrf_t *rf = transfer->tx_ctx;
+	size_t l = transfer->valid_length;
+	uint64_t u;
+	size_t r;
 	
-	free(buffers->buffers);
-	memset(buffers, 0, sizeof(buffers_t));
+	/* The slots are the same size as the transfers, so this
+	 * is normally a single copy of one whole slot */
+	r = ring_read(&rf->ring, transfer->buffer, l);
 	
-	return(0);
-}
-
-static int _buffer_read(buffers_t *buffers, void *dst, size_t length)
-{
-	buffer_t *buf = &buffers->buffers[buffers->out];
+	/* Two bytes per sample */
+	latency_consume(rf->latency, r / 2);
 	
-	if(buf->length == 0)
+	if(r < l)
 	{
-		buffer_t *next;
-		int i;
+		/* Not enough data ready, fill with zero */
+		memset(transfer->buffer + r, 0, l - r);
 		
-		/* This buffer is empty, try to move the read lock onto the next one */
-		i = (buffers->out + 1) % buffers->count;
-		next = &buffers->buffers[i];
-		
-		if(pthread_mutex_trylock(&next->mutex) != 0)
+		/* Only report real starvation, not the initial fill or refill */
+		u = atomic_load_explicit(&rf->ring.underruns, memory_order_relaxed);
+		if(u != rf->underruns)
 		{
-			/* No luck, the writer must have it */
 			fprintf(stderr, "U");
-			return(0);
+			rf->underruns = u;
 		}
-		
-		/* Got a lock on the next buffer, clear and release the previous */
-		buf->start = 0;
-		pthread_mutex_unlock(&buf->mutex);
-		
-		buf = next;
-		buffers->out = i;
 	}
 	
-	if(length > buf->length)
-	{
-		length = buf->length;
-	}
-	
-	memcpy(dst, buf->data + buf->start, length);
-	buf->start += length;
-	buf->length -= length;
-	
-	return(length);
+	return(0);
 }
 
-static int _buffer_write(buffers_t *buffers, void *src, size_t length)
+static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
-	buffer_t *buf = &buffers->buffers[buffers->in];
-	int i;
+	hackrf_t *rf = private;
+	int8_t *dst;
+	size_t l;
+	
+	samples *= 2;
 	
-	if(buf->length == buffers->length)
+	while(samples)
 	{
-		buffer_t *next;
+		/* Convert straight into the next free space in the ring */
+		dst = ring_write_ptr(&rf->ring, &l);
 		
-		/* This buffer is full, move the write lock onto the next one */
-		i = (buffers->in + 1) % buffers->count;
-		next = &buffers->buffers[i];
+		if(dst == NULL)
+		{
+			/* The ring is full, wait for the callback to drain it */
+			if(hackrf_is_streaming(rf->d) != HACKRF_TRUE)
+			{
+				fprintf(stderr, "hackrf: Device has stopped streaming\n");
+				return(HACKTV_ERROR);
+			}
+			
+			usleep(1000);
+			continue;
+		}
 		
-		pthread_mutex_lock(&next->mutex);
-		pthread_mutex_unlock(&buf->mutex);
+		if(l > samples) l = samples;
 		
-		buf = next;
-		buffers->in = i;
-	}
-	
-	i = buf->start + buf->length;
-	if(length > buffers->length - i)
-	{
-		length = buffers->length - i;
+		convert(&rf->conv, dst, iq_data, l);
+		ring_write_advance(&rf->ring, l);
+		
+		iq_data += l;
+		samples -= l;
 	}
 	
-	memcpy(buf->data + i, src, length);
-	buf->length += length;
-
-	return(length);
+	return(HACKTV_OK);
 }
 
-static int _tx_callback(hackrf_transfer *transfer)
+static void _drain(hackrf_t *rf)
 {
-	hackrf_t *rf = transfer->tx_ctx;
-	size_t l = transfer->valid_length;
-	uint8_t *buf = transfer->buffer;
-	int r;
+	int8_t *dst;
+	unsigned int t;
+	size_t l;
 	
-	while(l)
+	/* Pad out the last partly written slot so it gets sent too */
+	for(t = 0; rf->ring.woff > 0 && t < rf->drain_timeout; t++)
 	{
-		r = _buffer_read(&rf->buffers, buf, l);
+		dst = ring_write_ptr(&rf->ring, &l);
 		
-		if(r == 0)
-		{
-			/* Buffer underrun, fill with zero */
-			memset(buf, 0, l);
-			l = 0;
-		}
-		else
+		if(dst == NULL)
 		{
-			l -= r;
-			buf += r;
+			if(hackrf_is_streaming(rf->d) != HACKRF_TRUE) return;
+			usleep(1000);
+			continue;
 		}
+		
+		memset(dst, 0, l);
+		ring_write_advance(&rf->ring, l);
 	}
 	
-	return(0);
-}
-
-static int _rf_write(void *private, int16_t *iq_data, size_t samples)
-{
-	hackrf_t *rf = private;
-	int8_t iq8[1024 * 4];
-	int i, r;
-	
-	samples *= 2;
+	/* Once closed the callback reads out whatever is left, even a
+	 * run too short to have reached the watermark. Wait for that to
+	 * finish before stopping the transfers */
+	ring_write_close(&rf->ring);
 	
-	for(i = 0; i < samples; i++)
+	for(; !ring_eof(&rf->ring) && t < rf->drain_timeout; t++)
 	{
-		iq8[i] = iq_data[i] >> 8;
+		if(hackrf_is_streaming(rf->d) != HACKRF_TRUE) return;
+		usleep(1000);
 	}
 	
-	i = 0;
-	while(samples)
+	if(!ring_eof(&rf->ring))
 	{
-		r = _buffer_write(&rf->buffers, &iq8[i], samples);
-		
-		samples -= r;
-		i += r;
+		fprintf(stderr, "hackrf: Timed out sending the last samples\n");
 	}
-	
-	return(HACKTV_OK);
 }
 
 static int _rf_close(void *private)
@@ -234,6 +166,8 @@ static int _rf_close(void *private)
 	hackrf_t *rf = private;
 	int r;
 	
+	_drain(rf);
+	
 	r = hackrf_stop_tx(rf->d);
 	if(r != HACKRF_SUCCESS)
 	{
@@ -255,7 +189,19 @@ static int _rf_close(void *private)
 	
 	hackrf_exit();
 	
-	_buffer_free(&rf->buffers);
+	if(rf->verbose)
+	{
+		ring_stats_t st;
+		
+		ring_stats(&rf->ring, &st);
+		fprintf(stderr, "hackrf: %llu underruns, %llu overruns, lowest fill %u/%u slots, average %.1f\n",
+			(unsigned long long) st.underruns,
+			(unsigned long long) st.overruns,
+			st.min_fill, rf->ring.depth, st.avg_fill
+		);
+	}
+	
+	ring_free(&rf->ring);
 	free(rf);
 	
 	return(HACKTV_OK);
@@ -264,6 +210,7 @@ static int _rf_close(void *private)
 int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsigned int txvga_gain, unsigned char amp_enable)
 {
 	hackrf_t *rf;
+	int64_t depth;
 	int r;
 	
 	if(s->vid.conf.output_type != HACKTV_INT16_COMPLEX)
@@ -278,14 +225,31 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 		return(HACKTV_OUT_OF_MEMORY);
 	}
 	
-	/* Allocate memory for output buffers, each one large enough to hold a single frame */
-	_buffer_init(&rf->buffers, BUFFERS, s->vid.width * s->vid.conf.lines * sizeof(int8_t) * 2);
+	rf->verbose = s->verbose;
+	rf->latency = s->latency;
+	convert_init(&rf->conv, HACKTV_INT8, 1, s->dither);
+	
+	/* Size the ring to hold the requested length of samples, in
+	 * slots matching the libhackrf transfer size. The callback
+	 * waits for it to be half full before starting or resuming */
+	depth = (int64_t) (s->tx_buffer > 0 ? s->tx_buffer : DEFAULT_TX_BUFFER) * s->vid.sample_rate * 2 / 1000 / SLOT_SIZE;
+	if(depth < 4) depth = 4;
+	
+	if(ring_init(&rf->ring, depth, SLOT_SIZE, depth / 2) != 0)
+	{
+		free(rf);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Allow twice the time it takes to play out a full ring, plus a second */
+	rf->drain_timeout = depth * SLOT_SIZE / 2 * 2000 / s->vid.sample_rate + 1000;
 	
 	/* Prepare the HackRF for output */
 	r = hackrf_init();
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_init() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -294,6 +258,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_open() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -302,6 +267,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_sample_rate_set() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -310,6 +276,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_baseband_filter_bandwidth_set() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -318,6 +285,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_freq() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -326,6 +294,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_txvga_gain() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -334,6 +303,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_set_amp_enable() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
@@ -342,6 +312,7 @@ int rf_hackrf_open(hacktv_t *s, const char *serial, uint64_t frequency_hz, unsig
 	if(r != HACKRF_SUCCESS)
 	{
 		fprintf(stderr, "hackrf_start_tx() failed: %s (%d)\n", hackrf_error_name(r), r);
+		ring_free(&rf->ring);
 		free(rf);
 		return(HACKTV_ERROR);
 	}
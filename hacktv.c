@@ -25,6 +25,8 @@
 #include "test.h"
 #include "ffmpeg.h"
 #include "file.h"
+#include "cache.h"
+#include "net.h"
 #include "hackrf.h"
 
 #ifdef WIN32
@@ -55,9 +57,83 @@ static void _sigint_callback_handler(int signum)
 	_abort = 1;
 }
 
+/* Apply the options that work the same for any mode */
+static void _vid_conf_options(hacktv_t *s, vid_config_t *conf)
+{
+	if(s->deviation > 0)
+	{
+		/* Override the FM deviation value */
+		conf->fm_deviation = s->deviation;
+	}
+	
+	if(s->gamma > 0)
+	{
+		/* Override the gamma value */
+		conf->gamma = s->gamma;
+	}
+	
+	if(s->interlace)
+	{
+		conf->interlace = 1;
+	}
+	
+	if(s->yuv)
+	{
+		conf->yuv = 1;
+	}
+	
+	conf->verbose = s->verbose;
+	
+	if(s->nocolour)
+	{
+		if(conf->colour_mode == VID_PAL ||
+		   conf->colour_mode == VID_SECAM ||
+		   conf->colour_mode == VID_NTSC)
+		{
+			conf->colour_mode = VID_NONE;
+		}
+	}
+	
+	if(s->noaudio > 0)
+	{
+		/* Disable all audio sub-carriers */
+		conf->fm_mono_level = 0;
+		conf->fm_left_level = 0;
+		conf->fm_right_level = 0;
+		conf->am_audio_level = 0;
+		conf->nicam_level = 0;
+		conf->dance_level = 0;
+		conf->fm_mono_carrier = 0;
+		conf->fm_left_carrier = 0;
+		conf->fm_right_carrier = 0;
+		conf->nicam_carrier = 0;
+		conf->dance_carrier = 0;
+		conf->am_mono_carrier = 0;
+	}
+	
+	if(s->nonicam > 0)
+	{
+		/* Disable the NICAM sub-carrier */
+		conf->nicam_level = 0;
+		conf->nicam_carrier = 0;
+	}
+	
+	if(s->a2stereo > 0)
+	{
+		conf->a2stereo = 1;
+	}
+	
+	conf->level *= s->level;
+}
+
 /* RF sink callback handlers */
 static int _hacktv_rf_write(hacktv_t *s, int16_t *iq_data, size_t samples)
 {
+	if(s->latency)
+	{
+		latency_produce(s->latency, samples);
+	}
+	
 	if(s->rf_write)
 	{
 		return(s->rf_write(s->rf_private, iq_data, samples));
@@ -76,6 +152,123 @@ static int _hacktv_rf_close(hacktv_t *s)
 	return(HACKTV_OK);
 }
 
+/* Pass the main channel on to the sink, through the mixer if there
+ * are other channels */
+static int _hacktv_write(hacktv_t *s, int16_t *iq_data, size_t samples)
+{
+	int16_t *block;
+	size_t l;
+	
+	if(s->mix == NULL)
+	{
+		return(_hacktv_rf_write(s, iq_data, samples));
+	}
+	
+	while(samples > 0)
+	{
+		l = mix_write(s->mix, iq_data, samples);
+		iq_data += l * 2;
+		samples -= l;
+		
+		block = mix_read(s->mix, 0, &l);
+		
+		if(block != NULL && _hacktv_rf_write(s, block, l) != HACKTV_OK)
+		{
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+/* Open an input source on an encoder */
+static int _hacktv_open_input(vid_t *vid, char *input)
+{
+	char *sub;
+	int l;
+	
+	/* Get a pointer to the input prefix and target */
+	sub = strchr(input, ':');
+	
+	if(sub != NULL)
+	{
+		l = sub - input;
+		sub++;
+	}
+	else
+	{
+		l = strlen(input);
+	}
+	
+	if(strncmp(input, "test", l) == 0)
+	{
+		return(av_test_open(vid, sub));
+	}
+	else if(strncmp(input, "ffmpeg", l) == 0)
+	{
+		return(av_ffmpeg_open(vid, sub));
+	}
+	
+	return(av_ffmpeg_open(vid, input));
+}
+
+/* Set up an extra channel from <mode>:<offset>:<input> */
+static int _hacktv_add_channel(hacktv_t *s, mix_t *mix, char *spec)
+{
+	const vid_configs_t *vid_confs;
+	vid_config_t vid_conf;
+	char *mode, *offset, *input;
+	
+	/* The strings are kept for the life of the channel */
+	mode = strdup(spec);
+	if(!mode)
+	{
+		perror("strdup");
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	offset = strchr(mode, ':');
+	input = offset ? strchr(offset + 1, ':') : NULL;
+	
+	if(input == NULL)
+	{
+		fprintf(stderr, "Channels are set as <mode>:<offset>:<input>\n");
+		free(mode);
+		return(HACKTV_ERROR);
+	}
+	
+	*(offset++) = '\0';
+	*(input++) = '\0';
+	
+	for(vid_confs = vid_configs; vid_confs->id != NULL; vid_confs++)
+	{
+		if(strcmp(mode, vid_confs->id) == 0) break;
+	}
+	
+	if(vid_confs->id == NULL)
+	{
+		fprintf(stderr, "Unrecognised TV mode '%s'.\n", mode);
+		free(mode);
+		return(HACKTV_ERROR);
+	}
+	
+	memcpy(&vid_conf, vid_confs->conf, sizeof(vid_config_t));
+	_vid_conf_options(s, &vid_conf);
+	
+	vid_conf.mode = mode;
+	vid_conf.offset = (int64_t) strtod(offset, NULL);
+	vid_conf.vfilter = s->filter;
+	vid_conf.volume = s->volume;
+	vid_conf.threads = s->threads;
+	vid_conf.raster_threads = s->raster_threads;
+	vid_conf.frame_pool = s->frame_pool;
+	vid_conf.scaler = s->scaler;
+	
+	fprintf(stderr, "Channel %d: %s at %+lld Hz from %s\n", mix->nchannels + 2, mode, (long long) vid_conf.offset, input);
+	
+	return(mix_add_channel(mix, s->samplerate, 0, &vid_conf, input));
+}
+
 static void print_usage(void)
 {
 	printf(
@@ -91,8 +284,22 @@ static void print_usage(void)
 		"  -G, --gamma <value>            Override the mode's gamma correction value.\n"
 		"  -i, --interlace                Update image each field instead of each frame.\n"
 		"  -r, --repeat                   Repeat the inputs forever.\n"
+		"      --cache <dir>              Render the first frames once to a cache file in\n"
+		"                                 <dir> and repeat them forever. Only used if\n"
+		"                                 the frame after them matches the first. Also\n"
+		"                                 holds the keyframe indexes made for --position.\n"
+		"      --cache-frames <value>     Number of frames to cache. Default: 4\n"
 		"  -p, --position <value>         Set start position of video in minutes.\n"
-		"  -v, --verbose                  Enable verbose output.\n"
+		"  -v, --verbose                  Enable verbose output. Also prints the latency\n"
+		"                                 from encoder to output every 10 seconds.\n"
+		"      --threads <value>          Run the line processes over this many threads. Default: 1\n"
+		"      --raster-threads <value>   Render the video raster over this many threads. Default: 1\n"
+		"      --frame-pool <frames>      Number of frames ffmpeg decodes ahead. Default: 4\n"
+		"      --scaler <algorithm>       Set the ffmpeg video scaling algorithm. Default: bicubic\n"
+		"                                 (fast-bilinear, bilinear, bicubic, experimental,\n"
+		"                                 point, area, bicublin, gauss, sinc, lanczos, spline)\n"
+		"      --yuv                      Take planar YUV from ffmpeg in place of RGB frames, where\n"
+		"                                 the mode allows. Not available with the overlays or --gamma.\n"
 		"      --logo <path>              Overlay picture logo over video.\n"
 		"      --timestamp                Overlay video timestamp over video.\n"
 		"      --teletext <path>          Enable teletext output. (625 line modes only)\n"
@@ -132,6 +339,10 @@ static void print_usage(void)
 		"      --volume <value>           Adjust volume. Takes floats as argument.\n"
 		"      --showecm                  Show input and output control wordsfor scrambled modes.\n"
 		"      --offset <value>           Add a frequency offset in Hz (Complex modes only).\n"
+		"      --channel <mode>:<offset>:<input>\n"
+		"                                 Encode another channel and add it to the output,\n"
+		"                                 offset by <offset> Hz. (Complex modes only)\n"
+		"      --mix-level <value>        Set the level of the mixed channels. Default: 1.0\n"
 		"      --passthru <file>          Read and add an int16 complex signal.\n"
 		"\n"
 		"Input options\n"
@@ -150,6 +361,11 @@ static void print_usage(void)
 		"  -f, --frequency <value>        Set the RF frequency in Hz, 0MHz to 7250MHz.\n"
 		"  -a, --amp                      Enable the TX RF amplifier.\n"
 		"  -g, --gain <value>             Set the TX VGA (IF) gain, 0-47dB. Default: 0dB\n"
+		"      --tx-buffer <ms>           Set the length of the TX buffer. Default: 1000ms\n"
+		"      --dither                   Dither the samples when reducing them to 8-bits.\n"
+		"\n"
+		"  Transmission starts once the TX buffer is half full. If it runs empty\n"
+		"  a U is printed and transmission pauses until it is half full again.\n"
 		"\n"
 		"  Only modes with a complex output are supported by the HackRF.\n"
 		"\n"
@@ -159,10 +375,18 @@ static void print_usage(void)
 		"  -f, --frequency <value>        Set the RF frequency in Hz.\n"
 		"  -g, --gain <value>             Set the TX level. Default: 0dB\n"
 		"  -A, --antenna <name>           Set the antenna.\n"
+		"      --tx-buffer <ms>           Write to the device from a separate thread,\n"
+		"                                 through a buffer of this length.\n"
+		"\n"
+		"  Samples are written to the device in blocks of the stream's MTU.\n"
 		"\n"
 		"fl2k output options\n"
 		"\n"
 		"  -o, --output fl2k[:<dev>]      Open an fl2k device for output.\n"
+		"      --tx-buffer <ms>           Set the length of the TX buffer. Default: 100ms\n"
+		"      --dither                   Dither the samples when reducing them to 8-bits.\n"
+		"\n"
+		"  If the TX buffer runs empty a U is printed and silence is output.\n"
 		"\n"
 		"  Real signals are output on the Red channel. Complex signals are output\n"
 		"  on the Red (I) and Green (Q) channels.\n"
@@ -173,7 +397,14 @@ static void print_usage(void)
 		"File output options\n"
 		"\n"
 		"  -o, --output file:<filename>   Open a file for output. Use - for stdout.\n"
+		"  -o, --output sigmf:<name>      Write a SigMF recording, <name>.sigmf-data\n"
+		"                                 and <name>.sigmf-meta.\n"
+		"  -o, --output wav:<filename>    Write a WAV file. Use - for stdout.\n"
 		"  -t, --type <type>              Set the file data type.\n"
+		"      --direct                   Write with O_DIRECT, bypassing the page cache.\n"
+		"      --dither                   Dither the samples when reducing them to 8-bits.\n"
+		"      --pace                     Write at the sample rate rather than as fast\n"
+		"                                 as possible.\n"
 		"\n"
 		"Supported file types:\n"
 		"\n"
@@ -187,8 +418,26 @@ static void print_usage(void)
 		"  The default output is int16. The TV mode will determine if the output\n"
 		"  is real or complex.\n"
 		"\n"
+		"  SigMF output records the mode, sample rate, type and frequency in the\n"
+		"  metadata file. WAV output supports the uint8, int16, int32 and float\n"
+		"  types, and switches to RF64 for files larger than 4GiB.\n"
+		"\n"
 		"  If no valid output prefix is provided, file: is assumed.\n"
 		"\n"
+		"Network output options\n"
+		"\n"
+		"  -o, --output udp:<host>:<port> Stream samples to a UDP receiver.\n"
+		"  -o, --output tcp:<host>:<port> Stream samples to a TCP receiver.\n"
+		"  -t, --type <type>              Set the sample data type. Default: int16\n"
+		"      --packet-size <bytes>      Set the payload size of each packet. Default: 1408\n"
+		"                                 At most 65483 for UDP.\n"
+		"      --pace                     Send at the sample rate rather than as fast\n"
+		"                                 as possible.\n"
+		"\n"
+		"  Each packet starts with a 24 byte little-endian header: a 32-bit sequence\n"
+		"  number, a 16-bit sample count, the 8-bit data type and a complex flag, the\n"
+		"  64-bit index of the first sample and a 64-bit send time in nanoseconds.\n"
+		"\n"
 		"Supported television modes:\n"
 		"\n"
 		"  i             = PAL colour, 25 fps, 625 lines, AM (complex), 6.0 MHz FM audio\n"
@@ -425,6 +674,20 @@ enum {
 	_OPT_VOLUME,
 	_OPT_FMAUDIOTEST,
 	_OPT_PIXELRATE,
+	_OPT_THREADS,
+	_OPT_RASTER_THREADS,
+	_OPT_TX_BUFFER,
+	_OPT_DITHER,
+	_OPT_DIRECT,
+	_OPT_CACHE,
+	_OPT_CACHE_FRAMES,
+	_OPT_PACKET_SIZE,
+	_OPT_PACE,
+	_OPT_CHANNEL,
+	_OPT_MIX_LEVEL,
+	_OPT_FRAME_POOL,
+	_OPT_SCALER,
+	_OPT_YUV,
 };
 
 int main(int argc, char *argv[])
@@ -436,11 +699,18 @@ int main(int argc, char *argv[])
 		{ "mode",           required_argument, 0, 'm' },
 		{ "samplerate",     required_argument, 0, 's' },
 		{ "pixelrate",      required_argument, 0, _OPT_PIXELRATE },
+		{ "threads",        required_argument, 0, _OPT_THREADS },
+		{ "raster-threads", required_argument, 0, _OPT_RASTER_THREADS },
+		{ "frame-pool",     required_argument, 0, _OPT_FRAME_POOL },
+		{ "scaler",         required_argument, 0, _OPT_SCALER },
+		{ "yuv",            no_argument,       0, _OPT_YUV },
 		{ "level",          required_argument, 0, 'l' },
 		{ "deviation",      required_argument, 0, 'D' },
 		{ "gamma",          required_argument, 0, 'G' },
 		{ "interlace",      no_argument,       0, 'i' },
 		{ "repeat",         no_argument,       0, 'r' },
+		{ "cache",          required_argument, 0, _OPT_CACHE },
+		{ "cache-frames",   required_argument, 0, _OPT_CACHE_FRAMES },
 		{ "verbose",        no_argument,       0, 'v' },
 		{ "teletext",       required_argument, 0, _OPT_TELETEXT },
 		{ "wss",            required_argument, 0, _OPT_WSS },
@@ -479,12 +749,19 @@ int main(int argc, char *argv[])
 		{ "scramble-audio", no_argument,       0, _OPT_SCRAMBLE_AUDIO },
 		{ "chid",           required_argument, 0, _OPT_CHID },
 		{ "offset",         required_argument, 0, _OPT_OFFSET },
+		{ "channel",        required_argument, 0, _OPT_CHANNEL },
+		{ "mix-level",      required_argument, 0, _OPT_MIX_LEVEL },
 		{ "passthru",       required_argument, 0, _OPT_PASSTHRU },
 		{ "frequency",      required_argument, 0, 'f' },
 		{ "amp",            no_argument,       0, 'a' },
 		{ "gain",           required_argument, 0, 'g' },
+		{ "tx-buffer",      required_argument, 0, _OPT_TX_BUFFER },
+		{ "dither",         no_argument,       0, _OPT_DITHER },
 		{ "antenna",        required_argument, 0, 'A' },
 		{ "type",           required_argument, 0, 't' },
+		{ "direct",         no_argument,       0, _OPT_DIRECT },
+		{ "packet-size",    required_argument, 0, _OPT_PACKET_SIZE },
+		{ "pace",           no_argument,       0, _OPT_PACE },
 		{ "logo",           required_argument, 0, _OPT_LOGO },
 		{ "timestamp",      no_argument,       0, _OPT_TIMECODE },
 		{ "position",       required_argument, 0, 'p' },
@@ -499,6 +776,11 @@ int main(int argc, char *argv[])
 	const vid_configs_t *vid_confs;
 	vid_config_t vid_conf;
 	char *pre, *sub;
+	cache_t cache;
+	mix_t mix;
+	static latency_t latency;
+	int cache_state = HACKTV_ERROR;
+	size_t x;
 	int l;
 	int r;
 	
@@ -517,11 +799,18 @@ int main(int argc, char *argv[])
 	s.mode = "i";
 	s.samplerate = 20250000;
 	s.pixelrate = 0;
+	s.threads = 1;
+	s.raster_threads = 1;
+	s.frame_pool = 0;
+	s.scaler = NULL;
+	s.yuv = 0;
 	s.level = 1.0;
 	s.deviation = -1;
 	s.gamma = -1;
 	s.interlace = 0;
 	s.repeat = 0;
+	s.cache = NULL;
+	s.cache_frames = 4;
 	s.verbose = 0;
 	s.teletext = NULL;
 	s.position = 0;
@@ -551,8 +840,15 @@ int main(int argc, char *argv[])
 	s.frequency = 0;
 	s.amp = 0;
 	s.gain = 0;
+	s.tx_buffer = 0;
+	s.dither = 0;
 	s.antenna = NULL;
 	s.file_type = HACKTV_INT16;
+	s.file_direct = 0;
+	s.packet_size = 0;
+	s.pace = 0;
+	s.nchannels = 0;
+	s.mix_level = 1.0;
 	s.logo = NULL;
 	s.timestamp = 0;
 	s.enableemm = 0;
@@ -588,6 +884,26 @@ int main(int argc, char *argv[])
 				s.output_type = "file";
 				s.output = sub;
 			}
+			else if(strcmp(pre, "sigmf") == 0)
+			{
+				s.output_type = "sigmf";
+				s.output = sub;
+			}
+			else if(strcmp(pre, "wav") == 0)
+			{
+				s.output_type = "wav";
+				s.output = sub;
+			}
+			else if(strcmp(pre, "udp") == 0)
+			{
+				s.output_type = "udp";
+				s.output = sub;
+			}
+			else if(strcmp(pre, "tcp") == 0)
+			{
+				s.output_type = "tcp";
+				s.output = sub;
+			}
 			else if(strcmp(pre, "hackrf") == 0)
 			{
 				s.output_type = "hackrf";
@@ -641,6 +957,26 @@ int main(int argc, char *argv[])
 			s.pixelrate = atoi(optarg);
 			break;
 		
+		case _OPT_THREADS: /* --threads <value> */
+			s.threads = atoi(optarg);
+			break;
+		
+		case _OPT_RASTER_THREADS: /* --raster-threads <value> */
+			s.raster_threads = atoi(optarg);
+			break;
+		
+		case _OPT_FRAME_POOL: /* --frame-pool <frames> */
+			s.frame_pool = atoi(optarg);
+			break;
+		
+		case _OPT_SCALER: /* --scaler <algorithm> */
+			s.scaler = optarg;
+			break;
+		
+		case _OPT_YUV: /* --yuv */
+			s.yuv = 1;
+			break;
+		
 		case 'l': /* -l, --level <value> */
 			s.level = atof(optarg);
 			break;
@@ -661,6 +997,15 @@ int main(int argc, char *argv[])
 			s.repeat = 1;
 			break;
 		
+		case _OPT_CACHE: /* --cache <dir> */
+			s.cache = optarg;
+			s.repeat = 1;
+			break;
+		
+		case _OPT_CACHE_FRAMES: /* --cache-frames <value> */
+			s.cache_frames = atoi(optarg);
+			break;
+		
 		case 'v': /* -v, --verbose */
 			s.verbose = 1;
 			break;
@@ -846,6 +1191,19 @@ int main(int argc, char *argv[])
 			s.offset = (int64_t) strtod(optarg, NULL);
 			break;
 		
+		case _OPT_CHANNEL: /* --channel <mode>:<offset>:<input> */
+			if(s.nchannels == MIX_MAX_CHANNELS)
+			{
+				fprintf(stderr, "No more than %d extra channels are supported.\n", MIX_MAX_CHANNELS);
+				return(-1);
+			}
+			s.channels[s.nchannels++] = optarg;
+			break;
+		
+		case _OPT_MIX_LEVEL: /* --mix-level <value> */
+			s.mix_level = atof(optarg);
+			break;
+		
 		case _OPT_PASSTHRU: /* --passthru <path> */
 			free(s.passthru);
 			s.passthru = strdup(optarg);
@@ -863,6 +1221,14 @@ int main(int argc, char *argv[])
 			s.gain = atoi(optarg);
 			break;
 		
+		case _OPT_TX_BUFFER: /* --tx-buffer <ms> */
+			s.tx_buffer = atoi(optarg);
+			break;
+		
+		case _OPT_DITHER: /* --dither */
+			s.dither = 1;
+			break;
+		
 		case 'A': /* -A, --antenna <name> */
 			free(s.antenna);
 			s.antenna = strdup(optarg);
@@ -902,6 +1268,18 @@ int main(int argc, char *argv[])
 			
 			break;
 		
+		case _OPT_DIRECT: /* --direct */
+			s.file_direct = 1;
+			break;
+		
+		case _OPT_PACKET_SIZE: /* --packet-size <bytes> */
+			s.packet_size = atoi(optarg);
+			break;
+		
+		case _OPT_PACE: /* --pace */
+			s.pace = 1;
+			break;
+		
 		case '?':
 			print_usage();
 			return(0);
@@ -936,66 +1314,11 @@ int main(int argc, char *argv[])
 	
 	memcpy(&vid_conf, vid_confs->conf, sizeof(vid_config_t));
 	
-	if(s.deviation > 0)
-	{
-		/* Override the FM deviation value */
-		vid_conf.fm_deviation = s.deviation;
-	}
-	
-	if(s.gamma > 0)
-	{
-		/* Override the gamma value */
-		vid_conf.gamma = s.gamma;
-	}
-	
-	if(s.interlace)
-	{
-		vid_conf.interlace = 1;
-	}
-	
-	if(s.nocolour)
-	{
-		if(vid_conf.colour_mode == VID_PAL ||
-		   vid_conf.colour_mode == VID_SECAM ||
-		   vid_conf.colour_mode == VID_NTSC)
-		{
-			vid_conf.colour_mode = VID_NONE;
-		}
-	}
-	
-	if(s.noaudio > 0)
-	{
-		/* Disable all audio sub-carriers */
-		vid_conf.fm_mono_level = 0;
-		vid_conf.fm_left_level = 0;
-		vid_conf.fm_right_level = 0;
-		vid_conf.am_audio_level = 0;
-		vid_conf.nicam_level = 0;
-		vid_conf.dance_level = 0;
-		vid_conf.fm_mono_carrier = 0;
-		vid_conf.fm_left_carrier = 0;
-		vid_conf.fm_right_carrier = 0;
-		vid_conf.nicam_carrier = 0;
-		vid_conf.dance_carrier = 0;
-		vid_conf.am_mono_carrier = 0;
-	}
-	
-	if(s.nonicam > 0)
-	{
-		/* Disable the NICAM sub-carrier */
-		vid_conf.nicam_level = 0;
-		vid_conf.nicam_carrier = 0;
-	}
-	
-	if(s.a2stereo > 0)
-	{
-		vid_conf.a2stereo = 1;
-	}
+	_vid_conf_options(&s, &vid_conf);
 	
 	vid_conf.scramble_video = s.scramble_video;
 	vid_conf.scramble_audio = s.scramble_audio;
 	
-	vid_conf.level *= s.level;
 	vid_conf.mode = s.mode;
 	
 	if(s.teletext)
@@ -1294,6 +1617,11 @@ int main(int argc, char *argv[])
 	vid_conf.offset = s.offset;
 	vid_conf.passthru = s.passthru;
 	vid_conf.volume = s.volume;
+	vid_conf.threads = s.threads;
+	vid_conf.raster_threads = s.raster_threads;
+	vid_conf.frame_pool = s.frame_pool;
+	vid_conf.scaler = s.scaler;
+	vid_conf.cache = s.cache;
 	
 	/* Setup video encoder */
 	r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
@@ -1305,6 +1633,46 @@ int main(int argc, char *argv[])
 	
 	vid_info(&s.vid);
 	
+	if(s.nchannels > 0)
+	{
+		if(s.vid.conf.output_type != HACKTV_INT16_COMPLEX)
+		{
+			fprintf(stderr, "Extra channels can only be mixed with a complex mode.\n");
+			vid_free(&s.vid);
+			return(-1);
+		}
+		
+		if(s.cache)
+		{
+			fprintf(stderr, "The cache cannot be used with extra channels.\n");
+			vid_free(&s.vid);
+			return(-1);
+		}
+		
+		r = mix_init(&mix, s.mix_level, _hacktv_open_input, s.repeat);
+		
+		for(c = 0; c < s.nchannels && r == HACKTV_OK; c++)
+		{
+			r = _hacktv_add_channel(&s, &mix, s.channels[c]);
+		}
+		
+		if(r != HACKTV_OK)
+		{
+			mix_free(&mix);
+			vid_free(&s.vid);
+			return(-1);
+		}
+		
+		s.mix = &mix;
+	}
+	
+	if(s.verbose || s.pace)
+	{
+		/* Sinks pick this up when they are opened */
+		latency_init(&latency, s.vid.sample_rate, s.pace, s.verbose ? 10 : 0);
+		s.latency = &latency;
+	}
+	
 	if(strcmp(s.output_type, "hackrf") == 0)
 	{
 		if(rf_hackrf_open(&s, s.output, s.frequency, s.gain, s.amp) != HACKTV_OK)
@@ -1335,45 +1703,90 @@ int main(int argc, char *argv[])
 #endif
 	else if(strcmp(s.output_type, "file") == 0)
 	{
-		if(rf_file_open(&s, s.output, s.file_type) != HACKTV_OK)
+		if(rf_file_open(&s, s.output, s.file_type, RF_FILE_RAW) != HACKTV_OK)
 		{
 			vid_free(&s.vid);
 			return(-1);
 		}
 	}
+	else if(strcmp(s.output_type, "sigmf") == 0)
+	{
+		if(rf_file_open(&s, s.output, s.file_type, RF_FILE_SIGMF) != HACKTV_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	else if(strcmp(s.output_type, "wav") == 0)
+	{
+		if(rf_file_open(&s, s.output, s.file_type, RF_FILE_WAV) != HACKTV_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	else if(strcmp(s.output_type, "udp") == 0)
+	{
+		if(rf_net_open(&s, s.output, RF_NET_UDP, s.file_type, s.packet_size) != HACKTV_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	else if(strcmp(s.output_type, "tcp") == 0)
+	{
+		if(rf_net_open(&s, s.output, RF_NET_TCP, s.file_type, s.packet_size) != HACKTV_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	
+	if(s.cache && s.cache_frames > 0)
+	{
+		cache_state = cache_open(&cache, s.cache, cache_key(&s.vid, &argv[optind], argc - optind, s.cache_frames), &s.vid, s.cache_frames);
+		
+		if(cache_state == CACHE_HIT)
+		{
+			fprintf(stderr, "Cache: Playing %s\n", cache.path);
+		}
+		else if(cache_state == CACHE_MISS)
+		{
+			fprintf(stderr, "Cache: Recording %d frames to %s\n", s.cache_frames, cache.path);
+		}
+	}
 	
 	av_ffmpeg_init();
 	
+	if(s.mix && mix_start(s.mix) != HACKTV_OK)
+	{
+		_abort = 1;
+	}
+	
 	do
 	{
-		for(c = optind; c < argc && !_abort; c++)
+		if(cache_state == CACHE_HIT)
 		{
-			/* Get a pointer to the output prefix and target */
-			pre = argv[c];
-			sub = strchr(pre, ':');
-			
-			if(sub != NULL)
-			{
-				l = sub - pre;
-				sub++;
-			}
-			else
+			/* Stream the cached signal rather than render it again */
+			for(x = cache.resume; x < cache.samples && !_abort; x += l)
 			{
-				l = strlen(pre);
+				l = cache.samples - x < 65536 ? cache.samples - x : 65536;
+				
+				if(_hacktv_rf_write(&s, &cache.data[x * 2], l) != HACKTV_OK)
+				{
+					/* The sink has failed, don't replay into it again */
+					_abort = 1;
+				}
 			}
 			
-			if(strncmp(pre, "test", l) == 0)
-			{
-				r = av_test_open(&s.vid, sub);
-			}
-			else if(strncmp(pre, "ffmpeg", l) == 0)
-			{
-				r = av_ffmpeg_open(&s.vid, sub);
-			}
-			else
-			{
-				r = av_ffmpeg_open(&s.vid, pre);
-			}
+			cache.resume = 0;
+			
+			continue;
+		}
+		
+		for(c = optind; c < argc && !_abort; c++)
+		{
+			r = _hacktv_open_input(&s.vid, argv[c]);
 			
 			if(r != HACKTV_OK)
 			{
@@ -1388,15 +1801,53 @@ int main(int argc, char *argv[])
 				
 				if(data == NULL) break;
 				
-				if(_hacktv_rf_write(&s, data, samples) != HACKTV_OK) break;
+				if(_hacktv_write(&s, data, samples) != HACKTV_OK) break;
+				
+				if(cache_state == CACHE_MISS)
+				{
+					/* Stop rendering once the cache is complete */
+					cache_state = cache_write(&cache, data, samples);
+					if(cache_state == CACHE_HIT) break;
+					
+					if(cache_state == CACHE_REJECTED)
+					{
+						fprintf(stderr, "Cache: Frame %d differs from frame 1, the signal doesn't repeat. Not caching.\n", s.cache_frames + 1);
+					}
+				}
 			}
 			
 			vid_av_close(&s.vid);
+			
+			if(cache_state == CACHE_HIT) break;
 		}
 	}
 	while(s.repeat && !_abort);
 	
+	if(s.cache && s.cache_frames > 0)
+	{
+		cache_close(&cache);
+	}
+	
+	if(s.mix)
+	{
+		/* Write out the last part block */
+		int16_t *data = _abort ? NULL : mix_read(s.mix, 1, &x);
+		
+		if(data != NULL)
+		{
+			_hacktv_rf_write(&s, data, x);
+		}
+		
+		mix_free(s.mix);
+	}
+	
 	_hacktv_rf_close(&s);
+	
+	if(s.latency && s.verbose)
+	{
+		latency_print(s.latency);
+	}
+	
 	vid_free(&s.vid);
 	
 	av_ffmpeg_deinit();
@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 #include "video.h"
+#include "latency.h"
+#include "mix.h"
 
 /* Return codes */
 #define HACKTV_OK             0
@@ -58,11 +60,18 @@ typedef struct {
 	char *mode;
 	int samplerate;
 	int pixelrate;
+	int threads;
+	int raster_threads;
+	int frame_pool;
+	char *scaler;
+	int yuv;
 	float level;
 	float deviation;
 	float gamma;
 	int interlace;
 	int repeat;
+	char *cache;
+	int cache_frames;
 	int verbose;
 	char *d11;
 	char *systercnr;
@@ -93,8 +102,13 @@ typedef struct {
 	uint64_t frequency;
 	int amp;
 	int gain;
+	int tx_buffer;
+	int dither;
 	char *antenna;
 	int file_type;
+	int file_direct;
+	int packet_size;
+	int pace;
 	int timestamp;
 	int position;
 	uint32_t enableemm;
@@ -103,6 +117,9 @@ typedef struct {
 	int chid;
 	int64_t offset;
 	char *passthru;
+	char *channels[MIX_MAX_CHANNELS];
+	int nchannels;
+	float mix_level;
 	float volume;
 	int downmix;
 	int fmaudiotest;
@@ -112,6 +129,12 @@ typedef struct {
 	/* Video encoder state */
 	vid_t vid;
 	
+	/* Mixer for any extra channels, NULL if there are none */
+	mix_t *mix;
+	
+	/* Encoder to sink latency, NULL if not tracked */
+	latency_t *latency;
+	
 	/* RF sink interface */
 	void *rf_private;
 	hacktv_rf_write_t rf_write;
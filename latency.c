@@ -0,0 +1,266 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include "latency.h"
+
+static int64_t _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int _bin(int64_t ns)
+{
+	uint64_t us;
+	int e, b;
+	
+	us = ns > 0 ? ns / 1000 : 0;
+	if(us < 16) return(us);
+	
+	e = 63 - __builtin_clzll(us);
+	b = 16 + (e - 4) * 16 + ((us >> (e - 4)) & 15);
+	
+	return(b < LATENCY_BINS ? b : LATENCY_BINS - 1);
+}
+
+/* The middle of a bin, in ms */
+static double _bin_value(int b)
+{
+	uint64_t lo, width;
+	int e;
+	
+	if(b < 16) return(b / 1000.0);
+	
+	e = (b - 16) / 16 + 4;
+	lo = (uint64_t) (16 + (b - 16) % 16) << (e - 4);
+	width = (uint64_t) 1 << (e - 4);
+	
+	return((lo + width / 2.0) / 1000.0);
+}
+
+/* Time for the first n samples at the sample rate, in ns */
+static int64_t _sample_time(latency_t *l, uint64_t n)
+{
+	return((n / l->sample_rate) * 1000000000 + (n % l->sample_rate) * 1000000000 / l->sample_rate);
+}
+
+int latency_init(latency_t *l, int sample_rate, int pace, int report)
+{
+	int i;
+	
+	memset(l, 0, sizeof(latency_t));
+	
+	if(sample_rate <= 0)
+	{
+		return(-1);
+	}
+	
+	l->sample_rate = sample_rate;
+	l->pace = pace;
+	l->report = report;
+	
+	atomic_init(&l->head, 0);
+	atomic_init(&l->produced, 0);
+	atomic_init(&l->tail, 0);
+	atomic_init(&l->consumed, 0);
+	atomic_init(&l->count, 0);
+	atomic_init(&l->max, 0);
+	atomic_init(&l->depth_sum, 0);
+	atomic_init(&l->depth_max, 0);
+	atomic_init(&l->depth_count, 0);
+	
+	for(i = 0; i < LATENCY_BINS; i++)
+	{
+		atomic_init(&l->bins[i], 0);
+	}
+	
+	return(0);
+}
+
+void latency_produce(latency_t *l, size_t samples)
+{
+	uint64_t produced, consumed, depth;
+	unsigned int head;
+	int64_t now, t;
+	struct timespec ts;
+	
+	produced = atomic_load_explicit(&l->produced, memory_order_relaxed);
+	now = _now();
+	
+	if(l->start == 0)
+	{
+		l->start = now;
+		l->next_report = now + (int64_t) l->report * 1000000000;
+	}
+	
+	if(l->pace)
+	{
+		/* Hold this line back until the previous ones would
+		 * have finished playing. Once behind, don't wait */
+		t = l->start + _sample_time(l, produced);
+		
+		if(t > now)
+		{
+			ts.tv_sec = t / 1000000000;
+			ts.tv_nsec = t % 1000000000;
+			
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+			
+			now = _now();
+		}
+	}
+	
+	produced += samples;
+	atomic_store_explicit(&l->produced, produced, memory_order_relaxed);
+	
+	/* What is now between the encoder and the sink */
+	consumed = atomic_load_explicit(&l->consumed, memory_order_relaxed);
+	depth = produced > consumed ? produced - consumed : 0;
+	
+	atomic_fetch_add_explicit(&l->depth_sum, depth, memory_order_relaxed);
+	atomic_fetch_add_explicit(&l->depth_count, 1, memory_order_relaxed);
+	
+	if(depth > atomic_load_explicit(&l->depth_max, memory_order_relaxed))
+	{
+		atomic_store_explicit(&l->depth_max, depth, memory_order_relaxed);
+	}
+	
+	/* Timestamp the line if there is room for it */
+	head = atomic_load_explicit(&l->head, memory_order_relaxed);
+	
+	if(head - atomic_load_explicit(&l->tail, memory_order_acquire) < LATENCY_MARKS)
+	{
+		l->marks[head % LATENCY_MARKS].sample = produced;
+		l->marks[head % LATENCY_MARKS].time = now;
+		atomic_store_explicit(&l->head, head + 1, memory_order_release);
+	}
+	
+	if(l->report > 0 && now >= l->next_report)
+	{
+		latency_print(l);
+		l->next_report += (int64_t) l->report * 1000000000;
+	}
+}
+
+void latency_consume(latency_t *l, size_t samples)
+{
+	uint64_t consumed;
+	unsigned int head, tail;
+	latency_mark_t *m;
+	int64_t now, d;
+	
+	if(l == NULL || samples == 0)
+	{
+		return;
+	}
+	
+	consumed = atomic_load_explicit(&l->consumed, memory_order_relaxed) + samples;
+	atomic_store_explicit(&l->consumed, consumed, memory_order_relaxed);
+	
+	now = _now();
+	
+	/* Time every line whose last sample has now gone */
+	head = atomic_load_explicit(&l->head, memory_order_acquire);
+	tail = atomic_load_explicit(&l->tail, memory_order_relaxed);
+	
+	for(; tail != head; tail++)
+	{
+		m = &l->marks[tail % LATENCY_MARKS];
+		if(m->sample > consumed) break;
+		
+		d = now - m->time;
+		
+		atomic_fetch_add_explicit(&l->bins[_bin(d)], 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&l->count, 1, memory_order_relaxed);
+		
+		if(d > atomic_load_explicit(&l->max, memory_order_relaxed))
+		{
+			atomic_store_explicit(&l->max, d, memory_order_relaxed);
+		}
+	}
+	
+	atomic_store_explicit(&l->tail, tail, memory_order_release);
+}
+
+void latency_stats(latency_t *l, latency_stats_t *stats)
+{
+	uint64_t bins[LATENCY_BINS];
+	uint64_t n, c, produced, consumed, depth_count;
+	int i;
+	
+	memset(stats, 0, sizeof(latency_stats_t));
+	
+	for(n = i = 0; i < LATENCY_BINS; i++)
+	{
+		bins[i] = atomic_load_explicit(&l->bins[i], memory_order_relaxed);
+		n += bins[i];
+	}
+	
+	stats->count = n;
+	stats->max = atomic_load_explicit(&l->max, memory_order_relaxed) / 1000000.0;
+	
+	/* Percentiles from the histogram */
+	for(c = i = 0; i < LATENCY_BINS && n > 0; i++)
+	{
+		if(c < (n + 1) / 2 && c + bins[i] >= (n + 1) / 2)
+		{
+			stats->p50 = _bin_value(i);
+		}
+		
+		if(c < n - n / 100 && c + bins[i] >= n - n / 100)
+		{
+			stats->p99 = _bin_value(i);
+		}
+		
+		c += bins[i];
+	}
+	
+	produced = atomic_load_explicit(&l->produced, memory_order_relaxed);
+	consumed = atomic_load_explicit(&l->consumed, memory_order_relaxed);
+	depth_count = atomic_load_explicit(&l->depth_count, memory_order_relaxed);
+	
+	stats->depth = produced > consumed ? (produced - consumed) * 1000.0 / l->sample_rate : 0;
+	stats->max_depth = atomic_load_explicit(&l->depth_max, memory_order_relaxed) * 1000.0 / l->sample_rate;
+	
+	if(depth_count > 0)
+	{
+		stats->avg_depth = (double) atomic_load_explicit(&l->depth_sum, memory_order_relaxed) / depth_count * 1000.0 / l->sample_rate;
+	}
+}
+
+void latency_print(latency_t *l)
+{
+	latency_stats_t stats;
+	
+	latency_stats(l, &stats);
+	
+	fprintf(stderr, "\nlatency: %llu lines, p50 %.1f ms, p99 %.1f ms, max %.1f ms, buffer %.1f ms (avg %.1f ms, max %.1f ms)\n",
+		(unsigned long long) stats.count,
+		stats.p50, stats.p99, stats.max,
+		stats.depth, stats.avg_depth, stats.max_depth
+	);
+}
+
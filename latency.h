@@ -0,0 +1,111 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define LATENCY_CACHE_LINE 64
+
+/* Number of lines that can be in flight with a timestamp. Lines
+ * produced while this is full are not timed, but are still counted */
+#define LATENCY_MARKS 16384
+
+/* Latency histogram. Values in microseconds below 16 get a bin each,
+ * above that each power of two is split into 16 bins, so any value is
+ * reported to within about 6%. The last bin holds everything beyond */
+#define LATENCY_BINS (16 + 32 * 16)
+
+typedef struct {
+	uint64_t sample;	/* Sample count at the end of the line */
+	int64_t time;		/* When the line was produced, in ns */
+} latency_mark_t;
+
+/* Tracks how long samples take to get from the encoder to the sink.
+ * 
+ * The encoder calls latency_produce() for each line it hands to the
+ * sink, which records the time against the line's last sample. The sink
+ * calls latency_consume() as samples actually leave it, to the device,
+ * file or network, and this times any lines that are now complete.
+ * These may run on different threads, one producer and one consumer.
+ * 
+ * With pacing enabled latency_produce() also sleeps to hold the encoder
+ * to the sample rate, for sinks which would otherwise take samples as
+ * fast as they can be made. */
+typedef struct {
+	
+	/* Producer state */
+	_Alignas(LATENCY_CACHE_LINE) atomic_uint head;
+	atomic_uint_fast64_t produced;
+	int64_t start;
+	int64_t next_report;
+	atomic_uint_fast64_t depth_sum;
+	atomic_uint_fast64_t depth_max;
+	atomic_uint_fast64_t depth_count;
+	
+	/* Consumer state */
+	_Alignas(LATENCY_CACHE_LINE) atomic_uint tail;
+	atomic_uint_fast64_t consumed;
+	atomic_uint_fast64_t bins[LATENCY_BINS];
+	atomic_uint_fast64_t count;
+	atomic_int_fast64_t max;
+	
+	/* Fixed after latency_init() */
+	_Alignas(LATENCY_CACHE_LINE) int sample_rate;
+	int pace;
+	int report;
+	
+	latency_mark_t marks[LATENCY_MARKS];
+	
+} latency_t;
+
+typedef struct {
+	
+	/* Lines timed and the encoder to sink latency in ms */
+	uint64_t count;
+	double p50;
+	double p99;
+	double max;
+	
+	/* Samples between the encoder and the sink, in ms. Sampled
+	 * as each line is produced */
+	double depth;
+	double avg_depth;
+	double max_depth;
+	
+} latency_stats_t;
+
+/* report is the interval in seconds between printing the statistics
+ * while running, or 0 for none */
+extern int latency_init(latency_t *l, int sample_rate, int pace, int report);
+
+/* Producer side. Call with each line before passing it to the sink */
+extern void latency_produce(latency_t *l, size_t samples);
+
+/* Consumer side. Call as samples leave the sink. Does nothing if l is
+ * NULL, so sinks can call it without checking */
+extern void latency_consume(latency_t *l, size_t samples);
+
+/* Safe to call from any thread */
+extern void latency_stats(latency_t *l, latency_stats_t *stats);
+extern void latency_print(latency_t *l);
+
+#endif
+
@@ -1524,7 +1524,7 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		for(x = s->active_left; x < s->active_left + s->active_width; x++)
 		{
 			uint32_t rgb = (px != NULL ? *(px++) & 0xFFFFFF : 0x000000);
-			l->output[x * 2] = s->yiq_level_lookup[rgb].y;
+			l->output[x * 2] = vid_yiq_level(s, rgb).y;
 		}
 	}
 	
@@ -1538,7 +1538,8 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		for(x = s->mac.chrominance_left; x < s->mac.chrominance_left + s->mac.chrominance_width; x++)
 		{
 			uint32_t rgb = (px != NULL ? *(px++) & 0xFFFFFF : 0x000000);
-			l->output[x * 2] += (l->line & 1 ? s->yiq_level_lookup[rgb].q : s->yiq_level_lookup[rgb].i);
+			_yiq16_t yiq = vid_yiq_level(s, rgb);
+			l->output[x * 2] += (l->line & 1 ? yiq.q : yiq.i);
 			if(px != NULL) px++;
 		}
 	}
@@ -0,0 +1,329 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "hacktv.h"
+#include "mix.h"
+
+/* Fill one block from the channel's encoder */
+static void _render_block(mix_channel_t *ch, int16_t *block)
+{
+	mix_t *m = ch->mix;
+	size_t x, l;
+	
+	for(x = 0; x < MIX_BLOCK; x += l)
+	{
+		if(ch->line_left == 0)
+		{
+			ch->line = vid_next_line(&ch->vid, &ch->line_left);
+			
+			if(ch->line == NULL)
+			{
+				/* The input has ended. Play it again, or
+				 * carry on with a blank picture */
+				vid_av_close(&ch->vid);
+				
+				if(ch->repeat && m->open(&ch->vid, ch->input) != HACKTV_OK)
+				{
+					fprintf(stderr, "mix: Unable to reopen %s\n", ch->input);
+					ch->repeat = 0;
+				}
+				
+				ch->line_left = 0;
+				l = 0;
+				continue;
+			}
+		}
+		
+		l = MIX_BLOCK - x;
+		if(l > ch->line_left) l = ch->line_left;
+		
+		memcpy(&block[x * 2], ch->line, l * sizeof(int16_t) * 2);
+		ch->line += l * 2;
+		ch->line_left -= l;
+	}
+}
+
+static void *_channel_thread(void *arg)
+{
+	mix_channel_t *ch = arg;
+	mix_t *m = ch->mix;
+	int16_t *block;
+	
+	if(m->open(&ch->vid, ch->input) != HACKTV_OK)
+	{
+		fprintf(stderr, "mix: Unable to open %s, the channel will be blank\n", ch->input);
+	}
+	
+	pthread_mutex_lock(&m->mutex);
+	
+	while(!m->quit)
+	{
+		if(ch->ready == MIX_BUFFERS)
+		{
+			/* All blocks are full, wait for the mixer */
+			pthread_cond_wait(&m->cond, &m->mutex);
+			continue;
+		}
+		
+		block = ch->buffers[ch->in];
+		pthread_mutex_unlock(&m->mutex);
+		
+		_render_block(ch, block);
+		
+		pthread_mutex_lock(&m->mutex);
+		ch->in = (ch->in + 1) % MIX_BUFFERS;
+		ch->ready++;
+		pthread_cond_broadcast(&m->cond);
+	}
+	
+	pthread_mutex_unlock(&m->mutex);
+	
+	vid_av_close(&ch->vid);
+	
+	return(NULL);
+}
+
+int mix_init(mix_t *m, float level, mix_open_t open, int repeat)
+{
+	memset(m, 0, sizeof(mix_t));
+	
+	m->block = malloc(sizeof(int16_t) * 2 * MIX_BLOCK);
+	if(!m->block)
+	{
+		perror("malloc");
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* The gain is set once the number of channels is known */
+	m->gain = lround(level * 65536.0);
+	m->open = open;
+	m->repeat = repeat;
+	
+	pthread_mutex_init(&m->mutex, NULL);
+	pthread_cond_init(&m->cond, NULL);
+	
+	return(HACKTV_OK);
+}
+
+void mix_free(mix_t *m)
+{
+	mix_channel_t *ch;
+	int i, j;
+	
+	pthread_mutex_lock(&m->mutex);
+	m->quit = 1;
+	pthread_cond_broadcast(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		ch = m->channels[i];
+		
+		if(ch->thread_started)
+		{
+			pthread_join(ch->thread, NULL);
+		}
+		
+		vid_free(&ch->vid);
+		
+		for(j = 0; j < MIX_BUFFERS; j++)
+		{
+			free(ch->buffers[j]);
+		}
+		
+		free(ch);
+	}
+	
+	if(m->clipped > 0)
+	{
+		fprintf(stderr, "mix: %llu values clipped\n", (unsigned long long) m->clipped);
+	}
+	
+	pthread_mutex_destroy(&m->mutex);
+	pthread_cond_destroy(&m->cond);
+	
+	free(m->block);
+	memset(m, 0, sizeof(mix_t));
+}
+
+int mix_add_channel(mix_t *m, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t *conf, char *input)
+{
+	mix_channel_t *ch;
+	int i;
+	
+	if(m->nchannels == MIX_MAX_CHANNELS)
+	{
+		fprintf(stderr, "mix: No more than %d extra channels are supported\n", MIX_MAX_CHANNELS);
+		return(HACKTV_ERROR);
+	}
+	
+	ch = calloc(1, sizeof(mix_channel_t));
+	if(!ch)
+	{
+		perror("calloc");
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	if(vid_init(&ch->vid, sample_rate, pixel_rate, conf) != VID_OK)
+	{
+		fprintf(stderr, "mix: Unable to initialise the video encoder for %s\n", input);
+		free(ch);
+		return(HACKTV_ERROR);
+	}
+	
+	if(ch->vid.conf.output_type != HACKTV_INT16_COMPLEX)
+	{
+		fprintf(stderr, "mix: Only modes with a complex output can be mixed\n");
+		vid_free(&ch->vid);
+		free(ch);
+		return(HACKTV_ERROR);
+	}
+	
+	ch->input = input;
+	ch->repeat = m->repeat;
+	ch->mix = m;
+	
+	/* Register it now so mix_free() can clean up any failure below */
+	m->channels[m->nchannels++] = ch;
+	
+	for(i = 0; i < MIX_BUFFERS; i++)
+	{
+		ch->buffers[i] = malloc(sizeof(int16_t) * 2 * MIX_BLOCK);
+		if(!ch->buffers[i])
+		{
+			perror("malloc");
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+int mix_start(mix_t *m)
+{
+	mix_channel_t *ch;
+	int i;
+	
+	/* Share out the headroom between all the channels */
+	m->gain /= m->nchannels + 1;
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		ch = m->channels[i];
+		
+		if(pthread_create(&ch->thread, NULL, _channel_thread, ch) != 0)
+		{
+			perror("pthread_create");
+			return(HACKTV_ERROR);
+		}
+		
+		ch->thread_started = 1;
+	}
+	
+	return(HACKTV_OK);
+}
+
+size_t mix_write(mix_t *m, const int16_t *iq_data, size_t samples)
+{
+	size_t l;
+	
+	l = MIX_BLOCK - m->offset;
+	if(l > samples) l = samples;
+	
+	memcpy(&m->block[m->offset * 2], iq_data, l * sizeof(int16_t) * 2);
+	m->offset += l;
+	
+	return(l);
+}
+
+int16_t *mix_read(mix_t *m, int flush, size_t *samples)
+{
+	mix_channel_t *ch;
+	int16_t *b[MIX_MAX_CHANNELS];
+	int32_t v;
+	size_t x, n;
+	int i;
+	
+	if(m->offset < MIX_BLOCK && !(flush && m->offset > 0))
+	{
+		return(NULL);
+	}
+	
+	n = m->offset * 2;
+	
+	/* Wait for the other channels to catch up */
+	pthread_mutex_lock(&m->mutex);
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		ch = m->channels[i];
+		
+		while(ch->ready == 0)
+		{
+			pthread_cond_wait(&m->cond, &m->mutex);
+		}
+		
+		b[i] = ch->buffers[ch->out];
+	}
+	
+	pthread_mutex_unlock(&m->mutex);
+	
+	for(x = 0; x < n; x++)
+	{
+		v = m->block[x];
+		
+		for(i = 0; i < m->nchannels; i++)
+		{
+			v += b[i][x];
+		}
+		
+		v = ((int64_t) v * m->gain + 32768) >> 16;
+		
+		if(v > INT16_MAX || v < INT16_MIN)
+		{
+			v = v > INT16_MAX ? INT16_MAX : INT16_MIN;
+			m->clipped++;
+		}
+		
+		m->block[x] = v;
+	}
+	
+	/* Hand the blocks back */
+	pthread_mutex_lock(&m->mutex);
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		ch = m->channels[i];
+		ch->out = (ch->out + 1) % MIX_BUFFERS;
+		ch->ready--;
+	}
+	
+	pthread_cond_broadcast(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+	
+	*samples = m->offset;
+	m->offset = 0;
+	
+	return(m->block);
+}
+
@@ -0,0 +1,110 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _MIX_H
+#define _MIX_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "video.h"
+
+/* Multi-channel mixer. Each extra channel has its own video encoder,
+ * rendered on its own thread into blocks of MIX_BLOCK samples. The main
+ * channel is fed in by the caller and summed with the matching block of
+ * every other channel, so all the channels stay sample-locked.
+ * 
+ * The sum is scaled by level divided by the number of channels, the
+ * main one included, so it can't clip at a level of 1.0. Higher levels trade headroom for power and saturate if the
+ * channels peak together. */
+
+#define MIX_MAX_CHANNELS 16
+
+/* Samples per block, and blocks each channel may render ahead */
+#define MIX_BLOCK   65536
+#define MIX_BUFFERS 4
+
+/* Opens input on the encoder, as for the main channel */
+typedef int (*mix_open_t)(vid_t *vid, char *input);
+
+typedef struct {
+	
+	vid_t vid;
+	char *input;
+	int repeat;
+	
+	/* Rendered blocks. The thread fills them in turn from in,
+	 * the mixer sums them in turn from out */
+	int16_t *buffers[MIX_BUFFERS];
+	int in;
+	int out;
+	int ready;
+	
+	/* The rest of the last line that didn't fit in a block */
+	int16_t *line;
+	size_t line_left;
+	
+	pthread_t thread;
+	int thread_started;
+	
+	struct _mix_t *mix;
+	
+} mix_channel_t;
+
+typedef struct _mix_t {
+	
+	mix_channel_t *channels[MIX_MAX_CHANNELS];
+	int nchannels;
+	
+	/* Gain applied to the sum, 16.16 fixed point */
+	int32_t gain;
+	
+	/* The main channel's block and the mixed output */
+	int16_t *block;
+	size_t offset;
+	
+	mix_open_t open;
+	int repeat;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	
+	/* Output values that had to be clipped */
+	uint64_t clipped;
+	
+} mix_t;
+
+extern int mix_init(mix_t *m, float level, mix_open_t open, int repeat);
+extern void mix_free(mix_t *m);
+
+/* Set up an extra channel and the encoder for it */
+extern int mix_add_channel(mix_t *m, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t *conf, char *input);
+
+/* Start rendering the extra channels. Call once the input libraries
+ * have been initialised */
+extern int mix_start(mix_t *m);
+
+/* Feed in the main channel. Takes up to samples, stopping early if a
+ * block is complete, and returns the number taken */
+extern size_t mix_write(mix_t *m, const int16_t *iq_data, size_t samples);
+
+/* Returns the mixed block if complete, or if flush is set any part
+ * block there is, and sets samples to its length. Otherwise NULL */
+extern int16_t *mix_read(mix_t *m, int flush, size_t *samples);
+
+#endif
+
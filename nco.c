@@ -0,0 +1,591 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Block FM and AM modulators for the audio subcarriers. The sine and
+ * cosine of the phase are calculated with short polynomials in single
+ * precision, which vectorise without table lookups. The vector kernels
+ * use the same operations in the same order as the scalar ones and so
+ * produce exactly the same output. */
+
+#include <stdint.h>
+#include <math.h>
+#include "nco.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Radians per phase step */
+#define NCO_RAD ((float) (2.0 * M_PI / 4294967296.0))
+
+/* Taylor series for sin() and cos(), accurate to better than 1e-6
+ * over the +/- pi/4 range left after removing the quadrant */
+#define NCO_S3 (-1.0f / 6.0f)
+#define NCO_S5 (1.0f / 120.0f)
+#define NCO_S7 (-1.0f / 5040.0f)
+#define NCO_C2 (-1.0f / 2.0f)
+#define NCO_C4 (1.0f / 24.0f)
+#define NCO_C6 (-1.0f / 720.0f)
+#define NCO_C8 (1.0f / 40320.0f)
+
+typedef void (*_nco_add_t)(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n);
+
+/* Returns the cosine and sine of phase p, scaled to INT16_MAX */
+static inline void _sincos(uint32_t p, int32_t *c, int32_t *s)
+{
+	uint32_t q;
+	float t, t2, sn, cs, x, y;
+	
+	/* Split into the nearest quadrant and the remaining angle */
+	q = (p + (1 << 29)) >> 30;
+	t = (float) (int32_t) (p - (q << 30)) * NCO_RAD;
+	t2 = t * t;
+	
+	sn = t * (1.0f + t2 * (NCO_S3 + t2 * (NCO_S5 + t2 * NCO_S7)));
+	cs = 1.0f + t2 * (NCO_C2 + t2 * (NCO_C4 + t2 * (NCO_C6 + t2 * NCO_C8)));
+	
+	/* Rotate by the quadrant */
+	x = q & 1 ? -sn : cs;
+	y = q & 1 ? cs : sn;
+	
+	*c = (int32_t) (x * INT16_MAX);
+	*s = (int32_t) (y * INT16_MAX);
+	
+	if(q & 2)
+	{
+		*c = -*c;
+		*s = -*s;
+	}
+}
+
+static void _fm_add_scalar(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	uint32_t p = s->phase;
+	int32_t c, sn;
+	int x;
+	
+	for(x = 0; x < n; x++, in += istep, dst += 2)
+	{
+		p += s->delta + (uint32_t) (((int32_t) *in * s->scale) >> s->shift);
+		_sincos(p, &c, &sn);
+		
+		dst[0] += (c * s->level) >> 15;
+		dst[1] += (sn * s->level) >> 15;
+	}
+	
+	s->phase = p;
+}
+
+static void _am_add_scalar(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	uint32_t p = s->phase;
+	int32_t a, c, sn;
+	int x;
+	
+	for(x = 0; x < n; x++, in += istep, dst += 2)
+	{
+		p += s->delta;
+		_sincos(p, &c, &sn);
+		a = ((int32_t) *in - INT16_MIN) / 2;
+		
+		dst[0] += (((c * a) >> 15) * s->level) >> 15;
+		dst[1] += (((sn * a) >> 15) * s->level) >> 15;
+	}
+	
+	s->phase = p;
+}
+
+/* The vector loops read whole vectors of input, so they stop one
+ * sample early to keep the reads inside the last input sample */
+
+#if defined(CPU_X86)
+
+/* SSE2 has no 32-bit multiply, so build one from the 64-bit one */
+__attribute__((target("sse2")))
+static __m128i _mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i e, o;
+	
+	e = _mm_mul_epu32(a, b);
+	o = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	
+	return(_mm_unpacklo_epi32(
+		_mm_shuffle_epi32(e, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(o, _MM_SHUFFLE(0, 0, 2, 0))
+	));
+}
+
+__attribute__((target("sse2")))
+static void _sincos_sse2(__m128i p, __m128i *c, __m128i *s)
+{
+	__m128i q;
+	__m128 t, t2, sn, cs, x, y, m, neg;
+	
+	q = _mm_srli_epi32(_mm_add_epi32(p, _mm_set1_epi32(1 << 29)), 30);
+	t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(p, _mm_slli_epi32(q, 30))), _mm_set1_ps(NCO_RAD));
+	t2 = _mm_mul_ps(t, t);
+	
+	sn = _mm_add_ps(_mm_set1_ps(NCO_S5), _mm_mul_ps(t2, _mm_set1_ps(NCO_S7)));
+	sn = _mm_add_ps(_mm_set1_ps(NCO_S3), _mm_mul_ps(t2, sn));
+	sn = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(t2, sn));
+	sn = _mm_mul_ps(t, sn);
+	
+	cs = _mm_add_ps(_mm_set1_ps(NCO_C6), _mm_mul_ps(t2, _mm_set1_ps(NCO_C8)));
+	cs = _mm_add_ps(_mm_set1_ps(NCO_C4), _mm_mul_ps(t2, cs));
+	cs = _mm_add_ps(_mm_set1_ps(NCO_C2), _mm_mul_ps(t2, cs));
+	cs = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(t2, cs));
+	
+	/* Rotate by the quadrant, swapping for odd quadrants and
+	 * flipping the sign bits for quadrants 2 and 3 */
+	m = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	x = _mm_or_ps(_mm_and_ps(m, _mm_xor_ps(sn, _mm_set1_ps(-0.0f))), _mm_andnot_ps(m, cs));
+	y = _mm_or_ps(_mm_and_ps(m, cs), _mm_andnot_ps(m, sn));
+	
+	neg = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+	x = _mm_xor_ps(x, neg);
+	y = _mm_xor_ps(y, neg);
+	
+	*c = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(INT16_MAX)));
+	*s = _mm_cvttps_epi32(_mm_mul_ps(y, _mm_set1_ps(INT16_MAX)));
+}
+
+/* Load four input samples every istep samples */
+__attribute__((target("sse2")))
+static __m128i _load_sse2(const int16_t *in, int istep)
+{
+	__m128i v;
+	
+	if(istep == 0)
+	{
+		return(_mm_set1_epi32(in[0]));
+	}
+	else if(istep == 2)
+	{
+		/* Sign extend the low half of each 32-bit word */
+		v = _mm_loadu_si128((const __m128i *) in);
+		return(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+	}
+	
+	return(_mm_setr_epi32(in[istep * 0], in[istep * 1], in[istep * 2], in[istep * 3]));
+}
+
+/* Running sum of the four lanes of v */
+__attribute__((target("sse2")))
+static __m128i _scan_epi32_sse2(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+	v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+	
+	return(v);
+}
+
+/* Add four I and Q values to the interleaved samples in dst */
+__attribute__((target("sse2")))
+static void _add_iq_sse2(int16_t *dst, __m128i i, __m128i q)
+{
+	i = _mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(q, 16));
+	_mm_storeu_si128((__m128i *) dst, _mm_add_epi16(_mm_loadu_si128((const __m128i *) dst), i));
+}
+
+__attribute__((target("sse2")))
+static void _fm_add_sse2(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const __m128i delta = _mm_set1_epi32(s->delta);
+	const __m128i scale = _mm_set1_epi32(s->scale);
+	const __m128i level = _mm_set1_epi32(s->level);
+	const __m128i shift = _mm_cvtsi32_si128(s->shift);
+	__m128i p, v, c, sn;
+	int x;
+	
+	p = _mm_set1_epi32(s->phase);
+	
+	for(x = 0; x + 4 < n; x += 4, in += istep * 4, dst += 8)
+	{
+		v = _mm_sra_epi32(_mullo_epi32_sse2(_load_sse2(in, istep), scale), shift);
+		v = _scan_epi32_sse2(_mm_add_epi32(v, delta));
+		v = _mm_add_epi32(v, p);
+		
+		_sincos_sse2(v, &c, &sn);
+		c = _mm_srai_epi32(_mullo_epi32_sse2(c, level), 15);
+		sn = _mm_srai_epi32(_mullo_epi32_sse2(sn, level), 15);
+		_add_iq_sse2(dst, c, sn);
+		
+		p = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	
+	s->phase = _mm_cvtsi128_si32(p);
+	
+	_fm_add_scalar(s, dst, in, istep, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _am_add_sse2(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const __m128i step = _mm_setr_epi32(s->delta * 1, s->delta * 2, s->delta * 3, s->delta * 4);
+	const __m128i level = _mm_set1_epi32(s->level);
+	__m128i p, v, a, c, sn;
+	int x;
+	
+	p = _mm_set1_epi32(s->phase);
+	
+	for(x = 0; x + 4 < n; x += 4, in += istep * 4, dst += 8)
+	{
+		a = _load_sse2(in, istep);
+		a = _mm_srai_epi32(_mm_sub_epi32(a, _mm_set1_epi32(INT16_MIN)), 1);
+		v = _mm_add_epi32(p, step);
+		
+		_sincos_sse2(v, &c, &sn);
+		c = _mm_srai_epi32(_mullo_epi32_sse2(_mm_srai_epi32(_mullo_epi32_sse2(c, a), 15), level), 15);
+		sn = _mm_srai_epi32(_mullo_epi32_sse2(_mm_srai_epi32(_mullo_epi32_sse2(sn, a), 15), level), 15);
+		_add_iq_sse2(dst, c, sn);
+		
+		p = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	
+	s->phase = _mm_cvtsi128_si32(p);
+	
+	_am_add_scalar(s, dst, in, istep, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _sincos_avx2(__m256i p, __m256i *c, __m256i *s)
+{
+	__m256i q;
+	__m256 t, t2, sn, cs, x, y, m, neg;
+	
+	q = _mm256_srli_epi32(_mm256_add_epi32(p, _mm256_set1_epi32(1 << 29)), 30);
+	t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(p, _mm256_slli_epi32(q, 30))), _mm256_set1_ps(NCO_RAD));
+	t2 = _mm256_mul_ps(t, t);
+	
+	sn = _mm256_add_ps(_mm256_set1_ps(NCO_S5), _mm256_mul_ps(t2, _mm256_set1_ps(NCO_S7)));
+	sn = _mm256_add_ps(_mm256_set1_ps(NCO_S3), _mm256_mul_ps(t2, sn));
+	sn = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(t2, sn));
+	sn = _mm256_mul_ps(t, sn);
+	
+	cs = _mm256_add_ps(_mm256_set1_ps(NCO_C6), _mm256_mul_ps(t2, _mm256_set1_ps(NCO_C8)));
+	cs = _mm256_add_ps(_mm256_set1_ps(NCO_C4), _mm256_mul_ps(t2, cs));
+	cs = _mm256_add_ps(_mm256_set1_ps(NCO_C2), _mm256_mul_ps(t2, cs));
+	cs = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(t2, cs));
+	
+	/* Rotate by the quadrant, swapping for odd quadrants and
+	 * flipping the sign bits for quadrants 2 and 3 */
+	m = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+	x = _mm256_blendv_ps(cs, _mm256_xor_ps(sn, _mm256_set1_ps(-0.0f)), m);
+	y = _mm256_blendv_ps(sn, cs, m);
+	
+	neg = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+	x = _mm256_xor_ps(x, neg);
+	y = _mm256_xor_ps(y, neg);
+	
+	*c = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(INT16_MAX)));
+	*s = _mm256_cvttps_epi32(_mm256_mul_ps(y, _mm256_set1_ps(INT16_MAX)));
+}
+
+/* Load eight input samples every istep samples */
+__attribute__((target("avx2")))
+static __m256i _load_avx2(const int16_t *in, int istep)
+{
+	__m256i v;
+	
+	if(istep == 0)
+	{
+		return(_mm256_set1_epi32(in[0]));
+	}
+	else if(istep == 2)
+	{
+		/* Sign extend the low half of each 32-bit word */
+		v = _mm256_loadu_si256((const __m256i *) in);
+		return(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+	}
+	
+	return(_mm256_setr_epi32(
+		in[istep * 0], in[istep * 1], in[istep * 2], in[istep * 3],
+		in[istep * 4], in[istep * 5], in[istep * 6], in[istep * 7]
+	));
+}
+
+/* Running sum of the eight lanes of v */
+__attribute__((target("avx2")))
+static __m256i _scan_epi32_avx2(__m256i v)
+{
+	__m256i t;
+	
+	v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+	v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+	
+	/* Carry the low lane total into the high lane */
+	t = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(3));
+	
+	return(_mm256_add_epi32(v, _mm256_blend_epi32(_mm256_setzero_si256(), t, 0xF0)));
+}
+
+/* Add eight I and Q values to the interleaved samples in dst */
+__attribute__((target("avx2")))
+static void _add_iq_avx2(int16_t *dst, __m256i i, __m256i q)
+{
+	i = _mm256_or_si256(_mm256_and_si256(i, _mm256_set1_epi32(0xFFFF)), _mm256_slli_epi32(q, 16));
+	_mm256_storeu_si256((__m256i *) dst, _mm256_add_epi16(_mm256_loadu_si256((const __m256i *) dst), i));
+}
+
+__attribute__((target("avx2")))
+static void _fm_add_avx2(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const __m256i delta = _mm256_set1_epi32(s->delta);
+	const __m256i scale = _mm256_set1_epi32(s->scale);
+	const __m256i level = _mm256_set1_epi32(s->level);
+	const __m128i shift = _mm_cvtsi32_si128(s->shift);
+	__m256i p, v, c, sn;
+	int x;
+	
+	p = _mm256_set1_epi32(s->phase);
+	
+	for(x = 0; x + 8 < n; x += 8, in += istep * 8, dst += 16)
+	{
+		v = _mm256_sra_epi32(_mm256_mullo_epi32(_load_avx2(in, istep), scale), shift);
+		v = _scan_epi32_avx2(_mm256_add_epi32(v, delta));
+		v = _mm256_add_epi32(v, p);
+		
+		_sincos_avx2(v, &c, &sn);
+		c = _mm256_srai_epi32(_mm256_mullo_epi32(c, level), 15);
+		sn = _mm256_srai_epi32(_mm256_mullo_epi32(sn, level), 15);
+		_add_iq_avx2(dst, c, sn);
+		
+		p = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(7));
+	}
+	
+	s->phase = _mm256_cvtsi256_si32(p);
+	
+	/* Avoid the AVX to SSE transition penalty in the tail */
+	_mm256_zeroupper();
+	
+	_fm_add_scalar(s, dst, in, istep, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _am_add_avx2(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const __m256i step = _mm256_mullo_epi32(_mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8), _mm256_set1_epi32(s->delta));
+	const __m256i level = _mm256_set1_epi32(s->level);
+	__m256i p, v, a, c, sn;
+	int x;
+	
+	p = _mm256_set1_epi32(s->phase);
+	
+	for(x = 0; x + 8 < n; x += 8, in += istep * 8, dst += 16)
+	{
+		a = _load_avx2(in, istep);
+		a = _mm256_srai_epi32(_mm256_sub_epi32(a, _mm256_set1_epi32(INT16_MIN)), 1);
+		v = _mm256_add_epi32(p, step);
+		
+		_sincos_avx2(v, &c, &sn);
+		c = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(c, a), 15), level), 15);
+		sn = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(sn, a), 15), level), 15);
+		_add_iq_avx2(dst, c, sn);
+		
+		p = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(7));
+	}
+	
+	s->phase = _mm256_cvtsi256_si32(p);
+	
+	/* Avoid the AVX to SSE transition penalty in the tail */
+	_mm256_zeroupper();
+	
+	_am_add_scalar(s, dst, in, istep, n - x);
+}
+
+#elif defined(CPU_ARM_NEON)
+
+static void _sincos_neon(uint32x4_t p, int32x4_t *c, int32x4_t *s)
+{
+	uint32x4_t q, m, neg;
+	float32x4_t t, t2, sn, cs, x, y;
+	
+	q = vshrq_n_u32(vaddq_u32(p, vdupq_n_u32(1 << 29)), 30);
+	t = vmulq_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(vsubq_u32(p, vshlq_n_u32(q, 30)))), vdupq_n_f32(NCO_RAD));
+	t2 = vmulq_f32(t, t);
+	
+	sn = vaddq_f32(vdupq_n_f32(NCO_S5), vmulq_f32(t2, vdupq_n_f32(NCO_S7)));
+	sn = vaddq_f32(vdupq_n_f32(NCO_S3), vmulq_f32(t2, sn));
+	sn = vaddq_f32(vdupq_n_f32(1.0f), vmulq_f32(t2, sn));
+	sn = vmulq_f32(t, sn);
+	
+	cs = vaddq_f32(vdupq_n_f32(NCO_C6), vmulq_f32(t2, vdupq_n_f32(NCO_C8)));
+	cs = vaddq_f32(vdupq_n_f32(NCO_C4), vmulq_f32(t2, cs));
+	cs = vaddq_f32(vdupq_n_f32(NCO_C2), vmulq_f32(t2, cs));
+	cs = vaddq_f32(vdupq_n_f32(1.0f), vmulq_f32(t2, cs));
+	
+	/* Rotate by the quadrant */
+	m = vtstq_u32(q, vdupq_n_u32(1));
+	x = vbslq_f32(m, vnegq_f32(sn), cs);
+	y = vbslq_f32(m, cs, sn);
+	
+	neg = vshlq_n_u32(vandq_u32(q, vdupq_n_u32(2)), 30);
+	x = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(x), neg));
+	y = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(y), neg));
+	
+	*c = vcvtq_s32_f32(vmulq_f32(x, vdupq_n_f32(INT16_MAX)));
+	*s = vcvtq_s32_f32(vmulq_f32(y, vdupq_n_f32(INT16_MAX)));
+}
+
+/* Load four input samples every istep samples */
+static int32x4_t _load_neon(const int16_t *in, int istep)
+{
+	int32_t v[4] = { in[istep * 0], in[istep * 1], in[istep * 2], in[istep * 3] };
+	return(vld1q_s32(v));
+}
+
+/* Running sum of the four lanes of v */
+static uint32x4_t _scan_u32_neon(uint32x4_t v)
+{
+	const uint32x4_t z = vdupq_n_u32(0);
+	
+	v = vaddq_u32(v, vextq_u32(z, v, 3));
+	v = vaddq_u32(v, vextq_u32(z, v, 2));
+	
+	return(v);
+}
+
+/* Add four I and Q values to the interleaved samples in dst */
+static void _add_iq_neon(int16_t *dst, int32x4_t i, int32x4_t q)
+{
+	int16x4x2_t v = vld2_s16(dst);
+	
+	v.val[0] = vadd_s16(v.val[0], vmovn_s32(i));
+	v.val[1] = vadd_s16(v.val[1], vmovn_s32(q));
+	vst2_s16(dst, v);
+}
+
+static void _fm_add_neon(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const uint32x4_t delta = vdupq_n_u32(s->delta);
+	const int32x4_t shift = vdupq_n_s32(-s->shift);
+	int32x4_t c, sn;
+	uint32x4_t p, v;
+	int x;
+	
+	p = vdupq_n_u32(s->phase);
+	
+	for(x = 0; x + 4 < n; x += 4, in += istep * 4, dst += 8)
+	{
+		v = vreinterpretq_u32_s32(vshlq_s32(vmulq_n_s32(_load_neon(in, istep), s->scale), shift));
+		v = vaddq_u32(_scan_u32_neon(vaddq_u32(v, delta)), p);
+		
+		_sincos_neon(v, &c, &sn);
+		c = vshrq_n_s32(vmulq_n_s32(c, s->level), 15);
+		sn = vshrq_n_s32(vmulq_n_s32(sn, s->level), 15);
+		_add_iq_neon(dst, c, sn);
+		
+		p = vdupq_laneq_u32(v, 3);
+	}
+	
+	s->phase = vgetq_lane_u32(p, 0);
+	
+	_fm_add_scalar(s, dst, in, istep, n - x);
+}
+
+static void _am_add_neon(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	const uint32_t st[4] = { s->delta * 1, s->delta * 2, s->delta * 3, s->delta * 4 };
+	const uint32x4_t step = vld1q_u32(st);
+	int32x4_t a, c, sn;
+	uint32x4_t p, v;
+	int x;
+	
+	p = vdupq_n_u32(s->phase);
+	
+	for(x = 0; x + 4 < n; x += 4, in += istep * 4, dst += 8)
+	{
+		a = vshrq_n_s32(vsubq_s32(_load_neon(in, istep), vdupq_n_s32(INT16_MIN)), 1);
+		v = vaddq_u32(p, step);
+		
+		_sincos_neon(v, &c, &sn);
+		c = vshrq_n_s32(vmulq_n_s32(vshrq_n_s32(vmulq_s32(c, a), 15), s->level), 15);
+		sn = vshrq_n_s32(vmulq_n_s32(vshrq_n_s32(vmulq_s32(sn, a), 15), s->level), 15);
+		_add_iq_neon(dst, c, sn);
+		
+		p = vdupq_laneq_u32(v, 3);
+	}
+	
+	s->phase = vgetq_lane_u32(p, 0);
+	
+	_am_add_scalar(s, dst, in, istep, n - x);
+}
+
+#endif
+
+static _nco_add_t _fm_add = _fm_add_scalar;
+static _nco_add_t _am_add = _am_add_scalar;
+
+/* Select the kernels for this CPU. Called by nco_init(), before
+ * any oscillator can be running on another thread */
+static void _init_kernels(void)
+{
+	int f = cpu_features();
+	
+#if defined(CPU_X86)
+	if(f & CPU_SSE2)
+	{
+		_fm_add = _fm_add_sse2;
+		_am_add = _am_add_sse2;
+	}
+	
+	if(f & CPU_AVX2)
+	{
+		_fm_add = _fm_add_avx2;
+		_am_add = _am_add_avx2;
+	}
+#elif defined(CPU_ARM_NEON)
+	if(f & CPU_NEON)
+	{
+		_fm_add = _fm_add_neon;
+		_am_add = _am_add_neon;
+	}
+#endif
+}
+
+void nco_init(nco_t *s, int sample_rate, double frequency, double deviation, double level)
+{
+	double d;
+	
+	_init_kernels();
+	
+	s->phase = 0;
+	s->level = round(INT16_MAX * level);
+	s->delta = (uint32_t) llround(frequency / sample_rate * 4294967296.0);
+	
+	/* Phase step per input level. Keep as many fractional bits as
+	 * the largest input can be multiplied by without overflowing */
+	d = fabs(deviation) / INT16_MAX / sample_rate * 4294967296.0;
+	
+	for(s->shift = 24; s->shift > 0 && d * (1 << s->shift) >= 65535.0; s->shift--);
+	
+	s->scale = lround(deviation / INT16_MAX / sample_rate * 4294967296.0 * (1 << s->shift));
+}
+
+void nco_fm_add(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	_fm_add(s, dst, in, istep, n);
+}
+
+void nco_am_add(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n)
+{
+	_am_add(s, dst, in, istep, n);
+}
+
@@ -0,0 +1,45 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _NCO_H
+#define _NCO_H
+
+#include <stdint.h>
+
+/* Numerically controlled oscillator for the audio subcarriers. The phase
+ * is a 32-bit accumulator, advanced by delta each sample plus, for FM,
+ * the input level times scale >> shift. The output is calculated from
+ * the phase directly, so the amplitude never needs correcting. */
+typedef struct {
+	uint32_t phase;
+	uint32_t delta;
+	int32_t scale;
+	int shift;
+	int16_t level;
+} nco_t;
+
+/* Set up an oscillator at frequency Hz. deviation is the peak FM
+ * deviation in Hz (+/-) for a full scale input, 0 for AM only */
+extern void nco_init(nco_t *s, int sample_rate, double frequency, double deviation, double level);
+
+/* Modulate n samples of in (every istep samples) onto the carrier and
+ * add the result to the interleaved I/Q samples in dst */
+extern void nco_fm_add(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n);
+extern void nco_am_add(nco_t *s, int16_t *dst, const int16_t *in, int istep, int n);
+
+#endif
+
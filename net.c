@@ -0,0 +1,400 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Network sink. Samples are converted, split into packets with a small
+ * header and sent in batches with sendmmsg(), over UDP or TCP. The
+ * header lets the receiver spot lost or reordered packets. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "hacktv.h"
+#include "net.h"
+#include "convert.h"
+
+/* Packets sent per system call */
+#define NET_BATCH 64
+
+/* Largest UDP payload over IPv4, header included */
+#define NET_UDP_MAX 65507
+
+typedef struct {
+	
+	int fd;
+	int protocol;
+	
+	/* Sample converter */
+	convert_t conv;
+	int values;
+	
+	/* Samples per full packet and bytes per sample */
+	size_t packet_samples;
+	size_t sample_size;
+	
+	/* Batch of packets being built, the last one partly filled */
+	uint8_t *buffer;
+	size_t packet_size;
+	struct mmsghdr msgs[NET_BATCH];
+	struct iovec iov[NET_BATCH];
+	int count;
+	size_t fill;
+	
+	/* Header state */
+	uint32_t sequence;
+	uint64_t sample;
+	
+	/* Samples sent, for the latency tracking */
+	latency_t *latency;
+	uint64_t sent;
+	
+	/* Statistics */
+	uint64_t packets;
+	uint64_t bytes;
+	
+} rf_net_t;
+
+static uint8_t *_packet(rf_net_t *rf, int i)
+{
+	return(rf->buffer + i * (sizeof(rf_net_header_t) + rf->packet_size));
+}
+
+static int _send_all(rf_net_t *rf, const uint8_t *data, size_t length)
+{
+	ssize_t r;
+	
+	while(length)
+	{
+		r = send(rf->fd, data, length, MSG_NOSIGNAL);
+		
+		if(r < 0)
+		{
+			if(errno == EINTR) continue;
+			perror("send");
+			return(HACKTV_ERROR);
+		}
+		
+		data += r;
+		length -= r;
+	}
+	
+	return(HACKTV_OK);
+}
+
+/* Fill in the header of the current packet and send the batch if full */
+static int _finish_packet(rf_net_t *rf, int flush)
+{
+	rf_net_header_t *h;
+	struct timespec ts;
+	int i, n, r;
+	
+	if(rf->fill > 0)
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		
+		h = (rf_net_header_t *) _packet(rf, rf->count);
+		h->sequence = htole32(rf->sequence++);
+		h->samples = htole16(rf->fill);
+		h->type = rf->conv.type;
+		h->complex = rf->values == 2;
+		h->sample = htole64(rf->sample);
+		h->time = htole64((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+		
+		rf->iov[rf->count].iov_len = sizeof(rf_net_header_t) + rf->fill * rf->sample_size;
+		rf->sample += rf->fill;
+		rf->fill = 0;
+		rf->count++;
+	}
+	
+	if(rf->count < NET_BATCH && !(flush && rf->count > 0))
+	{
+		return(HACKTV_OK);
+	}
+	
+	for(i = 0; i < rf->count; i += n)
+	{
+		n = sendmmsg(rf->fd, &rf->msgs[i], rf->count - i, MSG_NOSIGNAL);
+		
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				n = 0;
+				continue;
+			}
+			
+			/* Nobody listening yet is not fatal for UDP */
+			if(rf->protocol == RF_NET_UDP && errno == ECONNREFUSED)
+			{
+				break;
+			}
+			
+			perror("sendmmsg");
+			return(HACKTV_ERROR);
+		}
+		
+		if(n == 0) break;
+		
+		/* A stream socket may take only part of the last message */
+		if(rf->protocol == RF_NET_TCP && rf->msgs[i + n - 1].msg_len < rf->iov[i + n - 1].iov_len)
+		{
+			r = _send_all(rf,
+				(uint8_t *) rf->iov[i + n - 1].iov_base + rf->msgs[i + n - 1].msg_len,
+				rf->iov[i + n - 1].iov_len - rf->msgs[i + n - 1].msg_len
+			);
+			
+			if(r != HACKTV_OK) return(r);
+		}
+	}
+	
+	for(i = 0; i < rf->count; i++)
+	{
+		rf->bytes += rf->iov[i].iov_len;
+	}
+	
+	rf->packets += rf->count;
+	rf->count = 0;
+	
+	latency_consume(rf->latency, rf->sample - rf->sent);
+	rf->sent = rf->sample;
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_net_write(void *private, int16_t *iq_data, size_t samples)
+{
+	rf_net_t *rf = private;
+	uint8_t *p;
+	size_t l;
+	
+	while(samples)
+	{
+		l = rf->packet_samples - rf->fill;
+		if(l > samples) l = samples;
+		
+		p = _packet(rf, rf->count) + sizeof(rf_net_header_t) + rf->fill * rf->sample_size;
+		convert(&rf->conv, p, iq_data, l * rf->values);
+		
+		rf->fill += l;
+		iq_data += l * 2;
+		samples -= l;
+		
+		if(rf->fill == rf->packet_samples)
+		{
+			if(_finish_packet(rf, 0) != HACKTV_OK)
+			{
+				return(HACKTV_ERROR);
+			}
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+static int _rf_net_close(void *private)
+{
+	rf_net_t *rf = private;
+	int r = HACKTV_OK;
+	
+	if(rf->fd >= 0)
+	{
+		/* Send anything still waiting */
+		r = _finish_packet(rf, 1);
+		
+		fprintf(stderr, "net: Sent %llu packets, %.1f MiB\n",
+			(unsigned long long) rf->packets,
+			rf->bytes / 1048576.0
+		);
+		
+		close(rf->fd);
+	}
+	
+	free(rf->buffer);
+	free(rf);
+	
+	return(r);
+}
+
+static int _connect(rf_net_t *rf, const char *target)
+{
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int r;
+	
+	/* Split host:port, allowing [addr]:port for IPv6 */
+	host = strdup(target);
+	if(!host)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	port = strrchr(host, ':');
+	if(port == NULL || port[1] == '\0')
+	{
+		fprintf(stderr, "net: Expected <host>:<port>, got '%s'\n", target);
+		free(host);
+		return(HACKTV_ERROR);
+	}
+	
+	*(port++) = '\0';
+	
+	if(host[0] == '[' && host[strlen(host) - 1] == ']')
+	{
+		memmove(host, host + 1, strlen(host));
+		host[strlen(host) - 1] = '\0';
+	}
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = rf->protocol == RF_NET_TCP ? SOCK_STREAM : SOCK_DGRAM;
+	
+	r = getaddrinfo(host, port, &hints, &res);
+	if(r != 0)
+	{
+		fprintf(stderr, "net: %s: %s\n", target, gai_strerror(r));
+		free(host);
+		return(HACKTV_ERROR);
+	}
+	
+	for(ai = res; ai; ai = ai->ai_next)
+	{
+		rf->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(rf->fd < 0) continue;
+		
+		if(connect(rf->fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		
+		close(rf->fd);
+		rf->fd = -1;
+	}
+	
+	freeaddrinfo(res);
+	free(host);
+	
+	if(rf->fd < 0)
+	{
+		perror(target);
+		return(HACKTV_ERROR);
+	}
+	
+	return(HACKTV_OK);
+}
+
+int rf_net_open(hacktv_t *s, const char *target, int protocol, int type, int packet_size)
+{
+	rf_net_t *rf;
+	size_t stride;
+	int complex;
+	int i, r;
+	
+	if(target == NULL)
+	{
+		fprintf(stderr, "net: No <host>:<port> provided.\n");
+		return(HACKTV_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_net_t));
+	if(!rf)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	rf->fd = -1;
+	rf->protocol = protocol;
+	
+	complex = s->vid.conf.output_type == HACKTV_INT16_COMPLEX;
+	rf->values = complex ? 2 : 1;
+	
+	/* Complex output takes every value, real output only the I samples */
+	if(convert_init(&rf->conv, type, complex ? 1 : 2, s->dither) != 0)
+	{
+		fprintf(stderr, "net: Unrecognised data type %d\n", type);
+		_rf_net_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	/* Round the payload down to whole samples */
+	rf->sample_size = rf->conv.size * rf->values;
+	rf->latency = s->latency;
+	rf->packet_samples = (packet_size > 0 ? packet_size : RF_NET_PACKET_SIZE) / rf->sample_size;
+	if(rf->packet_samples > UINT16_MAX) rf->packet_samples = UINT16_MAX;
+	
+	if(rf->packet_samples == 0)
+	{
+		fprintf(stderr, "net: Packet size is too small\n");
+		_rf_net_close(rf);
+		return(HACKTV_ERROR);
+	}
+	
+	rf->packet_size = rf->packet_samples * rf->sample_size;
+	
+	/* Each packet must fit in a single datagram */
+	if(protocol == RF_NET_UDP && sizeof(rf_net_header_t) + rf->packet_size > NET_UDP_MAX)
+	{
+		fprintf(stderr, "net: Packet size is too large for UDP, the maximum is %zu bytes\n",
+			NET_UDP_MAX - sizeof(rf_net_header_t)
+		);
+		_rf_net_close(rf);
+		return(HACKTV_ERROR);
+	}
+	stride = sizeof(rf_net_header_t) + rf->packet_size;
+	
+	rf->buffer = malloc(stride * NET_BATCH);
+	if(!rf->buffer)
+	{
+		_rf_net_close(rf);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < NET_BATCH; i++)
+	{
+		rf->iov[i].iov_base = _packet(rf, i);
+		rf->msgs[i].msg_hdr.msg_iov = &rf->iov[i];
+		rf->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	r = _connect(rf, target);
+	if(r != HACKTV_OK)
+	{
+		_rf_net_close(rf);
+		return(r);
+	}
+	
+	if(protocol == RF_NET_TCP)
+	{
+		/* Whole batches are sent at once, don't hold back the tail */
+		i = 1;
+		setsockopt(rf->fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i));
+	}
+	
+	/* Register the callback functions */
+	s->rf_private = rf;
+	s->rf_write = _rf_net_write;
+	s->rf_close = _rf_net_close;
+	
+	return(HACKTV_OK);
+}
+
@@ -0,0 +1,44 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _NET_H
+#define _NET_H
+
+#include <stdint.h>
+
+/* Protocols */
+#define RF_NET_UDP 0
+#define RF_NET_TCP 1
+
+/* Default payload bytes per packet, fits a 1500 byte MTU */
+#define RF_NET_PACKET_SIZE 1408
+
+/* Every packet starts with this header, all fields little-endian.
+ * The payload is the samples in the --type format */
+typedef struct {
+	uint32_t sequence;	/* Packet counter, wraps */
+	uint16_t samples;	/* Samples in this packet */
+	uint8_t type;		/* HACKTV_UINT8 ... HACKTV_FLOAT */
+	uint8_t complex;	/* 1 if the samples are I/Q pairs */
+	uint64_t sample;	/* Index of the first sample since the start */
+	uint64_t time;		/* Wall clock time when sent, ns since the epoch */
+} __attribute__((packed)) rf_net_header_t;
+
+extern int rf_net_open(hacktv_t *s, const char *target, int protocol, int type, int packet_size);
+
+#endif
+
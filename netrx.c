@@ -0,0 +1,589 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Loopback receiver for the network sink. Listens for the packets sent by
+ * hacktv's udp: and tcp: outputs, checks each header for lost, reordered
+ * or malformed packets and prints a summary. The payload can be saved to
+ * a file to compare with the same run written by the file: output.
+ * 
+ * Build with "make netrx". It isn't part of the default build. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "hacktv.h"
+#include "net.h"
+
+/* Datagrams read per system call */
+#define NETRX_BATCH 64
+
+/* Largest packet, UINT16_MAX complex float samples */
+#define NETRX_PACKET_MAX (sizeof(rf_net_header_t) + UINT16_MAX * 8)
+
+/* Bytes per value for each sample type */
+static const size_t _type_size[] = { 1, 1, 2, 2, 4, 4 };
+
+typedef struct {
+	
+	int protocol;
+	int fd;
+	FILE *output;
+	int timeout;
+	int verbose;
+	
+	/* Expected sequence number and sample index of the next packet */
+	int started;
+	uint32_t sequence;
+	uint64_t sample;
+	
+	/* Statistics */
+	uint64_t packets;
+	uint64_t samples;
+	uint64_t bytes;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t gaps;
+	uint64_t malformed;
+	double latency;
+	double latency_max;
+	struct timespec start;
+	struct timespec end;
+	
+} netrx_t;
+
+static volatile sig_atomic_t _abort = 0;
+
+static void _sigint_callback_handler(int signum)
+{
+	_abort = 1;
+}
+
+static double _elapsed(const struct timespec *a, const struct timespec *b)
+{
+	return((b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9);
+}
+
+static void _write_zeros(netrx_t *rx, uint64_t bytes)
+{
+	static const uint8_t zeros[4096];
+	size_t l;
+	
+	for(; bytes; bytes -= l)
+	{
+		l = bytes < sizeof(zeros) ? bytes : sizeof(zeros);
+		fwrite(zeros, 1, l, rx->output);
+	}
+}
+
+static void _packet(netrx_t *rx, const uint8_t *data, size_t length)
+{
+	rf_net_header_t h;
+	struct timespec ts;
+	size_t size;
+	uint64_t sample;
+	double latency;
+	int32_t d;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	
+	if(length < sizeof(rf_net_header_t))
+	{
+		rx->malformed++;
+		return;
+	}
+	
+	memcpy(&h, data, sizeof(rf_net_header_t));
+	h.sequence = le32toh(h.sequence);
+	h.samples = le16toh(h.samples);
+	h.sample = le64toh(h.sample);
+	h.time = le64toh(h.time);
+	
+	if(h.type > HACKTV_FLOAT || h.complex > 1)
+	{
+		rx->malformed++;
+		return;
+	}
+	
+	size = _type_size[h.type] * (h.complex ? 2 : 1);
+	
+	if(length != sizeof(rf_net_header_t) + h.samples * size)
+	{
+		rx->malformed++;
+		return;
+	}
+	
+	if(!rx->started)
+	{
+		/* Take the numbering from the first packet */
+		rx->started = 1;
+		rx->sequence = h.sequence;
+		rx->sample = h.sample;
+		rx->start = ts;
+	}
+	
+	rx->end = ts;
+	rx->packets++;
+	rx->samples += h.samples;
+	rx->bytes += length;
+	
+	latency = (((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec) - h.time) / 1e9;
+	rx->latency += latency;
+	if(latency > rx->latency_max) rx->latency_max = latency;
+	
+	/* The difference wraps with the sequence number */
+	d = (int32_t) (h.sequence - rx->sequence);
+	
+	if(d < 0)
+	{
+		/* Already counted as lost, too late to use */
+		if(rx->verbose) fprintf(stderr, "netrx: Packet %u arrived late\n", h.sequence);
+		rx->reordered++;
+		return;
+	}
+	
+	if(d > 0)
+	{
+		if(rx->verbose) fprintf(stderr, "netrx: Lost %d packets before %u\n", d, h.sequence);
+		rx->lost += d;
+	}
+	else if(h.sample != rx->sample)
+	{
+		if(rx->verbose) fprintf(stderr, "netrx: Packet %u starts at sample %llu, expected %llu\n",
+			h.sequence,
+			(unsigned long long) h.sample,
+			(unsigned long long) rx->sample
+		);
+		rx->gaps++;
+	}
+	
+	if(rx->output)
+	{
+		/* Keep the file aligned with the sample index over any loss */
+		sample = rx->sample;
+		if(h.sample > sample)
+		{
+			_write_zeros(rx, (h.sample - sample) * size);
+		}
+		
+		fwrite(data + sizeof(rf_net_header_t), size, h.samples, rx->output);
+	}
+	
+	rx->sequence = h.sequence + 1;
+	rx->sample = h.sample + h.samples;
+}
+
+static int _receive_udp(netrx_t *rx)
+{
+	struct mmsghdr msgs[NETRX_BATCH];
+	struct iovec iov[NETRX_BATCH];
+	struct timespec ts, idle;
+	uint8_t *buffer;
+	int i, n;
+	
+	buffer = malloc(NETRX_BATCH * NETRX_PACKET_MAX);
+	if(!buffer)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < NETRX_BATCH; i++)
+	{
+		iov[i].iov_base = buffer + i * NETRX_PACKET_MAX;
+		iov[i].iov_len = NETRX_PACKET_MAX;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &idle);
+	
+	while(!_abort)
+	{
+		n = recvmmsg(rx->fd, msgs, NETRX_BATCH, MSG_WAITFORONE, NULL);
+		
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		
+		if(n < 0)
+		{
+			if(errno == EINTR) continue;
+			
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				perror("recvmmsg");
+				free(buffer);
+				return(HACKTV_ERROR);
+			}
+			
+			/* UDP has no end, stop once the sender has gone quiet */
+			if(rx->started && rx->timeout > 0 && _elapsed(&idle, &ts) >= rx->timeout)
+			{
+				break;
+			}
+			
+			continue;
+		}
+		
+		for(i = 0; i < n; i++)
+		{
+			_packet(rx, iov[i].iov_base, msgs[i].msg_len);
+		}
+		
+		idle = ts;
+	}
+	
+	free(buffer);
+	
+	return(HACKTV_OK);
+}
+
+static int _read_all(int fd, uint8_t *data, size_t length)
+{
+	ssize_t r;
+	
+	while(length)
+	{
+		r = read(fd, data, length);
+		
+		if(r < 0)
+		{
+			if(errno == EINTR && !_abort) continue;
+			if(errno == EINTR) return(0);
+			perror("read");
+			return(-1);
+		}
+		
+		/* The connection has closed */
+		if(r == 0) return(0);
+		
+		data += r;
+		length -= r;
+	}
+	
+	return(1);
+}
+
+static int _receive_tcp(netrx_t *rx)
+{
+	rf_net_header_t h;
+	uint8_t *buffer;
+	size_t length;
+	int fd, r;
+	
+	buffer = malloc(NETRX_PACKET_MAX);
+	if(!buffer)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Take one connection */
+	do
+	{
+		fd = accept(rx->fd, NULL, NULL);
+	}
+	while(fd < 0 && errno == EINTR && !_abort);
+	
+	if(fd < 0)
+	{
+		if(!_abort) perror("accept");
+		free(buffer);
+		return(_abort ? HACKTV_OK : HACKTV_ERROR);
+	}
+	
+	while(!_abort)
+	{
+		r = _read_all(fd, buffer, sizeof(rf_net_header_t));
+		if(r <= 0) break;
+		
+		/* The header gives the payload length, a corrupt
+		 * one leaves no way to find the next packet */
+		memcpy(&h, buffer, sizeof(rf_net_header_t));
+		
+		if(h.type > HACKTV_FLOAT || h.complex > 1)
+		{
+			fprintf(stderr, "netrx: Malformed header, stopping\n");
+			rx->malformed++;
+			r = -1;
+			break;
+		}
+		
+		length = le16toh(h.samples) * _type_size[h.type] * (h.complex ? 2 : 1);
+		
+		r = _read_all(fd, buffer + sizeof(rf_net_header_t), length);
+		if(r <= 0) break;
+		
+		_packet(rx, buffer, sizeof(rf_net_header_t) + length);
+	}
+	
+	close(fd);
+	free(buffer);
+	
+	return(r < 0 ? HACKTV_ERROR : HACKTV_OK);
+}
+
+static int _listen(netrx_t *rx, const char *target)
+{
+	struct addrinfo hints, *res, *ai;
+	struct timeval tv;
+	char *host, *port;
+	int r, i;
+	
+	/* Accept <port> or <host>:<port>, allowing [addr]:port for IPv6 */
+	host = strdup(target);
+	if(!host)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	port = strrchr(host, ':');
+	if(port)
+	{
+		*(port++) = '\0';
+		
+		if(host[0] == '[' && host[strlen(host) - 1] == ']')
+		{
+			memmove(host, host + 1, strlen(host));
+			host[strlen(host) - 1] = '\0';
+		}
+	}
+	else
+	{
+		port = host;
+	}
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = rx->protocol == RF_NET_TCP ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	
+	r = getaddrinfo(port != host ? host : NULL, port, &hints, &res);
+	if(r != 0)
+	{
+		fprintf(stderr, "netrx: %s: %s\n", target, gai_strerror(r));
+		free(host);
+		return(HACKTV_ERROR);
+	}
+	
+	for(ai = res; ai; ai = ai->ai_next)
+	{
+		rx->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(rx->fd < 0) continue;
+		
+		i = 1;
+		setsockopt(rx->fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i));
+		
+		if(bind(rx->fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		
+		close(rx->fd);
+		rx->fd = -1;
+	}
+	
+	freeaddrinfo(res);
+	free(host);
+	
+	if(rx->fd < 0)
+	{
+		perror(target);
+		return(HACKTV_ERROR);
+	}
+	
+	if(rx->protocol == RF_NET_TCP)
+	{
+		if(listen(rx->fd, 1) != 0)
+		{
+			perror("listen");
+			return(HACKTV_ERROR);
+		}
+	}
+	else
+	{
+		/* A large buffer rides out scheduling delays at high rates */
+		i = 8 << 20;
+		setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i));
+		
+		/* Wake up regularly to check for the end of the stream */
+		tv.tv_sec = 0;
+		tv.tv_usec = 250000;
+		setsockopt(rx->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	}
+	
+	return(HACKTV_OK);
+}
+
+static void print_usage(void)
+{
+	printf(
+		"\n"
+		"Usage: netrx [options] udp:[<host>:]<port> | tcp:[<host>:]<port>\n"
+		"\n"
+		"Receives the packets sent by hacktv's udp: or tcp: output and checks\n"
+		"them for loss, reordering and damage.\n"
+		"\n"
+		"  -o, --output <file>            Save the payload to a file. Lost samples\n"
+		"                                 are written as zeros.\n"
+		"  -T, --timeout <seconds>        Stop a UDP stream once no packets have\n"
+		"                                 arrived for this long. 0 waits for\n"
+		"                                 Ctrl+C. Default: 2\n"
+		"  -v, --verbose                  Report each lost or late packet.\n"
+		"\n"
+		"The exit status is 0 if every packet arrived intact and in order.\n"
+		"\n"
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int option_index;
+	static struct option long_options[] = {
+		{ "output",  required_argument, 0, 'o' },
+		{ "timeout", required_argument, 0, 'T' },
+		{ "verbose", no_argument,       0, 'v' },
+		{ "help",    no_argument,       0, 'h' },
+		{ 0,         0,                 0,  0  }
+	};
+	struct sigaction sa;
+	netrx_t rx;
+	char *output = NULL;
+	char *target;
+	double t;
+	int r;
+	
+	memset(&rx, 0, sizeof(netrx_t));
+	rx.fd = -1;
+	rx.timeout = 2;
+	
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "o:T:vh", long_options, &option_index)) != -1)
+	{
+		switch(c)
+		{
+		case 'o': /* -o, --output <file> */
+			output = optarg;
+			break;
+		
+		case 'T': /* -T, --timeout <seconds> */
+			rx.timeout = atoi(optarg);
+			break;
+		
+		case 'v': /* -v, --verbose */
+			rx.verbose = 1;
+			break;
+		
+		case 'h': /* -h, --help */
+			print_usage();
+			return(0);
+		
+		case '?':
+			print_usage();
+			return(-1);
+		}
+	}
+	
+	if(optind != argc - 1)
+	{
+		print_usage();
+		return(-1);
+	}
+	
+	target = argv[optind];
+	
+	if(strncmp(target, "udp:", 4) == 0)
+	{
+		rx.protocol = RF_NET_UDP;
+	}
+	else if(strncmp(target, "tcp:", 4) == 0)
+	{
+		rx.protocol = RF_NET_TCP;
+	}
+	else
+	{
+		fprintf(stderr, "netrx: Expected udp: or tcp:, got '%s'\n", target);
+		return(-1);
+	}
+	
+	target += 4;
+	
+	if(output)
+	{
+		rx.output = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+		if(!rx.output)
+		{
+			perror(output);
+			return(-1);
+		}
+	}
+	
+	/* No SA_RESTART, so Ctrl+C interrupts a blocked receive */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _sigint_callback_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	
+	r = _listen(&rx, target);
+	
+	if(r == HACKTV_OK)
+	{
+		r = rx.protocol == RF_NET_TCP ? _receive_tcp(&rx) : _receive_udp(&rx);
+	}
+	
+	if(rx.fd >= 0) close(rx.fd);
+	if(rx.output && rx.output != stdout) fclose(rx.output);
+	
+	if(r != HACKTV_OK)
+	{
+		return(-1);
+	}
+	
+	t = _elapsed(&rx.start, &rx.end);
+	
+	fprintf(stderr, "netrx: Received %llu packets, %llu samples, %.1f MiB in %.1f seconds (%.1f MiB/s)\n",
+		(unsigned long long) rx.packets,
+		(unsigned long long) rx.samples,
+		rx.bytes / 1048576.0,
+		t,
+		t > 0 ? rx.bytes / 1048576.0 / t : 0
+	);
+	
+	fprintf(stderr, "netrx: %llu lost, %llu late, %llu sample gaps, %llu malformed\n",
+		(unsigned long long) rx.lost,
+		(unsigned long long) rx.reordered,
+		(unsigned long long) rx.gaps,
+		(unsigned long long) rx.malformed
+	);
+	
+	if(rx.packets > 0)
+	{
+		fprintf(stderr, "netrx: Latency %.3f ms average, %.3f ms maximum\n",
+			rx.latency / rx.packets * 1000.0,
+			rx.latency_max * 1000.0
+		);
+	}
+	
+	return(rx.lost || rx.reordered || rx.gaps || rx.malformed ? 1 : 0);
+}
@@ -0,0 +1,244 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "ring.h"
+
+int ring_init(ring_t *r, unsigned int depth, size_t slot_size, unsigned int watermark)
+{
+	memset(r, 0, sizeof(ring_t));
+	
+	if(depth < 2 || slot_size == 0)
+	{
+		return(-1);
+	}
+	
+	/* Keep each slot cache line aligned */
+	slot_size = (slot_size + RING_CACHE_LINE - 1) & ~(size_t) (RING_CACHE_LINE - 1);
+	
+	r->data = aligned_alloc(RING_CACHE_LINE, slot_size * depth);
+	if(!r->data)
+	{
+		return(-1);
+	}
+	
+	r->slot_size = slot_size;
+	r->depth = depth;
+	r->watermark = watermark < 1 ? 1 : (watermark > depth ? depth : watermark);
+	
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->overruns, 0);
+	atomic_init(&r->closed, 0);
+	atomic_init(&r->underruns, 0);
+	atomic_init(&r->reads, 0);
+	atomic_init(&r->fill_sum, 0);
+	atomic_init(&r->min_fill, depth);
+	
+	return(0);
+}
+
+void ring_free(ring_t *r)
+{
+	free(r->data);
+	memset(r, 0, sizeof(ring_t));
+}
+
+void *ring_write_slot(ring_t *r)
+{
+	uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint64_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+	
+	if(h - t == r->depth)
+	{
+		if(!r->full)
+		{
+			atomic_fetch_add_explicit(&r->overruns, 1, memory_order_relaxed);
+			r->full = 1;
+		}
+		
+		return(NULL);
+	}
+	
+	r->full = 0;
+	
+	return(&r->data[(h % r->depth) * r->slot_size]);
+}
+
+void ring_write_commit(ring_t *r)
+{
+	uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	
+	/* Publish the slot contents along with the new head */
+	atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+void *ring_write_ptr(ring_t *r, size_t *length)
+{
+	uint8_t *slot = ring_write_slot(r);
+	
+	if(!slot)
+	{
+		*length = 0;
+		return(NULL);
+	}
+	
+	*length = r->slot_size - r->woff;
+	
+	return(slot + r->woff);
+}
+
+void ring_write_advance(ring_t *r, size_t length)
+{
+	r->woff += length;
+	
+	if(r->woff == r->slot_size)
+	{
+		ring_write_commit(r);
+		r->woff = 0;
+	}
+}
+
+size_t ring_write(ring_t *r, const void *src, size_t length)
+{
+	const uint8_t *s = src;
+	uint8_t *dst;
+	size_t l, n;
+	
+	for(n = 0; n < length; n += l)
+	{
+		dst = ring_write_ptr(r, &l);
+		if(!dst) break;
+		
+		if(l > length - n) l = length - n;
+		
+		memcpy(dst, s + n, l);
+		ring_write_advance(r, l);
+	}
+	
+	return(n);
+}
+
+void ring_write_close(ring_t *r)
+{
+	/* Any partly written slot is left out */
+	atomic_store_explicit(&r->closed, 1, memory_order_release);
+}
+
+const void *ring_read_slot(ring_t *r)
+{
+	uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+	unsigned int fill = (unsigned int) (h - t);
+	
+	/* Track the fill level as seen by the consumer */
+	atomic_fetch_add_explicit(&r->reads, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&r->fill_sum, fill, memory_order_relaxed);
+	
+	if(fill < atomic_load_explicit(&r->min_fill, memory_order_relaxed))
+	{
+		atomic_store_explicit(&r->min_fill, fill, memory_order_relaxed);
+	}
+	
+	if(atomic_load_explicit(&r->closed, memory_order_acquire))
+	{
+		/* Draining, take what's left */
+		if(fill == 0) return(NULL);
+		return(&r->data[(t % r->depth) * r->slot_size]);
+	}
+	
+	if(!r->primed)
+	{
+		/* Wait for the ring to fill to the watermark */
+		if(fill < r->watermark) return(NULL);
+		r->primed = 1;
+	}
+	
+	if(fill == 0)
+	{
+		/* Starved, count it and refill before resuming */
+		atomic_fetch_add_explicit(&r->underruns, 1, memory_order_relaxed);
+		r->primed = 0;
+		return(NULL);
+	}
+	
+	return(&r->data[(t % r->depth) * r->slot_size]);
+}
+
+void ring_read_release(ring_t *r)
+{
+	uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	
+	/* Hand the slot back to the producer */
+	atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+}
+
+size_t ring_read(ring_t *r, void *dst, size_t length)
+{
+	uint8_t *d = dst;
+	const uint8_t *slot;
+	size_t l, n;
+	
+	for(n = 0; n < length; n += l)
+	{
+		slot = ring_read_slot(r);
+		if(!slot) break;
+		
+		l = r->slot_size - r->roff;
+		if(l > length - n) l = length - n;
+		
+		memcpy(d + n, slot + r->roff, l);
+		r->roff += l;
+		
+		if(r->roff == r->slot_size)
+		{
+			ring_read_release(r);
+			r->roff = 0;
+		}
+	}
+	
+	return(n);
+}
+
+int ring_eof(ring_t *r)
+{
+	uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	
+	return(atomic_load_explicit(&r->closed, memory_order_acquire) &&
+	       atomic_load_explicit(&r->head, memory_order_acquire) == t);
+}
+
+void ring_stats(ring_t *r, ring_stats_t *stats)
+{
+	uint64_t reads, sum;
+	
+	stats->underruns = atomic_load(&r->underruns);
+	stats->overruns = atomic_load(&r->overruns);
+	stats->fill = (unsigned int) (atomic_load(&r->head) - atomic_load(&r->tail));
+	
+	/* Reset the consumer's running figures */
+	reads = atomic_exchange(&r->reads, 0);
+	sum = atomic_exchange(&r->fill_sum, 0);
+	stats->min_fill = atomic_exchange(&r->min_fill, r->depth);
+	stats->avg_fill = reads ? (double) sum / reads : stats->fill;
+	
+	if(stats->min_fill > stats->fill) stats->min_fill = stats->fill;
+}
+
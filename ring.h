@@ -0,0 +1,118 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 agent <agent@local>                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RING_CACHE_LINE 64
+
+/* Lock-free single producer, single consumer ring of fixed size slots.
+ * 
+ * The producer fills slots and commits them, the consumer reads them and
+ * releases them, and the only state they share is the two slot counters.
+ * The counters are 64-bit so they never wrap, as the depth needn't be a
+ * power of two. Each side's state lives on its own cache line.
+ * 
+ * The consumer will not start reading until watermark slots are ready.
+ * If it runs dry after that it counts an underrun and waits for the
+ * watermark again, so a slow producer gives occasional clean gaps
+ * rather than constant stuttering.
+ * 
+ * Once the producer closes the ring the consumer ignores the watermark
+ * and reads out whatever is left without counting an underrun. */
+typedef struct {
+	
+	/* Producer state */
+	_Alignas(RING_CACHE_LINE) atomic_uint_fast64_t head;
+	size_t woff;
+	int full;
+	atomic_uint_fast64_t overruns;
+	atomic_int closed;
+	
+	/* Consumer state */
+	_Alignas(RING_CACHE_LINE) atomic_uint_fast64_t tail;
+	size_t roff;
+	int primed;
+	atomic_uint_fast64_t underruns;
+	atomic_uint_fast64_t reads;
+	atomic_uint_fast64_t fill_sum;
+	atomic_uint min_fill;
+	
+	/* Fixed after ring_init() */
+	_Alignas(RING_CACHE_LINE) uint8_t *data;
+	size_t slot_size;
+	unsigned int depth;
+	unsigned int watermark;
+	
+} ring_t;
+
+typedef struct {
+	
+	/* Times the consumer ran out of data after starting */
+	uint64_t underruns;
+	
+	/* Times the producer found the ring full, counted
+	 * once per wait rather than once per attempt */
+	uint64_t overruns;
+	
+	/* Slots ready to read now, the lowest and the average
+	 * seen by the consumer since the last call */
+	unsigned int fill;
+	unsigned int min_fill;
+	double avg_fill;
+	
+} ring_stats_t;
+
+extern int ring_init(ring_t *r, unsigned int depth, size_t slot_size, unsigned int watermark);
+extern void ring_free(ring_t *r);
+
+/* Producer side. ring_write_slot() returns the next free slot, or NULL
+ * if the ring is full. ring_write() copies up to length bytes in,
+ * committing slots as they fill, and returns the number copied.
+ * 
+ * ring_write_ptr() and ring_write_advance() let the producer write
+ * straight into the ring. The first returns where the next byte goes
+ * and sets length to the space left in that slot, or returns NULL if
+ * the ring is full. The second moves on by length bytes, which must
+ * not be more than that space */
+extern void *ring_write_slot(ring_t *r);
+extern void ring_write_commit(ring_t *r);
+extern void *ring_write_ptr(ring_t *r, size_t *length);
+extern void ring_write_advance(ring_t *r, size_t length);
+extern size_t ring_write(ring_t *r, const void *src, size_t length);
+extern void ring_write_close(ring_t *r);
+
+/* Consumer side. ring_read_slot() returns the next full slot, or NULL
+ * if there is none or the ring is refilling. ring_read() copies up to
+ * length bytes out, releasing slots as they empty, and returns the
+ * number copied */
+extern const void *ring_read_slot(ring_t *r);
+extern void ring_read_release(ring_t *r);
+extern size_t ring_read(ring_t *r, void *dst, size_t length);
+
+/* Returns 1 once the ring has been closed and read empty */
+extern int ring_eof(ring_t *r);
+
+/* Safe to call from any thread */
+extern void ring_stats(ring_t *r, ring_stats_t *stats);
+
+#endif
+
@@ -15,11 +15,25 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <SoapySDR/Device.h>
 #include <SoapySDR/Formats.h>
+#include <SoapySDR/Errors.h>
+#include <SoapySDR/Constants.h>
 #include "hacktv.h"
+#include "ring.h"
+
+/* Used when the driver doesn't report an MTU */
+#define DEFAULT_MTU 8192
+
+/* Give up on a device that has accepted nothing for this many timeouts */
+#define MAX_TIMEOUTS 10
 
 typedef struct {
 	
@@ -27,15 +41,151 @@ typedef struct {
 	SoapySDRDevice *d;
 	SoapySDRStream *s;
 	
+	/* Samples are collected until there is a full MTU to write */
+	size_t mtu;
+	int16_t *buffer;
+	size_t samples;
+	long timeout;
+	
+	/* Optional writer thread, fed through a ring of MTU sized slots */
+	int threaded;
+	ring_t ring;
+	pthread_t thread;
+	atomic_int error;
+	
+	/* Statistics */
+	uint64_t underflows;
+	uint64_t timeouts;
+	
+	latency_t *latency;
+	int verbose;
+	
 } soapysdr_t;
 
+/* Write all n samples to the device, retrying partial writes */
+static int _write_stream(soapysdr_t *rf, const int16_t *iq_data, size_t n, int end)
+{
+	const void *buffs[1];
+	int flags, r;
+	int timeouts = 0;
+	
+	while(n > 0)
+	{
+		buffs[0] = iq_data;
+		flags = end ? SOAPY_SDR_END_BURST : 0;
+		
+		r = SoapySDRDevice_writeStream(rf->d, rf->s, buffs, n, &flags, 0, rf->timeout);
+		
+		if(r > 0)
+		{
+			latency_consume(rf->latency, r);
+			iq_data += r * 2;
+			n -= r;
+			timeouts = 0;
+		}
+		else if(r == SOAPY_SDR_UNDERFLOW)
+		{
+			/* The device ran dry before this write, carry on */
+			fprintf(stderr, "U");
+			rf->underflows++;
+		}
+		else if(r == SOAPY_SDR_TIMEOUT || r == 0)
+		{
+			/* No room yet, try again */
+			rf->timeouts++;
+			
+			if(++timeouts == MAX_TIMEOUTS)
+			{
+				fprintf(stderr, "SoapySDRDevice_writeStream() timed out, the device has stopped taking samples\n");
+				return(HACKTV_ERROR);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "SoapySDRDevice_writeStream() failed: %s (%d)\n", SoapySDR_errToStr(r), r);
+			return(HACKTV_ERROR);
+		}
+	}
+	
+	return(HACKTV_OK);
+}
+
+static void *_writer_thread(void *arg)
+{
+	soapysdr_t *rf = arg;
+	const int16_t *slot;
+	
+	while(!ring_eof(&rf->ring))
+	{
+		slot = ring_read_slot(&rf->ring);
+		
+		if(slot == NULL)
+		{
+			usleep(500);
+			continue;
+		}
+		
+		if(_write_stream(rf, slot, rf->mtu, 0) != HACKTV_OK)
+		{
+			atomic_store(&rf->error, 1);
+			break;
+		}
+		
+		ring_read_release(&rf->ring);
+	}
+	
+	return(NULL);
+}
+
+/* Hand over a full MTU, either to the device or to the writer thread */
+static int _flush(soapysdr_t *rf)
+{
+	int16_t *slot;
+	
+	if(!rf->threaded)
+	{
+		rf->samples = 0;
+		return(_write_stream(rf, rf->buffer, rf->mtu, 0));
+	}
+	
+	ring_write_commit(&rf->ring);
+	rf->samples = 0;
+	
+	/* Wait for the next free slot */
+	while((slot = ring_write_slot(&rf->ring)) == NULL)
+	{
+		if(atomic_load(&rf->error)) return(HACKTV_ERROR);
+		usleep(1000);
+	}
+	
+	rf->buffer = slot;
+	
+	return(atomic_load(&rf->error) ? HACKTV_ERROR : HACKTV_OK);
+}
+
 static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	soapysdr_t *rf = private;
-	const void *buffs[] = { iq_data };
-	int flags = 0;
+	size_t l;
 	
-	SoapySDRDevice_writeStream(rf->d, rf->s, buffs, samples, &flags, 0, 100000);
+	while(samples)
+	{
+		l = rf->mtu - rf->samples;
+		if(l > samples) l = samples;
+		
+		memcpy(&rf->buffer[rf->samples * 2], iq_data, l * sizeof(int16_t) * 2);
+		rf->samples += l;
+		iq_data += l * 2;
+		samples -= l;
+		
+		if(rf->samples == rf->mtu)
+		{
+			if(_flush(rf) != HACKTV_OK)
+			{
+				return(HACKTV_ERROR);
+			}
+		}
+	}
 	
 	return(HACKTV_OK);
 }
@@ -43,13 +193,62 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 static int _rf_close(void *private)
 {
 	soapysdr_t *rf = private;
+	int r = HACKTV_OK;
+	
+	/* The burst always ends with a write, even of a single blank sample */
+	if(rf->samples == 0)
+	{
+		rf->buffer[0] = rf->buffer[1] = 0;
+		rf->samples = 1;
+	}
+	
+	if(rf->threaded)
+	{
+		/* Let the thread finish the ring. The partly filled last
+		 * slot is left out and written here to end the burst */
+		ring_write_close(&rf->ring);
+		pthread_join(rf->thread, NULL);
+		
+		r = atomic_load(&rf->error) ? HACKTV_ERROR : _write_stream(rf, rf->buffer, rf->samples, 1);
+		
+		if(rf->verbose)
+		{
+			ring_stats_t st;
+			
+			ring_stats(&rf->ring, &st);
+			fprintf(stderr, "soapysdr: %llu underruns, %llu overruns, lowest fill %u/%u slots, average %.1f\n",
+				(unsigned long long) st.underruns,
+				(unsigned long long) st.overruns,
+				st.min_fill, rf->ring.depth, st.avg_fill
+			);
+		}
+		
+		ring_free(&rf->ring);
+	}
+	else
+	{
+		/* Write out the remainder and end the burst */
+		r = _write_stream(rf, rf->buffer, rf->samples, 1);
+		free(rf->buffer);
+	}
+	
+	if(rf->verbose)
+	{
+		fprintf(stderr, "soapysdr: %llu underflows, %llu timeouts, MTU %zu samples\n",
+			(unsigned long long) rf->underflows,
+			(unsigned long long) rf->timeouts,
+			rf->mtu
+		);
+	}
 	
 	SoapySDRDevice_deactivateStream(rf->d, rf->s, 0, 0);
 	SoapySDRDevice_closeStream(rf->d, rf->s);
 	
 	SoapySDRDevice_unmake(rf->d);
 	
-	return(HACKTV_OK);
+	free(rf);
+	
+	return(r);
 }
 
 int rf_soapysdr_open(hacktv_t *s, const char *device, unsigned int frequency_hz, unsigned int gain, const char *antenna)
@@ -57,6 +256,7 @@ int rf_soapysdr_open(hacktv_t *s, const char *device, unsigned int frequency_hz,
 	soapysdr_t *rf;
 	SoapySDRKwargs *results;
 	size_t length;
+	int64_t depth;
 	
 	if(s->vid.conf.output_type != HACKTV_INT16_COMPLEX)
 	{
@@ -139,8 +339,61 @@ int rf_soapysdr_open(hacktv_t *s, const char *device, unsigned int frequency_hz,
 		return(HACKTV_ERROR);
 	}
 	
+	/* Collect writes up to the stream's MTU */
+	rf->mtu = SoapySDRDevice_getStreamMTU(rf->d, rf->s);
+	if(rf->mtu == 0) rf->mtu = DEFAULT_MTU;
+	
+	/* Allow for each write to take twice as long as it plays for */
+	rf->timeout = (long) ((double) rf->mtu * 2000000 / s->vid.sample_rate);
+	if(rf->timeout < 100000) rf->timeout = 100000;
+	
+	rf->verbose = s->verbose;
+	rf->latency = s->latency;
+	rf->threaded = s->tx_buffer > 0;
+	atomic_init(&rf->error, 0);
+	
+	if(rf->threaded)
+	{
+		/* Size the ring to the requested length, start writing
+		 * to the device once it is half full */
+		depth = (int64_t) s->tx_buffer * s->vid.sample_rate / 1000 / rf->mtu;
+		if(depth < 4) depth = 4;
+		
+		if(ring_init(&rf->ring, depth, rf->mtu * sizeof(int16_t) * 2, depth / 2) != 0)
+		{
+			SoapySDRDevice_closeStream(rf->d, rf->s);
+			SoapySDRDevice_unmake(rf->d);
+			free(rf);
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+		
+		rf->buffer = ring_write_slot(&rf->ring);
+	}
+	else
+	{
+		rf->buffer = malloc(rf->mtu * sizeof(int16_t) * 2);
+		if(!rf->buffer)
+		{
+			SoapySDRDevice_closeStream(rf->d, rf->s);
+			SoapySDRDevice_unmake(rf->d);
+			free(rf);
+			return(HACKTV_OUT_OF_MEMORY);
+		}
+	}
+	
 	SoapySDRDevice_activateStream(rf->d, rf->s, 0, 0, 0);
 	
+	if(rf->threaded && pthread_create(&rf->thread, NULL, _writer_thread, rf) != 0)
+	{
+		perror("pthread_create");
+		SoapySDRDevice_deactivateStream(rf->d, rf->s, 0, 0);
+		SoapySDRDevice_closeStream(rf->d, rf->s);
+		SoapySDRDevice_unmake(rf->d);
+		ring_free(&rf->ring);
+		free(rf);
+		return(HACKTV_ERROR);
+	}
+	
 	/* Register the callback functions */
 	s->rf_private = rf;
 	s->rf_write = _rf_write;
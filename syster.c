@@ -421,16 +421,32 @@ void _render_ng_vbi(ng_t *s, vid_t *vid, vid_line_t *l)
 
 int _ng_audio_init(ng_t *s)
 {
-	/* Allocate memory for the audio inversion FIR filters */
-	s->firli = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firlq = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firri = calloc(NTAPS * 2, sizeof(int16_t));
-	s->firrq = calloc(NTAPS * 2, sizeof(int16_t));
+	double *taps;
+	int i;
+	
+	/* The filter taps are listed oldest sample first,
+	 * reverse them into the order fir_int16 expects */
+	taps = malloc(sizeof(double) * 2 * NTAPS);
+	if(taps == NULL)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < NTAPS; i++)
+	{
+		taps[i * 2 + 0] = _firi[NTAPS - 1 - i] / 32767.0;
+		taps[i * 2 + 1] = _firq[NTAPS - 1 - i] / 32767.0;
+	}
+	
+	/* Allocate the audio inversion FIR filters */
+	i  = fir_int16_complex_init(&s->fir[0], taps, NTAPS, 1, 1, 0);
+	i |= fir_int16_complex_init(&s->fir[1], taps, NTAPS, 1, 1, 0);
+	free(taps);
+	
+	s->mix = malloc(sizeof(int16_t) * 2 * FIR_BLOCK_SIZE);
 	s->mixx = 0;
-	s->firx = 0;
 	
-	if(s->firli == NULL || s->firlq == NULL ||
-		 s->firri == NULL || s->firrq == NULL)
+	if(i != 0 || s->mix == NULL)
 	{
 		return(VID_OUT_OF_MEMORY);
 	}
@@ -569,17 +585,17 @@ int ng_init(ng_t *s, vid_t *vid)
 
 void ng_free(ng_t *s)
 {
-	free(s->firli);
-	free(s->firlq);
-	free(s->firri);
-	free(s->firrq);
+	fir_int16_free(&s->fir[0]);
+	fir_int16_free(&s->fir[1]);
+	free(s->mix);
 	free(s->delay);
 	free(s->lut);
 }
 
 void ng_invert_audio(ng_t *s, int16_t *audio, size_t samples)
 {
-	int i, x;
+	size_t i, n, x;
+	int c, m;
 	int a;
 	
 	/* Invert the audio spectrum below 12.8 kHz.
@@ -590,49 +606,39 @@ void ng_invert_audio(ng_t *s, int16_t *audio, size_t samples)
 	 * copied back into the audio buffer.
 	 * 
 	 * The mixing and filtering use complex operations to avoid the
-	 * upper sideband interfering after mixing.
+	 * upper sideband interfering after mixing. The real part of the
+	 * filter output is the inverted audio.
 	 */
 	
 	if(audio == NULL) return;
 	
-	for(i = 0; i < samples; i++)
+	for(i = 0; i < samples; i += n)
 	{
-		/* Left */
-		s->firli[s->firx + NTAPS] = s->firli[s->firx] =
-			(audio[i * 2 + 0] * _mixi[s->mixx] -
-			 audio[i * 2 + 0] * _mixq[s->mixx]) >> 15;
-		s->firlq[s->firx + NTAPS] = s->firlq[s->firx] =
-			(audio[i * 2 + 0] * _mixq[s->mixx] +
-			 audio[i * 2 + 0] * _mixi[s->mixx]) >> 15;
-		
-		/* Right */
-		s->firri[s->firx + NTAPS] = s->firri[s->firx] =
-			(audio[i * 2 + 1] * _mixi[s->mixx] -
-			 audio[i * 2 + 1] * _mixq[s->mixx]) >> 15;
-		s->firrq[s->firx + NTAPS] = s->firrq[s->firx] =
-			(audio[i * 2 + 1] * _mixq[s->mixx] +
-			 audio[i * 2 + 1] * _mixi[s->mixx]) >> 15;
-		
-		if(++s->firx == NTAPS) s->firx = 0;
-		if(++s->mixx == 5) s->mixx = 0;
+		n = samples - i;
+		if(n > FIR_BLOCK_SIZE) n = FIR_BLOCK_SIZE;
 		
-		/* Left */
-		for(a = x = 0; x < NTAPS; x++)
+		for(c = 0; c < 2; c++)
 		{
-			a += s->firli[s->firx + x] * _firi[x] -
-			     s->firlq[s->firx + x] * _firq[x];
-		}
-		
-		audio[i * 2 + 0] = a >> 15;
-		
-		/* Right */
-		for(a = x = 0; x < NTAPS; x++)
-		{
-			a += s->firri[s->firx + x] * _firi[x] -
-			     s->firrq[s->firx + x] * _firq[x];
+			/* Mix the block for this channel */
+			for(m = s->mixx, x = 0; x < n; x++)
+			{
+				a = audio[(i + x) * 2 + c];
+				
+				s->mix[x * 2 + 0] = (a * _mixi[m] - a * _mixq[m]) >> 15;
+				s->mix[x * 2 + 1] = (a * _mixq[m] + a * _mixi[m]) >> 15;
+				
+				if(++m == 5) m = 0;
+			}
+			
+			fir_int16_process_strided(&s->fir[c], s->mix, 2, s->mix, 2, n);
+			
+			for(x = 0; x < n; x++)
+			{
+				audio[(i + x) * 2 + c] = s->mix[x * 2];
+			}
 		}
 		
-		audio[i * 2 + 1] = a >> 15;
+		s->mixx = m;
 	}
 }
 
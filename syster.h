@@ -125,10 +125,9 @@ typedef struct {
 	int d11_line_delay[D11_LINES_PER_FIELD * D11_FIELDS];
 
 	/* Audio inversion FIR filter */
-	int16_t *firli, *firlq; /* Left channel, I + Q */
-	int16_t *firri, *firrq; /* Right channel, I + Q */
+	fir_int16_t fir[2]; /* Left and right channels */
+	int16_t *mix;
 	int mixx;
-	int firx;
 	
 	int video_scale[8520];
 
@@ -22,6 +22,7 @@
 #include "nicam728.h"
 #include "dance.h"
 #include "hacktv.h"
+#include "cpu.h"
 #include <sys/time.h>
 
 /* 
@@ -33,9 +34,11 @@
  * 
  * The encoder makes liberal use of lookup tables:
  * 
- * - 3x for RGB > gamma corrected Y, I and Q levels.
+ * - 3x for the R, G and B contributions to the gamma corrected
+ *   Y, I and Q levels, summed per pixel.
  * 
- * - A temporary gamma table used while generating the above.
+ * - 3x for the Y', Cb and Cr contributions to the same, for
+ *   sources that deliver planar YUV.
  * 
  * - PAL colour carrier (4 full frames in length + 1 line) or
  *   NTSC colour carrier (2 full lines + 1 line).
@@ -46,6 +49,14 @@
 #define SECAM_CB_FREQ 4250000
 #define SECAM_CR_FREQ 4406260
 
+/* Largest audio resampler interpolation factor */
+#define VID_AUDIO_MAX_INTERPOLATION 32768
+
+/* BT.601 luma weights, the matrix of any YUV input */
+#define BT601_KR 0.299
+#define BT601_KB 0.114
+#define BT601_KG (1.0 - BT601_KR - BT601_KB)
+
 const vid_config_t vid_config_pal_i = {
 	
 	/* System I (PAL) */
@@ -1877,13 +1888,6 @@ static void _secam_g(double *g, double f)
 	g[1] = 0.115 * (lq - rq) / d;
 }
 
-static double _dlimit(double v, double min, double max)
-{
-	if(v < min) return(min);
-	if(v > max) return(max);
-	return(v);
-}
-
 static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, double level, int *len)
 {
 	int16_t *win;
@@ -2030,25 +2034,6 @@ static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency,
 	return(VID_OK);
 }
 
-static void inline _fm_modulator_add(_mod_fm_t *fm, int16_t *dst, int16_t sample)
-{
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] += ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] += ((fm->phase.q >> 16) * fm->level) >> 15;
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
-	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
-		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
-		
-		fm->counter = INT16_MAX;
-	}
-}
-
 static void inline _fm_modulator_add_cgain(_mod_fm_t *fm, int16_t *dst, int16_t sample, const cint16_t *g)
 {
 	/* Only used by SECAM */
@@ -2092,49 +2077,20 @@ static void inline _fm_modulator(_mod_fm_t *fm, int16_t *dst, int16_t sample)
 static void _free_fm_modulator(_mod_fm_t *fm)
 {
 	free(fm->lut);
+	fir_int16_free(&fm->resampler);
 }
 
 /* AM modulator */
 static int _init_am_modulator(_mod_am_t *am, int sample_rate, double frequency, double level)
 {
-	double d;
-	
-	am->level   = round(INT16_MAX * level);
-	am->counter = INT16_MAX;
-	am->phase.i = INT32_MAX;
-	am->phase.q = 0;
-	
-	d = 2.0 * M_PI / sample_rate * frequency;
-	am->delta.i = lround(cos(d) * INT32_MAX);
-	am->delta.q = lround(sin(d) * INT32_MAX);
+	nco_init(&am->nco, sample_rate, frequency, 0, level);
 	
 	return(VID_OK);
 }
 
-static void inline _am_modulator_add(_mod_am_t *am, int16_t *dst, int16_t sample)
-{
-	cint32_mul(&am->phase, &am->phase, &am->delta);
-	
-	sample = ((int32_t) sample - INT16_MIN) / 2;
-	
-	dst[0] += ((((am->phase.i >> 16) * sample) >> 15) * am->level) >> 15;
-	dst[1] += ((((am->phase.q >> 16) * sample) >> 15) * am->level) >> 15;
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--am->counter == 0)
-	{
-		double ra = atan2(am->phase.q, am->phase.i);
-		
-		am->phase.i = lround(cos(ra) * INT32_MAX);
-		am->phase.q = lround(sin(ra) * INT32_MAX);
-		
-		am->counter = INT16_MAX;
-	}
-}
-
 static void _free_am_modulator(_mod_am_t *am)
 {
-	/* Nothing */
+	fir_int16_free(&am->resampler);
 }
 
 /* AV source callback handlers */
@@ -2168,663 +2124,1301 @@ static int _av_eof(vid_t *s)
 	return(0);
 }
 
-int vid_av_close(vid_t *s)
+static int _vid_next_frame(vid_t *s)
 {
-	int r;
-	
-	r = s->av_close ? s->av_close(s->av_private) : VID_ERROR;
-	
-	s->av_private = NULL;
-	s->av_read_video = NULL;
-	s->av_read_audio = NULL;
-	s->av_eof = NULL;
-	s->av_close = NULL;
+	/* Load the next frame */
+	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	{
+		/* Have we reached the end of the video? */
+		if(_av_eof(s))
+		{
+			return(VID_ERROR);
+		}
+		s->framebuffer = _av_read_video(s, &s->ratio);
+	}
 	
-	return(r);
+	return(VID_OK);
 }
 
-void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
+static void _vid_next_bline(vid_t *s)
 {
-	int m, r;
-	
-	/* Test if the chosen sample rate results in an even number of
-	 * samples per line. If not, display a warning and show the
-	 * previous and next valid sample rates. */
+	/* Advance the next line/frame counter */
+	if(s->bline++ == s->conf.lines)
+	{
+		s->bline = 1;
+		s->bframe++;
+	}
+}
+
+static void _run_lineprocesses(vid_t *s, int first, int last)
+{
+	int i, j;
 	
-	/* Calculate lowest valid sample rate */
-	m = conf->lines * conf->frame_rate_num;
-	m /= r = gcd(m, conf->frame_rate_den);
-	if(conf->frame_rate_den / r & 1) m *= 2;
+	for(i = first; i <= last; i++)
+	{
+		_lineprocess_t *p = &s->processes[i];
+		
+		if(p->process)
+		{
+			p->process(p->vid, p->arg, p->nlines, p->lines);
+		}
+		
+		for(j = 0; j < p->nlines; j++)
+		{
+			p->lines[j] = p->lines[j]->next;
+		}
+	}
+}
+
+/* Pipelined line processing
+ * 
+ * The line processes are split into a number of stages, each run on its
+ * own thread. A stage may work on line N once the previous stage has
+ * completed it. The first stage loads the frames and may run up to
+ * stage_slack lines ahead of the final stage, which is run by the thread
+ * calling vid_next_line(). The line windows of each process are unchanged,
+ * the ring of output lines is simply made longer to give the stages room.
+*/
+
+static int _stage_weight(const _lineprocess_t *p)
+{
+	/* Rough relative cost of each process, used to balance the stages */
+	static const struct {
+		const char *name;
+		int weight;
+	} w[] = {
+		{ "raster",     8 },
+		{ "audio",      8 },
+		{ "vfilter",    6 },
+		{ "vresampler", 6 },
+		{ "fmmod",      4 },
+		{ "offset",     3 },
+		{ "output",     0 },
+		{ NULL,         1 },
+	};
+	int i;
 	
-	/* Is the chosen sample rate good? */
-	if(sample_rate % m == 0) return;
+	for(i = 0; w[i].name; i++)
+	{
+		if(strcmp(p->name, w[i].name) == 0) break;
+	}
 	
-	/* Not really. Suggest some good sample rates */
-	r = sample_rate / m;
-	fprintf(stderr, "Warning: Pixel rate %u may not work well with this mode.\n", sample_rate);
-	fprintf(stderr, "Next valid pixel rates: %u, %u\n", m * r, m * (r + 1));
+	return(w[i].weight);
 }
 
-static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _stage_split_ok(vid_t *s, int i)
 {
-	const char *seq;
-	int x;
-	int vy;
-	int w;
-	uint32_t rgb;
-	int pal = 0;
-	int fsc = 0;
-	int16_t *lut_b = NULL;
-	int16_t *lut_i = NULL;
-	int16_t *lut_q = NULL;
-	vid_line_t *l = lines[0];
+	int j;
 	
-	l->width    = s->width;
-	l->frame    = s->bframe;
-	l->line     = s->bline;
-	l->vbialloc = 0;
+	/* D/D2-MAC shares its state between the raster and audio
+	 * processes, and Eurocrypt reads the output frame number */
+	if(s->conf.type == VID_MAC)
+	{
+		return(0);
+	}
 	
-	/* Sequence codes: abcd
-	 * 
-	 * a: first sync
-	 *    h = horizontal sync pulse
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 *    _ = no sync pulse
-	 * 
-	 * b: colour burst
-	 *    0 = line always has a colour burst
-	 *    _ = line never has a colour burst
-	 *    1 = line has a colour burst on odd frames
-	 *    2 = line has a colour burst on even frames
-	 * 
-	 * c: left content
-	 *    _ = blanking
-	 *    a = active video
-	 * 
-	 * d: right content
-	 *    _ = blanking
-	 *    a = active video
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 * 
-	 **** I don't like this code, it's overly complicated for all it does.
-	*/
-	
-	vy = -1;
-	seq = "____";
-	
-	if(s->conf.type == VID_RASTER_625)
-	{
-		switch(l->line)
+	/* WSS reads the aspect ratio of the frame being rendered, which
+	 * the raster updates as each frame is loaded. Keep every process
+	 * up to and including WSS in the first stage with the raster */
+	for(j = i; j < s->nprocesses; j++)
+	{
+		if(strcmp(s->processes[j].name, "wss") == 0)
 		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__v"; break;
-		case 4:   seq = "v__v"; break;
-		case 5:   seq = "v__v"; break;
-		case 6:   seq = "h1__"; break;
-		case 7:   seq = "h0__"; break;
-		case 8:   seq = "h0__"; break;
-		case 9:   seq = "h0__"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		case 21:  seq = "h0__"; break;
-		case 22:  seq = "h0__"; break;
-		case 23:  seq = "h0_a"; break;
-		
-		case 310: seq = "h1aa"; break;
-		case 311: seq = "v__v"; break;
-		case 312: seq = "v__v"; break;
-		case 313: seq = "v__V"; break;
-		case 314: seq = "V__V"; break;
-		case 315: seq = "V__V"; break;
-		case 316: seq = "v__v"; break;
-		case 317: seq = "v__v"; break;
-		case 318: seq = "v___"; break;
-		case 319: seq = "h2__"; break;
-		case 320: seq = "h0__"; break;
-		case 321: seq = "h0__"; break;
-		case 322: seq = "h0__"; break;
-		case 323: seq = "h0__"; break;
-		case 324: seq = "h0__"; break;
-		case 325: seq = "h0__"; break;
-		case 326: seq = "h0__"; break;
-		case 327: seq = "h0__"; break;
-		case 328: seq = "h0__"; break;
-		case 329: seq = "h0__"; break;
-		case 330: seq = "h0__"; break;
-		case 331: seq = "h0__"; break;
-		case 332: seq = "h0__"; break;
-		case 333: seq = "h0__"; break;
-		case 334: seq = "h0__"; break;
-		case 335: seq = "h0__"; break;
-		
-		case 622: seq = "h1aa"; break;
-		case 623: seq = "h_av"; break;
-		case 624: seq = "v__v"; break;
-		case 625: seq = "v__v"; break;
-		
-		default:  seq = "h0aa"; break;
+			return(0);
 		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 313 ? (l->line - 23) * 2 : (l->line - 336) * 2 + 1);
 	}
-	else if(s->conf.type == VID_RASTER_525)
+	
+	/* Syster and Discret 11 share the same state */
+	if(strcmp(s->processes[i].name, "discret11") == 0)
 	{
-		switch(l->line)
-		{
-		case 1:   seq = "v__v"; break;
-		case 2:   seq = "v__v"; break;
-		case 3:   seq = "v__v"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "v__v"; break;
-		case 8:   seq = "v__v"; break;
-		case 9:   seq = "v__v"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		
-		case 263: seq = "h0av"; break;
-		case 264: seq = "v__v"; break;
-		case 265: seq = "v__v"; break;
-		case 266: seq = "v__V"; break;
-		case 267: seq = "V__V"; break;
-		case 268: seq = "V__V"; break;
-		case 269: seq = "V__v"; break;
-		case 270: seq = "v__v"; break;
-		case 271: seq = "v__v"; break;
-		case 272: seq = "v___"; break;
-		case 273: seq = "h0__"; break;
-		case 274: seq = "h0__"; break;
-		case 275: seq = "h0__"; break;
-		case 276: seq = "h0__"; break;
-		case 277: seq = "h0__"; break;
-		case 278: seq = "h0__"; break;
-		case 279: seq = "h0__"; break;
-		case 280: seq = "h0__"; break;
-		case 281: seq = "h0__"; break;
-		case 282: seq = "h0__"; break;
-		case 283: seq = "h0_a"; break;
-		
-		default:  seq = "h0aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		
-		/* There are 486 lines in this mode with some active video,
-		 * but encoded files normally only have 480 of these. Here
-		 * we use the line numbers suggested by SMPTE Recommended
-		 * Practice RP-202. Lines 23-262 from the first field and
-		 * 286-525 from the second. */
-		
-		vy = (l->line < 265 ? (l->line - 23) * 2 : (l->line - 286) * 2 + 1);
+		return(0);
 	}
-	else if(s->conf.type == VID_RASTER_819)
+	
+	return(1);
+}
+
+static int _init_stages(vid_t *s)
+{
+	int n, i, stage;
+	int total, acc;
+	
+	n = s->conf.threads;
+	if(n > s->nprocesses) n = s->nprocesses;
+	if(n < 1) n = 1;
+	
+	s->stages = calloc(sizeof(_lineprocess_stage_t), n);
+	if(!s->stages)
 	{
-		switch(l->line)
-		{
-		case 817: seq = "h___"; break;
-		case 818: seq = "h___"; break;
-		case 819: seq = "h___"; break;
-		case 1:   seq = "V___"; break;
-		case 2:   seq = "h___"; break;
-		case 3:   seq = "h___"; break;
-		case 4:   seq = "h___"; break;
-		case 5:   seq = "h___"; break;
-		case 6:   seq = "h___"; break;
-		case 7:   seq = "h___"; break;
-		case 8:   seq = "h___"; break;
-		case 9:   seq = "h___"; break;
-		case 10:  seq = "h___"; break;
-		case 11:  seq = "h___"; break;
-		case 12:  seq = "h___"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		case 15:  seq = "h___"; break;
-		case 16:  seq = "h___"; break;
-		case 17:  seq = "h___"; break;
-		case 18:  seq = "h___"; break;
-		case 19:  seq = "h___"; break;
-		case 20:  seq = "h___"; break;
-		case 21:  seq = "h___"; break;
-		case 22:  seq = "h___"; break;
-		case 23:  seq = "h___"; break;
-		case 24:  seq = "h___"; break;
-		case 25:  seq = "h___"; break;
-		case 26:  seq = "h___"; break;
-		case 27:  seq = "h___"; break;
-		case 28:  seq = "h___"; break;
-		case 29:  seq = "h___"; break;
-		case 30:  seq = "h___"; break;
-		case 31:  seq = "h___"; break;
-		case 32:  seq = "h___"; break;
-		case 33:  seq = "h___"; break;
-		case 34:  seq = "h___"; break;
-		case 35:  seq = "h___"; break;
-		case 36:  seq = "h___"; break;
-		case 37:  seq = "h___"; break;
-		case 38:  seq = "h___"; break;
-		
-		case 406: seq = "h_a_"; break;
-		case 407: seq = "h___"; break;
-		case 408: seq = "h___"; break;
-		case 409: seq = "h__V"; break;
-		case 410: seq = "h___"; break;
-		case 411: seq = "h___"; break;
-		case 412: seq = "h___"; break;
-		case 413: seq = "h___"; break;
-		case 414: seq = "h___"; break;
-		case 415: seq = "h___"; break;
-		case 416: seq = "h___"; break;
-		case 417: seq = "h___"; break;
-		case 418: seq = "h___"; break;
-		case 419: seq = "h___"; break;
-		case 420: seq = "h___"; break;
-		case 421: seq = "h___"; break;
-		case 422: seq = "h___"; break;
-		case 423: seq = "h___"; break;
-		case 424: seq = "h___"; break;
-		case 425: seq = "h___"; break;
-		case 426: seq = "h___"; break;
-		case 427: seq = "h___"; break;
-		case 428: seq = "h___"; break;
-		case 429: seq = "h___"; break;
-		case 430: seq = "h___"; break;
-		case 431: seq = "h___"; break;
-		case 432: seq = "h___"; break;
-		case 433: seq = "h___"; break;
-		case 434: seq = "h___"; break;
-		case 435: seq = "h___"; break;
-		case 436: seq = "h___"; break;
-		case 437: seq = "h___"; break;
-		case 438: seq = "h___"; break;
-		case 439: seq = "h___"; break;
-		case 440: seq = "h___"; break;
-		case 441: seq = "h___"; break;
-		case 442: seq = "h___"; break;
-		case 443: seq = "h___"; break;
-		case 444: seq = "h___"; break;
-		case 445: seq = "h___"; break;
-		case 446: seq = "h___"; break;
-		case 447: seq = "h__a"; break;
-		
-		default:  seq = "h_aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 406 ? (l->line - 48) * 2 : (l->line - 457) * 2 + 1);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(total = i = 0; i < s->nprocesses; i++)
+	{
+		total += _stage_weight(&s->processes[i]);
 	}
-	else if(s->conf.type == VID_RASTER_405)
+	
+	/* Split the processes into stages of roughly equal weight */
+	s->stages[0].first = 0;
+	
+	for(stage = acc = i = 0; i < s->nprocesses; i++)
 	{
-		switch(l->line)
+		int w = _stage_weight(&s->processes[i]);
+		
+		if(i > 0 && w > 0 && stage < n - 1 &&
+		   n * (acc * 2 + w) > total * (stage + 1) * 2 &&
+		   _stage_split_ok(s, i))
 		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__V"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "h___"; break;
-		case 6:   seq = "h___"; break;
-		case 7:   seq = "h___"; break;
-		case 8:   seq = "h___"; break;
-		case 9:   seq = "h___"; break;
-		case 10:  seq = "h___"; break;
-		case 11:  seq = "h___"; break;
-		case 12:  seq = "h___"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		case 15:  seq = "h___"; break;
-		
-		case 203: seq = "h_aV"; break;
-		case 204: seq = "V__V"; break;
-		case 205: seq = "V__V"; break;
-		case 206: seq = "V__V"; break;
-		case 207: seq = "V___"; break;
-		case 208: seq = "h___"; break;
-		case 209: seq = "h___"; break;
-		case 210: seq = "h___"; break;
-		case 211: seq = "h___"; break;
-		case 212: seq = "h___"; break;
-		case 213: seq = "h___"; break;
-		case 214: seq = "h___"; break;
-		case 215: seq = "h___"; break;
-		case 216: seq = "h___"; break;
-		case 217: seq = "h___"; break;
-		case 218: seq = "h__a"; break;
-		
-		default:  seq = "h_aa"; break;
+			s->stages[stage++].last = i - 1;
+			s->stages[stage].first = i;
 		}
 		
-		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
+		acc += w;
 	}
-	else if(s->conf.type == VID_CBS_405)
+	
+	s->stages[stage].last = s->nprocesses - 1;
+	s->nstages = stage + 1;
+	
+	/* Syster cut-and-rotate reads the frame number last returned by
+	 * vid_next_line(), so must be run by the final stage */
+	if(s->conf.systercnr)
 	{
-		switch(l->line)
+		for(i = 0; i < s->nprocesses; i++)
 		{
-		case 1:   seq = "v__v"; break;
-		case 2:   seq = "v__v"; break;
-		case 3:   seq = "v__v"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "v__v"; break;
-		case 8:   seq = "v__v"; break;
-		case 9:   seq = "v__v"; break;
-		case 10:  seq = "h___"; break;
-		case 11:  seq = "h___"; break;
-		case 12:  seq = "h___"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		
-		case 203: seq = "h_av"; break;
-		case 204: seq = "v__v"; break;
-		case 205: seq = "v__v"; break;
-		case 206: seq = "v__V"; break;
-		case 207: seq = "V__V"; break;
-		case 208: seq = "V__V"; break;
-		case 209: seq = "V__v"; break;
-		case 210: seq = "v__v"; break;
-		case 211: seq = "v__v"; break;
-		case 212: seq = "v___"; break;
-		case 213: seq = "h___"; break;
-		case 214: seq = "h___"; break;
-		case 215: seq = "h___"; break;
-		case 216: seq = "h___"; break;
-		case 217: seq = "h__a"; break;
-		
-		default:  seq = "h_aa"; break;
+			if(strcmp(s->processes[i].name, "syster") == 0) break;
 		}
 		
-		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
-	}
-	else if(s->conf.type == VID_APOLLO_320)
-	{
-		if(l->line <= 8) seq = "V__v";
-		else seq = "h_aa";
+		for(stage = 0; stage < s->nstages - 1 && s->stages[stage].last < i; stage++);
 		
-		vy = l->line - 9;
-		if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
+		s->stages[stage].last = s->nprocesses - 1;
+		s->nstages = stage + 1;
 	}
-	else if(s->conf.type == VID_BAIRD_240)
+	
+	for(i = 0; i < s->nstages; i++)
 	{
-		switch(l->line)
-		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__V"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "V__V"; break;
-		case 8:   seq = "V__V"; break;
-		case 9:   seq = "V__V"; break;
-		case 10:  seq = "V__V"; break;
-		case 11:  seq = "V__V"; break;
-		case 12:  seq = "V__V"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		case 15:  seq = "h___"; break;
-		case 16:  seq = "h___"; break;
-		case 17:  seq = "h___"; break;
-		case 18:  seq = "h___"; break;
-		case 19:  seq = "h___"; break;
-		case 20:  seq = "h___"; break;
-		
-		default:  seq = "h_aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = l->line - 20;
+		atomic_init(&s->stages[i].done, 0);
+		s->stages[i].vid = s;
 	}
-	else if(s->conf.type == VID_BAIRD_30)
+	
+	/* Allow the first stage to run up to a frame ahead */
+	s->stage_slack = (s->nstages > 1 ? s->conf.lines : 0);
+	
+	return(VID_OK);
+}
+
+static int _stage_ready(vid_t *s, int i, unsigned int t)
+{
+	unsigned int d;
+	
+	if(i < s->nstages - 1 && atomic_load(&s->stage_abort))
 	{
-		/* The original Baird 30 line standard has no sync pulses */
-		seq = "__aa";
-		vy = l->line - 1;
+		return(-1);
 	}
-	else if(s->conf.type == VID_NBTV_32)
+	
+	if(i == 0)
 	{
-		switch(l->line)
+		if(atomic_load(&s->stage_eof))
 		{
-		case 1:  seq = "__aa"; break;
-		default: seq = "h_aa"; break;
+			return(0);
 		}
 		
-		vy = l->line - 1;
+		/* Wait for space in the line ring. The line last
+		 * returned by vid_next_line() is still in use */
+		d = atomic_load(&s->stages[s->nstages - 1].done);
+		
+		return((int) (d - t + s->stage_slack - 1) >= 0 ? 1 : 0);
 	}
 	
-	if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
+	d = atomic_load(&s->stages[i - 1].done);
 	
-	if(s->conf.colour_mode == VID_PAL ||
-	   s->conf.colour_mode == VID_NTSC)
+	if((int) (d - t) > 0)
 	{
-		/* Does this line use colour? */
-		pal  = seq[1] == '0';
-		pal |= seq[1] == '1' && (l->frame & 1) == 1;
-		pal |= seq[1] == '2' && (l->frame & 1) == 0;
-		
-		/* Calculate colour sub-carrier lookup-positions for the start of this line */
-		vid_get_colour_subcarrier(s, l->frame, l->line, &lut_b, &lut_i, &lut_q);
+		return(1);
 	}
-	if(s->conf.colour_mode == VID_APOLLO_FSC)
+	
+	/* The final stage stops when it reaches the end of the source */
+	if(i == s->nstages - 1 &&
+	   atomic_load(&s->stage_eof) &&
+	   atomic_load(&s->stage_eof_line) == t)
 	{
-		/* Apollo Field Sequential Colour */
-		fsc = (l->frame * 2 + (l->line < 264 ? 0 : 1)) % 3;
-		pal = 0;
+		return(-1);
 	}
-	else if(s->conf.colour_mode == VID_CBS_FSC)
+	
+	return(0);
+}
+
+static int _stage_wait(vid_t *s, int i, unsigned int t)
+{
+	int r, n;
+	
+	/* Spin briefly before sleeping */
+	for(n = 0; n < 1000; n++)
 	{
-		/* CBS Field Sequential Colour */
-		fsc = (l->frame * 2 + (l->line < 202 ? 0 : 1)) % 3;
-		pal = 0;
+		if((r = _stage_ready(s, i, t)) != 0)
+		{
+			return(r);
+		}
 	}
 	
-	/* Render the left side sync pulse */
-	if(seq[0] == 'v') w = s->vsync_short_width;
-	else if(seq[0] == 'V') w = s->vsync_long_width;
-	else if(seq[0] == 'h') w = s->hsync_width;
-	else w = 0;
+	pthread_mutex_lock(&s->stage_mutex);
+	atomic_fetch_add(&s->stage_waiters, 1);
 	
-	for(x = 0; x < w && x < s->half_width; x++)
+	while((r = _stage_ready(s, i, t)) == 0)
+	{
+		pthread_cond_wait(&s->stage_cond, &s->stage_mutex);
+	}
+	
+	atomic_fetch_sub(&s->stage_waiters, 1);
+	pthread_mutex_unlock(&s->stage_mutex);
+	
+	return(r);
+}
+
+static void _stage_notify(vid_t *s)
+{
+	if(atomic_load(&s->stage_waiters) > 0)
 	{
-		l->output[x * 2] = s->sync_level;
+		pthread_mutex_lock(&s->stage_mutex);
+		pthread_cond_broadcast(&s->stage_cond);
+		pthread_mutex_unlock(&s->stage_mutex);
 	}
+}
+
+static void *_stage_thread(void *arg)
+{
+	_lineprocess_stage_t *st = arg;
+	vid_t *s = st->vid;
+	int i = st - s->stages;
+	unsigned int t;
 	
-	/* Render left side of active video if required */
-	if(seq[2] == 'a' && vy != -1)
+	while(1)
 	{
-		for(; x < s->active_left; x++)
+		t = atomic_load(&st->done);
+		
+		if(_stage_wait(s, i, t) < 0)
 		{
-			l->output[x * 2] = s->blanking_level;
+			break;
 		}
 		
-		for(; x < s->half_width; x++)
+		if(i == 0 && _vid_next_frame(s) != VID_OK)
 		{
-			rgb = s->framebuffer != NULL ? s->framebuffer[vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
-			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
-			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
-			}
-			
-			l->output[x * 2] = s->yiq_level_lookup[rgb].y;
-			
-			if(pal)
-			{
-				l->output[x * 2] += (s->yiq_level_lookup[rgb].i * lut_i[x]) >> 15;
-				l->output[x * 2] += (s->yiq_level_lookup[rgb].q * lut_q[x]) >> 15;
-			}
+			/* End of the source, pause until the next one is opened */
+			atomic_store(&s->stage_eof_line, t);
+			atomic_store(&s->stage_eof, 1);
+			_stage_notify(s);
+			continue;
 		}
-	}
-	else
-	{
-		for(; x < s->half_width; x++)
+		
+		_run_lineprocesses(s, st->first, st->last);
+		
+		if(i == 0)
 		{
-			l->output[x * 2] = s->blanking_level;
+			_vid_next_bline(s);
 		}
+		
+		atomic_fetch_add(&st->done, 1);
+		_stage_notify(s);
 	}
 	
-	if(seq[3] == 'a' && vy != -1)
+	return(NULL);
+}
+
+static int _stages_start(vid_t *s)
+{
+	int i;
+	
+	atomic_store(&s->stage_abort, 0);
+	
+	for(i = 0; i < s->nstages - 1; i++)
 	{
-		for(; x < s->active_left + s->active_width; x++)
+		if(pthread_create(&s->stages[i].thread, NULL, &_stage_thread, &s->stages[i]) != 0)
 		{
-			rgb = s->framebuffer != NULL ? s->framebuffer[vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
-			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
-			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
-			}
+			fprintf(stderr, "Error starting line process thread\n");
 			
-			l->output[x * 2] = s->yiq_level_lookup[rgb].y;
+			/* Stop any threads already started */
+			atomic_store(&s->stage_abort, 1);
+			_stage_notify(s);
 			
-			if(pal)
+			while(i--)
 			{
-				l->output[x * 2] += (s->yiq_level_lookup[rgb].i * lut_i[x]) >> 15;
-				l->output[x * 2] += (s->yiq_level_lookup[rgb].q * lut_q[x]) >> 15;
+				pthread_join(s->stages[i].thread, NULL);
 			}
+			
+			return(VID_ERROR);
 		}
 	}
-	else
-	{
-		if(seq[3] == 'v') w = s->vsync_short_width;
-		else if(seq[3] == 'V') w = s->vsync_long_width;
-		else w = 0;
-		
-		for(; x < s->half_width + w && x < s->width; x++)
-		{
-			l->output[x * 2] = s->sync_level;
+	
+	s->stages_running = 1;
+	
+	return(VID_OK);
+}
+
+static void _stages_stop(vid_t *s)
+{
+	int i;
+	
+	if(!s->stages_running)
+	{
+		return;
+	}
+	
+	atomic_store(&s->stage_abort, 1);
+	
+	pthread_mutex_lock(&s->stage_mutex);
+	pthread_cond_broadcast(&s->stage_cond);
+	pthread_mutex_unlock(&s->stage_mutex);
+	
+	for(i = 0; i < s->nstages - 1; i++)
+	{
+		pthread_join(s->stages[i].thread, NULL);
+	}
+	
+	s->stages_running = 0;
+}
+
+int vid_av_close(vid_t *s)
+{
+	int r;
+	
+	/* Stop any line process threads before the source is closed */
+	_stages_stop(s);
+	
+	r = s->av_close ? s->av_close(s->av_private) : VID_ERROR;
+	
+	s->av_private = NULL;
+	s->av_read_video = NULL;
+	s->av_read_audio = NULL;
+	s->av_eof = NULL;
+	s->av_close = NULL;
+	s->framebuffer_yuv = 0;
+	
+	return(r);
+}
+
+void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
+{
+	int m, r;
+	
+	/* Test if the chosen sample rate results in an even number of
+	 * samples per line. If not, display a warning and show the
+	 * previous and next valid sample rates. */
+	
+	/* Calculate lowest valid sample rate */
+	m = conf->lines * conf->frame_rate_num;
+	m /= r = gcd(m, conf->frame_rate_den);
+	if(conf->frame_rate_den / r & 1) m *= 2;
+	
+	/* Is the chosen sample rate good? */
+	if(sample_rate % m == 0) return;
+	
+	/* Not really. Suggest some good sample rates */
+	r = sample_rate / m;
+	fprintf(stderr, "Warning: Pixel rate %u may not work well with this mode.\n", sample_rate);
+	fprintf(stderr, "Next valid pixel rates: %u, %u\n", m * r, m * (r + 1));
+}
+
+/* Sequence codes: abcd
+ * 
+ * a: first sync
+ *    h = horizontal sync pulse
+ *    v = short vertical sync pulse
+ *    V = long vertical sync pulse
+ *    _ = no sync pulse
+ * 
+ * b: colour burst
+ *    0 = line always has a colour burst
+ *    _ = line never has a colour burst
+ *    1 = line has a colour burst on odd frames
+ *    2 = line has a colour burst on even frames
+ * 
+ * c: left content
+ *    _ = blanking
+ *    a = active video
+ * 
+ * d: right content
+ *    _ = blanking
+ *    a = active video
+ *    v = short vertical sync pulse
+ *    V = long vertical sync pulse
+ * 
+ * Each raster lists the lines that differ from its default sequence,
+ * as ranges of lines. The list ends with the default.
+*/
+
+typedef struct {
+	int first;
+	int last;
+	const char *seq;
+} _line_seq_t;
+
+typedef struct {
+	int type;
+	const _line_seq_t *seq;
+	int field_line;		/* First line of the second field, 0 if progressive */
+	int active_line[2];	/* Line carrying the first active line of each field */
+} _raster_seq_t;
+
+static const _line_seq_t _seq_625[] = {
+	{   1,   2, "V__V" },
+	{   3,   3, "V__v" },
+	{   4,   5, "v__v" },
+	{   6,   6, "h1__" },
+	{   7,  22, "h0__" },
+	{  23,  23, "h0_a" },
+	{ 310, 310, "h1aa" },
+	{ 311, 312, "v__v" },
+	{ 313, 313, "v__V" },
+	{ 314, 315, "V__V" },
+	{ 316, 317, "v__v" },
+	{ 318, 318, "v___" },
+	{ 319, 319, "h2__" },
+	{ 320, 335, "h0__" },
+	{ 622, 622, "h1aa" },
+	{ 623, 623, "h_av" },
+	{ 624, 625, "v__v" },
+	{   0,   0, "h0aa" },
+};
+
+static const _line_seq_t _seq_525[] = {
+	{   1,   3, "v__v" },
+	{   4,   6, "V__V" },
+	{   7,   9, "v__v" },
+	{  10,  20, "h0__" },
+	{ 263, 263, "h0av" },
+	{ 264, 265, "v__v" },
+	{ 266, 266, "v__V" },
+	{ 267, 268, "V__V" },
+	{ 269, 269, "V__v" },
+	{ 270, 271, "v__v" },
+	{ 272, 272, "v___" },
+	{ 273, 282, "h0__" },
+	{ 283, 283, "h0_a" },
+	{   0,   0, "h0aa" },
+};
+
+static const _line_seq_t _seq_819[] = {
+	{ 817, 819, "h___" },
+	{   1,   1, "V___" },
+	{   2,  38, "h___" },
+	{ 406, 406, "h_a_" },
+	{ 407, 408, "h___" },
+	{ 409, 409, "h__V" },
+	{ 410, 446, "h___" },
+	{ 447, 447, "h__a" },
+	{   0,   0, "h_aa" },
+};
+
+static const _line_seq_t _seq_405[] = {
+	{   1,   4, "V__V" },
+	{   5,  15, "h___" },
+	{ 203, 203, "h_aV" },
+	{ 204, 206, "V__V" },
+	{ 207, 207, "V___" },
+	{ 208, 217, "h___" },
+	{ 218, 218, "h__a" },
+	{   0,   0, "h_aa" },
+};
+
+static const _line_seq_t _seq_cbs_405[] = {
+	{   1,   3, "v__v" },
+	{   4,   6, "V__V" },
+	{   7,   9, "v__v" },
+	{  10,  14, "h___" },
+	{ 203, 203, "h_av" },
+	{ 204, 205, "v__v" },
+	{ 206, 206, "v__V" },
+	{ 207, 208, "V__V" },
+	{ 209, 209, "V__v" },
+	{ 210, 211, "v__v" },
+	{ 212, 212, "v___" },
+	{ 213, 216, "h___" },
+	{ 217, 217, "h__a" },
+	{   0,   0, "h_aa" },
+};
+
+static const _line_seq_t _seq_apollo_320[] = {
+	{   1,   8, "V__v" },
+	{   0,   0, "h_aa" },
+};
+
+static const _line_seq_t _seq_baird_240[] = {
+	{   1,  12, "V__V" },
+	{  13,  20, "h___" },
+	{   0,   0, "h_aa" },
+};
+
+/* The original Baird 30 line standard has no sync pulses */
+static const _line_seq_t _seq_baird_30[] = {
+	{   0,   0, "__aa" },
+};
+
+static const _line_seq_t _seq_nbtv_32[] = {
+	{   1,   1, "__aa" },
+	{   0,   0, "h_aa" },
+};
+
+static const _line_seq_t _seq_none[] = {
+	{   0,   0, "____" },
+};
+
+static const _raster_seq_t _raster_seqs[] = {
+	{ VID_RASTER_625, _seq_625,        313, {  23, 336 } },
+	
+	/* There are 486 lines in this mode with some active video,
+	 * but encoded files normally only have 480 of these. Here
+	 * we use the line numbers suggested by SMPTE Recommended
+	 * Practice RP-202. Lines 23-262 from the first field and
+	 * 286-525 from the second. */
+	{ VID_RASTER_525, _seq_525,        265, {  23, 286 } },
+	
+	{ VID_RASTER_819, _seq_819,        406, {  48, 457 } },
+	{ VID_RASTER_405, _seq_405,        210, {  16, 219 } },
+	{ VID_CBS_405,    _seq_cbs_405,    210, {  16, 219 } },
+	{ VID_APOLLO_320, _seq_apollo_320,   0, {   9     } },
+	{ VID_BAIRD_240,  _seq_baird_240,    0, {  20     } },
+	{ VID_BAIRD_30,   _seq_baird_30,     0, {   1     } },
+	{ VID_NBTV_32,    _seq_nbtv_32,      0, {   1     } },
+	{ -1,             _seq_none,         0, {   0     } },
+};
+
+static void _render_blank_line(vid_t *s, int16_t *output, const char *seq)
+{
+	int x, w;
+	
+	/* Render the left side sync pulse */
+	if(seq[0] == 'v') w = s->vsync_short_width;
+	else if(seq[0] == 'V') w = s->vsync_long_width;
+	else if(seq[0] == 'h') w = s->hsync_width;
+	else w = 0;
+	
+	for(x = 0; x < w && x < s->half_width; x++)
+	{
+		output[x * 2] = s->sync_level;
+	}
+	
+	for(; x < s->half_width; x++)
+	{
+		output[x * 2] = s->blanking_level;
+	}
+	
+	/* Render the right side sync pulse */
+	if(seq[3] == 'v') w = s->vsync_short_width;
+	else if(seq[3] == 'V') w = s->vsync_long_width;
+	else w = 0;
+	
+	for(; x < s->half_width + w && x < s->width; x++)
+	{
+		output[x * 2] = s->sync_level;
+	}
+	
+	/* Blank the remainder of the line */
+	for(; x < s->width; x++)
+	{
+		output[x * 2] = s->blanking_level;
+	}
+	
+	for(x = 0; x < s->width; x++)
+	{
+		output[x * 2 + 1] = 0;
+	}
+}
+
+static int _init_line_templates(vid_t *s)
+{
+	const _raster_seq_t *rs;
+	const _line_seq_t *ls;
+	_line_desc_t *d;
+	const char *shapes[12];
+	int16_t *b;
+	int16_t *lut_b;
+	int *offsets;
+	int line, vy, x, i;
+	
+	for(rs = _raster_seqs; rs->type != -1 && rs->type != s->conf.type; rs++);
+	
+	s->line_desc = calloc(s->conf.lines, sizeof(_line_desc_t));
+	if(!s->line_desc)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Describe each line of the frame */
+	s->nshapes = 0;
+	
+	for(line = 1; line <= s->conf.lines; line++)
+	{
+		d = &s->line_desc[line - 1];
+		
+		for(ls = rs->seq; ls->first && (line < ls->first || line > ls->last); ls++);
+		d->seq = ls->seq;
+		
+		/* Calculate the active line number */
+		if(rs->field_line == 0) vy = line - rs->active_line[0];
+		else if(line < rs->field_line) vy = (line - rs->active_line[0]) * 2;
+		else vy = (line - rs->active_line[1]) * 2 + 1;
+		
+		d->vy = vy < 0 || vy >= s->conf.active_lines ? -1 : vy;
+		
+		/* Lines share a template if their sync pulses match */
+		for(i = 0; i < s->nshapes; i++)
+		{
+			if(shapes[i][0] == d->seq[0] &&
+			   (shapes[i][3] == d->seq[3] ||
+			   (strchr("vV", shapes[i][3]) == NULL &&
+			    strchr("vV", d->seq[3]) == NULL))) break;
+		}
+		
+		if(i == s->nshapes)
+		{
+			shapes[s->nshapes++] = d->seq;
+		}
+		
+		d->shape = i;
+		
+		/* The runs of active video on each side of the line */
+		if(d->vy == -1) continue;
+		
+		if(d->seq[0] == 'v') x = s->vsync_short_width;
+		else if(d->seq[0] == 'V') x = s->vsync_long_width;
+		else if(d->seq[0] == 'h') x = s->hsync_width;
+		else x = 0;
+		
+		if(x > s->half_width) x = s->half_width;
+		
+		if(d->seq[2] == 'a')
+		{
+			if(x < s->active_left) x = s->active_left;
+			
+			d->active_x[0] = x;
+			d->active_w[0] = s->half_width - x;
+			if(d->active_w[0] < 0) d->active_w[0] = 0;
+		}
+		
+		if(x < s->half_width) x = s->half_width;
+		
+		if(d->seq[3] == 'a')
+		{
+			d->active_x[1] = x;
+			d->active_w[1] = s->active_left + s->active_width - x;
+			if(d->active_w[1] < 0) d->active_w[1] = 0;
+		}
+	}
+	
+	/* Render the sync and blanking templates */
+	s->shapes = malloc(sizeof(int16_t) * 2 * s->width * s->nshapes);
+	if(!s->shapes)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < s->nshapes; i++)
+	{
+		_render_blank_line(s, &s->shapes[i * 2 * s->width], shapes[i]);
+	}
+	
+	if(s->conf.colour_mode != VID_PAL &&
+	   s->conf.colour_mode != VID_NTSC)
+	{
+		return(VID_OK);
+	}
+	
+	/* Cached bursts replace the blanking they sit on before the active
+	 * video is rendered. Only do this if the burst can't overlap any
+	 * sync pulse or active video, otherwise it's added to each line */
+	for(line = 0; line < s->conf.lines; line++)
+	{
+		d = &s->line_desc[line];
+		
+		if(d->seq[1] == '_') continue;
+		
+		for(x = s->burst_left; x < s->burst_left + s->burst_width; x++)
+		{
+			if(s->shapes[(d->shape * s->width + x) * 2] != s->blanking_level) break;
+		}
+		
+		if(x < s->burst_left + s->burst_width) break;
+		
+		for(i = 0; i < 2; i++)
+		{
+			if(d->active_w[i] > 0 &&
+			   d->active_x[i] < s->burst_left + s->burst_width &&
+			   d->active_x[i] + d->active_w[i] > s->burst_left) break;
+		}
+		
+		if(i < 2) break;
+	}
+	
+	if(line < s->conf.lines)
+	{
+		return(VID_OK);
+	}
+	
+	/* The subcarrier phase of each line repeats every 4 frames. Render
+	 * the burst once for each distinct phase */
+	s->burst_index = malloc(sizeof(int) * 4 * s->conf.lines);
+	offsets = malloc(sizeof(int) * 4 * s->conf.lines);
+	if(!s->burst_index || !offsets)
+	{
+		free(offsets);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->nbursts = 0;
+	
+	for(i = 0; i < 4 * s->conf.lines; i++)
+	{
+		vid_get_colour_subcarrier(s, i / s->conf.lines, i % s->conf.lines + 1, &lut_b, NULL, NULL);
+		
+		for(x = 0; x < s->nbursts && offsets[x] != lut_b - s->colour_lookup; x++);
+		if(x == s->nbursts) offsets[s->nbursts++] = lut_b - s->colour_lookup;
+		
+		s->burst_index[i] = x;
+	}
+	
+	s->bursts = malloc(sizeof(int16_t) * 2 * s->burst_width * s->nbursts);
+	if(!s->bursts)
+	{
+		free(offsets);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < s->nbursts; i++)
+	{
+		b = &s->bursts[i * 2 * s->burst_width];
+		lut_b = &s->colour_lookup[offsets[i]];
+		
+		for(x = 0; x < s->burst_width; x++)
+		{
+			b[x * 2] = s->blanking_level;
+			b[x * 2] += (lut_b[s->burst_left + x] * s->burst_win[x]) >> 15;
+			b[x * 2 + 1] = 0;
+		}
+	}
+	
+	free(offsets);
+	
+	return(VID_OK);
+}
+
+static void _vid_render_raster(vid_t *s, vid_line_t *l, const uint32_t *framebuffer)
+{
+	const _line_desc_t *d = &s->line_desc[l->line - 1];
+	const char *seq = d->seq;
+	int x;
+	int w;
+	int i;
+	uint32_t rgb;
+	_yiq16_t yiq;
+	int vec;
+	int pal = 0;
+	int fsc = 0;
+	int16_t *lut_b = NULL;
+	int16_t *lut_i = NULL;
+	int16_t *lut_q = NULL;
+	
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		/* Does this line use colour? */
+		pal  = seq[1] == '0';
+		pal |= seq[1] == '1' && (l->frame & 1) == 1;
+		pal |= seq[1] == '2' && (l->frame & 1) == 0;
+		
+		/* Calculate colour sub-carrier lookup-positions for the start of this line */
+		vid_get_colour_subcarrier(s, l->frame, l->line, &lut_b, &lut_i, &lut_q);
+	}
+	if(s->conf.colour_mode == VID_APOLLO_FSC)
+	{
+		/* Apollo Field Sequential Colour */
+		fsc = (l->frame * 2 + (l->line < 264 ? 0 : 1)) % 3;
+		pal = 0;
+	}
+	else if(s->conf.colour_mode == VID_CBS_FSC)
+	{
+		/* CBS Field Sequential Colour */
+		fsc = (l->frame * 2 + (l->line < 202 ? 0 : 1)) % 3;
+		pal = 0;
+	}
+	
+	/* The field sequential modes pick a single channel from each
+	 * pixel, everything else can use the active video kernel */
+	vec = framebuffer != NULL &&
+	      s->conf.colour_mode != VID_APOLLO_FSC &&
+	      s->conf.colour_mode != VID_CBS_FSC;
+	
+	/* Start with the sync pulses and blanking for this line */
+	memcpy(l->output, &s->shapes[d->shape * 2 * s->width], sizeof(int16_t) * 2 * s->width);
+	
+	/* Copy in the pre-rendered colour burst */
+	if(pal && s->bursts)
+	{
+		i = s->burst_index[(l->frame & 3) * s->conf.lines + l->line - 1];
+		
+		memcpy(
+			&l->output[s->burst_left * 2],
+			&s->bursts[i * 2 * s->burst_width],
+			sizeof(int16_t) * 2 * s->burst_width
+		);
+	}
+	
+	/* Render the active video */
+	for(i = 0; i < 2 && d->vy != -1; i++)
+	{
+		x = d->active_x[i];
+		w = d->active_x[i] + d->active_w[i];
+		
+		if(vec && x < w && s->framebuffer_yuv)
+		{
+			const uint8_t *py = (const uint8_t *) framebuffer;
+			const uint8_t *pu = py + s->active_width * s->conf.active_lines;
+			const uint8_t *pv = pu + (s->active_width + 1) / 2 * s->conf.active_lines;
+			
+			py += d->vy * s->active_width;
+			pu += d->vy * ((s->active_width + 1) / 2);
+			pv += d->vy * ((s->active_width + 1) / 2);
+			
+			s->composite_yuv(
+				&l->output[x * 2],
+				py, pu, pv,
+				x - s->active_left,
+				w - x,
+				s->yuv_lut, s->yiq_offset,
+				pal ? &lut_i[x] : NULL,
+				pal ? &lut_q[x] : NULL
+			);
+			
+			continue;
+		}
+		
+		if(vec && x < w)
+		{
+			s->composite_rgb(
+				&l->output[x * 2],
+				&framebuffer[d->vy * s->active_width + x - s->active_left],
+				w - x,
+				s->yiq_lut, s->yiq_offset,
+				pal ? &lut_i[x] : NULL,
+				pal ? &lut_q[x] : NULL
+			);
+			
+			continue;
+		}
+		
+		for(; x < w; x++)
+		{
+			rgb = framebuffer != NULL ? framebuffer[d->vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
+			
+			if(s->conf.colour_mode == VID_APOLLO_FSC ||
+			   s->conf.colour_mode == VID_CBS_FSC)
+			{
+				rgb  = (rgb >> (8 * fsc)) & 0xFF;
+				rgb |= (rgb << 8) | (rgb << 16);
+			}
+			
+			yiq = vid_yiq_level(s, rgb);
+			
+			l->output[x * 2] = yiq.y;
+			
+			if(pal)
+			{
+				l->output[x * 2] += (yiq.i * lut_i[x]) >> 15;
+				l->output[x * 2] += (yiq.q * lut_q[x]) >> 15;
+			}
+		}
+	}
+	
+	/* Render the colour burst, if it couldn't be cached */
+	if(pal && !s->bursts)
+	{
+		for(x = s->burst_left; x < s->burst_left + s->burst_width; x++)
+		{
+			l->output[x * 2] += (lut_b[x] * s->burst_win[x - s->burst_left]) >> 15;
+		}
+	}
+	
+	/* Render the FSC flag */
+	if(s->conf.colour_mode == VID_APOLLO_FSC && fsc == 1 &&
+	  (l->line == 18 || l->line == 281))
+	{
+		/* The Apollo colour standard transmits one colour per field
+		 * (Blue, Red, Green), with the green field indicated by a flag
+		 * on field line 18. The flag also indicates the temperature of
+		 * the camera by its duration, varying between 5 and 45 μs. The
+		 * duration is fixed to 20 μs in hacktv. */
+		for(x = s->fsc_flag_left; x < s->fsc_flag_left + s->fsc_flag_width; x++)
+		{
+			l->output[x * 2] = s->fsc_flag_level;
+		}
+	}
+	
+	/* Render the CBS FSC flag */
+	if(s->conf.colour_mode == VID_CBS_FSC && fsc == 2 &&
+	  (l->line == 1 || l->line == 203))
+	{
+		w = (l->line == 1 ? s->fsc_flag_left : s->half_width + s->fsc_flag_left);
+		for(x = 0; x < s->vsync_short_width; x++)
+		{
+			l->output[(w + x) * 2] = s->sync_level;
+		}
+	}
+	
+	/* Render the SECAM colour subcarrier */
+	if(s->conf.colour_mode == VID_SECAM &&
+	   (seq[2] == 'a' || seq[3] == 'a'))
+	{
+		const cint16_t *g;
+		int16_t dmin, dmax;
+		
+		for(x = 0; x < s->width; x++)
+		{
+			rgb = 0x000000;
+			
+			if(x >= s->active_left && x < s->active_left + s->active_width)
+			{
+				rgb = framebuffer != NULL ? framebuffer[d->vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
+			}
+			
+			yiq = vid_yiq_level(s, rgb);
+			
+			if(((l->frame * s->conf.lines) + l->line) & 1)
+			{
+				l->output[x * 2 + 1] = yiq.q;
+			}
+			else
+			{
+				l->output[x * 2 + 1] = yiq.i;
+			}
+		}
+		
+		fir_int16_process_block(&s->secam_l_fir, l->output + s->active_left * 2, l->output + s->active_left * 2, s->active_width);
+		fir_int16_process_block(&s->fm_secam_fir, l->output + 1, l->output + 1, s->width);
+		iir_int16_process(&s->fm_secam_iir, l->output + 1, l->output + 1, s->width, 2);
+		
+		/* Limit the FM deviation */
+		dmin = s->fm_secam_dmin[((l->frame * s->conf.lines) + l->line) & 1];
+		dmax = s->fm_secam_dmax[((l->frame * s->conf.lines) + l->line) & 1];
+		
+		for(x = 0; x < s->width; x++)
+		{
+			if(l->output[x * 2 + 1] < dmin) l->output[x * 2 + 1] = dmin;
+			else if(l->output[x * 2 + 1] > dmax) l->output[x * 2 + 1] = dmax;
+		}
+		
+		x = s->active_left;
+		w = x + s->active_width;
+		
+		if(seq[2] != 'a') x = s->half_width;
+		if(seq[3] != 'a') w = s->half_width;
+		
+		x -= s->active_left - s->burst_left;
+		
+		for(; x < w; x++)
+		{
+			g = &s->fm_secam_bell[(uint16_t) l->output[x * 2 + 1]];
+			_fm_modulator_add_cgain(&s->fm_secam, &l->output[x * 2], l->output[x * 2 + 1], g);
+		}
+	}
+	
+	/* Clear the Q channel. The templates already did this for
+	 * the line itself, except where SECAM has used it */
+	for(x = s->conf.colour_mode == VID_SECAM ? 0 : s->width; x < s->max_width; x++)
+	{
+		l->output[x * 2 + 1] = 0;
+	}
+}
+
+static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	
+	l->width    = s->width;
+	l->frame    = s->bframe;
+	l->line     = s->bline;
+	l->vbialloc = 0;
+	
+	_vid_render_raster(s, l, s->framebuffer);
+	
+	return(1);
+}
+
+/* Frame-parallel raster
+ * 
+ * Each time a new frame (or field, if interlaced) is loaded the lines
+ * that use it are rendered by a pool of worker threads into a ring of
+ * line buffers. The raster process then takes the completed lines in
+ * order, swapping its output buffer with the rendered one. The next
+ * frame is not loaded until all lines of the previous have been taken,
+ * so the framebuffer remains valid for the workers.
+ * 
+ * Not used with SECAM, as its FM subcarrier and filters carry state
+ * from one line to the next.
+*/
+
+static int _raster_pool_render_next(_raster_pool_t *p)
+{
+	vid_line_t *l;
+	unsigned int c;
+	int i;
+	
+	/* Claim the next line of the current batch. The batch generation is
+	 * held in the upper bits so stale claims from a previous batch fail */
+	c = atomic_load(&p->claim);
+	
+	do
+	{
+		i = c & 0xFFFF;
+		
+		if(i >= atomic_load(&p->count))
+		{
+			return(0);
+		}
+	}
+	while(!atomic_compare_exchange_weak(&p->claim, &c, c + 1));
+	
+	l = &p->lines[i];
+	l->width    = p->vid->width;
+	l->frame    = p->frame;
+	l->line     = p->line + i;
+	l->vbialloc = 0;
+	
+	_vid_render_raster(p->vid, l, p->framebuffer);
+	
+	atomic_store(&p->ready[i], 1);
+	
+	if(atomic_load(&p->line_waiters) > 0)
+	{
+		pthread_mutex_lock(&p->mutex);
+		pthread_cond_broadcast(&p->line_cond);
+		pthread_mutex_unlock(&p->mutex);
+	}
+	
+	return(1);
+}
+
+static void *_raster_pool_thread(void *arg)
+{
+	_raster_pool_t *p = arg;
+	unsigned int gen = 0;
+	
+	while(1)
+	{
+		/* Wait for a new batch */
+		pthread_mutex_lock(&p->mutex);
+		
+		while(atomic_load(&p->gen) == gen && !atomic_load(&p->abort))
+		{
+			pthread_cond_wait(&p->batch_cond, &p->mutex);
+		}
+		
+		pthread_mutex_unlock(&p->mutex);
+		
+		if(atomic_load(&p->abort))
+		{
+			break;
 		}
+		
+		gen = atomic_load(&p->gen);
+		
+		while(_raster_pool_render_next(p));
 	}
 	
-	/* Blank the remainder of the line */
-	for(; x < s->width; x++)
+	return(NULL);
+}
+
+static void _raster_pool_dispatch(vid_t *s, _raster_pool_t *p)
+{
+	unsigned int gen;
+	int i, n;
+	
+	/* Block any claims while the batch is set up */
+	gen = (atomic_load(&p->gen) + 1) & 0xFFFF;
+	atomic_store(&p->claim, (gen << 16) | 0xFFFF);
+	
+	/* A batch covers every line up to the next frame load */
+	if(!s->conf.interlace) n = s->conf.lines;
+	else if(s->bline == 1) n = s->conf.hline - 1;
+	else n = s->conf.lines - s->conf.hline + 1;
+	
+	atomic_store(&p->count, n);
+	p->framebuffer = s->framebuffer;
+	p->frame = s->bframe;
+	p->line = s->bline;
+	p->next = 0;
+	
+	for(i = 0; i < n; i++)
 	{
-		l->output[x * 2] = s->blanking_level;
+		atomic_store(&p->ready[i], 0);
 	}
 	
-	/* Render the colour burst */
-	if(pal)
+	atomic_store(&p->claim, gen << 16);
+	
+	pthread_mutex_lock(&p->mutex);
+	atomic_store(&p->gen, gen);
+	pthread_cond_broadcast(&p->batch_cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static int _vid_raster_pool_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	_raster_pool_t *p = arg;
+	vid_line_t *l = lines[0];
+	vid_line_t *r;
+	int16_t *output;
+	
+	/* Start rendering the lines of a newly loaded frame */
+	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
 	{
-		for(x = s->burst_left; x < s->burst_left + s->burst_width; x++)
-		{
-			l->output[x * 2] += (lut_b[x] * s->burst_win[x - s->burst_left]) >> 15;
-		}
+		_raster_pool_dispatch(s, p);
 	}
 	
-	/* Render the FSC flag */
-	if(s->conf.colour_mode == VID_APOLLO_FSC && fsc == 1 &&
-	  (l->line == 18 || l->line == 281))
+	r = &p->lines[p->next];
+	
+	/* Help render while waiting for the next line */
+	while(!atomic_load(&p->ready[p->next]))
 	{
-		/* The Apollo colour standard transmits one colour per field
-		 * (Blue, Red, Green), with the green field indicated by a flag
-		 * on field line 18. The flag also indicates the temperature of
-		 * the camera by its duration, varying between 5 and 45 μs. The
-		 * duration is fixed to 20 μs in hacktv. */
-		for(x = s->fsc_flag_left; x < s->fsc_flag_left + s->fsc_flag_width; x++)
+		if(_raster_pool_render_next(p))
 		{
-			l->output[x * 2] = s->fsc_flag_level;
+			continue;
+		}
+		
+		pthread_mutex_lock(&p->mutex);
+		atomic_fetch_add(&p->line_waiters, 1);
+		
+		while(!atomic_load(&p->ready[p->next]))
+		{
+			pthread_cond_wait(&p->line_cond, &p->mutex);
 		}
+		
+		atomic_fetch_sub(&p->line_waiters, 1);
+		pthread_mutex_unlock(&p->mutex);
 	}
 	
-	/* Render the CBS FSC flag */
-	if(s->conf.colour_mode == VID_CBS_FSC && fsc == 2 &&
-	  (l->line == 1 || l->line == 203))
+	p->next++;
+	
+	/* Swap the rendered buffer into the output line */
+	output = l->output;
+	l->output = r->output;
+	r->output = output;
+	
+	l->width    = r->width;
+	l->frame    = r->frame;
+	l->line     = r->line;
+	l->vbialloc = r->vbialloc;
+	
+	return(1);
+}
+
+static void _vid_raster_pool_free(vid_t *s, void *arg)
+{
+	_raster_pool_t *p = arg;
+	int i;
+	
+	if(p == NULL)
 	{
-		w = (l->line == 1 ? s->fsc_flag_left : s->half_width + s->fsc_flag_left);
-		for(x = 0; x < s->vsync_short_width; x++)
-		{
-			l->output[(w + x) * 2] = s->sync_level;
-		}
+		return;
 	}
 	
-	/* Render the SECAM colour subcarrier */
-	if(s->conf.colour_mode == VID_SECAM &&
-	   (seq[2] == 'a' || seq[3] == 'a'))
+	if(p->threads)
 	{
-		const cint16_t *g;
-		int16_t dmin, dmax;
+		pthread_mutex_lock(&p->mutex);
+		atomic_store(&p->abort, 1);
+		pthread_cond_broadcast(&p->batch_cond);
+		pthread_mutex_unlock(&p->mutex);
 		
-		for(x = 0; x < s->width; x++)
+		for(i = 0; i < p->nthreads; i++)
 		{
-			rgb = 0x000000;
-			
-			if(x >= s->active_left && x < s->active_left + s->active_width)
-			{
-				rgb = s->framebuffer != NULL ? s->framebuffer[vy * s->active_width + x - s->active_left] & 0xFFFFFF : 0x000000;
-			}
-			
-			if(((l->frame * s->conf.lines) + l->line) & 1)
-			{
-				l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].q;
-			}
-			else
-			{
-				l->output[x * 2 + 1] = s->yiq_level_lookup[rgb].i;
-			}
+			pthread_join(p->threads[i], NULL);
 		}
 		
-		fir_int16_process_block(&s->secam_l_fir, l->output + s->active_left * 2, l->output + s->active_left * 2, s->active_width);
-		fir_int16_process_block(&s->fm_secam_fir, l->output + 1, l->output + 1, s->width);
-		iir_int16_process(&s->fm_secam_iir, l->output + 1, l->output + 1, s->width, 2);
-		
-		/* Limit the FM deviation */
-		dmin = s->fm_secam_dmin[((l->frame * s->conf.lines) + l->line) & 1];
-		dmax = s->fm_secam_dmax[((l->frame * s->conf.lines) + l->line) & 1];
-		
-		for(x = 0; x < s->width; x++)
+		free(p->threads);
+	}
+	
+	if(p->lines)
+	{
+		for(i = 0; i < s->conf.lines; i++)
 		{
-			if(l->output[x * 2 + 1] < dmin) l->output[x * 2 + 1] = dmin;
-			else if(l->output[x * 2 + 1] > dmax) l->output[x * 2 + 1] = dmax;
+			free(p->lines[i].output);
 		}
 		
-		x = s->active_left;
-		w = x + s->active_width;
-		
-		if(seq[2] != 'a') x = s->half_width;
-		if(seq[3] != 'a') w = s->half_width;
-		
-		x -= s->active_left - s->burst_left;
+		free(p->lines);
+	}
+	
+	free(p->ready);
+	
+	pthread_cond_destroy(&p->line_cond);
+	pthread_cond_destroy(&p->batch_cond);
+	pthread_mutex_destroy(&p->mutex);
+	
+	free(p);
+}
+
+static int _init_raster_pool(vid_t *s, _raster_pool_t *p)
+{
+	int i;
+	
+	/* Allocate the line ring, once the final line width is known */
+	p->lines = calloc(sizeof(vid_line_t), s->conf.lines);
+	p->ready = calloc(sizeof(atomic_int), s->conf.lines);
+	if(!p->lines || !p->ready)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < s->conf.lines; i++)
+	{
+		p->lines[i].output = calloc(sizeof(int16_t) * 2, s->max_width);
+		if(!p->lines[i].output)
+		{
+			return(VID_OUT_OF_MEMORY);
+		}
 		
-		for(; x < w; x++)
+		atomic_init(&p->ready[i], 0);
+	}
+	
+	/* Start the workers. The thread running the raster
+	 * process also renders, so one less is needed */
+	p->threads = calloc(sizeof(pthread_t), p->nthreads);
+	if(!p->threads)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < p->nthreads; i++)
+	{
+		if(pthread_create(&p->threads[i], NULL, &_raster_pool_thread, p) != 0)
 		{
-			g = &s->fm_secam_bell[(uint16_t) l->output[x * 2 + 1]];
-			_fm_modulator_add_cgain(&s->fm_secam, &l->output[x * 2], l->output[x * 2 + 1], g);
+			fprintf(stderr, "Error starting raster thread\n");
+			p->nthreads = i;
+			return(VID_ERROR);
 		}
 	}
 	
-	/* Clear the Q channel */
-	for(x = 0; x < s->max_width; x++)
+	return(VID_OK);
+}
+
+static _raster_pool_t *_new_raster_pool(vid_t *s)
+{
+	_raster_pool_t *p;
+	
+	p = calloc(1, sizeof(_raster_pool_t));
+	if(!p)
 	{
-		l->output[x * 2 + 1] = 0;
+		return(NULL);
 	}
 	
-	return(1);
+	p->vid = s;
+	p->nthreads = s->conf.raster_threads - 1;
+	
+	atomic_init(&p->claim, 0);
+	atomic_init(&p->count, 0);
+	atomic_init(&p->gen, 0);
+	atomic_init(&p->abort, 0);
+	atomic_init(&p->line_waiters, 0);
+	
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->batch_cond, NULL);
+	pthread_cond_init(&p->line_cond, NULL);
+	
+	return(p);
 }
 
 static int _vid_filter_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
@@ -2838,6 +3432,17 @@ static int _vid_filter_process(vid_t *s, void *arg, int nlines, vid_line_t **lin
 	return(1);
 }
 
+static int _vid_vfilter_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	_vid_filter_process_t *p = arg;
+	vid_line_t *dst = lines[0];
+	vid_line_t *src = lines[nlines - 1];
+	
+	dst->width = fir_int16_process_strided(&p->fir, dst->output, 2, src->output, 2, src->width);
+	
+	return(1);
+}
+
 static void _vid_filter_free(vid_t *s, void *arg)
 {
 	_vid_filter_process_t *p = arg;
@@ -2846,158 +3451,267 @@ static void _vid_filter_free(vid_t *s, void *arg)
 	free(p);
 }
 
+static int _init_audio_upsampler(vid_t *s)
+{
+	fir_int16_t *fir[4] = { NULL, NULL, NULL, NULL };
+	int i, n;
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0) fir[0] = &s->fm_mono.resampler;
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0) fir[1] = &s->fm_left.resampler;
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0) fir[2] = &s->fm_right.resampler;
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0) fir[3] = &s->am_mono.resampler;
+	
+	n = gcd(s->sample_rate, HACKTV_AUDIO_SAMPLE_RATE);
+	s->audio_interpolation = s->sample_rate / n;
+	s->audio_decimation = HACKTV_AUDIO_SAMPLE_RATE / n;
+	s->interp = 0;
+	s->audio_phase = 0;
+	
+	/* The carriers run one input sample behind the source audio, so
+	 * the resamplers always have a line ready while the source is
+	 * still read at the same points as the original sample hold */
+	s->audio_len = (s->audio_interpolation + s->audio_decimation - 1) / s->audio_decimation;
+	
+	/* The resampler uses 21 taps per phase, so sample rates with a
+	 * very large ratio fall back to holding each sample */
+	for(i = 0; i < 4 && s->audio_interpolation <= VID_AUDIO_MAX_INTERPOLATION; i++)
+	{
+		if(fir[i] && fir_int16_resampler_init(fir[i], s->sample_rate, HACKTV_AUDIO_SAMPLE_RATE) != 0)
+		{
+			return(VID_OUT_OF_MEMORY);
+		}
+	}
+	
+	/* Room for a line plus the output of one more input sample */
+	n = s->max_width + s->audio_len + 1;
+	
+	for(i = 0; i < 2; i++)
+	{
+		s->audio_line[i] = calloc(n * 2, sizeof(int16_t));
+		if(!s->audio_line[i])
+		{
+			return(VID_OUT_OF_MEMORY);
+		}
+	}
+	
+	return(VID_OK);
+}
+
+static void _vid_audio_next_sample(vid_t *s)
+{
+	int16_t audio[2] = { 0, 0 };
+	
+	if(s->audiobuffer_samples == 0)
+	{
+		s->audiobuffer = _av_read_audio(s, &s->audiobuffer_samples);
+		
+		if(s->conf.systeraudio == 1)
+		{
+			ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
+		}
+	}
+	
+	if(s->audiobuffer)
+	{
+		/* Fetch next sample */
+		audio[0] = s->audiobuffer[0];
+		audio[1] = s->audiobuffer[1];
+		s->audiobuffer += 2;
+		s->audiobuffer_samples--;
+	}
+	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		s->am_mono.sample = (audio[0] + audio[1]) / 2;
+	}
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		s->fm_mono.sample = (audio[0] + audio[1]) / 2;
+		if(s->fm_mono.limiter.width)
+		{
+			limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
+		}
+		
+		/* Reduce volume of audio in A2 Stereo mode to
+		 * leave room for the pilot/mode signal */
+		if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		s->fm_left.sample = audio[0];
+		if(s->fm_left.limiter.width)
+		{
+			limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
+		}
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		s->fm_right.sample = audio[1];
+		if(s->fm_right.limiter.width)
+		{
+			limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
+		}
+		
+		/* Reduce volume of audio in A2 Stereo mode to
+		 * leave room for the pilot/mode signal */
+		if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
+	}
+	
+	if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+	   s->conf.type == VID_MAC)
+	{
+		s->nicam_buf[s->nicam_buf_len++] = audio[0];
+		s->nicam_buf[s->nicam_buf_len++] = audio[1];
+		
+		if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
+		{
+			if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+			{
+				nicam_mod_input(&s->nicam, s->nicam_buf);
+			}
+			
+			if(s->conf.type == VID_MAC)
+			{
+				mac_write_audio(s, s->nicam_buf);
+			}
+			
+			s->nicam_buf_len = 0;
+		}
+	}
+	
+	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	{
+		s->dance_buf[s->dance_buf_len++] = audio[0];
+		s->dance_buf[s->dance_buf_len++] = audio[1];
+		
+		if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
+		{
+			dance_mod_input(&s->dance, s->dance_buf);
+			s->dance_buf_len = 0;
+		}
+	}
+}
+
+static void _vid_audio_carrier(fir_int16_t *fir, int16_t *out, int16_t *sample, int n)
+{
+	/* Resample the carrier's audio if a filter is available,
+	 * otherwise hold the sample for the period */
+	if(fir->type != 0)
+	{
+		fir_int16_process(fir, out, sample, 1);
+		return;
+	}
+	
+	for(; n; n--, out += 2)
+	{
+		*out = *sample;
+	}
+}
+
+static void _vid_audio_upsample(vid_t *s)
+{
+	int16_t *m = s->audio_line[0];
+	int16_t *st = s->audio_line[1];
+	int n;
+	
+	/* Read the next source sample and append its output from each
+	 * carrier's resampler. Each input sample produces the same number
+	 * of outputs from every resampler, tracked here in s->audio_phase */
+	n = (s->audio_interpolation - s->audio_phase + s->audio_decimation - 1) / s->audio_decimation;
+	s->audio_phase += n * s->audio_decimation - s->audio_interpolation;
+	
+	_vid_audio_next_sample(s);
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		_vid_audio_carrier(&s->fm_mono.resampler, &m[s->audio_len * 2 + 0], &s->fm_mono.sample, n);
+	}
+	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		_vid_audio_carrier(&s->am_mono.resampler, &m[s->audio_len * 2 + 1], &s->am_mono.sample, n);
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		_vid_audio_carrier(&s->fm_left.resampler, &st[s->audio_len * 2 + 0], &s->fm_left.sample, n);
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		_vid_audio_carrier(&s->fm_right.resampler, &st[s->audio_len * 2 + 1], &s->fm_right.sample, n);
+	}
+	
+	s->audio_len += n;
+}
+
 static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	vid_line_t *l = lines[0];
-	int16_t audio[2] = { 0, 0 };
+	int16_t *m = s->audio_line[0];
+	int16_t *st = s->audio_line[1];
 	int x;
 	
-	for(x = 0; x < l->width; x++)
+	/* Read the source audio at the same points in the line as the
+	 * sample hold did, so NICAM, MAC and DANCE see the same timing.
+	 * The hold read a sample each time the phase passed the
+	 * interpolation factor, the remainder carries to the next line */
+	x = s->interp + l->width * s->audio_decimation;
+	s->interp = x % s->audio_interpolation;
+	
+	for(x /= s->audio_interpolation; x; x--)
 	{
-		int16_t add[2] = { 0, 0 };
-		
-		/* TODO: Replace this with a real FIR filter... */
-		s->interp += HACKTV_AUDIO_SAMPLE_RATE;
-		if(s->interp >= s->sample_rate)
+		_vid_audio_upsample(s);
+	}
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		nco_fm_add(&s->fm_mono.nco, l->output, &m[0], 2, l->width);
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		nco_fm_add(&s->fm_left.nco, l->output, &st[0], 2, l->width);
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		if(s->conf.a2stereo)
 		{
-			s->interp -= s->sample_rate;
-			
-			if(s->audiobuffer_samples == 0)
-			{
-				s->audiobuffer = _av_read_audio(s, &s->audiobuffer_samples);
-				
-				if(s->conf.systeraudio == 1)
-				{
-					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
-				}
-			}
-			
-			if(s->audiobuffer)
-			{
-				/* Fetch next sample */
-				audio[0] = s->audiobuffer[0];
-				audio[1] = s->audiobuffer[1];
-				s->audiobuffer += 2;
-				s->audiobuffer_samples--;
-			}
-			else
-			{
-				/* No audio from the source */
-				audio[0] = 0;
-				audio[1] = 0;
-			}
-			
-			if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
-			{
-				s->am_mono.sample = (audio[0] + audio[1]) / 2;
-			}
-			
-			if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
-			{
-				s->fm_mono.sample = (audio[0] + audio[1]) / 2;
-				if(s->fm_mono.limiter.width)
-				{
-					limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
-			}
-			
-			if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
-			{
-				s->fm_left.sample = audio[0];
-				if(s->fm_left.limiter.width)
-				{
-					limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
-				}
-			}
-			
-			if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
-			{
-				s->fm_right.sample = audio[1];
-				if(s->fm_right.limiter.width)
-				{
-					limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
-			}
+			static const int16_t zero[2] = { 0, 0 };
+			int16_t *sig = s->a2stereo_line[0];
+			int16_t *pilot = s->a2stereo_line[1];
 			
-			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
-			   s->conf.type == VID_MAC)
-			{
-				s->nicam_buf[s->nicam_buf_len++] = audio[0];
-				s->nicam_buf[s->nicam_buf_len++] = audio[1];
-				
-				if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
-				{
-					if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
-					{
-						nicam_mod_input(&s->nicam, s->nicam_buf);
-					}
-					
-					if(s->conf.type == VID_MAC)
-					{
-						mac_write_audio(s, s->nicam_buf);
-					}
-					
-					s->nicam_buf_len = 0;
-				}
-			}
+			/* The pilot is AM modulated by the mode signal, and
+			 * added to the right channel before FM modulation */
+			memset(sig, 0, sizeof(int16_t) * 2 * l->width);
+			memset(pilot, 0, sizeof(int16_t) * 2 * l->width);
 			
-			if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
-			{
-				s->dance_buf[s->dance_buf_len++] = audio[0];
-				s->dance_buf[s->dance_buf_len++] = audio[1];
-				
-				if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
-				{
-					dance_mod_input(&s->dance, s->dance_buf);
-					s->dance_buf_len = 0;
-				}
-			}
-		}
-		
-		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
-		{
-			_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
-		}
-		
-		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
-		{
-			_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
-		}
-		
-		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
-		{
-			int16_t a2 = 0;
+			nco_am_add(&s->a2stereo_signal.nco, sig, zero, 0, l->width);
+			nco_am_add(&s->a2stereo_pilot.nco, pilot, sig, 2, l->width);
 			
-			if(s->conf.a2stereo)
+			for(x = 0; x < l->width; x++)
 			{
-				int16_t s1[2] = { 0, 0 };
-				int16_t s2[2] = { 0, 0 };
-				
-				_am_modulator_add(&s->a2stereo_signal, s1, 0);
-				_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
-				a2 = s2[0];
+				st[x * 2 + 1] += pilot[x * 2];
 			}
-			
-			_fm_modulator_add(&s->fm_right, add, s->fm_right.sample + a2);
-		}
-		
-		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
-		{
-			_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
 		}
 		
-		l->output[x * 2 + 0] += add[0];
-		l->output[x * 2 + 1] += add[1];
+		nco_fm_add(&s->fm_right.nco, l->output, &st[1], 2, l->width);
 	}
 	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		nco_am_add(&s->am_mono.nco, l->output, &m[1], 2, l->width);
+	}
+	
+	/* Keep any remaining samples for the next line */
+	s->audio_len -= l->width;
+	memmove(m, &m[l->width * 2], s->audio_len * 2 * sizeof(int16_t));
+	memmove(st, &st[l->width * 2], s->audio_len * 2 * sizeof(int16_t));
+	
 	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
 	{
 		nicam_mod_output(&s->nicam, l->output, l->width);
@@ -3106,7 +3820,7 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 		return(VID_OUT_OF_MEMORY);
 	}
 	
-	/* Update required line total (non-threaded version) */
+	/* Update required line total */
 	s->olines += nlines - 1;
 	
 	return(VID_OK);
@@ -3271,17 +3985,108 @@ static int _init_vfilter(vid_t *s)
 	
 	delay = (ntaps / 2 + width - 1) / width;
 	
-	_add_lineprocess(s, "vfilter", 1 + delay, p, _vid_filter_process, _vid_filter_free);
+	_add_lineprocess(s, "vfilter", 1 + delay, p, _vid_vfilter_process, _vid_filter_free);
 	
 	return(VID_OK);
 }
 
+/* Set the Y, I and Q contributions of a gamma corrected R, G and B value */
+static void _yiq_entry(const vid_t *s, const double rgb[3], double ys, double is, double scale, int32_t *lut)
+{
+	double y, u, v;
+	double i, q;
+	
+	/* Calculate Y, Cb and Cr values */
+	y = rgb[0] * s->conf.rw_co
+	  + rgb[1] * s->conf.gw_co
+	  + rgb[2] * s->conf.bw_co;
+	u = (rgb[2] - y);
+	v = (rgb[0] - y);
+	
+	i = s->conf.iv_co * v + s->conf.iu_co * u;
+	q = s->conf.qv_co * v + s->conf.qu_co * u;
+	
+	lut[0] = lround(y * ys * scale);
+	lut[1] = lround(i * is * scale);
+	lut[2] = lround(q * is * scale);
+	lut[3] = 0;
+}
+
+static void _init_yiq_lut(vid_t *s, double level)
+{
+	double scale = INT16_MAX * (double) (1 << VID_YIQ_BITS);
+	double ys, is;
+	double rgb[3];
+	double d;
+	int c, k;
+	
+	/* Scale and offset of the Y, I and Q levels */
+	ys = (s->conf.white_level - s->conf.black_level) * level;
+	
+	s->yiq_offset[0] = lround(s->conf.black_level * level * scale);
+	s->yiq_offset[1] = 0;
+	s->yiq_offset[2] = 0;
+	s->yiq_offset[3] = 0;
+	
+	if(s->conf.colour_mode != VID_SECAM)
+	{
+		is = ys;
+	}
+	else
+	{
+		is = 1.0 / SECAM_FM_DEV;
+		s->yiq_offset[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * scale);
+		s->yiq_offset[2] = lround((SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * scale);
+	}
+	
+	/* Round to nearest when the fractional bits are dropped */
+	for(k = 0; k < 3; k++)
+	{
+		s->yiq_offset[k] += 1 << (VID_YIQ_BITS - 1);
+	}
+	
+	for(c = 0; c < 0x100; c++)
+	{
+		for(k = 0; k < 3; k++)
+		{
+			/* Calculate the gamma corrected 0..1 value of this channel alone */
+			rgb[0] = rgb[1] = rgb[2] = 0;
+			rgb[k] = pow((double) c / 255, 1 / s->conf.gamma);
+			
+			_yiq_entry(s, rgb, ys, is, scale, s->yiq_lut[k][c]);
+		}
+	}
+	
+	/* Each Y', Cb and Cr sample maps to R, G and B linearly, so they
+	 * can be tabled the same way. This holds only without gamma
+	 * correction, vid_init() falls back to RGB otherwise */
+	for(c = 0; c < 0x100; c++)
+	{
+		/* Luma alone is grey */
+		rgb[0] = rgb[1] = rgb[2] = (double) c / 255;
+		_yiq_entry(s, rgb, ys, is, scale, s->yuv_lut[0][c]);
+		
+		/* Cb is scaled B - Y and Cr is scaled R - Y, with G
+		 * balancing them out to leave the luma unchanged */
+		d = (double) (c - 128) / 255;
+		
+		rgb[0] = 0;
+		rgb[2] = 2 * (1 - BT601_KB) * d;
+		rgb[1] = -BT601_KB * rgb[2] / BT601_KG;
+		_yiq_entry(s, rgb, ys, is, scale, s->yuv_lut[1][c]);
+		
+		rgb[0] = 2 * (1 - BT601_KR) * d;
+		rgb[2] = 0;
+		rgb[1] = -BT601_KR * rgb[0] / BT601_KG;
+		_yiq_entry(s, rgb, ys, is, scale, s->yuv_lut[2][c]);
+	}
+}
+
 int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf)
 {
 	int r, x;
 	int64_t c;
 	double d;
-	double glut[0x100];
 	double level, slevel;
 	vid_line_t *l;
 	
@@ -3291,6 +4096,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	memset(s, 0, sizeof(vid_t));
 	memcpy(&s->conf, conf, sizeof(vid_config_t));
 	
+	pthread_mutex_init(&s->stage_mutex, NULL);
+	pthread_cond_init(&s->stage_cond, NULL);
+	
 	s->sample_rate = sample_rate;
 	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
 	
@@ -3323,65 +4131,30 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->blanking_level = round(s->conf.blanking_level * level * INT16_MAX);
 	s->sync_level     = round(s->conf.sync_level     * level * INT16_MAX);
 	
-	/* Allocate memory for YUV lookup tables */
-	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
-	if(s->yiq_level_lookup == NULL)
-	{
-		vid_free(s);
-		return(VID_OUT_OF_MEMORY);
-	}
-	
-	/* Generate the gamma lookup table. LUTception */
+	/* Generate the RGB > signal level lookup tables */
 	if(s->conf.gamma <= 0)
 	{
 		s->conf.gamma = 1.0;
 	}
 	
-	for(c = 0; c < 0x100; c++)
-	{
-		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
-	}
-	
-	/* Generate the RGB > signal level lookup tables */
-	for(c = 0x000000; c <= 0xFFFFFF; c++)
+	_init_yiq_lut(s, level);
+	s->composite_rgb = composite_rgb_kernel(cpu_features());
+	s->composite_yuv = composite_yuv_kernel(cpu_features());
+	
+	/* YUV input is only rendered by the Y, I and Q sums of the
+	 * raster, and the overlays can only draw on RGB frames */
+	if(s->conf.yuv &&
+	  (s->conf.type == VID_MAC ||
+	   s->conf.colour_mode == VID_SECAM ||
+	   s->conf.colour_mode == VID_APOLLO_FSC ||
+	   s->conf.colour_mode == VID_CBS_FSC ||
+	   s->conf.gamma != 1.0 ||
+	   s->conf.logo ||
+	   s->conf.timestamp ||
+	   s->conf.subtitles))
 	{
-		double r, g, b;
-		double y, u, v;
-		double i, q;
-		
-		/* Calculate RGB 0..1 values */
-		r = glut[(c & 0xFF0000) >> 16];
-		g = glut[(c & 0x00FF00) >> 8];
-		b = glut[(c & 0x0000FF) >> 0];
-		
-		/* Calculate Y, Cb and Cr values */
-		y = r * s->conf.rw_co
-		  + g * s->conf.gw_co
-		  + b * s->conf.bw_co;
-		u = (b - y);
-		v = (r - y);
-		
-		i = s->conf.iv_co * v + s->conf.iu_co * u;
-		q = s->conf.qv_co * v + s->conf.qu_co * u;
-		
-		/* Adjust values to correct signal level */
-		y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
-		
-		if(s->conf.colour_mode != VID_SECAM)
-		{
-			i *= (s->conf.white_level - s->conf.black_level) * level;
-			q *= (s->conf.white_level - s->conf.black_level) * level;
-		}
-		else
-		{
-			i = (i + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-			q = (q + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-		}
-		
-		/* Convert to INT16 range and store in tables */
-		s->yiq_level_lookup[c].y = round(_dlimit(y, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].i = round(_dlimit(i, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].q = round(_dlimit(q, -1, 1) * INT16_MAX);
+		fprintf(stderr, "Warning: YUV input is not supported with this mode or options. Using RGB.\n");
+		s->conf.yuv = 0;
 	}
 	
 	if(s->conf.colour_lookup_lines > 0)
@@ -3488,6 +4261,17 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->audio = 0;
 	
 	/* Initalise D/D2-MAC state */
+	/* Build the line descriptors and the sync / blanking templates */
+	if(s->conf.type != VID_MAC)
+	{
+		r = _init_line_templates(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
 	if(s->conf.type == VID_MAC)
 	{
 		r = mac_init(s);
@@ -3499,6 +4283,17 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		
 		_add_lineprocess(s, "macraster", 3, NULL, mac_next_line, NULL);
 	}
+	else if(s->conf.raster_threads > 1 && s->conf.colour_mode != VID_SECAM)
+	{
+		s->raster_pool = _new_raster_pool(s);
+		if(!s->raster_pool)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		_add_lineprocess(s, "raster", 1, s->raster_pool, _vid_raster_pool_process, _vid_raster_pool_free);
+	}
 	else
 	{
 		_add_lineprocess(s, "raster", 1, NULL, _vid_next_line_raster, NULL);
@@ -3634,6 +4429,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		if(r != VID_OK)
 		{
 			vid_free(s);
+			return(r);
+		}
+		
+		/* Line buffers for the mode signal and the pilot */
+		for(x = 0; x < 2; x++)
+		{
+			s->a2stereo_line[x] = malloc(sizeof(int16_t) * 2 * s->max_width);
+			if(!s->a2stereo_line[x])
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
 		}
 		
 		/* Disable NICAM */
@@ -3644,12 +4451,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* FM audio */
 	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
-		if(r != VID_OK)
-		{
-			vid_free(s);
-			return(r);
-		}
+		nco_init(&s->fm_mono.nco, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
 		
 		if(s->conf.fm_mono_preemph)
 		{
@@ -3685,12 +4487,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
-		if(r != VID_OK)
-		{
-			vid_free(s);
-			return(r);
-		}
+		nco_init(&s->fm_left.nco, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
 		
 		if(s->conf.fm_left_preemph)
 		{
@@ -3726,12 +4523,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
-		if(r != VID_OK)
-		{
-			vid_free(s);
-			return(r);
-		}
+		nco_init(&s->fm_right.nco, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
 		
 		if(s->conf.fm_right_preemph)
 		{
@@ -3811,6 +4603,13 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* Add the audio process */
 	if(s->audio == 1)
 	{
+		r = _init_audio_upsampler(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+		
 		_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
 	}
 	
@@ -3876,6 +4675,16 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	_add_lineprocess(s, "output", 1, NULL, NULL, NULL);
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
+	/* Split the line processes into stages */
+	r = _init_stages(s);
+	if(r != VID_OK)
+	{
+		vid_free(s);
+		return(r);
+	}
+	
+	s->olines += s->stage_slack;
+	
 	/* Output line buffer(s) */
 	s->oline = calloc(sizeof(vid_line_t), s->olines);
 	if(!s->oline)
@@ -3906,8 +4715,19 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->oline[r].next = &s->oline[(r + 1) % s->olines];
 	}
 	
-	/* Setup lineprocess output windows (non-threaded version) */
-	l = &s->oline[s->olines - 1];
+	/* Start the raster workers */
+	if(s->raster_pool)
+	{
+		r = _init_raster_pool(s, s->raster_pool);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
+	/* Setup lineprocess output windows */
+	l = &s->oline[s->olines - s->stage_slack - 1];
 	
 	for(r = 0; r < s->nprocesses; r++)
 	{
@@ -3941,6 +4761,7 @@ void vid_free(vid_t *s)
 		free(s->processes[i].lines);
 	}
 	free(s->processes);
+	free(s->stages);
 	
 	if(s->conf.passthru)
 	{
@@ -3989,8 +4810,11 @@ void vid_free(vid_t *s)
 	}
 	
 	/* Free allocated memory */
-	free(s->yiq_level_lookup);
 	free(s->colour_lookup);
+	free(s->line_desc);
+	free(s->shapes);
+	free(s->burst_index);
+	free(s->bursts);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
 	iir_int16_free(&s->fm_secam_iir);
@@ -4007,6 +4831,10 @@ void vid_free(vid_t *s)
 	dance_mod_free(&s->dance);
 	nicam_mod_free(&s->nicam);
 	_free_am_modulator(&s->am_mono);
+	free(s->audio_line[0]);
+	free(s->audio_line[1]);
+	free(s->a2stereo_line[0]);
+	free(s->a2stereo_line[1]);
 	
 	if(s->oline)
 	{
@@ -4019,6 +4847,9 @@ void vid_free(vid_t *s)
 	
 	free(s->burst_win);
 	
+	pthread_cond_destroy(&s->stage_cond);
+	pthread_mutex_destroy(&s->stage_mutex);
+	
 	memset(s, 0, sizeof(vid_t));
 }
 
@@ -4036,51 +4867,104 @@ void vid_info(vid_t *s)
 	}
 	
 	fprintf(stderr, "Sample rate: %d\n", s->sample_rate);
+	
+	if(s->nstages > 1)
+	{
+		int i, j;
+		
+		fprintf(stderr, "Line process stages:");
+		
+		for(i = 0; i < s->nstages; i++)
+		{
+			if(i > 0) fprintf(stderr, " |");
+			
+			for(j = s->stages[i].first; j <= s->stages[i].last; j++)
+			{
+				fprintf(stderr, " %s", s->processes[j].name);
+			}
+		}
+		
+		fprintf(stderr, "\n");
+	}
 }
 
 size_t vid_get_framebuffer_length(vid_t *s)
 {
+	if(s->framebuffer_yuv)
+	{
+		/* Y plane followed by the half width Cb and Cr planes */
+		return((s->active_width + (s->active_width + 1) / 2 * 2) * s->conf.active_lines);
+	}
+	
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
+/* Fill a frame with a grey level, in whichever format the source uses */
+void vid_fill_framebuffer(vid_t *s, void *framebuffer, uint8_t level)
+{
+	size_t l = (size_t) s->active_width * s->conf.active_lines;
+	
+	if(s->framebuffer_yuv)
+	{
+		memset(framebuffer, level, l);
+		memset((uint8_t *) framebuffer + l, 0x80, vid_get_framebuffer_length(s) - l);
+		return;
+	}
+	
+	memset(framebuffer, level, vid_get_framebuffer_length(s));
+}
+
 static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 {
 	vid_line_t *l = s->output_process->lines[0];
-	int i, j;
 	
-	/* Load the next frame */
-	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	if(_vid_next_frame(s) != VID_OK)
 	{
-		/* Have we reached the end of the video? */
-		if(_av_eof(s))
-		{
-			return(NULL);
-		}
-		s->framebuffer = _av_read_video(s, &s->ratio);
+		return(NULL);
 	}
 	
-	for(i = 0; i < s->nprocesses; i++)
+	_run_lineprocesses(s, 0, s->nprocesses - 1);
+	_vid_next_bline(s);
+	
+	/* Return a pointer to the output buffer */
+	if(samples)
 	{
-		_lineprocess_t *p = &s->processes[i];
-		
-		if(p->process)
-		{
-			p->process(p->vid, p->arg, p->nlines, p->lines);
-		}
-		
-		for(j = 0; j < p->nlines; j++)
-		{
-			p->lines[j] = p->lines[j]->next;
-		}
+		*samples = l->width;
 	}
 	
-	/* Advance the next line/frame counter */
-	if(s->bline++ == s->conf.lines)
+	return(l);
+}
+
+static vid_line_t *_vid_next_line_staged(vid_t *s, size_t *samples)
+{
+	_lineprocess_stage_t *st = &s->stages[s->nstages - 1];
+	vid_line_t *l = s->output_process->lines[0];
+	unsigned int t = atomic_load(&st->done);
+	
+	/* Resume the first stage if the end of the previous source was reached */
+	if(s->stage_eof_returned)
 	{
-		s->bline = 1;
-		s->bframe++;
+		s->stage_eof_returned = 0;
+		atomic_store(&s->stage_eof, 0);
+		_stage_notify(s);
+	}
+	
+	if(!s->stages_running && _stages_start(s) != VID_OK)
+	{
+		return(NULL);
+	}
+	
+	if(_stage_wait(s, s->nstages - 1, t) < 0)
+	{
+		s->stage_eof_returned = 1;
+		return(NULL);
 	}
 	
+	_run_lineprocesses(s, st->first, st->last);
+	
+	atomic_fetch_add(&st->done, 1);
+	_stage_notify(s);
+	
 	/* Return a pointer to the output buffer */
 	if(samples)
 	{
@@ -4097,7 +4981,7 @@ int16_t *vid_next_line(vid_t *s, size_t *samples)
 	/* Drop any delay lines introduced by scramblers / filters */
 	do
 	{
-		l = _vid_next_line(s, samples);
+		l = s->nstages > 1 ? _vid_next_line_staged(s, samples) : _vid_next_line(s, samples);
 		if(l == NULL) return(NULL);
 	}
 	while(l->line < 1);
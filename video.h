@@ -20,10 +20,14 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "nicam728.h"
 #include "dance.h"
 #include "fir.h"
+#include "composite.h"
+#include "nco.h"
 
 #ifdef WIN32
 #define OS_SEP '\\'
@@ -99,18 +103,18 @@ typedef struct {
 	cint32_t phase;
 	cint32_t *lut;
 	
+	/* Audio subcarriers only */
+	nco_t nco;
 	limiter_t limiter;
 	int16_t sample;
+	fir_int16_t resampler;
 	
 } _mod_fm_t;
 
 typedef struct {
-	int16_t level;
-	int32_t counter;
-	cint32_t phase;
-	cint32_t delta;
-	
+	nco_t nco;
 	int16_t sample;
+	fir_int16_t resampler;
 	
 } _mod_am_t;
 
@@ -276,6 +280,27 @@ typedef struct {
 	/* Video filter enable flag */
 	int vfilter;
 	
+	/* Number of threads used to run the line processes */
+	int threads;
+	
+	/* Number of threads used to render the raster */
+	int raster_threads;
+	
+	/* Number of frames buffered between each ffmpeg thread */
+	int frame_pool;
+	
+	/* ffmpeg scaler algorithm */
+	char *scaler;
+	
+	/* --cache directory, where ffmpeg also keeps keyframe indexes */
+	char *cache;
+	
+	/* Take planar YUV 4:2:2 from the source, where the mode allows */
+	int yuv;
+	
+	/* Print source statistics */
+	int verbose;
+	
 } vid_config_t;
 
 typedef struct {
@@ -289,6 +314,17 @@ typedef struct {
 	int16_t q;
 } _yiq16_t;
 
+typedef struct {
+	const char *seq;	/* Sequence code, see _raster_seqs in video.c */
+	int vy;			/* Active line number, or -1 */
+	int shape;		/* Sync and blanking template */
+	int active_x[2];	/* Left and right runs of active video */
+	int active_w[2];
+} _line_desc_t;
+
+/* Fractional bits used by the RGB > signal level tables */
+#define VID_YIQ_BITS 12
+
 struct vid_line_t {
 	
 	/* The output line buffer */
@@ -329,6 +365,53 @@ struct _lineprocess_t {
 	void *arg;
 };
 
+typedef struct {
+	
+	/* The range of line processes run by this stage */
+	int first;
+	int last;
+	
+	/* Number of lines completed by this stage */
+	atomic_uint done;
+	
+	/* Worker thread (not used by the final stage) */
+	pthread_t thread;
+	vid_t *vid;
+	
+} _lineprocess_stage_t;
+
+typedef struct {
+	
+	vid_t *vid;
+	
+	/* Worker threads */
+	int nthreads;
+	pthread_t *threads;
+	
+	/* The batch of lines being rendered */
+	const uint32_t *framebuffer;
+	int frame;
+	int line;
+	atomic_int count;
+	
+	/* Rendered line ring, one frame long */
+	vid_line_t *lines;
+	atomic_int *ready;
+	
+	/* Next line to be claimed by a worker, and the
+	 * next to be taken by the raster process */
+	atomic_uint claim;
+	int next;
+	
+	atomic_uint gen;
+	atomic_int abort;
+	atomic_int line_waiters;
+	pthread_mutex_t mutex;
+	pthread_cond_t batch_cond;
+	pthread_cond_t line_cond;
+	
+} _raster_pool_t;
+
 struct vid_t {
 	
 	/* Source interface */
@@ -364,7 +447,20 @@ struct vid_t {
 	int16_t blanking_level;
 	int16_t sync_level;
 	
-	_yiq16_t *yiq_level_lookup;
+	/* RGB > signal level tables. Y, I and Q are each a linear sum of
+	 * the gamma corrected R, G and B values, so the contribution of
+	 * each is stored separately with VID_YIQ_BITS fractional bits */
+	int32_t yiq_lut[3][0x100][4];
+	int32_t yiq_offset[4];
+	
+	/* Y'CbCr > signal level tables, the same as above for full range
+	 * BT.601 luma and chroma samples. Used when the source delivers
+	 * planar YUV 4:2:2 in place of 0xRRGGBB pixels */
+	int32_t yuv_lut[3][0x100][4];
+	
+	/* Active video kernels for the running CPU */
+	composite_rgb_t composite_rgb;
+	composite_yuv_t composite_yuv;
 	
 	int colour_lookup_width;
 	int16_t *colour_lookup;
@@ -373,6 +469,18 @@ struct vid_t {
 	int burst_width;
 	int16_t *burst_win;
 	
+	/* Per-line descriptors, the sync and blanking template for each
+	 * distinct line shape, and the burst for each subcarrier phase */
+	_line_desc_t *line_desc;
+	int nshapes;
+	int16_t *shapes;
+	int *burst_index;
+	int nbursts;
+	int16_t *bursts;
+	
+	/* Frame-parallel raster workers */
+	_raster_pool_t *raster_pool;
+	
 	_mod_fm_t fm_secam;
 	iir_int16_t fm_secam_iir;
 	fir_int16_t fm_secam_fir;
@@ -387,6 +495,7 @@ struct vid_t {
 	
 	/* Video state */
 	uint32_t *framebuffer;
+	int framebuffer_yuv;	/* Set by the source if it delivers YUV */
 	
 	/* The frame and line number being rendered next */
 	int bframe;
@@ -424,6 +533,16 @@ struct vid_t {
 	size_t audiobuffer_samples;
 	int interp;
 	
+	/* Audio upsampler state. Each carrier's audio is resampled from
+	 * HACKTV_AUDIO_SAMPLE_RATE to the sample rate and buffered here
+	 * ahead of the modulators, as the pairs fm_mono / am_mono and
+	 * fm_left / fm_right */
+	int audio_interpolation;
+	int audio_decimation;
+	int audio_phase;
+	int16_t *audio_line[2];
+	int audio_len;
+	
 	/* FM Mono/Stereo audio state */
 	_mod_fm_t fm_mono;
 	_mod_fm_t fm_left;
@@ -432,6 +551,7 @@ struct vid_t {
 	/* Zweikanalton / A2 Stereo state */
 	_mod_am_t a2stereo_pilot;
 	_mod_am_t a2stereo_signal;
+	int16_t *a2stereo_line[2];
 	
 	/* NICAM stereo audio state */
 	nicam_mod_t nicam;
@@ -468,8 +588,43 @@ struct vid_t {
 	int nprocesses;
 	_lineprocess_t *processes;
 	_lineprocess_t *output_process;
+	
+	/* Pipelined line process stages. The final stage runs
+	 * on the thread calling vid_next_line() */
+	int nstages;
+	_lineprocess_stage_t *stages;
+	int stages_running;
+	int stage_slack;
+	atomic_int stage_abort;
+	atomic_int stage_eof;
+	atomic_uint stage_eof_line;
+	int stage_eof_returned;
+	atomic_int stage_waiters;
+	pthread_mutex_t stage_mutex;
+	pthread_cond_t stage_cond;
 };
 
+static inline int16_t _yiq_limit(int32_t v)
+{
+	v >>= VID_YIQ_BITS;
+	return(v < -INT16_MAX ? -INT16_MAX : (v > INT16_MAX ? INT16_MAX : v));
+}
+
+/* Convert a 0xRRGGBB value to its Y, I and Q signal levels */
+static inline _yiq16_t vid_yiq_level(const vid_t *s, uint32_t rgb)
+{
+	const int32_t *r = s->yiq_lut[0][(rgb >> 16) & 0xFF];
+	const int32_t *g = s->yiq_lut[1][(rgb >> 8) & 0xFF];
+	const int32_t *b = s->yiq_lut[2][(rgb >> 0) & 0xFF];
+	_yiq16_t yiq;
+	
+	yiq.y = _yiq_limit(s->yiq_offset[0] + r[0] + g[0] + b[0]);
+	yiq.i = _yiq_limit(s->yiq_offset[1] + r[1] + g[1] + b[1]);
+	yiq.q = _yiq_limit(s->yiq_offset[2] + r[2] + g[2] + b[2]);
+	
+	return(yiq);
+}
+
 extern const vid_configs_t vid_configs[];
 
 extern int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf);
@@ -478,6 +633,7 @@ extern void vid_get_colour_subcarrier(vid_t *s, int frame, int line, int16_t **p
 extern int vid_av_close(vid_t *s);
 extern void vid_info(vid_t *s);
 extern size_t vid_get_framebuffer_length(vid_t *s);
+extern void vid_fill_framebuffer(vid_t *s, void *framebuffer, uint8_t level);
 extern int16_t *vid_next_line(vid_t *s, size_t *samples);
 
 #endif